@@ -0,0 +1,254 @@
+/*
+Benchmark de la clasificación de ACLs: genera un archivo con N reglas para una interfaz,
+lo carga con sr_acl_load y mide el tiempo por consulta (sr_acl_classify) con paquetes al
+azar, la mitad armados para que coincidan con alguna regla y la otra mitad sin coincidencia
+(los que llegan al deny implícito, que son el peor caso porque miran todas las tuplas).
+
+Las reglas mezclan largos de prefijo como una ACL de borde: /8 a /32 de origen y destino,
+algunas con any, protocolo tcp/udp/icmp/any y puertos sueltos o rangos.
+
+Después se repite con todas las reglas sobre el mismo par de prefijos (10.0.0.0/8 a
+192.168.0.0/16, tcp) y un puerto destino distinto cada una, como una lista de servicios
+permitidos: ahí lo único que separa las reglas es el puerto. Los paquetes sin coincidencia
+de esta parte caen adentro de los prefijos con un puerto que no está en ninguna regla.
+
+Se compila con los fuentes del router, sin sr_main.c ni sr_vns_comm.c (este archivo pone
+su main y un sr_send_packet que no manda nada):
+  gcc -O2 -o bench_acl bench_acl.c sr_router.c sr_acl.c sr_ct.c sr_nat.c sr_flow.c sr_tap.c \
+      sr_io.c sr_txq.c sr_epoch.c sr_arpcache.c sr_rip.c sr_if.c sr_rt.c sr_utils.c -lpthread
+Uso: ./bench_acl [reglas (10000)] [consultas (2000000)] [tuplas distintas (16)]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_acl.h"
+
+#define BENCH_ACL_PATH "bench_acl_rules.txt"
+
+struct bench_rule {
+    uint32_t src, dst;   /* En orden de host */
+    unsigned int src_len, dst_len;
+    uint8_t proto;
+    uint16_t dport;
+};
+
+int sr_send_packet(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface)
+{
+    (void)sr;
+    (void)buf;
+    (void)len;
+    (void)iface;
+    return 0;
+}
+
+static uint32_t bench_rand32(void)
+{
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+static uint32_t bench_mask(unsigned int len)
+{
+    return len ? 0xFFFFFFFFu << (32 - len) : 0;
+}
+
+static void bench_fmt_prefix(char *out, size_t size, uint32_t addr, unsigned int len)
+{
+    if (len == 0) {
+        snprintf(out, size, "any");
+        return;
+    }
+    struct in_addr in;
+    in.s_addr = htonl(addr & bench_mask(len));
+    snprintf(out, size, "%s/%u", inet_ntoa(in), len);
+}
+
+static double bench_elapsed_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+static const char *bench_proto_name(uint8_t proto)
+{
+    switch (proto) {
+    case 6:
+        return "tcp";
+    case 17:
+        return "udp";
+    case 1:
+        return "icmp";
+    default:
+        return "any";
+    }
+}
+
+static double bench_load_ms = 0;
+
+/* Escribe las reglas en BENCH_ACL_PATH (una de cada tres deny) y las carga */
+static int bench_load(const struct bench_rule *rules, int n_rules)
+{
+    FILE *f = fopen(BENCH_ACL_PATH, "w");
+    if (!f) {
+        perror("fopen");
+        return -1;
+    }
+    for (int i = 0; i < n_rules; i++) {
+        const struct bench_rule *r = &rules[i];
+        char src[40], dst[40], dports[16];
+        bench_fmt_prefix(src, sizeof(src), r->src, r->src_len);
+        bench_fmt_prefix(dst, sizeof(dst), r->dst, r->dst_len);
+        if (r->dport) {
+            snprintf(dports, sizeof(dports), "%u", r->dport);
+        } else {
+            snprintf(dports, sizeof(dports), "any");
+        }
+        fprintf(f, "eth0 in %s %s %s %s any %s\n", (i % 3) ? "permit" : "deny", src, dst,
+                bench_proto_name(r->proto), dports);
+    }
+    fclose(f);
+
+    /* Lo de carga se imprime (con los printf del router); el resultado va a stderr */
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int loaded = sr_acl_load(BENCH_ACL_PATH);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    unlink(BENCH_ACL_PATH);
+    if (loaded != n_rules) {
+        fprintf(stderr, "Se cargaron %d reglas de %d\n", loaded, n_rules);
+        return -1;
+    }
+    bench_load_ms = bench_elapsed_ns(&t0, &t1) / 1e6;
+    return 0;
+}
+
+/*
+Mide las consultas: una pasada con paquetes adentro de reglas al azar y otra sin
+coincidencia. Sin same_pair los que no coinciden salen de rangos de direcciones que no usa
+ninguna regla; con same_pair están adentro de los prefijos pero con un puerto que no tiene
+regla (todas las reglas son del mismo par y con puertos 1..n_rules).
+*/
+static int bench_queries(const struct bench_rule *rules, int n_rules, long n_queries, int same_pair)
+{
+    /* Consultas armadas de antemano para no medir rand() */
+    enum { BENCH_KEYS = 1 << 16 };
+    struct bench_key { uint32_t src, dst; uint8_t proto; uint16_t sport, dport; } *keys;
+    struct timespec t0, t1;
+    keys = malloc(BENCH_KEYS * sizeof(*keys));
+    if (!keys) {
+        perror("malloc");
+        return -1;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        int hits = (pass == 0);
+        for (int i = 0; i < BENCH_KEYS; i++) {
+            if (hits) {
+                /* Adentro de una regla al azar */
+                const struct bench_rule *r = &rules[rand() % n_rules];
+                keys[i].src = htonl(r->src | (bench_rand32() & ~bench_mask(r->src_len)));
+                keys[i].dst = htonl(r->dst | (bench_rand32() & ~bench_mask(r->dst_len)));
+                keys[i].proto = r->proto ? r->proto : 6;
+                keys[i].dport = r->dport ? r->dport : (uint16_t)(1 + rand() % 1024);
+            } else if (same_pair) {
+                /* Adentro de los prefijos, con un puerto más alto que todos los de las reglas */
+                keys[i].src = htonl(0x0A000000u | (bench_rand32() & 0x00FFFFFF));
+                keys[i].dst = htonl(0xC0A80000u | (bench_rand32() & 0x0000FFFF));
+                keys[i].proto = 6;
+                keys[i].dport = (uint16_t)(n_rules + 1 + rand() % (65535 - n_rules));
+            } else {
+                /* Fuera de los rangos de las reglas: 172.16/12 a 100.64/10 */
+                keys[i].src = htonl(0xAC100000u | (bench_rand32() & 0x000FFFFF));
+                keys[i].dst = htonl(0x64400000u | (bench_rand32() & 0x003FFFFF));
+                keys[i].proto = 6;
+                keys[i].dport = (uint16_t)(1 + rand() % 1024);
+            }
+            keys[i].sport = (uint16_t)(1024 + rand() % 60000);
+        }
+
+        long permitted = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (long q = 0; q < n_queries; q++) {
+            const struct bench_key *k = &keys[q & (BENCH_KEYS - 1)];
+            permitted += sr_acl_classify("eth0", 0, k->src, k->dst, k->proto, k->sport, k->dport);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        fprintf(stderr, "%-22s %ld consultas, %.1f ns por consulta (%ld permitidas)\n",
+                hits ? "coinciden con reglas:" : "sin coincidencia:", n_queries,
+                bench_elapsed_ns(&t0, &t1) / n_queries, permitted);
+    }
+
+    free(keys);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int n_rules = argc > 1 ? atoi(argv[1]) : 10000;
+    long n_queries = argc > 2 ? atol(argv[2]) : 2000000;
+    int n_shapes = argc > 3 ? atoi(argv[3]) : 16;
+    if (n_rules <= 0 || n_queries <= 0 || n_shapes <= 0) {
+        fprintf(stderr, "Uso: %s [reglas] [consultas] [tuplas distintas]\n", argv[0]);
+        return 1;
+    }
+    srand(1);
+
+    /* Las formas (largo origen, largo destino) que se usan; las ACL reales tienen pocas */
+    static const unsigned int lens[] = {0, 8, 16, 20, 24, 28, 32};
+    unsigned int n_lens = sizeof(lens) / sizeof(lens[0]);
+    unsigned int (*shapes)[2] = malloc(n_shapes * sizeof(*shapes));
+    struct bench_rule *rules = malloc(n_rules * sizeof(struct bench_rule));
+    if (!shapes || !rules) {
+        perror("malloc");
+        return 1;
+    }
+    for (int i = 0; i < n_shapes; i++) {
+        shapes[i][0] = lens[rand() % n_lens];
+        shapes[i][1] = lens[1 + rand() % (n_lens - 1)];
+    }
+
+    static const uint8_t proto_nums[] = {6, 17, 1, 0};
+    for (int i = 0; i < n_rules; i++) {
+        struct bench_rule *r = &rules[i];
+        int shape = rand() % n_shapes;
+        int p = rand() % 4;
+        r->src_len = shapes[shape][0];
+        r->dst_len = shapes[shape][1];
+        r->src = (0x0A000000u | (bench_rand32() & 0x00FFFFFF)) & bench_mask(r->src_len);
+        r->dst = (0xC0000000u | (bench_rand32() & 0x3FFFFFFF)) & bench_mask(r->dst_len);
+        r->proto = proto_nums[p];
+        r->dport = (p < 2) ? (uint16_t)(1 + rand() % 1024) : 0;
+    }
+    if (bench_load(rules, n_rules) < 0) {
+        return 1;
+    }
+    fprintf(stderr, "%d reglas, %d formas de prefijo: carga %.1f ms\n", n_rules, n_shapes, bench_load_ms);
+    if (bench_queries(rules, n_rules, n_queries, 0) < 0) {
+        return 1;
+    }
+
+    /* Mismo par de prefijos, un puerto por regla (hay 65535 puertos, se usan hasta 60000) */
+    int n_same = n_rules < 60000 ? n_rules : 60000;
+    for (int i = 0; i < n_same; i++) {
+        rules[i].src = 0x0A000000u;
+        rules[i].src_len = 8;
+        rules[i].dst = 0xC0A80000u;
+        rules[i].dst_len = 16;
+        rules[i].proto = 6;
+        rules[i].dport = (uint16_t)(1 + i);
+    }
+    if (bench_load(rules, n_same) < 0) {
+        return 1;
+    }
+    fprintf(stderr, "%d reglas con el mismo par de prefijos: carga %.1f ms\n", n_same, bench_load_ms);
+    if (bench_queries(rules, n_same, n_queries, 1) < 0) {
+        return 1;
+    }
+
+    free(rules);
+    free(shapes);
+    return 0;
+}
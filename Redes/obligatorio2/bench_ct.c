@@ -0,0 +1,198 @@
+/*
+Benchmark de conntrack: arma N conexiones distintas, las crea pasando el primer paquete de
+cada una por sr_ct_track_tuple (búsqueda que falla más inserción) y después reproduce una
+traza de paquetes sobre esas mismas conexiones, con la popularidad sesgada como en un enlace
+real (el 80% de los paquetes va al 20% de las conexiones) y la mitad en sentido de respuesta.
+La traza se reproduce con 1 hilo y con varios, para ver que las búsquedas sin lock escalan.
+Al final se vencen todas de golpe, se mide el barrido y se vuelven a crear (ya con entradas
+recicladas después de la época) repartidas entre los mismos hilos, para ver que crear
+conexiones tampoco pasa por un lock de toda la tabla.
+
+Se compila con los fuentes del router, sin sr_main.c ni sr_vns_comm.c (este archivo pone
+su main y un sr_send_packet que no manda nada):
+  gcc -O2 -o bench_ct bench_ct.c sr_router.c sr_acl.c sr_ct.c sr_nat.c sr_flow.c sr_tap.c \
+      sr_io.c sr_txq.c sr_epoch.c sr_arpcache.c sr_rip.c sr_if.c sr_rt.c sr_utils.c -lpthread
+Uso: ./bench_ct [conexiones (1000000)] [paquetes de la traza (20000000)] [hilos (4)]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_ct.h"
+
+struct bench_flow {
+    uint32_t src, dst;   /* En orden de red */
+    uint16_t sport, dport;
+    uint8_t proto;
+};
+
+struct bench_worker {
+    pthread_t thread;
+    const struct bench_flow *flows;
+    const uint32_t *trace;
+    long from, to;
+    long tracked;
+};
+
+int sr_send_packet(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface)
+{
+    (void)sr;
+    (void)buf;
+    (void)len;
+    (void)iface;
+    return 0;
+}
+
+static uint32_t bench_rand32(void)
+{
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+static double bench_elapsed_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+/* Un paquete de la traza: índice de conexión, con el bit alto prendido si es la respuesta */
+#define BENCH_REPLY 0x80000000u
+
+static int bench_track(const struct bench_flow *f, int reply)
+{
+    if (reply) {
+        return sr_ct_track_tuple(f->dst, f->src, f->proto, f->dport, f->sport);
+    }
+    return sr_ct_track_tuple(f->src, f->dst, f->proto, f->sport, f->dport);
+}
+
+static void *bench_replay(void *arg)
+{
+    struct bench_worker *w = (struct bench_worker *)arg;
+    for (long i = w->from; i < w->to; i++) {
+        uint32_t t = w->trace[i];
+        w->tracked += bench_track(&w->flows[t & ~BENCH_REPLY], (t & BENCH_REPLY) != 0);
+    }
+    return NULL;
+}
+
+/* Reproduce la traza repartida entre n_threads hilos; devuelve los ns por paquete */
+static double bench_run_trace(const struct bench_flow *flows, const uint32_t *trace, long n_pkts,
+                              int n_threads, long *tracked)
+{
+    struct bench_worker *workers = calloc(n_threads, sizeof(struct bench_worker));
+    struct timespec t0, t1;
+
+    *tracked = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < n_threads; i++) {
+        workers[i].flows = flows;
+        workers[i].trace = trace;
+        workers[i].from = n_pkts * i / n_threads;
+        workers[i].to = n_pkts * (i + 1) / n_threads;
+        pthread_create(&workers[i].thread, NULL, bench_replay, &workers[i]);
+    }
+    for (int i = 0; i < n_threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        *tracked += workers[i].tracked;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    free(workers);
+    return bench_elapsed_ns(&t0, &t1) / n_pkts;
+}
+
+static long bench_rss_mb(void)
+{
+    long pages = 0, rss = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &rss) != 2) {
+            rss = 0;
+        }
+        fclose(f);
+    }
+    return rss * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+int main(int argc, char **argv)
+{
+    long n_flows = argc > 1 ? atol(argv[1]) : 1000000;
+    long n_pkts = argc > 2 ? atol(argv[2]) : 20000000;
+    int n_threads = argc > 3 ? atoi(argv[3]) : 4;
+    if (n_flows <= 0 || n_flows > 0xFFFFFF || n_pkts <= 0 || n_threads <= 0) {
+        fprintf(stderr, "Uso: %s [conexiones (hasta 16M)] [paquetes] [hilos]\n", argv[0]);
+        return 1;
+    }
+    srand(1);
+
+    /* El origen sale del índice, así las conexiones son todas distintas */
+    struct bench_flow *flows = malloc(n_flows * sizeof(struct bench_flow));
+    /* La traza se reusa al final para volver a crearlas, así que entran las dos */
+    uint32_t *trace = malloc((n_pkts > n_flows ? n_pkts : n_flows) * sizeof(uint32_t));
+    if (!flows || !trace) {
+        perror("malloc");
+        return 1;
+    }
+    static const uint16_t dports[] = {80, 443, 53, 123, 22, 8080};
+    for (long i = 0; i < n_flows; i++) {
+        int d = rand() % 6;
+        flows[i].src = htonl(0x0A000000u | (uint32_t)i);
+        flows[i].dst = htonl(0xC0A80000u | (bench_rand32() & 0xFFFF));
+        flows[i].sport = (uint16_t)(1024 + rand() % 60000);
+        flows[i].dport = dports[d];
+        flows[i].proto = (dports[d] == 53 || dports[d] == 123) ? 17 : 6;
+    }
+    long hot = n_flows / 5 ? n_flows / 5 : 1;
+    for (long i = 0; i < n_pkts; i++) {
+        uint32_t idx = (rand() % 10 < 8) ? bench_rand32() % hot : bench_rand32() % n_flows;
+        trace[i] = idx | ((rand() & 1) ? BENCH_REPLY : 0);
+    }
+
+    /* Primer paquete de cada conexión: búsqueda que falla y creación */
+    struct timespec t0, t1;
+    long created = 0;
+    long rss_before = bench_rss_mb();
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long i = 0; i < n_flows; i++) {
+        created += bench_track(&flows[i], 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    fprintf(stderr, "creación: %ld conexiones (%ld en la tabla), %.1f ns cada una, %ld MB más de memoria\n",
+            n_flows, created, bench_elapsed_ns(&t0, &t1) / n_flows, bench_rss_mb() - rss_before);
+
+    /* Replay: todas existen, así que mide búsquedas sin lock más la actualización */
+    for (int pass = 0; pass < 2; pass++) {
+        int t = pass ? n_threads : 1;
+        if (pass && n_threads == 1) {
+            break;
+        }
+        long tracked;
+        double ns = bench_run_trace(flows, trace, n_pkts, t, &tracked);
+        fprintf(stderr, "replay con %d hilo(s): %ld paquetes, %.1f ns por paquete, %.1f Mpps en total (%ld encontrados)\n",
+                t, n_pkts, ns, 1e3 / ns, tracked);
+    }
+
+    /* Se vencen todas: el barrido toma los buckets de una conexión por vez */
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    sr_ct_expire(time(NULL) + 600);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    fprintf(stderr, "barrido de %ld conexiones vencidas: %.1f ms\n", created, bench_elapsed_ns(&t0, &t1) / 1e6);
+
+    /* Sin lectores adentro la época ya pasó: se crean de nuevo con las entradas recicladas,
+    cada hilo con su parte (una "traza" con el primer paquete de cada conexión) */
+    for (long i = 0; i < n_flows; i++) {
+        trace[i] = (uint32_t)i;
+    }
+    double ns = bench_run_trace(flows, trace, n_flows, n_threads, &created);
+    fprintf(stderr, "creación con entradas recicladas y %d hilo(s): %ld en la tabla, %.1f ns cada una\n",
+            n_threads, created, ns);
+
+    sr_ct_print_stats();
+    free(trace);
+    free(flows);
+    return 0;
+}
@@ -0,0 +1,275 @@
+/*
+Benchmark de los backends de E/S: generador y sumidero para medir cuántos paquetes por
+segundo reenvía sr_local con cada backend. Dos pares veth, el router (sr_local) en un
+extremo de cada uno y este programa en el otro:
+
+  bench_io g0 <--veth--> r0  sr_local  r1 <--veth--> g1 bench_io
+
+  ip link add g0 type veth peer name r0
+  ip link add g1 type veth peer name r1
+  for i in g0 r0 g1 r1; do ip link set $i up; sysctl -qw net.ipv6.conf.$i.disable_ipv6=1; done
+  ./sr_local -b uring -i r0=10.1.0.1/24,r1=10.2.0.1/24 > /dev/null &
+  ./bench_io g0 g1 r0
+
+El generador manda por g0 tramas UDP de 10.1.0.2 a 10.2.0.2 (con la MAC de r0 de destino y
+puertos de origen distintos, así son muchas conexiones), con sendmmsg de a lotes y lo más
+rápido que puede o a la tasa pedida. El sumidero lee g1, cuenta lo que llega a 10.2.0.2 y
+contesta el ARP del router por esa IP. Después de una vuelta de calentamiento (hasta que
+llega algo, o sea que el router ya resolvió ARP y tiene la ruta conectada) mide durante los
+segundos pedidos y muestra lo ofrecido y lo reenviado.
+
+Con una sola CPU el generador, el sumidero y el router se la reparten: lo que se mide es el
+costo relativo de cada backend, no lo que daría el router solo en una máquina con más núcleos.
+
+Se compila solo (no usa los fuentes del router):
+  gcc -O2 -o bench_io bench_io.c -lpthread
+Uso: ./bench_io <ifaz gen> <ifaz sumidero> <ifaz del router del lado del gen> [segundos (5)]
+                [pps ofrecidos, 0 = todo lo que se pueda (0)] [bytes de UDP (64)]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <arpa/inet.h>
+
+#define BENCH_BATCH 64
+#define BENCH_SRC_IP "10.1.0.2"
+#define BENCH_DST_IP "10.2.0.2"
+#define BENCH_FLOWS 4096
+
+static volatile unsigned long sink_rx = 0;
+static volatile int stop = 0;
+
+struct bench_sink {
+    const char *ifname;
+    uint8_t mac[6];
+    uint32_t ip;
+};
+
+static int bench_open(const char *name)
+{
+    int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd < 0) {
+        perror("socket(AF_PACKET)");
+        exit(1);
+    }
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = if_nametoindex(name);
+    if (sll.sll_ifindex == 0 || bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        perror(name);
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+    int size = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    return fd;
+}
+
+static void bench_get_mac(const char *name, uint8_t *mac)
+{
+    struct ifreq ifr;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (fd < 0 || ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+        perror(name);
+        exit(1);
+    }
+    close(fd);
+    memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+}
+
+static uint16_t bench_cksum(const void *data, int len)
+{
+    const uint8_t *d = data;
+    uint32_t sum = 0;
+    for (; len > 1; len -= 2, d += 2) {
+        sum += (d[0] << 8) | d[1];
+    }
+    if (len) {
+        sum += d[0] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return htons(~sum & 0xFFFF);
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Cuenta lo que llega a la IP del sumidero y contesta el ARP que pregunta por ella */
+static void *bench_sink_thread(void *arg)
+{
+    struct bench_sink *s = (struct bench_sink *)arg;
+    int fd = bench_open(s->ifname);
+    static uint8_t bufs[BENCH_BATCH][2048];
+    struct mmsghdr msgs[BENCH_BATCH];
+    struct iovec iov[BENCH_BATCH];
+    struct timeval tv = { 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    while (!stop) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len = sizeof(bufs[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(fd, msgs, BENCH_BATCH, MSG_WAITFORONE, NULL);
+        for (int i = 0; i < n; i++) {
+            uint8_t *f = bufs[i];
+            uint16_t type = (f[12] << 8) | f[13];
+            if (type == ETH_P_IP && msgs[i].msg_len >= 34 && memcmp(f + 30, &s->ip, 4) == 0) {
+                sink_rx++;
+            } else if (type == ETH_P_ARP && msgs[i].msg_len >= 42 && f[21] == 1 && memcmp(f + 38, &s->ip, 4) == 0) {
+                /* Request por nuestra IP: se da vuelta y se contesta */
+                uint8_t reply[42];
+                memcpy(reply, f + 6, 6);
+                memcpy(reply + 6, s->mac, 6);
+                memcpy(reply + 12, f + 12, 8);
+                reply[21] = 2;
+                memcpy(reply + 22, s->mac, 6);
+                memcpy(reply + 28, &s->ip, 4);
+                memcpy(reply + 32, f + 22, 10);
+                if (send(fd, reply, sizeof(reply), 0) < 0) {
+                    perror("send(ARP)");
+                }
+            }
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4) {
+        fprintf(stderr, "Uso: %s <ifaz gen> <ifaz sumidero> <ifaz del router> [segundos] [pps] [bytes UDP]\n", argv[0]);
+        return 1;
+    }
+    double secs = argc > 4 ? atof(argv[4]) : 5;
+    double rate = argc > 5 ? atof(argv[5]) : 0;
+    int payload = argc > 6 ? atoi(argv[6]) : 64;
+    if (secs <= 0 || rate < 0 || payload < 8 || payload > 1472) {
+        fprintf(stderr, "Parámetros fuera de rango\n");
+        return 1;
+    }
+
+    struct bench_sink sink;
+    sink.ifname = argv[2];
+    bench_get_mac(argv[2], sink.mac);
+    inet_pton(AF_INET, BENCH_DST_IP, &sink.ip);
+    pthread_t sink_thread;
+    pthread_create(&sink_thread, NULL, bench_sink_thread, &sink);
+
+    /* Tramas armadas de antemano, una por conexión; cambia el puerto de origen */
+    uint8_t gen_mac[6], router_mac[6];
+    bench_get_mac(argv[1], gen_mac);
+    bench_get_mac(argv[3], router_mac);
+    unsigned int frame_len = 14 + 20 + payload;
+    uint8_t (*frames)[1514] = calloc(BENCH_FLOWS, sizeof(*frames));
+    uint32_t src, dst;
+    inet_pton(AF_INET, BENCH_SRC_IP, &src);
+    inet_pton(AF_INET, BENCH_DST_IP, &dst);
+    for (int i = 0; i < BENCH_FLOWS; i++) {
+        uint8_t *f = frames[i];
+        memcpy(f, router_mac, 6);
+        memcpy(f + 6, gen_mac, 6);
+        f[12] = 0x08;
+        f[13] = 0x00;
+        uint8_t *ip = f + 14;
+        ip[0] = 0x45;
+        ip[2] = (20 + payload) >> 8;
+        ip[3] = (20 + payload) & 0xFF;
+        ip[8] = 64;
+        ip[9] = 17;
+        memcpy(ip + 12, &src, 4);
+        memcpy(ip + 16, &dst, 4);
+        uint16_t sum = bench_cksum(ip, 20);
+        memcpy(ip + 10, &sum, 2);
+        uint8_t *udp = ip + 20;
+        uint16_t sport = htons(10000 + i), dport = htons(9), ulen = htons(payload);
+        memcpy(udp, &sport, 2);
+        memcpy(udp + 2, &dport, 2);
+        memcpy(udp + 4, &ulen, 2);
+    }
+
+    int fd = bench_open(argv[1]);
+    struct mmsghdr msgs[BENCH_BATCH];
+    struct iovec iov[BENCH_BATCH];
+    unsigned long sent = 0;
+    unsigned int next_flow = 0;
+
+    /* Calentamiento: de a poco hasta que algo llega al sumidero */
+    double t_warm = bench_now();
+    while (sink_rx == 0) {
+        if (send(fd, frames[next_flow++ % BENCH_FLOWS], frame_len, 0) < 0 && errno != ENOBUFS) {
+            perror("send");
+            return 1;
+        }
+        usleep(10000);
+        if (bench_now() - t_warm > 10) {
+            fprintf(stderr, "No llega nada al sumidero: ¿está corriendo sr_local con las rutas?\n");
+            return 1;
+        }
+    }
+    usleep(200000);
+
+    unsigned long rx0 = sink_rx;
+    double t0 = bench_now(), t = t0;
+    while (t - t0 < secs) {
+        if (rate > 0 && sent >= (t - t0) * rate) {
+            usleep(50);
+            t = bench_now();
+            continue;
+        }
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            iov[i].iov_base = frames[next_flow++ % BENCH_FLOWS];
+            iov[i].iov_len = frame_len;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = sendmmsg(fd, msgs, BENCH_BATCH, 0);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && errno != ENOBUFS && errno != EAGAIN) {
+            perror("sendmmsg");
+            break;
+        }
+        t = bench_now();
+    }
+    /* Lo que quedó en vuelo todavía cuenta */
+    usleep(200000);
+    unsigned long fwd = sink_rx - rx0;
+    stop = 1;
+    pthread_join(sink_thread, NULL);
+
+    printf("%.1f s, tramas de %u bytes: ofrecidos %lu (%.0f pps), reenviados %lu (%.0f pps, %.1f%%)\n",
+           secs, frame_len, sent, sent / secs, fwd, fwd / secs, sent ? 100.0 * fwd / sent : 0.0);
+    free(frames);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,393 @@
+/*
+Banco de pruebas de la búsqueda LPM, para comparar el recorrido de la lista (el de
+sr_lpm_lookup) con la FIB comprimida de sr_rip.c. Genera una tabla al azar con una
+distribución de largos de prefijo parecida a la de BGP (casi todo /24, bastante /22-/23 y
+colas largas para los dos lados), siempre con la misma semilla, y la busca con un flujo de
+destinos uniforme, Zipf (pocos prefijos se llevan casi todo el tráfico) o sacado de un pcap.
+
+Reporta armado (tiempo y memoria), búsquedas por segundo, ciclos por búsqueda y fallos de
+caché por búsqueda si el kernel deja usar los contadores de perf (si no, los ciclos salen del
+TSC y los fallos no se reportan). Todo va sobre una instancia aparte, sin hilos del router.
+
+Se compila con los fuentes del router, sin sr_main.c ni sr_vns_comm.c (este archivo pone
+su main y un sr_send_packet que no manda nada):
+  gcc -O2 -o bench_lpm bench_lpm.c sr_router.c sr_acl.c sr_ct.c sr_nat.c sr_flow.c sr_tap.c \
+      sr_io.c sr_txq.c sr_epoch.c sr_arpcache.c sr_rip.c sr_if.c sr_rt.c sr_utils.c -lpthread
+Uso: ./bench_lpm [rutas (1000, 100000 y 1000000)] [captura .pcap o .pcapng]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_fwd.h"
+
+/* En sr_rip.c */
+struct sr_fib;
+struct sr_fib *sr_rip_fib_build(struct sr_instance *sr);
+struct sr_rt *sr_rip_fib_find(struct sr_fib *fib, uint32_t dest_ip);
+void sr_rip_fib_free(struct sr_fib *fib);
+void sr_rip_fib_mem(struct sr_fib *fib, size_t *lookup, size_t *total);
+void sr_rip_fib_counts(struct sr_fib *fib, unsigned int *prefixes, unsigned int *nodes, unsigned int *next_hops);
+
+#define FIB_BENCH_UNIFORM 0
+#define FIB_BENCH_ZIPF 1
+#define FIB_BENCH_PCAP 2
+
+#define FIB_BENCH_SEED 20241019u
+#define FIB_BENCH_STREAM_LEN (1 << 20)  /* Destinos pregenerados (el pcap se repite si tiene menos) */
+#define FIB_BENCH_MIN_NS 500000000ull   /* Cuánto dura como mínimo cada medición */
+#define FIB_BENCH_CHUNK 64              /* Búsquedas entre lecturas del reloj */
+
+/* Largo de prefijo -> por mil de las rutas, más o menos como en una tabla BGP completa */
+static const unsigned short fib_bench_plen_weight[33] = {
+    [8] = 1, [9] = 1, [10] = 1, [11] = 2, [12] = 3, [13] = 5, [14] = 8, [15] = 10,
+    [16] = 15, [17] = 10, [18] = 18, [19] = 30, [20] = 45, [21] = 50, [22] = 100,
+    [23] = 90, [24] = 590, [25] = 4, [26] = 4, [27] = 3, [28] = 3, [29] = 3, [30] = 2,
+    [31] = 1, [32] = 1,
+};
+
+struct fib_bench_ctr {
+    int fd_cycles;
+    int fd_misses;
+};
+
+static int bench_perf_open(uint64_t config, int group)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = (group < 0);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static uint64_t bench_read(int fd)
+{
+    uint64_t v = 0;
+    if (fd >= 0 && read(fd, &v, sizeof(v)) != sizeof(v)) {
+        v = 0;
+    }
+    return v;
+}
+
+static uint64_t bench_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t bench_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* Arma la tabla de prueba en sr (lista enlazada, como la del router). Devuelve los prefijos
+   en orden de host en nets/plens, que usa el flujo Zipf */
+static int bench_table(struct sr_instance *sr, unsigned int n_routes,
+                       uint32_t *nets, unsigned char *plens)
+{
+    unsigned int seed = FIB_BENCH_SEED;
+    unsigned int total = 0;
+    for (int l = 0; l <= 32; l++) {
+        total += fib_bench_plen_weight[l];
+    }
+
+    sr->routing_table = NULL;
+    for (unsigned int i = 0; i < n_routes; i++) {
+        unsigned int pick = (unsigned int)rand_r(&seed) % total;
+        unsigned int plen = 8;
+        while (pick >= fib_bench_plen_weight[plen]) {
+            pick -= fib_bench_plen_weight[plen];
+            plen++;
+        }
+        uint32_t mask = 0xFFFFFFFFu << (32 - plen);
+        uint32_t net = ((uint32_t)rand_r(&seed) << 16) ^ (uint32_t)rand_r(&seed);
+        net = ((1 + net % 223) << 24 | (net & 0x00FFFFFF)) & mask; /* Unicast, de 1.x a 223.x */
+
+        struct sr_rt *rt = calloc(1, sizeof(struct sr_rt));
+        if (!rt) {
+            return -1;
+        }
+        unsigned int hop = (unsigned int)rand_r(&seed) % 8;
+        rt->dest.s_addr = htonl(net);
+        rt->mask.s_addr = htonl(mask);
+        rt->gw.s_addr = htonl(0x0A000001u + (hop << 8));
+        snprintf(rt->interface, sr_IFACE_NAMELEN, "eth%u", hop % 4);
+        rt->metric = 1;
+        rt->valid = 1;
+        rt->next = sr->routing_table;
+        sr->routing_table = rt;
+        nets[i] = net;
+        plens[i] = plen;
+    }
+    return 0;
+}
+
+/* Si la trama Ethernet lleva IPv4, agrega el destino al flujo */
+static void bench_frame(const uint8_t *frame, uint32_t caplen, uint32_t *stream, unsigned int *n)
+{
+    if (caplen >= 34 && frame[12] == 0x08 && frame[13] == 0x00) {
+        memcpy(&stream[(*n)++], frame + 30, 4);
+    }
+}
+
+/* Destinos IPv4 de una captura Ethernet, pcap o pcapng (en el orden de bytes de la máquina,
+   que es como las guarda Wireshark); devuelve cuántos leyó */
+static unsigned int bench_pcap(const char *path, uint32_t *stream, unsigned int max)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("fopen (pcap)");
+        return 0;
+    }
+    static uint8_t frame[65536];
+    uint32_t hdr[6];
+    unsigned int n = 0;
+    if (fread(hdr, sizeof(hdr), 1, f) == 1 && (hdr[0] == 0xa1b2c3d4 || hdr[0] == 0xd4c3b2a1)) {
+        int swap = (hdr[0] == 0xd4c3b2a1);
+        uint32_t linktype = swap ? __builtin_bswap32(hdr[5]) : hdr[5];
+        uint32_t rec[4];
+        while (linktype == 1 && n < max && fread(rec, sizeof(rec), 1, f) == 1) {
+            uint32_t caplen = swap ? __builtin_bswap32(rec[2]) : rec[2];
+            if (caplen > sizeof(frame) || fread(frame, 1, caplen, f) != caplen) {
+                break;
+            }
+            bench_frame(frame, caplen, stream, &n);
+        }
+    } else if (hdr[0] == 0x0A0D0D0A && hdr[2] == 0x1A2B3C4D) {
+        /* pcapng: se recorren los bloques y se usan los Enhanced Packet Block (tipo 6) */
+        uint32_t block[2] = {hdr[0], hdr[1]};
+        fseek(f, 0, SEEK_SET);
+        while (n < max && fread(block, sizeof(block), 1, f) == 1 && block[1] >= 12 && block[1] - 8 <= sizeof(frame)) {
+            uint32_t body_len = block[1] - 8;
+            if (fread(frame, 1, body_len, f) != body_len) {
+                break;
+            }
+            uint32_t caplen;
+            memcpy(&caplen, frame + 12, 4);
+            if (block[0] == 6 && body_len >= 24 && caplen <= body_len - 24) {
+                bench_frame(frame + 20, caplen, stream, &n);
+            }
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+/* Arma el flujo de destinos (en orden de red); devuelve su largo o 0 si no se pudo */
+static unsigned int bench_stream(int kind, const char *pcap_path, unsigned int n_routes,
+                                 const uint32_t *nets, const unsigned char *plens,
+                                 uint32_t *stream)
+{
+    unsigned int seed = FIB_BENCH_SEED + 1;
+
+    if (kind == FIB_BENCH_PCAP) {
+        unsigned int n = pcap_path ? bench_pcap(pcap_path, stream, FIB_BENCH_STREAM_LEN) : 0;
+        for (unsigned int i = n; n && i < FIB_BENCH_STREAM_LEN; i++) {
+            stream[i] = stream[i % n];
+        }
+        return n ? FIB_BENCH_STREAM_LEN : 0;
+    }
+    if (kind == FIB_BENCH_UNIFORM) {
+        for (unsigned int i = 0; i < FIB_BENCH_STREAM_LEN; i++) {
+            stream[i] = ((uint32_t)rand_r(&seed) << 16) ^ (uint32_t)rand_r(&seed);
+        }
+        return FIB_BENCH_STREAM_LEN;
+    }
+
+    /* Zipf con s = 1 sobre los prefijos: el de rango r sale con probabilidad proporcional a 1/r */
+    double *cdf = malloc(n_routes * sizeof(double));
+    if (!cdf) {
+        return 0;
+    }
+    double sum = 0;
+    for (unsigned int r = 0; r < n_routes; r++) {
+        sum += 1.0 / (r + 1);
+        cdf[r] = sum;
+    }
+    for (unsigned int i = 0; i < FIB_BENCH_STREAM_LEN; i++) {
+        double u = (double)rand_r(&seed) / ((double)RAND_MAX + 1) * sum;
+        unsigned int lo = 0, hi = n_routes - 1;
+        while (lo < hi) {
+            unsigned int mid = (lo + hi) / 2;
+            if (cdf[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        uint32_t host = plens[lo] < 32 ? (((uint32_t)rand_r(&seed) << 16) ^ (uint32_t)rand_r(&seed)) >> plens[lo] : 0;
+        stream[i] = htonl(nets[lo] | host);
+    }
+    free(cdf);
+    return FIB_BENCH_STREAM_LEN;
+}
+
+/* Mide una forma de buscar sobre el flujo y lo imprime */
+static void bench_measure(const char *name, struct sr_instance *sr, struct sr_fib *fib,
+                          const uint32_t *stream, unsigned int stream_len,
+                          double build_ms, double mem_mb)
+{
+    struct fib_bench_ctr ctr;
+    ctr.fd_cycles = bench_perf_open(PERF_COUNT_HW_CPU_CYCLES, -1);
+    ctr.fd_misses = ctr.fd_cycles >= 0 ? bench_perf_open(PERF_COUNT_HW_CACHE_MISSES, ctr.fd_cycles) : -1;
+
+    uintptr_t sink = 0;
+    unsigned long lookups = 0;
+    unsigned int pos = 0;
+    if (ctr.fd_cycles >= 0) {
+        ioctl(ctr.fd_cycles, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(ctr.fd_cycles, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    uint64_t tsc0 = bench_tsc();
+    uint64_t t0 = bench_ns();
+    uint64_t t1;
+    do {
+        for (unsigned int i = 0; i < FIB_BENCH_CHUNK; i++) {
+            uint32_t ip = stream[pos];
+            pos = (pos + 1) % stream_len;
+            sink += (uintptr_t)(fib ? sr_rip_fib_find(fib, ip) : sr_lpm_lookup_linear(sr, ip));
+        }
+        lookups += FIB_BENCH_CHUNK;
+        t1 = bench_ns();
+    } while (t1 - t0 < FIB_BENCH_MIN_NS);
+    uint64_t tsc1 = bench_tsc();
+    if (ctr.fd_cycles >= 0) {
+        ioctl(ctr.fd_cycles, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    double secs = (t1 - t0) / 1e9;
+    uint64_t cycles = ctr.fd_cycles >= 0 ? bench_read(ctr.fd_cycles) : tsc1 - tsc0;
+    printf("  %-15s armado %9.2f ms, %8.2f MB, %12.0f búsquedas/s, %10.1f ciclos/búsqueda%s",
+           name, build_ms, mem_mb, lookups / secs, (double)cycles / lookups,
+           ctr.fd_cycles >= 0 ? "" : " (TSC)");
+    if (ctr.fd_misses >= 0) {
+        printf(", %.2f fallos de caché/búsqueda", (double)bench_read(ctr.fd_misses) / lookups);
+    }
+    printf(" [%lx]\n", (unsigned long)(sink & 0xF)); /* Para que el compilador no saque las búsquedas */
+
+    if (ctr.fd_misses >= 0) {
+        close(ctr.fd_misses);
+    }
+    if (ctr.fd_cycles >= 0) {
+        close(ctr.fd_cycles);
+    }
+}
+
+static int bench_run(struct sr_instance *bench, unsigned int n_routes, int stream_kind,
+                     const char *pcap_path, uint32_t *nets, unsigned char *plens, uint32_t *stream)
+{
+    static const char *stream_names[] = {"uniforme", "zipf", "pcap"};
+
+    uint64_t t0 = bench_ns();
+    if (bench_table(bench, n_routes, nets, plens) < 0) {
+        return -1;
+    }
+    double list_ms = (bench_ns() - t0) / 1e6;
+
+    unsigned int stream_len = bench_stream(stream_kind, pcap_path, n_routes, nets, plens, stream);
+    if (stream_len == 0) {
+        printf("FIB bench: no se pudo armar el flujo de destinos %s\n", stream_names[stream_kind]);
+        return -1;
+    }
+
+    printf("FIB bench: %u rutas, destinos %s\n", n_routes, stream_names[stream_kind]);
+    bench_measure("lista", bench, NULL, stream, stream_len,
+                  list_ms, n_routes * sizeof(struct sr_rt) / 1048576.0);
+
+    t0 = bench_ns();
+    struct sr_fib *fib = sr_rip_fib_build(bench);
+    double fib_ms = (bench_ns() - t0) / 1e6;
+    if (fib) {
+        size_t lookup_mem, total_mem;
+        sr_rip_fib_mem(fib, &lookup_mem, &total_mem);
+        unsigned int prefixes, nodes, next_hops;
+        sr_rip_fib_counts(fib, &prefixes, &nodes, &next_hops);
+        printf("  FIB comprimida: %u prefijos, %u nodos, %u next hops, %.2f MB con lo de los cambios\n",
+               prefixes, nodes, next_hops, total_mem / 1048576.0);
+        bench_measure("FIB comprimida", bench, fib, stream, stream_len, fib_ms,
+                      lookup_mem / 1048576.0);
+        sr_rip_fib_free(fib);
+    }
+    return 0;
+}
+
+/*
+Una corrida: tabla de n_routes rutas, flujo de destinos stream_kind (FIB_BENCH_*; el pcap
+sale de pcap_path). Devuelve -1 si no se pudo armar la tabla o el flujo.
+*/
+static int bench_one(unsigned int n_routes, int stream_kind, const char *pcap_path)
+{
+    struct sr_instance bench;
+    memset(&bench, 0, sizeof(bench));
+
+    uint32_t *nets = malloc((size_t)n_routes * sizeof(uint32_t));
+    unsigned char *plens = malloc(n_routes);
+    uint32_t *stream = malloc(FIB_BENCH_STREAM_LEN * sizeof(uint32_t));
+    int ret = -1;
+    if (n_routes > 0 && nets && plens && stream) {
+        ret = bench_run(&bench, n_routes, stream_kind, pcap_path, nets, plens, stream);
+    }
+
+    while (bench.routing_table) {
+        struct sr_rt *next = bench.routing_table->next;
+        free(bench.routing_table);
+        bench.routing_table = next;
+    }
+    free(nets);
+    free(plens);
+    free(stream);
+    return ret;
+}
+
+int sr_send_packet(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface)
+{
+    (void)sr;
+    (void)buf;
+    (void)len;
+    (void)iface;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int sizes[] = {1000, 100000, 1000000};
+    unsigned int n_routes = argc > 1 ? (unsigned int)atoi(argv[1]) : 0;
+    const char *pcap_path = argc > 2 ? argv[2] : NULL;
+    if (argc > 1 && n_routes == 0) {
+        fprintf(stderr, "Uso: %s [rutas] [captura]\n", argv[0]);
+        return 1;
+    }
+
+    /* Sin cantidad, todas: 1k, 100k y 1M rutas con cada flujo (el de pcap solo si hay archivo) */
+    int ret = 0;
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        unsigned int n = n_routes ? n_routes : sizes[i];
+        ret |= bench_one(n, FIB_BENCH_UNIFORM, NULL);
+        ret |= bench_one(n, FIB_BENCH_ZIPF, NULL);
+        if (pcap_path) {
+            ret |= bench_one(n, FIB_BENCH_PCAP, pcap_path);
+        }
+        if (n_routes) {
+            break;
+        }
+    }
+    return ret ? 1 : 0;
+}
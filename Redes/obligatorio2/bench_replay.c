@@ -0,0 +1,257 @@
+/*
+Benchmark de replay del camino de reenvío: arma un router con dos interfaces y pasa por
+sr_handlepacket una traza de tramas con tamaños IMIX (7 de 64, 4 de 576 y 1 de 1500 bytes)
+desde eth0 hacia hosts de la red de eth1. Dos fases:
+- resuelta: los destinos ya están en el caché ARP, cada trama se reenvía en el lugar.
+- ARP miss: cada ronda va a hosts nuevos, así todas las tramas quedan en la cola de ARP;
+  al final de la ronda entra el ARP reply de cada host y se vacía su cola (es el camino de
+  sr_arpcache_queuereq y sr_arp_reply_send_pending_packets).
+Para cada fase muestra ns por trama y, si se compila contando memcpy, los bytes copiados con
+memcpy por cada byte reenviado (la medida de ancho de banda de memoria de este camino). Solo
+se cuentan las copias que pasan por el memcpy de libc: las chicas de tamaño fijo (una MAC)
+el compilador las hace en línea.
+
+Se compila con los fuentes del router, sin sr_main.c ni sr_vns_comm.c (este archivo pone
+su main y un sr_send_packet que solo cuenta):
+  gcc -O2 -o bench_replay bench_replay.c sr_router.c sr_acl.c sr_ct.c sr_nat.c sr_flow.c sr_tap.c \
+      sr_io.c sr_txq.c sr_epoch.c sr_arpcache.c sr_rip.c sr_if.c sr_rt.c sr_utils.c -lpthread
+Contando memcpy (envuelve el memcpy de libc):
+  gcc -O2 -DBENCH_COUNT_MEMCPY -Wl,--wrap=memcpy -o bench_replay bench_replay.c \
+      sr_router.c sr_acl.c sr_ct.c sr_nat.c sr_flow.c sr_tap.c sr_io.c sr_txq.c sr_epoch.c \
+      sr_arpcache.c sr_rip.c sr_if.c sr_rt.c sr_utils.c -lpthread
+Uso: ./bench_replay [tramas por fase (1000000)] [hosts por ronda (64)] [tramas por ronda (1024)]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_arpcache.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+
+/* En sr_rip.c */
+void sr_rip_set_snapshot_path(struct sr_instance* sr, const char* path);
+void sr_rip_poll(struct sr_instance* sr);
+void sr_rip_set_clock(time_t (*now_fn)(void));
+
+#define BENCH_NET_IN 0x0A010000u   /* 10.1.0.0/16 en eth0, de donde vienen las tramas */
+#define BENCH_NET_OUT 0x0A020000u  /* 10.2.0.0/16 en eth1, los destinos */
+#define BENCH_FRAME_MAX 1514
+
+static unsigned long bench_fwd_frames = 0;
+static unsigned long bench_fwd_bytes = 0;
+static unsigned long bench_other_frames = 0;
+static unsigned long bench_copied = 0;
+static time_t bench_clock_now = 1000;
+
+/* Reloj de RIP simulado, para no esperar el arranque de verdad */
+static time_t bench_clock(void)
+{
+    return bench_clock_now;
+}
+
+#ifdef BENCH_COUNT_MEMCPY
+void *__real_memcpy(void *dst, const void *src, size_t n);
+
+void *__wrap_memcpy(void *dst, const void *src, size_t n)
+{
+    bench_copied += n;
+    return __real_memcpy(dst, src, n);
+}
+#endif
+
+/* Cuenta lo que sale: IP reenviado por un lado, lo demás (ARP requests) por otro */
+int sr_send_packet(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface)
+{
+    (void)sr;
+    (void)iface;
+    if (len >= sizeof(sr_ethernet_hdr_t) && ntohs(((sr_ethernet_hdr_t *)buf)->ether_type) == ethertype_ip) {
+        bench_fwd_frames++;
+        bench_fwd_bytes += len;
+    } else {
+        bench_other_frames++;
+    }
+    return 0;
+}
+
+static double bench_elapsed_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+static uint16_t bench_cksum(const void *data, int len)
+{
+    const uint8_t *d = data;
+    uint32_t sum = 0;
+    for (; len > 1; len -= 2, d += 2) {
+        sum += (d[0] << 8) | d[1];
+    }
+    if (len) {
+        sum += d[0] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return htons(~sum & 0xFFFF);
+}
+
+/* Trama UDP de 10.1.0.2 a dst, de frame_len bytes en total */
+static unsigned int bench_build_ip(uint8_t *f, const uint8_t *router_mac, uint32_t dst, unsigned int frame_len)
+{
+    sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)f;
+    sr_ip_hdr_t *ip = (sr_ip_hdr_t *)(f + sizeof(sr_ethernet_hdr_t));
+    static const uint8_t src_mac[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x10, 0x02};
+    unsigned int ip_len = frame_len - sizeof(sr_ethernet_hdr_t);
+
+    memset(f, 0, frame_len);
+    memcpy(eth->ether_dhost, router_mac, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, src_mac, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(ip_len);
+    ip->ip_ttl = 64;
+    ip->ip_p = ip_protocol_udp;
+    ip->ip_src = htonl(BENCH_NET_IN | 2);
+    ip->ip_dst = dst;
+    ip->ip_sum = bench_cksum(ip, sizeof(sr_ip_hdr_t));
+    uint8_t *udp = (uint8_t *)ip + sizeof(sr_ip_hdr_t);
+    uint16_t sport = htons(40000), dport = htons(9), ulen = htons(ip_len - sizeof(sr_ip_hdr_t));
+    memcpy(udp, &sport, 2);
+    memcpy(udp + 2, &dport, 2);
+    memcpy(udp + 4, &ulen, 2);
+    return frame_len;
+}
+
+/* ARP reply de host (con una MAC armada a partir de la IP) hacia la interfaz del router */
+static unsigned int bench_build_arp_reply(uint8_t *f, const struct sr_if *iface, uint32_t host)
+{
+    sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)f;
+    sr_arp_hdr_t *arp = (sr_arp_hdr_t *)(f + sizeof(sr_ethernet_hdr_t));
+    uint8_t mac[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+    memcpy(mac + 2, &host, 4);
+
+    memset(f, 0, sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t));
+    memcpy(eth->ether_dhost, iface->addr, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, mac, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_arp);
+    arp->ar_hrd = htons(arp_hrd_ethernet);
+    arp->ar_pro = htons(ethertype_ip);
+    arp->ar_hln = ETHER_ADDR_LEN;
+    arp->ar_pln = 4;
+    arp->ar_op = htons(arp_op_reply);
+    memcpy(arp->ar_sha, mac, ETHER_ADDR_LEN);
+    arp->ar_sip = host;
+    memcpy(arp->ar_tha, iface->addr, ETHER_ADDR_LEN);
+    arp->ar_tip = iface->ip;
+    return sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
+}
+
+static unsigned int bench_imix_len(unsigned int i)
+{
+    static const unsigned int imix[12] = {64, 576, 64, 64, 576, 64, 1500, 64, 576, 64, 576, 64};
+    return imix[i % 12] - 4; /* Sin el FCS */
+}
+
+static void bench_report(const char *name, unsigned long frames, double ns,
+                         unsigned long fwd_frames, unsigned long fwd_bytes, unsigned long copied)
+{
+    fprintf(stderr, "%-9s %lu tramas, %.1f ns por trama, %lu reenviadas (%.2f Gbit/s)",
+            name, frames, ns / frames, fwd_frames, fwd_bytes * 8 / ns);
+#ifdef BENCH_COUNT_MEMCPY
+    fprintf(stderr, ", memcpy: %.2f bytes por byte reenviado", fwd_bytes ? (double)copied / fwd_bytes : 0.0);
+#else
+    (void)copied;
+#endif
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+    static struct sr_instance sr;
+    long n_frames = argc > 1 ? atol(argv[1]) : 1000000;
+    int hosts = argc > 2 ? atoi(argv[2]) : 64;
+    int per_round = argc > 3 ? atoi(argv[3]) : 1024;
+    if (n_frames <= 0 || hosts <= 0 || hosts > 60000 || per_round <= 0) {
+        fprintf(stderr, "Uso: %s [tramas por fase] [hosts por ronda] [tramas por ronda]\n", argv[0]);
+        return 1;
+    }
+
+    /* Los printf del router por paquete no dejan medir nada */
+    if (!freopen("/dev/null", "w", stdout)) {
+        perror("freopen");
+    }
+    sr_arpcache_init(&sr.cache);
+    struct sr_if **tail = &sr.if_list;
+    for (int i = 0; i < 2; i++) {
+        struct sr_if *iface = calloc(1, sizeof(struct sr_if));
+        if (!iface) {
+            perror("calloc");
+            return 1;
+        }
+        snprintf(iface->name, sizeof(iface->name), "eth%d", i);
+        uint8_t mac[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x01, (uint8_t)i};
+        memcpy(iface->addr, mac, ETHER_ADDR_LEN);
+        iface->ip = htonl((i ? BENCH_NET_OUT : BENCH_NET_IN) | 1);
+        iface->mask = htonl(0xFFFF0000u);
+        iface->cost = 1;
+        *tail = iface;
+        tail = &iface->next;
+    }
+    struct sr_if *eth0 = sr.if_list, *eth1 = sr.if_list->next;
+    sr_rip_set_snapshot_path(&sr, NULL);
+    sr_rip_set_clock(bench_clock);
+    /* El primer poll es el arranque; el de un rato después agrega las rutas conectadas */
+    sr_rip_poll(&sr);
+    bench_clock_now += 60;
+    sr_rip_poll(&sr);
+
+    static uint8_t frame[BENCH_FRAME_MAX];
+    struct timespec t0, t1;
+
+    /* Fase resuelta: los hosts de la primera ronda entran al caché antes */
+    for (int h = 0; h < hosts; h++) {
+        unsigned int len = bench_build_arp_reply(frame, eth1, htonl(BENCH_NET_OUT | (uint32_t)(h + 2)));
+        sr_handlepacket(&sr, frame, len, eth1->name);
+    }
+    bench_fwd_frames = bench_fwd_bytes = bench_copied = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long i = 0; i < n_frames; i++) {
+        unsigned int len = bench_build_ip(frame, eth0->addr, htonl(BENCH_NET_OUT | (uint32_t)(i % hosts + 2)),
+                                          bench_imix_len((unsigned int)i));
+        sr_handlepacket(&sr, frame, len, eth0->name);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    bench_report("resuelta:", n_frames, bench_elapsed_ns(&t0, &t1), bench_fwd_frames, bench_fwd_bytes, bench_copied);
+
+    /* Fase ARP miss: hosts nuevos en cada ronda, los replies al final de la ronda */
+    bench_fwd_frames = bench_fwd_bytes = bench_copied = 0;
+    uint32_t next_host = (uint32_t)hosts + 2;
+    long done = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (done < n_frames) {
+        if (next_host + hosts > 0xFFFE) {
+            next_host = (uint32_t)hosts + 2;
+        }
+        for (int i = 0; i < per_round && done < n_frames; i++, done++) {
+            uint32_t dst = htonl(BENCH_NET_OUT | (next_host + (uint32_t)(i % hosts)));
+            unsigned int len = bench_build_ip(frame, eth0->addr, dst, bench_imix_len((unsigned int)done));
+            sr_handlepacket(&sr, frame, len, eth0->name);
+        }
+        for (int h = 0; h < hosts; h++) {
+            unsigned int len = bench_build_arp_reply(frame, eth1, htonl(BENCH_NET_OUT | (next_host + (uint32_t)h)));
+            sr_handlepacket(&sr, frame, len, eth1->name);
+        }
+        next_host += (uint32_t)hosts;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    bench_report("ARP miss:", n_frames, bench_elapsed_ns(&t0, &t1), bench_fwd_frames, bench_fwd_bytes, bench_copied);
+    fprintf(stderr, "otras tramas enviadas (ARP requests): %lu\n", bench_other_frames);
+    return 0;
+}
@@ -0,0 +1,439 @@
+/*
+Harness de fuzzing para sr_handlepacket: arma un router con tres interfaces, rutas conectadas,
+una ruta por defecto y los vecinos ya en el caché ARP, y le pasa cada entrada como una trama
+recibida. El primer byte de la entrada elige la interfaz de entrada y el resto es la trama.
+La trama se copia a un buffer del tamaño justo, así ASan agarra cualquier lectura fuera de
+ella (con el buffer del fuzzer no siempre). Los paquetes RIP que quedan encolados se procesan
+cada SR_FUZZ_RIP_EVERY entradas con sr_rip_poll, así también se fuzzea su parser.
+
+Con libFuzzer (el throughput lo imprime libFuzzer, exec/s):
+  clang -g -O1 -fsanitize=fuzzer,address,undefined -DSR_FUZZ_LIBFUZZER -o fuzz_handlepacket \
+      fuzz_handlepacket.c sr_router.c sr_acl.c sr_ct.c sr_nat.c sr_flow.c sr_tap.c \
+      sr_io.c sr_txq.c sr_epoch.c sr_arpcache.c sr_rip.c sr_if.c sr_rt.c sr_utils.c -lpthread
+  ./fuzz_handlepacket -w semillas      (con el driver propio, ver abajo)
+  ./fuzz_handlepacket semillas/        (con libFuzzer; el directorio queda como corpus)
+
+Sin clang hay un driver propio que muta las semillas (bits, bytes, campos de largo, cortes)
+y cada SR_FUZZ_REPORT_EVERY entradas imprime entradas por segundo:
+  gcc -g -O1 -fsanitize=address,undefined -o fuzz_handlepacket \
+      fuzz_handlepacket.c sr_router.c sr_acl.c sr_ct.c sr_nat.c sr_flow.c sr_tap.c \
+      sr_io.c sr_txq.c sr_epoch.c sr_arpcache.c sr_rip.c sr_if.c sr_rt.c sr_utils.c -lpthread
+  ./fuzz_handlepacket [entradas (1000000)] [semilla]
+  ./fuzz_handlepacket -w dir           escribe las semillas en dir y termina
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_arpcache.h"
+#include "sr_protocol.h"
+
+/* En sr_rip.c */
+void sr_rip_set_snapshot_path(struct sr_instance* sr, const char* path);
+void sr_rip_poll(struct sr_instance* sr);
+
+#define SR_FUZZ_IFACES 3
+#define SR_FUZZ_MAX_FRAME 2048
+#define SR_FUZZ_RIP_EVERY 256
+#define SR_FUZZ_REPORT_EVERY 200000
+
+static struct sr_instance fuzz_sr;
+static int fuzz_ready = 0;
+static unsigned long fuzz_inputs = 0;
+static unsigned long fuzz_sent = 0;
+
+/* Se manda todo a ningún lado; solo se cuenta */
+int sr_send_packet(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface)
+{
+    (void)sr;
+    (void)buf;
+    (void)len;
+    (void)iface;
+    fuzz_sent++;
+    return 0;
+}
+
+/* eth<i>: 10.0.<i+1>.1/24, vecino en 10.0.<i+1>.2 */
+static uint32_t fuzz_if_ip(int i)
+{
+    return htonl(0x0A000001u | (uint32_t)(i + 1) << 8);
+}
+
+static uint32_t fuzz_peer_ip(int i)
+{
+    return htonl(0x0A000002u | (uint32_t)(i + 1) << 8);
+}
+
+static void fuzz_if_mac(int i, uint8_t *mac)
+{
+    uint8_t m[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x01, (uint8_t)i};
+    memcpy(mac, m, ETHER_ADDR_LEN);
+}
+
+static void fuzz_peer_mac(int i, uint8_t *mac)
+{
+    uint8_t m[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x02, (uint8_t)i};
+    memcpy(mac, m, ETHER_ADDR_LEN);
+}
+
+static void fuzz_setup(void)
+{
+    struct sr_instance *sr = &fuzz_sr;
+
+    /* Los printf del router por paquete no dejan medir nada */
+    if (!freopen("/dev/null", "w", stdout)) {
+        perror("freopen");
+    }
+    sr_arpcache_init(&sr->cache);
+    struct sr_if **tail = &sr->if_list;
+    for (int i = 0; i < SR_FUZZ_IFACES; i++) {
+        struct sr_if *iface = calloc(1, sizeof(struct sr_if));
+        if (!iface) {
+            perror("calloc");
+            exit(1);
+        }
+        snprintf(iface->name, sizeof(iface->name), "eth%d", i);
+        fuzz_if_mac(i, iface->addr);
+        iface->ip = fuzz_if_ip(i);
+        iface->mask = htonl(0xFFFFFF00u);
+        iface->cost = 1;
+        *tail = iface;
+        tail = &iface->next;
+
+        uint8_t mac[ETHER_ADDR_LEN];
+        fuzz_peer_mac(i, mac);
+        struct sr_arpreq *req = sr_arpcache_insert(&sr->cache, mac, fuzz_peer_ip(i));
+        if (req) {
+            sr_arpreq_destroy(&sr->cache, req);
+        }
+    }
+    sr_rip_set_snapshot_path(sr, NULL);
+    /* El primer poll agrega las rutas conectadas */
+    sr_rip_poll(sr);
+
+    /* Por defecto hacia el vecino de eth2, para que casi todo se reenvíe */
+    struct in_addr any = { 0 };
+    struct in_addr gw = { fuzz_peer_ip(2) };
+    sr_add_rt_entry(sr, any, gw, any, "eth2", 2, 0, 0, time(NULL), 1, 0);
+    fuzz_ready = 1;
+}
+
+static void fuzz_one(const uint8_t *data, size_t size)
+{
+    static const char *names[SR_FUZZ_IFACES] = {"eth0", "eth1", "eth2"};
+
+    if (!fuzz_ready) {
+        fuzz_setup();
+    }
+    if (size < 1 || size > SR_FUZZ_MAX_FRAME + 1) {
+        return;
+    }
+    unsigned int len = size - 1;
+    uint8_t *frame = malloc(len ? len : 1);
+    if (!frame) {
+        return;
+    }
+    memcpy(frame, data + 1, len);
+    sr_handlepacket(&fuzz_sr, frame, len, (char *)names[data[0] % SR_FUZZ_IFACES]);
+    free(frame);
+
+    if (++fuzz_inputs % SR_FUZZ_RIP_EVERY == 0) {
+        sr_rip_poll(&fuzz_sr);
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    fuzz_one(data, size);
+    return 0;
+}
+
+#ifndef SR_FUZZ_LIBFUZZER
+
+/*
+Semillas: una trama válida de cada camino interesante, para que las mutaciones arranquen
+desde adentro de cada handler y no se queden en la validación.
+*/
+#define SR_FUZZ_SEEDS 7
+
+static uint16_t fuzz_cksum(const void *data, unsigned int len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t sum = 0;
+    for (; len > 1; len -= 2, p += 2) {
+        sum += (p[0] << 8) | p[1];
+    }
+    if (len) {
+        sum += p[0] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return htons(~sum & 0xFFFF);
+}
+
+/* La entrada lleva el byte de la interfaz adelante, así que los campos quedan desalineados */
+static void fuzz_put16(uint8_t *p, uint16_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static void fuzz_put32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+/* Ethernet + IP con la carga ya puesta en buf + 34; devuelve el largo de la entrada */
+static unsigned int fuzz_seed_ip(uint8_t *in, int iface, uint32_t src, uint32_t dst, uint8_t proto,
+                                 uint8_t ttl, unsigned int payload_len)
+{
+    uint8_t *frame = in + 1;
+    sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)frame;
+    sr_ip_hdr_t *ip = (sr_ip_hdr_t *)(frame + sizeof(sr_ethernet_hdr_t));
+
+    in[0] = (uint8_t)iface;
+    fuzz_if_mac(iface, eth->ether_dhost);
+    fuzz_peer_mac(iface, eth->ether_shost);
+    eth->ether_type = htons(ethertype_ip);
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_tos = 0;
+    ip->ip_len = htons(sizeof(sr_ip_hdr_t) + payload_len);
+    ip->ip_id = htons(1);
+    ip->ip_off = htons(IP_DF);
+    ip->ip_ttl = ttl;
+    ip->ip_p = proto;
+    ip->ip_src = src;
+    ip->ip_dst = dst;
+    ip->ip_sum = 0;
+    ip->ip_sum = fuzz_cksum(ip, sizeof(sr_ip_hdr_t));
+    return 1 + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + payload_len;
+}
+
+static unsigned int fuzz_seed(int n, uint8_t *in)
+{
+    const unsigned int l4 = 1 + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t);
+    uint8_t *p = in + l4;
+
+    memset(in, 0, SR_FUZZ_MAX_FRAME + 1);
+    switch (n) {
+    case 0: { /* Echo request al router */
+        p[0] = 8;
+        memcpy(p + 8, "ping ping ping!!", 16);
+        fuzz_put16(p + 2, fuzz_cksum(p, 24));
+        return fuzz_seed_ip(in, 0, fuzz_peer_ip(0), fuzz_if_ip(0), ip_protocol_icmp, 64, 24);
+    }
+    case 1: /* TCP SYN que se reenvía por la ruta por defecto */
+        fuzz_put16(p, htons(40000));
+        fuzz_put16(p + 2, htons(80));
+        p[12] = 5 << 4;
+        p[13] = 0x02;
+        return fuzz_seed_ip(in, 1, fuzz_peer_ip(1), htonl(0x08080808u), 6, 64, 20);
+    case 2: /* TTL 1: time exceeded */
+        fuzz_put16(p, htons(5000));
+        fuzz_put16(p + 2, htons(53));
+        fuzz_put16(p + 4, htons(12));
+        return fuzz_seed_ip(in, 0, fuzz_peer_ip(0), fuzz_peer_ip(1), ip_protocol_udp, 1, 12);
+    case 3: /* UDP a un puerto cerrado del router: port unreachable */
+        fuzz_put16(p, htons(5000));
+        fuzz_put16(p + 2, htons(33434));
+        fuzz_put16(p + 4, htons(16));
+        return fuzz_seed_ip(in, 2, fuzz_peer_ip(2), fuzz_if_ip(2), ip_protocol_udp, 64, 16);
+    case 4: { /* Respuesta RIPv2 con dos rutas */
+        unsigned int rip_len = 4 + 2 * 20;
+        fuzz_put16(p, htons(520));
+        fuzz_put16(p + 2, htons(520));
+        fuzz_put16(p + 4, htons(8 + rip_len));
+        uint8_t *rip = p + 8;
+        rip[0] = 2;
+        rip[1] = 2;
+        for (int e = 0; e < 2; e++) {
+            uint8_t *ent = rip + 4 + 20 * e;
+            fuzz_put16(ent, htons(2));
+            fuzz_put32(ent + 4, htonl(0xAC100000u | (uint32_t)e << 8));
+            fuzz_put32(ent + 8, htonl(0xFFFFFF00u));
+            fuzz_put32(ent + 16, htonl(1 + e));
+        }
+        return fuzz_seed_ip(in, 0, fuzz_peer_ip(0), htonl(0xE0000009u), ip_protocol_udp, 1, 8 + rip_len);
+    }
+    case 5: { /* ARP request por la IP de eth1 */
+        uint8_t *frame = in + 1;
+        sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)frame;
+        sr_arp_hdr_t *arp = (sr_arp_hdr_t *)(frame + sizeof(sr_ethernet_hdr_t));
+        in[0] = 1;
+        memset(eth->ether_dhost, 0xFF, ETHER_ADDR_LEN);
+        fuzz_peer_mac(1, eth->ether_shost);
+        eth->ether_type = htons(ethertype_arp);
+        arp->ar_hrd = htons(arp_hrd_ethernet);
+        arp->ar_pro = htons(ethertype_ip);
+        arp->ar_hln = ETHER_ADDR_LEN;
+        arp->ar_pln = 4;
+        arp->ar_op = htons(arp_op_request);
+        fuzz_peer_mac(1, arp->ar_sha);
+        arp->ar_sip = fuzz_peer_ip(1);
+        arp->ar_tip = fuzz_if_ip(1);
+        return 1 + sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
+    }
+    default: { /* Datagrama grande con DF hacia afuera, por si el MTU de salida es menor */
+        unsigned int payload = 1480;
+        fuzz_put16(p, htons(40001));
+        fuzz_put16(p + 2, htons(443));
+        p[12] = 5 << 4;
+        p[13] = 0x10;
+        return fuzz_seed_ip(in, 0, fuzz_peer_ip(0), htonl(0x08080404u), 6, 64, payload);
+    }
+    }
+}
+
+static uint32_t fuzz_rand(void)
+{
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+/* Cambios al azar sobre una semilla; los campos de largo y los bordes reciben más atención */
+static unsigned int fuzz_mutate(uint8_t *in, unsigned int len)
+{
+    static const uint16_t interesting[] = {0, 1, 7, 8, 19, 20, 27, 28, 60, 0x7FFF, 0xFFFF};
+    static const uint8_t protos[] = {1, 6, 17, 47, 89};
+    /* ip_hl, ip_len, udp length, offset de la opción TCP */
+    static const unsigned int hot[] = {15, 17, 18, 21, 22, 39, 40, 47};
+    int n = 1 + fuzz_rand() % 8;
+
+    for (int m = 0; m < n; m++) {
+        unsigned int pos = len > 1 ? 1 + fuzz_rand() % (len - 1) : 0;
+        switch (fuzz_rand() % 7) {
+        case 0:
+            in[pos] ^= (uint8_t)(1u << (fuzz_rand() % 8));
+            break;
+        case 1:
+            in[pos] = (uint8_t)fuzz_rand();
+            break;
+        case 2: {
+            unsigned int h = hot[fuzz_rand() % (sizeof(hot) / sizeof(hot[0]))];
+            uint16_t v = interesting[fuzz_rand() % (sizeof(interesting) / sizeof(interesting[0]))];
+            if (h + 1 < len) {
+                fuzz_put16(in + h, htons(v));
+            }
+            break;
+        }
+        case 3:
+            in[16] = (uint8_t)((in[16] & 0xF0) | (fuzz_rand() % 16));
+            break;
+        case 4:
+            len = 1 + fuzz_rand() % len;
+            break;
+        case 5:
+            /* Protocolo y TTL, que deciden a qué handler va */
+            if (len > 24) {
+                in[24] = protos[fuzz_rand() % (sizeof(protos) / sizeof(protos[0]))];
+                in[23] = (uint8_t)(fuzz_rand() % 3);
+            }
+            break;
+        default: {
+            unsigned int more = fuzz_rand() % 64;
+            if (len + more <= SR_FUZZ_MAX_FRAME + 1) {
+                memset(in + len, (uint8_t)fuzz_rand(), more);
+                len += more;
+            }
+            break;
+        }
+        }
+    }
+    /* El cabezal IP casi siempre se vuelve a sumar, si no casi todo moriría en el checksum */
+    unsigned int ip_at = 1 + sizeof(sr_ethernet_hdr_t);
+    if (fuzz_rand() % 8 != 0 && len >= ip_at + sizeof(sr_ip_hdr_t)) {
+        unsigned int ihl = (in[ip_at] & 0x0F) * 4;
+        if (ihl >= sizeof(sr_ip_hdr_t) && ip_at + ihl <= len) {
+            fuzz_put16(in + ip_at + 10, 0);
+            fuzz_put16(in + ip_at + 10, fuzz_cksum(in + ip_at, ihl));
+        }
+    }
+    /* Una de cada 4 se corta justo en ip_len: sin relleno, cualquier lectura que se pase
+    de lo declarado cae afuera del buffer */
+    if (fuzz_rand() % 4 == 0 && len >= ip_at + 4) {
+        uint16_t ip_len;
+        memcpy(&ip_len, in + ip_at + 2, sizeof(ip_len));
+        if (ip_at + ntohs(ip_len) < len) {
+            len = ip_at + ntohs(ip_len);
+        }
+    }
+    return len;
+}
+
+static int fuzz_write_seeds(const char *dir)
+{
+    static uint8_t in[SR_FUZZ_MAX_FRAME + 1];
+    for (int n = 0; n < SR_FUZZ_SEEDS; n++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/semilla%d", dir, n);
+        FILE *f = fopen(path, "wb");
+        if (!f) {
+            perror(path);
+            return 1;
+        }
+        unsigned int len = fuzz_seed(n, in);
+        fwrite(in, 1, len, f);
+        fclose(f);
+    }
+    fprintf(stderr, "%d semillas en %s\n", SR_FUZZ_SEEDS, dir);
+    return 0;
+}
+
+static double fuzz_elapsed(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2 && strcmp(argv[1], "-w") == 0) {
+        return fuzz_write_seeds(argv[2]);
+    }
+    long n_inputs = argc > 1 ? atol(argv[1]) : 1000000;
+    unsigned int seed = argc > 2 ? (unsigned int)atoi(argv[2]) : (unsigned int)time(NULL);
+    if (n_inputs <= 0) {
+        fprintf(stderr, "Uso: %s [entradas] [semilla] | -w dir\n", argv[0]);
+        return 1;
+    }
+
+    static uint8_t seeds[SR_FUZZ_SEEDS][SR_FUZZ_MAX_FRAME + 1];
+    static unsigned int seed_len[SR_FUZZ_SEEDS];
+    static uint8_t in[SR_FUZZ_MAX_FRAME + 1 + 64];
+    for (int n = 0; n < SR_FUZZ_SEEDS; n++) {
+        seed_len[n] = fuzz_seed(n, seeds[n]);
+    }
+    /* sr_arpcache_init siembra rand con la hora; la semilla del fuzzer va después */
+    fuzz_setup();
+    srand(seed);
+    fprintf(stderr, "fuzz: %ld entradas, semilla %u\n", n_inputs, seed);
+
+    struct timespec t0, t_last, t_now;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    t_last = t0;
+    for (long i = 1; i <= n_inputs; i++) {
+        int s = fuzz_rand() % SR_FUZZ_SEEDS;
+        memcpy(in, seeds[s], seed_len[s]);
+        /* Una de cada 16 va sin tocar, así los caminos válidos también se miden */
+        unsigned int len = (i % 16) ? fuzz_mutate(in, seed_len[s]) : seed_len[s];
+        fuzz_one(in, len);
+
+        if (i % SR_FUZZ_REPORT_EVERY == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &t_now);
+            fprintf(stderr, "#%ld  %.0f exec/s  (%lu tramas enviadas)\n",
+                    i, SR_FUZZ_REPORT_EVERY / fuzz_elapsed(&t_last, &t_now), fuzz_sent);
+            t_last = t_now;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_now);
+    fprintf(stderr, "fuzz: %ld entradas en %.1f s, %.0f exec/s, %lu tramas enviadas, sin errores\n",
+            n_inputs, fuzz_elapsed(&t0, &t_now), n_inputs / fuzz_elapsed(&t0, &t_now), fuzz_sent);
+    return 0;
+}
+
+#endif /* SR_FUZZ_LIBFUZZER */
@@ -0,0 +1,646 @@
+/*
+Simulador de RIP: levanta N routers en un solo proceso, cada uno con su sr_instance y su
+estado de RIP, unidos por enlaces punto a punto (/30) con latencia y pérdida. No hay hilos
+ni timerfd: el reloj es simulado (sr_rip_set_clock) y cada router avanza con sr_rip_poll.
+Los paquetes que manda un router salen por sr_send_packet (que acá lo pone este archivo en
+vez de sr_vns_comm.c) y llegan al vecino después de la latencia del enlace.
+
+Mide, para arranque en frío y para cada falla inyectada (se baja un enlace y después se
+vuelve a subir):
+- tiempo de convergencia: hasta que en todos los routers la métrica de cada subred de enlace
+  es la distancia en saltos al extremo más cercano + 1 (lo que da un BFS sobre la topología).
+  Se mira una vez por segundo, pero lo que se informa es el milisegundo simulado del último
+  cambio de tabla antes de converger. Los timers de RIP (el freno de los triggered updates,
+  timeouts, garbage collection) van de a segundo igual que en el router, porque
+  sr_rip_set_clock es de time_t: eso sí queda redondeado al segundo.
+- mensajes RIP enviados y recibidos por router.
+- CPU de RIP por router (lo que cuenta sr_rip_poll con CLOCK_THREAD_CPUTIME_ID).
+
+Se compila con los fuentes del router, sin sr_main.c ni sr_vns_comm.c:
+  gcc -O2 -o rip_sim rip_sim.c sr_rip.c sr_router.c sr_acl.c sr_ct.c sr_nat.c \
+      sr_flow.c sr_tap.c sr_io.c sr_txq.c sr_epoch.c sr_arpcache.c sr_if.c sr_rt.c sr_utils.c -lpthread
+Uso:
+  ./rip_sim [-t line|ring|mesh] [-n routers] [-l latencia_ms] [-p pérdida 0..1] [-f fallas]
+            [-s semilla] [-T límite_seg] [-r] [-v]
+  -r imprime la línea de cada router, -v deja pasar los printf del router (muchísimos).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_arpcache.h"
+#include "sr_protocol.h"
+
+/* En sr_rip.c */
+void sr_rip_set_clock(time_t (*now_fn)(void));
+void sr_rip_set_snapshot_path(struct sr_instance* sr, const char* path);
+void sr_rip_poll(struct sr_instance* sr);
+void sr_rip_destroy(struct sr_instance* sr);
+void sr_handle_rip_packet(struct sr_instance* sr, const uint8_t* packet, unsigned int pkt_len,
+                          unsigned int ip_off, unsigned int rip_off, unsigned int rip_len,
+                          const char* in_ifname);
+int sr_rip_get_stats(struct sr_instance* sr, unsigned long* rx_packets, unsigned long* tx_packets,
+                     unsigned long* table_changes, double* cpu_sec);
+
+#define SIM_MAX_PORTS 8
+#define SIM_RX_BATCH 32            /* La cola de RX de RIP es de 64: se procesa antes de llenarla */
+#define SIM_NET_BASE 0x0A000000u   /* 10.0.0.0, un /30 por enlace */
+#define SIM_INFINITY 16
+
+struct sim_link {
+    int a, b;           /* Routers de los extremos */
+    int a_port, b_port; /* Interfaz en cada extremo */
+    int up;
+};
+
+struct sim_router {
+    struct sr_instance sr; /* Primero, así sr_send_packet vuelve al router con un cast */
+    int n_ports;
+    int links[SIM_MAX_PORTS];
+    int rx_pending;        /* Paquetes encolados en RIP desde el último poll */
+    int dirty;             /* Está en la lista de routers a pollear */
+    unsigned long frames_tx;
+    unsigned long frames_rx;
+    unsigned long changes_seen; /* Cambios de tabla que ya se anotaron en sim_last_change_ms */
+};
+
+struct sim_event {
+    uint64_t at_ms;
+    uint64_t seq;          /* Desempata para que dos envíos al mismo tiempo lleguen en orden */
+    int router;
+    int port;
+    unsigned int len;
+    uint8_t* buf;
+};
+
+static struct sim_router* routers;
+static int n_routers;
+static struct sim_link* links;
+static int n_links;
+
+static struct sim_event* heap;
+static int heap_len, heap_cap;
+static uint64_t heap_seq;
+
+static int* dirty_list;
+static int n_dirty;
+
+static uint64_t sim_now_ms;
+static uint64_t sim_last_change_ms; /* Cuándo cambió por última vez la tabla de algún router */
+static unsigned int latency_ms = 5;
+static double loss = 0.0;
+static unsigned long frames_lost, frames_dropped_down;
+
+/* RIP cuenta en segundos: los milisegundos solo los usan la entrega de tramas y las mediciones */
+static time_t sim_clock(void)
+{
+    return (time_t)(sim_now_ms / 1000);
+}
+
+/* Si la tabla de r cambió desde la última vez, anota el momento */
+static void sim_note_changes(struct sim_router* r)
+{
+    unsigned long rx, tx, changes;
+    double cpu;
+    if (sr_rip_get_stats(&r->sr, &rx, &tx, &changes, &cpu) == 0 && changes != r->changes_seen) {
+        r->changes_seen = changes;
+        sim_last_change_ms = sim_now_ms;
+    }
+}
+
+static int sim_event_before(const struct sim_event* a, const struct sim_event* b)
+{
+    return a->at_ms < b->at_ms || (a->at_ms == b->at_ms && a->seq < b->seq);
+}
+
+static void sim_heap_push(struct sim_event ev)
+{
+    if (heap_len == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 1024;
+        heap = realloc(heap, heap_cap * sizeof(struct sim_event));
+        if (!heap) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    ev.seq = heap_seq++;
+    int i = heap_len++;
+    while (i > 0 && sim_event_before(&ev, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = ev;
+}
+
+static struct sim_event sim_heap_pop(void)
+{
+    struct sim_event top = heap[0];
+    struct sim_event last = heap[--heap_len];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= heap_len) {
+            break;
+        }
+        if (child + 1 < heap_len && sim_event_before(&heap[child + 1], &heap[child])) {
+            child++;
+        }
+        if (!sim_event_before(&heap[child], &last)) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (heap_len > 0) {
+        heap[i] = last;
+    }
+    return top;
+}
+
+static uint32_t sim_link_net(int link)
+{
+    return SIM_NET_BASE + 4u * (uint32_t)link;
+}
+
+/* IP (en orden de host) del extremo 'side' (0 = a, 1 = b) del enlace */
+static uint32_t sim_link_ip(int link, int side)
+{
+    return sim_link_net(link) + 1 + side;
+}
+
+static int sim_port_of(const char* ifname)
+{
+    return (strncmp(ifname, "eth", 3) == 0) ? atoi(ifname + 3) : -1;
+}
+
+/*
+Reemplaza al sr_send_packet de VNS: la trama queda en vuelo por el enlace de la interfaz.
+Si el enlace está caído o le toca perderse, se descarta sin avisar (como un cable).
+*/
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len, const char* iface)
+{
+    struct sim_router* from = (struct sim_router*)sr;
+    int port = sim_port_of(iface);
+    if (port < 0 || port >= from->n_ports) {
+        return -1;
+    }
+    from->frames_tx++;
+
+    struct sim_link* link = &links[from->links[port]];
+    if (!link->up) {
+        frames_dropped_down++;
+        return 0;
+    }
+    if (loss > 0 && (double)rand() / RAND_MAX < loss) {
+        frames_lost++;
+        return 0;
+    }
+
+    int from_idx = (int)(from - routers);
+    struct sim_event ev;
+    ev.at_ms = sim_now_ms + latency_ms;
+    ev.router = (link->a == from_idx) ? link->b : link->a;
+    ev.port = (link->a == from_idx) ? link->b_port : link->a_port;
+    ev.len = len;
+    ev.buf = malloc(len);
+    if (!ev.buf) {
+        return -1;
+    }
+    memcpy(ev.buf, buf, len);
+    sim_heap_push(ev);
+    return 0;
+}
+
+static void sim_poll_dirty(void)
+{
+    for (int i = 0; i < n_dirty; i++) {
+        struct sim_router* r = &routers[dirty_list[i]];
+        r->dirty = 0;
+        r->rx_pending = 0;
+        sr_rip_poll(&r->sr);
+        sim_note_changes(r);
+    }
+    n_dirty = 0;
+}
+
+/* Entrega la trama a RIP del router destino. Solo viaja RIP, así que basta con UDP/520 */
+static void sim_deliver(struct sim_event* ev)
+{
+    struct sim_router* r = &routers[ev->router];
+    r->frames_rx++;
+
+    unsigned int ip_off = sizeof(sr_ethernet_hdr_t);
+    if (ev->len < ip_off + sizeof(sr_ip_hdr_t) + sizeof(sr_udp_hdr_t)) {
+        return;
+    }
+    sr_ip_hdr_t* ip_hdr = (sr_ip_hdr_t*)(ev->buf + ip_off);
+    unsigned int udp_off = ip_off + ip_hdr->ip_hl * 4;
+    if (ip_hdr->ip_p != ip_protocol_udp || ev->len < udp_off + sizeof(sr_udp_hdr_t)) {
+        return;
+    }
+    sr_udp_hdr_t* udp_hdr = (sr_udp_hdr_t*)(ev->buf + udp_off);
+    unsigned int rip_off = udp_off + sizeof(sr_udp_hdr_t);
+    unsigned int rip_len = ntohs(udp_hdr->length) - sizeof(sr_udp_hdr_t);
+    if (ntohs(udp_hdr->dst_port) != 520 || rip_off + rip_len > ev->len) {
+        return;
+    }
+
+    char ifname[sr_IFACE_NAMELEN];
+    snprintf(ifname, sizeof(ifname), "eth%d", ev->port);
+    sr_handle_rip_packet(&r->sr, ev->buf, ev->len, ip_off, rip_off, rip_len, ifname);
+    sim_note_changes(r);
+
+    if (!r->dirty) {
+        r->dirty = 1;
+        dirty_list[n_dirty++] = ev->router;
+    }
+    if (++r->rx_pending >= SIM_RX_BATCH) {
+        sim_poll_dirty();
+    }
+}
+
+/* Avanza la simulación hasta 'until_ms', entregando todo lo que llega antes */
+static void sim_run_until(uint64_t until_ms)
+{
+    while (heap_len > 0 && heap[0].at_ms < until_ms) {
+        struct sim_event ev = sim_heap_pop();
+        sim_now_ms = ev.at_ms;
+        sim_deliver(&ev);
+        free(ev.buf);
+        /* Lo que llegó en el mismo milisegundo se procesa junto, como un lote */
+        if (heap_len == 0 || heap[0].at_ms != sim_now_ms) {
+            sim_poll_dirty();
+        }
+    }
+    sim_poll_dirty();
+    sim_now_ms = until_ms;
+}
+
+static int sim_add_port(int router, int link)
+{
+    struct sim_router* r = &routers[router];
+    if (r->n_ports >= SIM_MAX_PORTS) {
+        fprintf(stderr, "Demasiadas interfaces en el router %d\n", router);
+        exit(1);
+    }
+    r->links[r->n_ports] = link;
+    return r->n_ports++;
+}
+
+static void sim_connect(int a, int b)
+{
+    links = realloc(links, (n_links + 1) * sizeof(struct sim_link));
+    if (!links) {
+        perror("realloc");
+        exit(1);
+    }
+    struct sim_link* l = &links[n_links];
+    l->a = a;
+    l->b = b;
+    l->up = 1;
+    l->a_port = sim_add_port(a, n_links);
+    l->b_port = sim_add_port(b, n_links);
+    n_links++;
+}
+
+static void sim_build_topology(const char* topo)
+{
+    if (strcmp(topo, "mesh") == 0) {
+        /* Grilla de lado x lado, cada router con sus vecinos de derecha y abajo */
+        int side = 1;
+        while (side * side < n_routers) {
+            side++;
+        }
+        for (int i = 0; i < n_routers; i++) {
+            if ((i % side) + 1 < side && i + 1 < n_routers) {
+                sim_connect(i, i + 1);
+            }
+            if (i + side < n_routers) {
+                sim_connect(i, i + side);
+            }
+        }
+        return;
+    }
+    for (int i = 0; i + 1 < n_routers; i++) {
+        sim_connect(i, i + 1);
+    }
+    if (strcmp(topo, "ring") == 0 && n_routers > 2) {
+        sim_connect(n_routers - 1, 0);
+    }
+}
+
+/* Arma la sr_instance de cada router: interfaces, ARP de los vecinos y estado de RIP */
+static void sim_build_routers(void)
+{
+    for (int i = 0; i < n_routers; i++) {
+        struct sim_router* r = &routers[i];
+        sr_arpcache_init(&r->sr.cache);
+        struct sr_if** tail = &r->sr.if_list;
+        for (int p = 0; p < r->n_ports; p++) {
+            struct sr_if* iface = calloc(1, sizeof(struct sr_if));
+            if (!iface) {
+                perror("calloc");
+                exit(1);
+            }
+            int link = r->links[p];
+            int side = (links[link].a == i && links[link].a_port == p) ? 0 : 1;
+            snprintf(iface->name, sizeof(iface->name), "eth%d", p);
+            unsigned char mac[ETHER_ADDR_LEN] = {0x02, 0x00, (i >> 8) & 0xff, i & 0xff, 0x00, p};
+            memcpy(iface->addr, mac, ETHER_ADDR_LEN);
+            iface->ip = htonl(sim_link_ip(link, side));
+            iface->mask = htonl(0xFFFFFFFCu);
+            iface->cost = 1;
+            *tail = iface;
+            tail = &iface->next;
+        }
+        sr_rip_set_snapshot_path(&r->sr, NULL);
+    }
+
+    /* Las respuestas a un REQUEST van unicast y RIP no espera por ARP: se cargan los vecinos */
+    for (int l = 0; l < n_links; l++) {
+        for (int side = 0; side < 2; side++) {
+            int me = side ? links[l].b : links[l].a;
+            int peer = side ? links[l].a : links[l].b;
+            int peer_port = side ? links[l].a_port : links[l].b_port;
+            unsigned char mac[ETHER_ADDR_LEN] = {0x02, 0x00, (peer >> 8) & 0xff, peer & 0xff, 0x00, peer_port};
+            struct sr_arpreq* req = sr_arpcache_insert(&routers[me].sr.cache, mac,
+                                                       htonl(sim_link_ip(l, !side)));
+            if (req) {
+                sr_arpreq_destroy(&routers[me].sr.cache, req);
+            }
+        }
+    }
+}
+
+/* Distancias en saltos desde 'src' por los enlaces que están arriba (-1 = inalcanzable) */
+static void sim_bfs(int src, int* dist, int* queue)
+{
+    for (int i = 0; i < n_routers; i++) {
+        dist[i] = -1;
+    }
+    int qh = 0, qt = 0;
+    dist[src] = 0;
+    queue[qt++] = src;
+    while (qh < qt) {
+        int u = queue[qh++];
+        struct sim_router* r = &routers[u];
+        for (int p = 0; p < r->n_ports; p++) {
+            struct sim_link* l = &links[r->links[p]];
+            if (!l->up) {
+                continue;
+            }
+            int v = (l->a == u) ? l->b : l->a;
+            if (dist[v] < 0) {
+                dist[v] = dist[u] + 1;
+                queue[qt++] = v;
+            }
+        }
+    }
+}
+
+/*
+Cuántas métricas (router, subred de enlace) no coinciden con lo esperado. Un enlace caído
+lo siguen anunciando sus dos extremos como conectado, así que la cuenta es igual para todos.
+*/
+static long sim_count_wrong(void)
+{
+    int* dist = malloc(n_routers * sizeof(int));
+    int* queue = malloc(n_routers * sizeof(int));
+    int* metric = malloc(n_links * sizeof(int));
+    if (!dist || !queue || !metric) {
+        perror("malloc");
+        exit(1);
+    }
+
+    long wrong = 0;
+    for (int r = 0; r < n_routers; r++) {
+        sim_bfs(r, dist, queue);
+
+        for (int l = 0; l < n_links; l++) {
+            metric[l] = SIM_INFINITY;
+        }
+        for (struct sr_rt* rt = routers[r].sr.routing_table; rt; rt = rt->next) {
+            uint32_t net = ntohl(rt->dest.s_addr);
+            if (!rt->valid || ntohl(rt->mask.s_addr) != 0xFFFFFFFCu || net < SIM_NET_BASE) {
+                continue;
+            }
+            uint32_t l = (net - SIM_NET_BASE) / 4;
+            if (l < (uint32_t)n_links && rt->metric < metric[l]) {
+                metric[l] = rt->metric;
+            }
+        }
+
+        for (int l = 0; l < n_links; l++) {
+            int da = dist[links[l].a], db = dist[links[l].b];
+            int d = (da < 0) ? db : (db < 0 ? da : (da < db ? da : db));
+            int expected = (d < 0 || d + 1 >= SIM_INFINITY) ? SIM_INFINITY : d + 1;
+            if (metric[l] != expected) {
+                wrong++;
+            }
+        }
+    }
+
+    free(dist);
+    free(queue);
+    free(metric);
+    return wrong;
+}
+
+/*
+Corre de a segundos hasta converger. Devuelve los milisegundos desde start_ms hasta el último
+cambio de tabla (0 si no hizo falta ninguno) o -1 si no llegó en limit_sec
+*/
+static long sim_converge(uint64_t start_ms, long limit_sec)
+{
+    for (long s = 1; s <= limit_sec; s++) {
+        sim_run_until(start_ms + (uint64_t)s * 1000);
+        /* Cada segundo se pollean todos: son los timers de RIP */
+        for (int i = 0; i < n_routers; i++) {
+            sr_rip_poll(&routers[i].sr);
+            sim_note_changes(&routers[i]);
+        }
+        if (sim_count_wrong() == 0) {
+            return sim_last_change_ms > start_ms ? (long)(sim_last_change_ms - start_ms) : 0;
+        }
+    }
+    return -1;
+}
+
+struct sim_totals {
+    unsigned long tx, rx, changes;
+    double cpu;
+};
+
+static void sim_snapshot_totals(struct sim_totals* t)
+{
+    memset(t, 0, sizeof(*t));
+    for (int i = 0; i < n_routers; i++) {
+        unsigned long rx, tx, changes;
+        double cpu;
+        if (sr_rip_get_stats(&routers[i].sr, &rx, &tx, &changes, &cpu) == 0) {
+            t->tx += tx;
+            t->rx += rx;
+            t->changes += changes;
+            t->cpu += cpu;
+        }
+    }
+}
+
+static void sim_report_phase(FILE* out, const char* what, long ms, const struct sim_totals* before)
+{
+    struct sim_totals after;
+    sim_snapshot_totals(&after);
+    if (ms < 0) {
+        fprintf(out, "%-28s NO convergió\n", what);
+    } else {
+        fprintf(out, "%-28s %9.3f s", what, ms / 1000.0);
+    }
+    fprintf(out, "  | msgs tx %lu rx %lu, cambios %lu, CPU %.3f ms\n",
+            after.tx - before->tx, after.rx - before->rx, after.changes - before->changes,
+            (after.cpu - before->cpu) * 1e3);
+}
+
+static void sim_report_routers(FILE* out, int per_router)
+{
+    unsigned long max_tx = 0, sum_tx = 0, sum_rx = 0;
+    double max_cpu = 0, sum_cpu = 0;
+    int max_tx_at = 0, max_cpu_at = 0;
+
+    if (per_router) {
+        fprintf(out, "\nrouter  ifs  msgs_tx  msgs_rx  cambios  rutas  CPU(ms)\n");
+    }
+    for (int i = 0; i < n_routers; i++) {
+        unsigned long rx = 0, tx = 0, changes = 0;
+        double cpu = 0;
+        sr_rip_get_stats(&routers[i].sr, &rx, &tx, &changes, &cpu);
+        int n_routes = 0;
+        for (struct sr_rt* rt = routers[i].sr.routing_table; rt; rt = rt->next) {
+            n_routes++;
+        }
+        if (per_router) {
+            fprintf(out, "%6d  %3d  %7lu  %7lu  %7lu  %5d  %7.3f\n",
+                    i, routers[i].n_ports, tx, rx, changes, n_routes, cpu * 1e3);
+        }
+        sum_tx += tx;
+        sum_rx += rx;
+        sum_cpu += cpu;
+        if (tx > max_tx) {
+            max_tx = tx;
+            max_tx_at = i;
+        }
+        if (cpu > max_cpu) {
+            max_cpu = cpu;
+            max_cpu_at = i;
+        }
+    }
+
+    fprintf(out, "\nmensajes: tx %lu (prom %.1f, máx %lu en r%d), rx %lu\n",
+            sum_tx, (double)sum_tx / n_routers, max_tx, max_tx_at, sum_rx);
+    fprintf(out, "CPU RIP: total %.3f ms (prom %.3f ms, máx %.3f ms en r%d)\n",
+            sum_cpu * 1e3, sum_cpu * 1e3 / n_routers, max_cpu * 1e3, max_cpu_at);
+    fprintf(out, "tramas: perdidas %lu, descartadas por enlace caído %lu\n",
+            frames_lost, frames_dropped_down);
+}
+
+int main(int argc, char** argv)
+{
+    const char* topo = "ring";
+    int n_failures = 1;
+    int per_router = 0;
+    int verbose = 0;
+    long limit_sec = 900;
+    unsigned int seed = 1;
+    n_routers = 16;
+
+    int c;
+    while ((c = getopt(argc, argv, "t:n:l:p:f:s:T:rv")) != -1) {
+        switch (c) {
+        case 't': topo = optarg; break;
+        case 'n': n_routers = atoi(optarg); break;
+        case 'l': latency_ms = (unsigned int)atoi(optarg); break;
+        case 'p': loss = atof(optarg); break;
+        case 'f': n_failures = atoi(optarg); break;
+        case 's': seed = (unsigned int)atoi(optarg); break;
+        case 'T': limit_sec = atol(optarg); break;
+        case 'r': per_router = 1; break;
+        case 'v': verbose = 1; break;
+        default:
+            fprintf(stderr, "Uso: %s [-t line|ring|mesh] [-n routers] [-l latencia_ms] [-p pérdida] "
+                            "[-f fallas] [-s semilla] [-T límite_seg] [-r] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n_routers < 2 || (strcmp(topo, "line") && strcmp(topo, "ring") && strcmp(topo, "mesh"))) {
+        fprintf(stderr, "Topología o cantidad de routers inválida\n");
+        return 1;
+    }
+
+    /* El reporte va por una copia de stdout; el router imprime demasiado y se tira */
+    FILE* out = fdopen(dup(STDOUT_FILENO), "w");
+    if (!out) {
+        perror("fdopen");
+        return 1;
+    }
+    if (!verbose && !freopen("/dev/null", "w", stdout)) {
+        perror("freopen");
+        return 1;
+    }
+
+    srand(seed);
+    routers = calloc(n_routers, sizeof(struct sim_router));
+    dirty_list = malloc(n_routers * sizeof(int));
+    if (!routers || !dirty_list) {
+        perror("calloc");
+        return 1;
+    }
+    sim_build_topology(topo);
+    sim_build_routers();
+    sr_rip_set_clock(sim_clock);
+
+    fprintf(out, "topología %s, %d routers, %d enlaces, latencia %u ms, pérdida %.3f, semilla %u\n",
+            topo, n_routers, n_links, latency_ms, loss, seed);
+    fprintf(out, "convergencia: último cambio de tabla, al ms; los timers de RIP van de a 1 s\n\n");
+
+    struct sim_totals before;
+    sim_snapshot_totals(&before);
+    /* El primer poll es el arranque de cada router */
+    for (int i = 0; i < n_routers; i++) {
+        sr_rip_poll(&routers[i].sr);
+        sim_note_changes(&routers[i]);
+    }
+    long ms = sim_converge(sim_now_ms, limit_sec);
+    sim_report_phase(out, "arranque", ms, &before);
+
+    for (int f = 0; f < n_failures && ms >= 0; f++) {
+        int l = rand() % n_links;
+        char what[64];
+
+        sim_snapshot_totals(&before);
+        links[l].up = 0;
+        ms = sim_converge(sim_now_ms, limit_sec);
+        snprintf(what, sizeof(what), "cae enlace %d (r%d-r%d)", l, links[l].a, links[l].b);
+        sim_report_phase(out, what, ms, &before);
+
+        sim_snapshot_totals(&before);
+        links[l].up = 1;
+        ms = sim_converge(sim_now_ms, limit_sec);
+        snprintf(what, sizeof(what), "vuelve enlace %d", l);
+        sim_report_phase(out, what, ms, &before);
+    }
+
+    sim_report_routers(out, per_router);
+    fclose(out);
+
+    for (int i = 0; i < n_routers; i++) {
+        sr_rip_destroy(&routers[i].sr);
+    }
+    return 0;
+}
@@ -0,0 +1,715 @@
+/**********************************************************************
+ * file:  sr_acl.c
+ *
+ * Descripción:
+ *
+ * ACLs de entrada y salida por interfaz (búsqueda por espacio de tuplas).
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_epoch.h"
+#include "sr_acl.h"
+
+/*
+ACLs de entrada y salida por interfaz. Las reglas se leen de ACL_RULES_PATH, una por línea:
+
+    <interfaz> <in|out> <permit|deny> <origen/len|any> <destino/len|any> <proto|any> <puertos origen> <puertos destino>
+
+donde el protocolo es "any", tcp, udp, icmp o un número de 0 a 255, y los puertos son "any",
+"n" o "desde-hasta" (solo cuentan para TCP y UDP). Las líneas vacías (o solo con espacios) y
+las que empiezan con # se saltean; sirven los archivos con fin de línea de Windows. Gana la
+primera regla que coincide, en el orden del archivo; si ninguna coincide se descarta (deny
+implícito). Una interfaz/dirección sin reglas deja pasar todo.
+
+El archivo se vuelve a leer cuando cambia (sr_acl_poll, desde el hilo de la caché ARP). Si
+la versión nueva tiene errores se sigue con la anterior.
+
+Las reglas se compilan fuera del camino de los paquetes en una búsqueda por espacio de tuplas:
+se agrupan por forma (largo de prefijo origen y destino, si nombran un protocolo, y de cada
+lado si el puerto es cualquiera, uno solo o un rango) y cada grupo es una tabla hash por
+(origen & máscara, destino & máscara) más el protocolo y los puertos sueltos si la forma los
+tiene. Los rangos no entran en el hash: las reglas con el mismo rango van a la misma tupla y
+el rango se mira una vez por tupla. Así miles de reglas con el mismo par de prefijos y
+distinto puerto caen en buckets distintos en vez de una sola cadena. Las tuplas con el mismo
+par de máscaras forman un grupo con un bitmap de los pares de direcciones que tienen reglas:
+clasificar un paquete es mirar un bit por grupo y una consulta de hash solo por las tuplas
+de los grupos donde el par está, cortando apenas ningún grupo que falta puede tener una
+regla de mayor prioridad.
+Una regla "any" con puertos vale para cualquier protocolo, pero los puertos solo se miran
+en TCP y UDP: se compila como dos, una para TCP/UDP con los puertos y otra sin puertos para
+el resto de los protocolos.
+El conjunto compilado se cambia de una con un puntero atómico y el viejo se libera con
+sr_epoch_retire, cuando ya no lo está mirando ningún hilo.
+*/
+#define ACL_ENABLED 1
+#define ACL_RULES_PATH "acl_rules.txt" /* Reglas de filtrado, ver sr_acl_load */
+
+/* Qué protocolos acepta una regla */
+#define ACL_PROTO_ANY 0      /* Cualquiera (y los puertos son any) */
+#define ACL_PROTO_ONE 1      /* Solo rule->proto */
+#define ACL_PROTO_PORTS 2    /* "any" con puertos: TCP o UDP */
+#define ACL_PROTO_NOPORTS 3  /* La copia sin puertos de la anterior: todo menos TCP y UDP */
+
+/* Cómo entra cada puerto en la forma de la tupla */
+#define ACL_PORTS_ANY 0
+#define ACL_PORTS_ONE 1      /* Un puerto solo: va en el hash */
+#define ACL_PORTS_RANGE 2    /* Un rango: es parte de la forma */
+
+struct sr_acl_rule {
+    uint32_t prio;          /* Línea del archivo: menor es más prioritaria */
+    uint32_t src, src_mask; /* En orden de red, ya enmascarados */
+    uint32_t dst, dst_mask;
+    uint8_t proto;          /* 0 = cualquiera */
+    uint8_t proto_class;    /* ACL_PROTO_* */
+    uint8_t permit;
+    uint16_t sport_lo, sport_hi;
+    uint16_t dport_lo, dport_hi;
+    struct sr_acl_rule *next; /* Siguiente en el mismo bucket, por prioridad */
+};
+
+struct sr_acl_tuple {
+    uint32_t src_mask, dst_mask;
+    uint8_t by_proto;            /* El hash incluye el protocolo (reglas ACL_PROTO_ONE) */
+    uint8_t sport_kind, dport_kind;
+    uint8_t proto_mask;          /* 0xFF si by_proto, si no 0: para armar el hash sin ifs */
+    uint32_t port_mask;          /* Bits de (sport << 16 | dport) que entran en el hash */
+    uint16_t sport_lo, sport_hi; /* El rango de todas sus reglas, si es ACL_PORTS_RANGE */
+    uint16_t dport_lo, dport_hi;
+    uint64_t protos;             /* Bit (proto % 64) de lo que acepta alguna regla: si no está, ni se busca */
+    unsigned int group;          /* Índice en list->groups */
+    uint32_t min_prio;
+    unsigned int n_buckets; /* Potencia de 2 */
+    struct sr_acl_rule **buckets;
+};
+
+/*
+Las tuplas con el mismo par de máscaras: comparten el hash de las direcciones y un bitmap de
+los pares (origen, destino) que tienen reglas, así si el par del paquete no está se saltean
+todas las variantes de protocolo y puertos de una vez.
+*/
+struct sr_acl_group {
+    uint32_t src_mask, dst_mask;
+    uint32_t min_prio;
+    unsigned int first, n;   /* Sus tuplas en list->tuples, ordenadas por min_prio */
+    uint32_t bits_mask;      /* Cantidad de bits - 1 (potencia de 2) */
+    uint64_t *bits;
+};
+
+struct sr_acl_list {
+    char ifname[sr_IFACE_NAMELEN];
+    int dir;
+    unsigned int n_tuples;
+    struct sr_acl_tuple *tuples; /* Agrupadas por grupo */
+    unsigned int n_groups;
+    struct sr_acl_group *groups; /* Ordenados por min_prio */
+};
+
+struct sr_acl_set {
+    unsigned int n_lists;
+    struct sr_acl_list *lists;
+    unsigned int n_rules;
+    struct sr_acl_rule *rules;
+};
+
+static struct sr_acl_set *acl_active = NULL;
+static unsigned long acl_denied = 0;
+
+/* Solo TCP y UDP tienen puertos para las ACLs */
+static int sr_acl_has_ports(uint8_t proto)
+{
+    return proto == 6 || proto == ip_protocol_udp;
+}
+
+static uint8_t sr_acl_port_kind(uint16_t lo, uint16_t hi)
+{
+    if (lo == 0 && hi == 0xFFFF) {
+        return ACL_PORTS_ANY;
+    }
+    return lo == hi ? ACL_PORTS_ONE : ACL_PORTS_RANGE;
+}
+
+/* La forma de la tupla donde va la regla (sin min_prio ni buckets) */
+static void sr_acl_rule_shape(const struct sr_acl_rule *r, struct sr_acl_tuple *shape)
+{
+    shape->src_mask = r->src_mask;
+    shape->dst_mask = r->dst_mask;
+    shape->by_proto = (r->proto_class == ACL_PROTO_ONE);
+    shape->sport_kind = sr_acl_port_kind(r->sport_lo, r->sport_hi);
+    shape->dport_kind = sr_acl_port_kind(r->dport_lo, r->dport_hi);
+    shape->proto_mask = shape->by_proto ? 0xFF : 0;
+    shape->port_mask = (shape->sport_kind == ACL_PORTS_ONE ? 0xFFFF0000u : 0)
+                       | (shape->dport_kind == ACL_PORTS_ONE ? 0x0000FFFFu : 0);
+    shape->sport_lo = r->sport_lo;
+    shape->sport_hi = r->sport_hi;
+    shape->dport_lo = r->dport_lo;
+    shape->dport_hi = r->dport_hi;
+}
+
+static int sr_acl_same_shape(const struct sr_acl_tuple *a, const struct sr_acl_tuple *b)
+{
+    return a->src_mask == b->src_mask && a->dst_mask == b->dst_mask && a->by_proto == b->by_proto
+           && a->sport_kind == b->sport_kind && a->dport_kind == b->dport_kind
+           && (a->sport_kind != ACL_PORTS_RANGE || (a->sport_lo == b->sport_lo && a->sport_hi == b->sport_hi))
+           && (a->dport_kind != ACL_PORTS_RANGE || (a->dport_lo == b->dport_lo && a->dport_hi == b->dport_hi));
+}
+
+/* Hash del par de direcciones (ya enmascaradas), sin mezclar: lo terminan las dos de abajo */
+static uint32_t sr_acl_addr_hash(uint32_t src, uint32_t dst)
+{
+    return src * 0x9E3779B1u ^ dst * 0x85EBCA6Bu;
+}
+
+/* Bit del par en el bitmap del grupo */
+static uint32_t sr_acl_group_bit(const struct sr_acl_group *group, uint32_t h)
+{
+    return (h ^ (h >> 15)) & group->bits_mask;
+}
+
+/* Bucket en la tupla: el par más lo que la forma de la tupla tiene fijo */
+static unsigned int sr_acl_hash(const struct sr_acl_tuple *tuple, uint32_t h, uint8_t proto,
+                                uint16_t sport, uint16_t dport)
+{
+    uint32_t ports = ((uint32_t)sport << 16 | dport) & tuple->port_mask;
+    h ^= ports * 0xC2B2AE35u ^ (proto & tuple->proto_mask);
+    return (h ^ (h >> 15)) & (tuple->n_buckets - 1);
+}
+
+/* Marca en protos (bit proto % 64) los protocolos que acepta la regla */
+static uint64_t sr_acl_rule_protos(const struct sr_acl_rule *r)
+{
+    uint64_t protos = 0;
+    for (unsigned int p = 0; p < 256; p++) {
+        int ok = (r->proto_class == ACL_PROTO_ANY)
+                 || (r->proto_class == ACL_PROTO_ONE && p == r->proto)
+                 || (r->proto_class == ACL_PROTO_PORTS && sr_acl_has_ports(p))
+                 || (r->proto_class == ACL_PROTO_NOPORTS && !sr_acl_has_ports(p));
+        if (ok) {
+            protos |= 1ull << (p & 63);
+        }
+    }
+    return protos;
+}
+
+static int sr_acl_tuple_cmp(const void *a, const void *b)
+{
+    const struct sr_acl_tuple *x = (const struct sr_acl_tuple *)a;
+    const struct sr_acl_tuple *y = (const struct sr_acl_tuple *)b;
+    if (x->group != y->group) {
+        return x->group > y->group ? 1 : -1;
+    }
+    return (x->min_prio > y->min_prio) - (x->min_prio < y->min_prio);
+}
+
+static void sr_acl_free(void *arg)
+{
+    struct sr_acl_set *set = (struct sr_acl_set *)arg;
+    if (!set) {
+        return;
+    }
+    for (unsigned int i = 0; i < set->n_lists; i++) {
+        for (unsigned int t = 0; t < set->lists[i].n_tuples; t++) {
+            free(set->lists[i].tuples[t].buckets);
+        }
+        free(set->lists[i].tuples);
+        for (unsigned int g = 0; g < set->lists[i].n_groups; g++) {
+            free(set->lists[i].groups[g].bits);
+        }
+        free(set->lists[i].groups);
+    }
+    free(set->lists);
+    free(set->rules);
+    free(set);
+}
+
+static int sr_acl_parse_prefix(const char *str, uint32_t *addr, uint32_t *mask)
+{
+    char ip[32];
+    unsigned int len;
+
+    if (strcmp(str, "any") == 0) {
+        *addr = 0;
+        *mask = 0;
+        return 0;
+    }
+    if (sscanf(str, "%31[0-9.]/%u", ip, &len) != 2 || len > 32) {
+        return -1;
+    }
+    struct in_addr in;
+    if (inet_aton(ip, &in) == 0) {
+        return -1;
+    }
+    *mask = len ? htonl(0xFFFFFFFFu << (32 - len)) : 0;
+    *addr = in.s_addr & *mask;
+    return 0;
+}
+
+/* "any" (0), un nombre conocido o un número de 0 a 255. -1 si no es nada de eso */
+static int sr_acl_parse_proto(const char *str, uint8_t *proto)
+{
+    if (strcmp(str, "any") == 0) {
+        *proto = 0;
+    } else if (strcmp(str, "tcp") == 0) {
+        *proto = 6;
+    } else if (strcmp(str, "udp") == 0) {
+        *proto = ip_protocol_udp;
+    } else if (strcmp(str, "icmp") == 0) {
+        *proto = ip_protocol_icmp;
+    } else {
+        char *end;
+        unsigned long n = strtoul(str, &end, 10);
+        if (end == str || *end != '\0' || n > 255) {
+            return -1;
+        }
+        *proto = (uint8_t)n;
+    }
+    return 0;
+}
+
+static int sr_acl_parse_ports(const char *str, uint16_t *lo, uint16_t *hi)
+{
+    unsigned int a, b;
+
+    if (strcmp(str, "any") == 0) {
+        *lo = 0;
+        *hi = 0xFFFF;
+        return 0;
+    }
+    if (sscanf(str, "%u-%u", &a, &b) == 2 && a <= b && b <= 0xFFFF) {
+        *lo = a;
+        *hi = b;
+        return 0;
+    }
+    if (sscanf(str, "%u", &a) == 1 && a <= 0xFFFF) {
+        *lo = a;
+        *hi = a;
+        return 0;
+    }
+    return -1;
+}
+
+/* La tupla de la lista con la forma de r, o NULL */
+static struct sr_acl_tuple *sr_acl_find_tuple(struct sr_acl_list *list, const struct sr_acl_rule *r)
+{
+    struct sr_acl_tuple shape;
+    sr_acl_rule_shape(r, &shape);
+    for (unsigned int t = 0; t < list->n_tuples; t++) {
+        if (sr_acl_same_shape(&list->tuples[t], &shape)) {
+            return &list->tuples[t];
+        }
+    }
+    return NULL;
+}
+
+/* Agrupa las reglas de una lista (interfaz, dirección) por forma de tupla */
+static int sr_acl_compile_list(struct sr_acl_list *list, struct sr_acl_rule **rules, unsigned int n)
+{
+    /* Como mucho una tupla por regla; en la práctica son pocas */
+    list->tuples = (struct sr_acl_tuple *)calloc(n, sizeof(struct sr_acl_tuple));
+    if (!list->tuples) {
+        return -1;
+    }
+
+    /* n_buckets cuenta las reglas hasta que se piden los buckets */
+    for (unsigned int i = 0; i < n; i++) {
+        struct sr_acl_tuple *tuple = sr_acl_find_tuple(list, rules[i]);
+        if (!tuple) {
+            tuple = &list->tuples[list->n_tuples++];
+            sr_acl_rule_shape(rules[i], tuple);
+            tuple->min_prio = rules[i]->prio;
+        }
+        if (rules[i]->prio < tuple->min_prio) {
+            tuple->min_prio = rules[i]->prio;
+        }
+        tuple->protos |= sr_acl_rule_protos(rules[i]);
+        tuple->n_buckets++;
+    }
+    /* Las copias sin puertos vienen al final, así que se ordena acá y no por el orden de
+    llegada: primero por min_prio para numerar los grupos en ese orden, después por grupo */
+    qsort(list->tuples, list->n_tuples, sizeof(struct sr_acl_tuple), sr_acl_tuple_cmp);
+    list->groups = (struct sr_acl_group *)calloc(list->n_tuples, sizeof(struct sr_acl_group));
+    if (!list->groups) {
+        return -1;
+    }
+    for (unsigned int t = 0; t < list->n_tuples; t++) {
+        struct sr_acl_tuple *tuple = &list->tuples[t];
+        unsigned int g;
+        for (g = 0; g < list->n_groups; g++) {
+            if (list->groups[g].src_mask == tuple->src_mask && list->groups[g].dst_mask == tuple->dst_mask) {
+                break;
+            }
+        }
+        if (g == list->n_groups) {
+            list->groups[g].src_mask = tuple->src_mask;
+            list->groups[g].dst_mask = tuple->dst_mask;
+            list->groups[g].min_prio = tuple->min_prio;
+            list->n_groups++;
+        }
+        tuple->group = g;
+        list->groups[g].n++;
+        list->groups[g].bits_mask += tuple->n_buckets; /* Reglas del grupo, por ahora */
+    }
+    qsort(list->tuples, list->n_tuples, sizeof(struct sr_acl_tuple), sr_acl_tuple_cmp);
+    for (unsigned int g = 0, first = 0; g < list->n_groups; g++) {
+        struct sr_acl_group *group = &list->groups[g];
+        unsigned int n_bits = 64;
+        while (n_bits < 8 * group->bits_mask) {
+            n_bits <<= 1;
+        }
+        group->first = first;
+        first += group->n;
+        group->bits_mask = n_bits - 1;
+        group->bits = (uint64_t *)calloc(n_bits / 64, sizeof(uint64_t));
+        if (!group->bits) {
+            return -1;
+        }
+    }
+
+    for (unsigned int t = 0; t < list->n_tuples; t++) {
+        unsigned int n_buckets = 1;
+        while (n_buckets < 2 * list->tuples[t].n_buckets) {
+            n_buckets <<= 1;
+        }
+        list->tuples[t].n_buckets = n_buckets;
+        list->tuples[t].buckets = (struct sr_acl_rule **)calloc(n_buckets, sizeof(struct sr_acl_rule *));
+        if (!list->tuples[t].buckets) {
+            return -1;
+        }
+    }
+
+    /* Cada bucket queda ordenado por prioridad */
+    for (unsigned int i = 0; i < n; i++) {
+        struct sr_acl_rule *r = rules[i];
+        struct sr_acl_tuple *tuple = sr_acl_find_tuple(list, r);
+        struct sr_acl_group *group = &list->groups[tuple->group];
+        uint32_t h = sr_acl_addr_hash(r->src, r->dst);
+        uint32_t bit = sr_acl_group_bit(group, h);
+        group->bits[bit / 64] |= 1ull << (bit % 64);
+        struct sr_acl_rule **link = &tuple->buckets[sr_acl_hash(tuple, h, r->proto, r->sport_lo, r->dport_lo)];
+        while (*link && (*link)->prio <= r->prio) {
+            link = &(*link)->next;
+        }
+        r->next = *link;
+        *link = r;
+    }
+    return 0;
+}
+
+/* Completa proto_class. En un protocolo sin puertos los puertos de la regla no cuentan */
+static void sr_acl_rule_classify(struct sr_acl_rule *r)
+{
+    if (r->proto != 0) {
+        r->proto_class = ACL_PROTO_ONE;
+        if (!sr_acl_has_ports(r->proto)) {
+            r->sport_lo = r->dport_lo = 0;
+            r->sport_hi = r->dport_hi = 0xFFFF;
+        }
+    } else if (r->sport_lo == 0 && r->sport_hi == 0xFFFF && r->dport_lo == 0 && r->dport_hi == 0xFFFF) {
+        r->proto_class = ACL_PROTO_ANY;
+    } else {
+        r->proto_class = ACL_PROTO_PORTS;
+    }
+}
+
+/* Hace lugar para una regla más en set->rules y en los arreglos paralelos */
+static int sr_acl_reserve(struct sr_acl_set *set, char (**ifnames)[sr_IFACE_NAMELEN], int **dirs,
+                          unsigned int *capacity)
+{
+    if (set->n_rules < *capacity) {
+        return 0;
+    }
+    *capacity = *capacity ? *capacity * 2 : 64;
+    struct sr_acl_rule *rules = realloc(set->rules, *capacity * sizeof(struct sr_acl_rule));
+    char (*names)[sr_IFACE_NAMELEN] = realloc(*ifnames, *capacity * sizeof(**ifnames));
+    int *dirs2 = realloc(*dirs, *capacity * sizeof(int));
+    if (rules) set->rules = rules;
+    if (names) *ifnames = names;
+    if (dirs2) *dirs = dirs2;
+    return (rules && names && dirs2) ? 0 : -1;
+}
+
+/*
+Lee y compila las reglas y, si todo salió bien, las pone en uso. Si el archivo no existe
+no hay ACLs. Devuelve la cantidad de reglas cargadas o -1 si hubo error (y queda el conjunto anterior).
+*/
+int sr_acl_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+
+    struct sr_acl_set *set = (struct sr_acl_set *)calloc(1, sizeof(struct sr_acl_set));
+    char (*ifnames)[sr_IFACE_NAMELEN] = NULL;
+    int *dirs = NULL;
+    unsigned int capacity = 0;
+    char line[256];
+    unsigned int line_no = 0;
+    int error = (set == NULL);
+
+    /* 1 Leer las reglas */
+    while (!error && fgets(line, sizeof(line), f))
+    {
+        char ifname[sr_IFACE_NAMELEN], dir[8], action[8], src[40], dst[40], proto[8], sports[16], dports[16];
+        line_no++;
+        const char *p = line + strspn(line, " \t\r\n");
+        if (*p == '#' || *p == '\0') {
+            continue;
+        }
+        if (sscanf(p, "%31s %7s %7s %39s %39s %7s %15s %15s",
+                   ifname, dir, action, src, dst, proto, sports, dports) != 8) {
+            printf("ACL: Línea %u mal formada.\n", line_no);
+            error = 1;
+            break;
+        }
+
+        if (sr_acl_reserve(set, &ifnames, &dirs, &capacity) < 0) {
+            error = 1;
+            break;
+        }
+
+        struct sr_acl_rule *r = &set->rules[set->n_rules];
+        memset(r, 0, sizeof(*r));
+        r->prio = line_no;
+        r->permit = (strcmp(action, "permit") == 0);
+        if ((!r->permit && strcmp(action, "deny") != 0)
+            || sr_acl_parse_proto(proto, &r->proto) < 0
+            || (strcmp(dir, "in") != 0 && strcmp(dir, "out") != 0)
+            || sr_acl_parse_prefix(src, &r->src, &r->src_mask) < 0
+            || sr_acl_parse_prefix(dst, &r->dst, &r->dst_mask) < 0
+            || sr_acl_parse_ports(sports, &r->sport_lo, &r->sport_hi) < 0
+            || sr_acl_parse_ports(dports, &r->dport_lo, &r->dport_hi) < 0) {
+            printf("ACL: Línea %u inválida.\n", line_no);
+            error = 1;
+            break;
+        }
+        sr_acl_rule_classify(r);
+        strncpy(ifnames[set->n_rules], ifname, sr_IFACE_NAMELEN);
+        dirs[set->n_rules] = (strcmp(dir, "in") == 0) ? ACL_DIR_IN : ACL_DIR_OUT;
+        set->n_rules++;
+    }
+    fclose(f);
+
+    /* Las "any" con puertos llevan una copia sin puertos para los protocolos que no tienen */
+    unsigned int n_loaded = error ? 0 : set->n_rules;
+    for (unsigned int i = 0; !error && i < n_loaded; i++) {
+        if (set->rules[i].proto_class != ACL_PROTO_PORTS) {
+            continue;
+        }
+        if (sr_acl_reserve(set, &ifnames, &dirs, &capacity) < 0) {
+            error = 1;
+            break;
+        }
+        struct sr_acl_rule *copy = &set->rules[set->n_rules];
+        *copy = set->rules[i];
+        copy->proto_class = ACL_PROTO_NOPORTS;
+        copy->sport_lo = copy->dport_lo = 0;
+        copy->sport_hi = copy->dport_hi = 0xFFFF;
+        memcpy(ifnames[set->n_rules], ifnames[i], sr_IFACE_NAMELEN);
+        dirs[set->n_rules] = dirs[i];
+        set->n_rules++;
+    }
+
+    /* 2 Separar por (interfaz, dirección) y compilar cada lista */
+    struct sr_acl_rule **group = NULL;
+    if (!error && set->n_rules > 0) {
+        set->lists = (struct sr_acl_list *)calloc(set->n_rules, sizeof(struct sr_acl_list));
+        group = (struct sr_acl_rule **)malloc(set->n_rules * sizeof(struct sr_acl_rule *));
+        error = (!set->lists || !group);
+    }
+    for (unsigned int i = 0; !error && i < set->n_rules; i++)
+    {
+        unsigned int l;
+        for (l = 0; l < set->n_lists; l++) {
+            if (set->lists[l].dir == dirs[i] && strcmp(set->lists[l].ifname, ifnames[i]) == 0) {
+                break;
+            }
+        }
+        if (l < set->n_lists) {
+            continue; /* Esa lista ya se compiló */
+        }
+
+        struct sr_acl_list *list = &set->lists[set->n_lists++];
+        strncpy(list->ifname, ifnames[i], sr_IFACE_NAMELEN);
+        list->dir = dirs[i];
+
+        unsigned int n = 0;
+        for (unsigned int j = i; j < set->n_rules; j++) {
+            if (dirs[j] == dirs[i] && strcmp(ifnames[j], ifnames[i]) == 0) {
+                group[n++] = &set->rules[j];
+            }
+        }
+        error = (sr_acl_compile_list(list, group, n) < 0);
+    }
+    free(group);
+    free(ifnames);
+    free(dirs);
+
+    if (error) {
+        printf("ACL: No se cargaron las reglas de %s, quedan las anteriores.\n", path);
+        sr_acl_free(set);
+        return -1;
+    }
+
+    /* 3 Cambiar el conjunto en uso */
+    struct sr_acl_set *old = __atomic_exchange_n(&acl_active, set, __ATOMIC_ACQ_REL);
+    sr_epoch_retire(old, sr_acl_free);
+
+    printf("ACL: Cargadas %u reglas en %u listas desde %s.\n", n_loaded, set->n_lists, path);
+    return n_loaded;
+}
+
+/*
+Si ACL_RULES_PATH cambió desde la última vez, lo vuelve a cargar; si se borró, saca las ACLs.
+La llama una vez por segundo el hilo de la caché ARP.
+*/
+void sr_acl_poll(void)
+{
+    static struct timespec conf_mtime = {0, 0};
+    struct stat st;
+    if (stat(ACL_RULES_PATH, &st) != 0) {
+        if (conf_mtime.tv_sec != 0 || conf_mtime.tv_nsec != 0) {
+            conf_mtime.tv_sec = 0;
+            conf_mtime.tv_nsec = 0;
+            sr_epoch_retire(__atomic_exchange_n(&acl_active, NULL, __ATOMIC_ACQ_REL), sr_acl_free);
+            printf("ACL: %s ya no está, se sacan las reglas.\n", ACL_RULES_PATH);
+        }
+        return;
+    }
+    if (st.st_mtim.tv_sec == conf_mtime.tv_sec && st.st_mtim.tv_nsec == conf_mtime.tv_nsec) {
+        return;
+    }
+    conf_mtime = st.st_mtim;
+    sr_acl_load(ACL_RULES_PATH);
+}
+
+static int sr_acl_match(const char *ifname, int dir, const struct sr_flow_key *k);
+
+/* Devuelve 1 si el paquete pasa la ACL de (interfaz, dirección) */
+int sr_acl_permit(const char *ifname, int dir, const struct sr_flow_key *k)
+{
+    if (!ACL_ENABLED) {
+        return 1;
+    }
+    sr_epoch_enter();
+    int permit = sr_acl_match(ifname, dir, k);
+    sr_epoch_exit();
+    if (!permit) {
+        __atomic_add_fetch(&acl_denied, 1, __ATOMIC_RELAXED);
+    }
+    return permit;
+}
+
+/* Lo mismo con la clave suelta (direcciones en orden de red, puertos en orden de host). Para el benchmark */
+int sr_acl_classify(const char *ifname, int dir, uint32_t src, uint32_t dst, uint8_t proto,
+                    uint16_t sport, uint16_t dport)
+{
+    struct sr_flow_key k;
+    k.src = src;
+    k.dst = dst;
+    k.proto = proto;
+    k.sport = sport;
+    k.dport = dport;
+    return sr_acl_permit(ifname, dir, &k);
+}
+
+static int sr_acl_match(const char *ifname, int dir, const struct sr_flow_key *k)
+{
+    struct sr_acl_set *set = __atomic_load_n(&acl_active, __ATOMIC_ACQUIRE);
+    if (!set) {
+        return 1;
+    }
+
+    struct sr_acl_list *list = NULL;
+    for (unsigned int l = 0; l < set->n_lists; l++) {
+        if (set->lists[l].dir == dir && strcmp(set->lists[l].ifname, ifname) == 0) {
+            list = &set->lists[l];
+            break;
+        }
+    }
+    if (!list) {
+        return 1;
+    }
+
+    const struct sr_acl_rule *best = NULL;
+    int ports = sr_acl_has_ports(k->proto);
+    for (unsigned int g = 0; g < list->n_groups; g++)
+    {
+        const struct sr_acl_group *group = &list->groups[g];
+        /* Ninguna regla de los grupos que faltan puede ganarle a la que ya tenemos */
+        if (best && group->min_prio > best->prio) {
+            break;
+        }
+        uint32_t src = k->src & group->src_mask;
+        uint32_t dst = k->dst & group->dst_mask;
+        uint32_t h = sr_acl_addr_hash(src, dst);
+        uint32_t bit = sr_acl_group_bit(group, h);
+        if (!(group->bits[bit / 64] & (1ull << (bit % 64)))) {
+            continue;
+        }
+
+        for (unsigned int t = group->first; t < group->first + group->n; t++)
+        {
+            const struct sr_acl_tuple *tuple = &list->tuples[t];
+            if (best && tuple->min_prio > best->prio) {
+                break;
+            }
+            if (!(tuple->protos & (1ull << (k->proto & 63)))) {
+                continue;
+            }
+            /* Sin puertos solo sirven las tuplas que no piden puertos; con rango se mira acá */
+            if (tuple->sport_kind != ACL_PORTS_ANY || tuple->dport_kind != ACL_PORTS_ANY) {
+                if (!ports
+                    || (tuple->sport_kind == ACL_PORTS_RANGE && (k->sport < tuple->sport_lo || k->sport > tuple->sport_hi))
+                    || (tuple->dport_kind == ACL_PORTS_RANGE && (k->dport < tuple->dport_lo || k->dport > tuple->dport_hi))) {
+                    continue;
+                }
+            }
+
+            for (const struct sr_acl_rule *r = tuple->buckets[sr_acl_hash(tuple, h, k->proto, k->sport, k->dport)];
+                 r; r = r->next) {
+                if (best && r->prio > best->prio) {
+                    break;
+                }
+                if (r->src != src || r->dst != dst) {
+                    continue;
+                }
+                switch (r->proto_class) {
+                case ACL_PROTO_ONE:
+                    if (r->proto != k->proto) {
+                        continue;
+                    }
+                    break;
+                case ACL_PROTO_PORTS:
+                    if (!ports) {
+                        continue;
+                    }
+                    break;
+                case ACL_PROTO_NOPORTS:
+                    if (ports) {
+                        continue;
+                    }
+                    break;
+                }
+                if (!ports
+                    || (k->sport >= r->sport_lo && k->sport <= r->sport_hi
+                        && k->dport >= r->dport_lo && k->dport <= r->dport_hi)) {
+                    best = r;
+                    break;
+                }
+            }
+        }
+    }
+
+    return best && best->permit;
+}
+
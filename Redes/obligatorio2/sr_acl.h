@@ -0,0 +1,19 @@
+/*
+ACLs de entrada y salida por interfaz (ver sr_acl.c).
+*/
+#ifndef SR_ACL_H
+#define SR_ACL_H
+
+#include <stdint.h>
+#include "sr_flow.h"
+
+#define ACL_DIR_IN 0
+#define ACL_DIR_OUT 1
+
+int sr_acl_load(const char *path);
+void sr_acl_poll(void);
+int sr_acl_permit(const char *ifname, int dir, const struct sr_flow_key *k);
+int sr_acl_classify(const char *ifname, int dir, uint32_t src, uint32_t dst, uint8_t proto,
+                    uint16_t sport, uint16_t dport);
+
+#endif /* SR_ACL_H */
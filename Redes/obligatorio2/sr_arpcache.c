@@ -12,13 +12,78 @@
 #include "sr_rt.h"
 #include "sr_protocol.h"
 #include "sr_utils.h"
+#include "sr_fwd.h"
+#include "sr_epoch.h"
+#include "sr_flow.h"
+#include "sr_acl.h"
+#include "sr_ct.h"
+#include "sr_tap.h"
+#include "sr_io.h"
 
+/*
+Los paquetes de la cola guardan una referencia al buffer en vez de una copia propia. El
+sr_packet va primero para que la lista siga siendo de struct sr_packet (buf apunta a los datos
+del buffer) y con sr_arpcache_packet_buf se recupera el buffer para mandarlo sin copiar.
+*/
+struct sr_queued_packet {
+    struct sr_packet pkt;
+    struct sr_pktbuf *pb;
+};
+
+struct sr_pktbuf *sr_arpcache_packet_buf(struct sr_packet *pkt)
+{
+    return ((struct sr_queued_packet *)pkt)->pb;
+}
+
+/*
+Refresco proactivo: a las entradas que se usaron hace poco se les manda un ARP request
+unicast (un probe a la MAC que ya conocemos) un poco antes de que venzan. Si el vecino
+contesta, sr_arpcache_insert renueva la entrada y el tráfico hacia él nunca pierde la MAC.
+Los tiempos de uso y del último probe van en tablas paralelas a cache->entries, una por caché
+(cada sr_instance tiene la suya, rip_sim arma varios routers en el mismo proceso). No entran
+en struct sr_arpcache porque viene del enunciado, así que cuelgan de una lista que arma
+sr_arpcache_init. Las de una caché destruida no se liberan, quedan para la próxima que se
+inicialice: así se recorre la lista sin lock.
+*/
+#define ARP_REFRESH_ENABLED 1
+#define ARP_REFRESH_BEFORE_SEC 3      /* Se empieza a probar cuando falta esto para vencer */
+#define ARP_REFRESH_HIT_WINDOW_SEC 5  /* Solo si la entrada se usó en este último tiempo */
+
+struct sr_arp_refresh {
+    struct sr_arpcache *cache;    /* NULL = libre */
+    time_t last_hit[SR_ARPCACHE_SZ];
+    time_t last_probe[SR_ARPCACHE_SZ];
+    struct sr_arp_refresh *next;
+};
+
+static struct sr_arp_refresh *arp_refresh_list = NULL;
+static pthread_mutex_t arp_refresh_lock = PTHREAD_MUTEX_INITIALIZER; /* Entre init y destroy */
+
+/* Las tablas de cache, o NULL si no pasó por sr_arpcache_init */
+static struct sr_arp_refresh *sr_arp_refresh_of(struct sr_arpcache *cache)
+{
+    struct sr_arp_refresh *r = __atomic_load_n(&arp_refresh_list, __ATOMIC_ACQUIRE);
+    while (r && __atomic_load_n(&r->cache, __ATOMIC_ACQUIRE) != cache) {
+        r = r->next;
+    }
+    return r;
+}
+
+static int sr_arp_request_send_to(struct sr_instance *sr, uint32_t ip, const unsigned char *mac);
 
-struct sr_rt *sr_lpm_lookup(struct sr_instance *sr, uint32_t dest_ip);
 /*
 	Envía una solicitud ARP.
 */
 void sr_arp_request_send(struct sr_instance *sr, uint32_t ip) {
+  sr_arp_request_send_to(sr, ip, NULL);
+}
+
+/*
+	Envía una solicitud ARP a broadcast o, si mac no es NULL, unicast a esa MAC (probe de refresco).
+	Devuelve -1 solo si la cola de salida no la aceptó; sin ruta o sin memoria cuenta como
+	enviada, para que los reintentos se terminen y salga el host unreachable.
+*/
+static int sr_arp_request_send_to(struct sr_instance *sr, uint32_t ip, const unsigned char *mac) {
 
 
   printf("$$$ -> Send ARP request.\n");
@@ -39,7 +104,7 @@ void sr_arp_request_send(struct sr_instance *sr, uint32_t ip) {
   if (!rt_entry) {
         printf("ERROR ARP Request: No se encontró ruta para la IP %s. No se puede enviar ARP Request.\n", 
                 inet_ntoa( (struct in_addr){.s_addr = ip} ));
-        return;
+        return 0;
   }
 
   /*obtener interfaz*/
@@ -47,7 +112,7 @@ void sr_arp_request_send(struct sr_instance *sr, uint32_t ip) {
     if (!iface_out) {
         // no deberia pasar
         fprintf(stderr, "ERROR ARP Request: Interfaz de salida '%s' no encontrada.\n", rt_entry->interface);
-        return;
+        return 0;
     }
 
   /*crear el encabezado ethernet*/
@@ -56,16 +121,16 @@ void sr_arp_request_send(struct sr_instance *sr, uint32_t ip) {
   
   if (!pkt_request) {
         fprintf(stderr, "Error: Fallo al asignar memoria para ARP Request.\n");
-        return;
+        return 0;
     }
   memset(pkt_request, 0, tam_request);
 
   sr_ethernet_hdr_t *eth_req = (sr_ethernet_hdr_t *)pkt_request;
   sr_arp_hdr_t *arp_req = (sr_arp_hdr_t *)(pkt_request + sizeof(sr_ethernet_hdr_t));
   
-  /*MAC destino (broadcast)*/
+  /*MAC destino (broadcast, o la conocida si es un probe)*/
   uint8_t mac_broadcast[ETHER_ADDR_LEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-  memcpy(eth_req->ether_dhost, mac_broadcast, ETHER_ADDR_LEN);
+  memcpy(eth_req->ether_dhost, mac ? mac : mac_broadcast, ETHER_ADDR_LEN);
 
   /*MAC origen*/
   memcpy(eth_req->ether_shost, iface_out->addr, ETHER_ADDR_LEN);
@@ -85,9 +150,9 @@ void sr_arp_request_send(struct sr_instance *sr, uint32_t ip) {
   memcpy(arp_req->ar_sha, iface_out->addr, ETHER_ADDR_LEN);
   arp_req->ar_sip = iface_out->ip;
 
-  /*MAC destino. 0 porque es desconocida*/
+  /*MAC destino. 0 porque es desconocida (en el probe va la que tenemos)*/
   uint8_t mac_unknown[ETHER_ADDR_LEN] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-  memcpy(arp_req->ar_tha, mac_unknown, ETHER_ADDR_LEN);
+  memcpy(arp_req->ar_tha, mac ? mac : mac_unknown, ETHER_ADDR_LEN);
   
   /*IP de la Mac que se busca*/
   arp_req->ar_tip = ip;
@@ -96,11 +161,12 @@ void sr_arp_request_send(struct sr_instance *sr, uint32_t ip) {
   printf("Enviando ARP Request por %s para resolver %s\n", 
       iface_out->name, 
       inet_ntoa( (struct in_addr){.s_addr = ip} ));       
-  sr_send_packet(sr, pkt_request, tam_request, iface_out->name);
+  int ret = sr_io_send_ctl(sr, pkt_request, tam_request, iface_out->name);
 
   free(pkt_request);
 
   printf("$$$ -> Send ARP request processing complete.\n");
+  return ret;
 }
 
 /*
@@ -136,11 +202,15 @@ void handle_arpreq(struct sr_instance *sr, struct sr_arpreq *req) {
         //Reenvias solicitud ARP, como todavía son menos de 5
         Debug("--> Reenviando ARP para %s (intento %d).\n", inet_ntoa( (struct in_addr){.s_addr = req->ip} ), req->times_sent + 1);
         
-        sr_arp_request_send(sr, req->ip);
+        /* Si la cola de salida no lo aceptó no cuenta como intento: se prueba de nuevo en un
+        segundo, así una ráfaga de tráfico no agota los 5 intentos sin que salga ninguno */
+        int ok = sr_arp_request_send_to(sr, req->ip, NULL) == 0;
         
         /* Actualizar los campos de la solicitud */
         req->sent = now;
-        req->times_sent++;
+        if (ok) {
+            req->times_sent++;
+        }
     }
     
     /*Si no paso un segundo no hace nada, solo espera*/
@@ -162,14 +232,23 @@ void host_unreachable(struct sr_instance *sr, struct sr_arpreq *req) {
         Debug("Envia ICMP (3,1) al emisor del paquete en cola (len: %d)\n", packet->len);
         
         
-        /*Llama a esta otra función que también la hicimos nosotros*/
-        sr_send_icmp_error_packet(
-            3,                      //ICMP Type: destination unreachable
-            1,                      //ICMP Code: host unreachable (queda icmp 3,1)
-            sr,
-            packet->len,            //uint32_t: Longitud del paquete original
-            packet->buf             //uint8_t*:  Buffer del paquete original
-        );
+        /* En la cola están las tramas enteras: el paquete IP empieza después del Ethernet, y
+        el error va a su IP de origen. Se mira que entre el cabezal y que ip_len no se pase de
+        la trama, porque sr_send_icmp_error_packet copia hasta ip_len (o 28) bytes. */
+        unsigned int eth_len = sizeof(sr_ethernet_hdr_t);
+        sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet->buf + eth_len);
+        if (packet->len >= eth_len + sizeof(sr_ip_hdr_t)
+            && ntohs(ip_hdr->ip_len) >= sizeof(sr_ip_hdr_t)
+            && ntohs(ip_hdr->ip_len) <= packet->len - eth_len) {
+            /*Llama a esta otra función que también la hicimos nosotros*/
+            sr_send_icmp_error_packet(
+                3,                      //ICMP Type: destination unreachable
+                1,                      //ICMP Code: host unreachable (queda icmp 3,1)
+                sr,
+                ip_hdr->ip_src,         //uint32_t: IP de origen del paquete original
+                (uint8_t *)ip_hdr       //uint8_t*:  Paquete IP original
+            );
+        }
         
         /*Itera al siguiente paquete*/
         packet = packet->next;
@@ -203,11 +282,15 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
     pthread_mutex_lock(&(cache->lock));
     
     struct sr_arpentry *entry = NULL, *copy = NULL;
+    struct sr_arp_refresh *refresh = sr_arp_refresh_of(cache);
     
     int i;
     for (i = 0; i < SR_ARPCACHE_SZ; i++) {
         if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
             entry = &(cache->entries[i]);
+            if (refresh) {
+                refresh->last_hit[i] = time(NULL);
+            }
         }
     }
     
@@ -229,40 +312,61 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
    
    A pointer to the ARP request is returned; it should not be freed. The caller
    can remove the ARP request from the queue by calling sr_arpreq_destroy. */
-struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
-                                       uint32_t ip,
-                                       uint8_t *packet,           /* borrowed */
-                                       unsigned int packet_len,
-                                       char *iface)
+/* Agrega el paquete a la cola del request tomando una referencia al buffer. Con el lock tomado */
+static void sr_arpcache_queue_buf_locked(struct sr_arpreq *req, struct sr_pktbuf *pb,
+                                         unsigned int packet_len, char *iface)
+{
+    struct sr_queued_packet *new_pkt = (struct sr_queued_packet *)malloc(sizeof(struct sr_queued_packet));
+    if (!new_pkt) {
+        return;
+    }
+    SR_TAP(SR_TAP_ARPQ, sr_pktbuf_data(pb), packet_len, iface);
+    new_pkt->pb = sr_pktbuf_get(pb);
+    new_pkt->pkt.buf = sr_pktbuf_data(pb);
+    new_pkt->pkt.len = packet_len;
+    new_pkt->pkt.iface = (char *)malloc(sr_IFACE_NAMELEN);
+    strncpy(new_pkt->pkt.iface, iface, sr_IFACE_NAMELEN);
+    new_pkt->pkt.next = req->packets;
+    req->packets = &new_pkt->pkt;
+}
+
+/* Busca el request de ip y si no está lo crea. Con el lock tomado */
+static struct sr_arpreq *sr_arpcache_req_locked(struct sr_arpcache *cache, uint32_t ip)
 {
-    pthread_mutex_lock(&(cache->lock));
-    
     struct sr_arpreq *req;
     for (req = cache->requests; req != NULL; req = req->next) {
         if (req->ip == ip) {
-            break;
+            return req;
         }
     }
-    
+
     /* If the IP wasn't found, add it */
-    if (!req) {
-        req = (struct sr_arpreq *) calloc(1, sizeof(struct sr_arpreq));
+    req = (struct sr_arpreq *) calloc(1, sizeof(struct sr_arpreq));
+    if (req) {
         req->ip = ip;
         req->next = cache->requests;
         cache->requests = req;
     }
+    return req;
+}
+
+struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
+                                       uint32_t ip,
+                                       uint8_t *packet,           /* borrowed */
+                                       unsigned int packet_len,
+                                       char *iface)
+{
+    pthread_mutex_lock(&(cache->lock));
+    
+    struct sr_arpreq *req = sr_arpcache_req_locked(cache, ip);
     
     /* Add the packet to the list of packets for this request */
-    if (packet && packet_len && iface) {
-        struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
-        
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
-        memcpy(new_pkt->buf, packet, packet_len);
-        new_pkt->len = packet_len;
-		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
-        strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
-        new_pkt->next = req->packets;
-        req->packets = new_pkt;
+    if (req && packet && packet_len && iface) {
+        struct sr_pktbuf *pb = sr_pktbuf_copy(packet, packet_len);
+        if (pb) {
+            sr_arpcache_queue_buf_locked(req, pb, packet_len, iface);
+            sr_pktbuf_put(pb);
+        }
     }
     
     pthread_mutex_unlock(&(cache->lock));
@@ -270,6 +374,27 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
     return req;
 }
 
+/* Como sr_arpcache_queuereq pero con un buffer que ya es nuestro: la cola toma una referencia
+   en vez de copiarlo. El que llama sigue siendo dueño de la suya. */
+struct sr_arpreq *sr_arpcache_queuereq_buf(struct sr_arpcache *cache,
+                                           uint32_t ip,
+                                           struct sr_pktbuf *pb,
+                                           unsigned int packet_len,
+                                           char *iface)
+{
+    /* Buscar o crear el request y encolar con el mismo lock: si no, entre medio puede llegar
+       el ARP reply, sr_arpcache_insert saca el request, el que lo recibe lo vacía y lo
+       destruye, y el paquete se agregaría a memoria liberada */
+    pthread_mutex_lock(&(cache->lock));
+    struct sr_arpreq *req = sr_arpcache_req_locked(cache, ip);
+    if (req) {
+        sr_arpcache_queue_buf_locked(req, pb, packet_len, iface);
+    }
+    pthread_mutex_unlock(&(cache->lock));
+
+    return req;
+}
+
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
       to the sr_arpreq with this IP. Otherwise, returns NULL.
@@ -297,11 +422,22 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
         prev = req;
     }
     
+    /* Si ya hay una entrada para esa IP (respuesta a un probe de refresco) se renueva esa */
     int i;
     for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if (!(cache->entries[i].valid))
+        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip))
             break;
     }
+    if (i == SR_ARPCACHE_SZ) {
+        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+            if (!(cache->entries[i].valid))
+                break;
+        }
+        struct sr_arp_refresh *refresh = sr_arp_refresh_of(cache);
+        if (i != SR_ARPCACHE_SZ && refresh) {
+            refresh->last_hit[i] = 0;
+        }
+    }
     
     if (i != SR_ARPCACHE_SZ) {
         memcpy(cache->entries[i].mac, mac, 6);
@@ -315,6 +451,25 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
     return req;
 }
 
+/* Actualiza la MAC de una IP que ya está en la caché (ARP gratuito o cualquier ARP de un
+   vecino conocido, como pide RFC 826). No crea entradas. Devuelve 1 si había una. */
+int sr_arpcache_update(struct sr_arpcache *cache, unsigned char *mac, uint32_t ip)
+{
+    int updated = 0;
+
+    pthread_mutex_lock(&(cache->lock));
+    for (int i = 0; i < SR_ARPCACHE_SZ; i++) {
+        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
+            memcpy(cache->entries[i].mac, mac, 6);
+            cache->entries[i].added = time(NULL);
+            updated = 1;
+        }
+    }
+    pthread_mutex_unlock(&(cache->lock));
+
+    return updated;
+}
+
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
@@ -342,8 +497,7 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
         
         for (pkt = entry->packets; pkt; pkt = nxt) {
             nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
+            sr_pktbuf_put(sr_arpcache_packet_buf(pkt));
             if (pkt->iface)
                 free(pkt->iface);
             free(pkt);
@@ -383,12 +537,40 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
     pthread_mutexattr_init(&(cache->attr));
     pthread_mutexattr_settype(&(cache->attr), PTHREAD_MUTEX_RECURSIVE);
     int success = pthread_mutex_init(&(cache->lock), &(cache->attr));
+
+    /* Tablas del refresco: una libre si hay, si no una nueva al principio de la lista */
+    pthread_mutex_lock(&arp_refresh_lock);
+    struct sr_arp_refresh *r = arp_refresh_list;
+    while (r && r->cache != NULL && r->cache != cache) {
+        r = r->next;
+    }
+    if (!r) {
+        r = calloc(1, sizeof(struct sr_arp_refresh));
+        if (r) {
+            r->next = arp_refresh_list;
+            __atomic_store_n(&arp_refresh_list, r, __ATOMIC_RELEASE);
+        }
+    }
+    if (r) {
+        memset(r->last_hit, 0, sizeof(r->last_hit));
+        memset(r->last_probe, 0, sizeof(r->last_probe));
+        __atomic_store_n(&r->cache, cache, __ATOMIC_RELEASE);
+    } else {
+        perror("calloc (refresco ARP)");
+    }
+    pthread_mutex_unlock(&arp_refresh_lock);
     
     return success;
 }
 
 /* Destroys table + table lock. Returns 0 on success. */
 int sr_arpcache_destroy(struct sr_arpcache *cache) {
+    pthread_mutex_lock(&arp_refresh_lock);
+    struct sr_arp_refresh *r = sr_arp_refresh_of(cache);
+    if (r) {
+        __atomic_store_n(&r->cache, NULL, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&arp_refresh_lock);
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
 
@@ -401,20 +583,51 @@ void *sr_arpcache_timeout(void *sr_ptr) {
     while (1) {
         sleep(1.0);
         
+        /* Los reintentos y los ICMP host unreachable buscan en la FIB: la ruta vale hasta salir */
+        sr_epoch_enter();
         pthread_mutex_lock(&(cache->lock));
     
         time_t curtime = time(NULL);
+        struct sr_arpentry probes[SR_ARPCACHE_SZ];
+        int n_probes = 0;
+        struct sr_arp_refresh *refresh = sr_arp_refresh_of(cache);
         
         int i;    
         for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
+            if (!cache->entries[i].valid) {
+                continue;
+            }
+            double age = difftime(curtime, cache->entries[i].added);
+            if (age > SR_ARPCACHE_TO) {
                 cache->entries[i].valid = 0;
+            } else if (ARP_REFRESH_ENABLED && refresh
+                       && age >= SR_ARPCACHE_TO - ARP_REFRESH_BEFORE_SEC
+                       && difftime(curtime, refresh->last_hit[i]) <= ARP_REFRESH_HIT_WINDOW_SEC
+                       && difftime(curtime, refresh->last_probe[i]) >= 1) {
+                /* Se usa seguido y está por vencer: probe (uno por segundo hasta que conteste) */
+                probes[n_probes++] = cache->entries[i];
+                refresh->last_probe[i] = curtime;
             }
         }
         
         sr_arpcache_sweepreqs(sr);
 
         pthread_mutex_unlock(&(cache->lock));
+
+        /* Los probes se mandan fuera del lock */
+        for (i = 0; i < n_probes; i++) {
+            sr_arp_request_send_to(sr, probes[i].ip, probes[i].mac);
+        }
+        sr_epoch_exit();
+
+        /* Aprovechamos el mismo tic para vencer conexiones y ver si cambió la configuración */
+        sr_ct_expire(curtime);
+        sr_mtu_poll();
+        sr_icmp_ratelimit_poll();
+        sr_acl_poll();
+        sr_flow_poll();
+        sr_local_addr_poll(sr);
+        sr_epoch_reclaim();
     }
     
     return NULL;
@@ -0,0 +1,775 @@
+/**********************************************************************
+ * file:  sr_ct.c
+ *
+ * Descripción:
+ *
+ * Tabla de conexiones (conntrack): cuckoo hash por buckets y rueda de timers.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_epoch.h"
+#include "sr_ct.h"
+#include "sr_nat.h"
+
+/*
+Tabla de conexiones (conntrack) para lo que necesite estado por flujo. Cada conexión ocupa
+una entrada de un pool fijo y dos lugares en la tabla hash, uno por sentido (original y
+respuesta), así un paquete de vuelta encuentra la misma entrada.
+
+La tabla es un cuckoo hash por buckets: cada bucket ocupa una línea de caché (64 bytes) con
+8 lugares, y cada lugar tiene un tag de 8 bits sacado del hash. Para buscar se comparan los
+8 tags de una sola vez como un uint64 y recién después se mira la clave en el pool. Cada
+clave puede estar en 2 buckets (el segundo sale del primero y el tag, para poder moverla
+sin recalcular el hash).
+
+No hay un lock de toda la tabla. Cada bucket tiene un número de versión que hace de lock
+propio (impar = alguien lo está cambiando, se toma con CAS): crear una conexión toma solo los
+buckets donde pueden ir sus dos claves, en orden para no trabarse con otro hilo, y los
+desplazamientos de cuckoo se hacen de a una movida con sus dos buckets. Las búsquedas no
+toman nada: miran la versión de los dos buckets antes y después y reintentan si cambió. Las
+entradas libres son una pila con CAS y la rueda de timers también se llena con CAS, así que
+dos conexiones nuevas (por ejemplo dos mapeos de NAT) que no caen en los mismos buckets se
+crean en paralelo sin esperarse.
+Los timeouts van con una rueda de timers de un slot por segundo; la entrada no se mueve en
+la rueda en cada paquete, cuando le toca el slot se fija si de verdad venció y si no la vuelve
+a poner donde corresponde. Una conexión TCP pasa al timeout corto recién cuando los dos lados
+mandaron FIN (o con un RST): medio cerrada puede seguir mandando datos el otro lado.
+
+Un lector que encontró una entrada la sigue usando después de la búsqueda (la actualiza en
+sr_ct_touch, el NAT lee la tupla traducida), así que una entrada vencida no se reutiliza
+enseguida: las que borra un barrido pasan juntas por sr_epoch_retire y vuelven a la lista de
+libres recién cuando no queda ningún hilo de reenvío adentro de una época que las pudo ver.
+
+Las tablas se piden con mmap al crear la primera conexión y la memoria se va ocupando a
+medida que se usa (las entradas nuevas salen en orden, no de una lista armada de antemano).
+Con los valores de abajo son 64 MB de buckets más 52 bytes por conexión, unos 170 MB con la
+tabla llena (2M conexiones).
+*/
+#define CT_ENABLED 1
+#define CT_MAX_ENTRIES (1u << 21)  /* Conexiones simultáneas como máximo */
+#define CT_BUCKETS (1u << 20)      /* Potencia de 2; con 2 lugares por conexión queda a la mitad de carga */
+#define CT_BUCKET_SLOTS 8
+#define CT_MAX_KICKS 64       /* Desplazamientos de cuckoo antes de darse por vencido */
+#define CT_INSERT_TRIES 8     /* Veces que se hace lugar y se reintenta si otro hilo ganó la carrera */
+#define CT_WHEEL_SLOTS 512    /* Segundos; los timeouts más largos dan más de una vuelta */
+#define CT_TIMEOUT_TCP 300
+#define CT_TIMEOUT_TCP_CLOSING 10
+#define CT_TIMEOUT_UDP 30
+#define CT_TIMEOUT_OTHER 30
+
+#define CT_TCP_FIN 0x01
+#define CT_TCP_RST 0x04
+#define CT_SPIN_PAUSES 64     /* Esperas cortas antes de ceder el procesador (ver sr_ct_relax) */
+
+struct sr_ct_bucket {
+    union {
+        uint8_t tag[CT_BUCKET_SLOTS];   /* 0 = lugar libre */
+        uint64_t word;
+    } tags;
+    uint32_t slot[CT_BUCKET_SLOTS];     /* (índice en el pool << 1) | sentido */
+    uint32_t version;                   /* Impar mientras alguien lo cambia: es el lock del bucket */
+} __attribute__ ((aligned(64)));
+
+/* Lote de entradas borradas por un barrido, encadenadas por wheel_next, esperando la época */
+struct sr_ct_retired {
+    uint32_t head;
+    uint32_t tail;
+    unsigned int count;
+};
+
+static struct sr_ct_bucket *ct_buckets = NULL;
+struct sr_ct_entry *ct_entries = NULL;
+static uint32_t ct_wheel[CT_WHEEL_SLOTS];
+static uint32_t ct_wheel_tick = 0;
+static uint32_t ct_free_head = CT_NONE;
+static uint32_t ct_fresh = 0;          /* Primera entrada que nunca se usó */
+static struct sr_ct_retired ct_limbo = { CT_NONE, CT_NONE, 0 };  /* Borradas sin retirar todavía */
+static int ct_ready = 0;               /* 1 = tablas pedidas, -1 = no hubo memoria */
+static pthread_mutex_t ct_init_lock = PTHREAD_MUTEX_INITIALIZER;    /* Solo hasta que hay tablas */
+static pthread_mutex_t ct_expire_lock = PTHREAD_MUTEX_INITIALIZER;  /* Un barrido a la vez; cuida ct_limbo */
+
+static unsigned long ct_stat_lookups = 0;
+static unsigned long ct_stat_hits = 0;
+static unsigned long ct_stat_inserts = 0;
+static unsigned long ct_stat_kicks = 0;
+static unsigned long ct_stat_full = 0;
+static unsigned long ct_stat_expired = 0;
+static unsigned int ct_count = 0;
+
+static uint8_t sr_ct_tag(uint32_t h)
+{
+    uint8_t tag = h >> 24;
+    return tag ? tag : 1;
+}
+
+/* El otro bucket posible de un lugar con ese tag; aplicarlo dos veces vuelve al primero */
+static uint32_t sr_ct_alt_bucket(uint32_t b, uint8_t tag)
+{
+    return (b ^ (tag * 0x5BD1E995u)) & (CT_BUCKETS - 1);
+}
+
+/* Bits 0x80 prendidos en los bytes del bucket cuyo tag coincide. Puede dar algún falso
+positivo (se descarta al comparar la clave), nunca un falso negativo. */
+static uint64_t sr_ct_match_tags(uint64_t word, uint8_t tag)
+{
+    uint64_t x = word ^ (tag * 0x0101010101010101ull);
+    return (x - 0x0101010101010101ull) & ~x & 0x8080808080808080ull;
+}
+
+static int sr_ct_key_eq(const struct sr_flow_key *a, const struct sr_flow_key *b)
+{
+    return a->src == b->src && a->dst == b->dst && a->proto == b->proto
+           && a->sport == b->sport && a->dport == b->dport;
+}
+
+static uint32_t sr_ct_find_in_bucket(uint32_t b, uint8_t tag, const struct sr_flow_key *k)
+{
+    struct sr_ct_bucket *bucket = &ct_buckets[b];
+    uint64_t match = sr_ct_match_tags(bucket->tags.word, tag);
+    while (match) {
+        unsigned int i = __builtin_ctzll(match) / 8;
+        match &= match - 1;
+        uint32_t val = bucket->slot[i];
+        if (bucket->tags.tag[i] == tag && sr_ct_key_eq(&ct_entries[val >> 1].tuple[val & 1], k)) {
+            return val;
+        }
+    }
+    return CT_NONE;
+}
+
+static uint32_t sr_ct_find(const struct sr_flow_key *k)
+{
+    uint32_t h = sr_flow_key_hash(k);
+    uint8_t tag = sr_ct_tag(h);
+    uint32_t b1 = h & (CT_BUCKETS - 1);
+    uint32_t val = sr_ct_find_in_bucket(b1, tag, k);
+    if (val == CT_NONE) {
+        val = sr_ct_find_in_bucket(sr_ct_alt_bucket(b1, tag), tag, k);
+    }
+    return val;
+}
+
+/*
+Espera corta mientras un escritor termina: pause (le avisa al procesador que es un spin y no
+le roba el pipeline al otro hilo del core) y, si tarda, cede el procesador por si el escritor
+quedó sin correr. spins cuenta las vueltas de esta espera.
+*/
+static void sr_ct_relax(unsigned int *spins)
+{
+    if (++*spins % CT_SPIN_PAUSES == 0) {
+        sched_yield();
+        return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/* Búsqueda sin lock. Devuelve (índice << 1) | sentido, o CT_NONE. */
+uint32_t sr_ct_lookup(const struct sr_flow_key *k)
+{
+    unsigned int spins = 0;
+    uint32_t v1, v2, val;
+
+    if (__atomic_load_n(&ct_ready, __ATOMIC_ACQUIRE) != 1) {
+        return CT_NONE;
+    }
+    uint32_t h = sr_flow_key_hash(k);
+    uint8_t tag = sr_ct_tag(h);
+    uint32_t b1 = h & (CT_BUCKETS - 1);
+    uint32_t b2 = sr_ct_alt_bucket(b1, tag);
+    do {
+        while (((v1 = __atomic_load_n(&ct_buckets[b1].version, __ATOMIC_ACQUIRE)) & 1)
+               || ((v2 = __atomic_load_n(&ct_buckets[b2].version, __ATOMIC_ACQUIRE)) & 1)) {
+            /* Hay un escritor a mitad de camino en alguno de los dos */
+            sr_ct_relax(&spins);
+        }
+        val = sr_ct_find_in_bucket(b1, tag, k);
+        if (val == CT_NONE) {
+            val = sr_ct_find_in_bucket(b2, tag, k);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&ct_buckets[b1].version, __ATOMIC_RELAXED) != v1
+             || __atomic_load_n(&ct_buckets[b2].version, __ATOMIC_RELAXED) != v2);
+    return val;
+}
+
+/* La versión impar es el lock del bucket; los lectores la ven y reintentan */
+static void sr_ct_bucket_lock(uint32_t b)
+{
+    unsigned int spins = 0;
+    uint32_t v = __atomic_load_n(&ct_buckets[b].version, __ATOMIC_RELAXED);
+    while ((v & 1) || !__atomic_compare_exchange_n(&ct_buckets[b].version, &v, v + 1, 0,
+                                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        sr_ct_relax(&spins);
+        v = __atomic_load_n(&ct_buckets[b].version, __ATOMIC_RELAXED);
+    }
+    /* Lo que se escriba en el bucket no puede quedar antes de que la versión sea impar */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void sr_ct_bucket_unlock(uint32_t b)
+{
+    uint32_t v = __atomic_load_n(&ct_buckets[b].version, __ATOMIC_RELAXED);
+    __atomic_store_n(&ct_buckets[b].version, v + 1, __ATOMIC_RELEASE);
+}
+
+/*
+Toma los n buckets de b (pueden repetirse) de menor a mayor, así dos hilos que quieren
+buckets en común nunca quedan esperándose entre sí. Deja en b los distintos, ordenados, y
+devuelve cuántos son.
+*/
+static unsigned int sr_ct_lock_set(uint32_t *b, unsigned int n)
+{
+    unsigned int m = 0;
+
+    for (unsigned int i = 0; i < n; i++) {
+        uint32_t x = b[i];
+        unsigned int j = m;
+        while (j > 0 && b[j - 1] > x) {
+            b[j] = b[j - 1];
+            j--;
+        }
+        if (j > 0 && b[j - 1] == x) {
+            /* Repetido: se deshace el corrimiento */
+            for (; j < m; j++) {
+                b[j] = b[j + 1];
+            }
+            continue;
+        }
+        b[j] = x;
+        m++;
+    }
+    for (unsigned int i = 0; i < m; i++) {
+        sr_ct_bucket_lock(b[i]);
+    }
+    return m;
+}
+
+static void sr_ct_unlock_set(const uint32_t *b, unsigned int m)
+{
+    while (m > 0) {
+        sr_ct_bucket_unlock(b[--m]);
+    }
+}
+
+/* Un lugar libre de b que no sea skip (-1 = ninguno que saltear), o -1 */
+static int sr_ct_free_slot(uint32_t b, int skip)
+{
+    for (int i = 0; i < CT_BUCKET_SLOTS; i++) {
+        if (ct_buckets[b].tags.tag[i] == 0 && i != skip) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void sr_ct_slot_put(uint32_t b, int i, uint8_t tag, uint32_t val)
+{
+    ct_buckets[b].slot[i] = val;
+    ct_buckets[b].tags.tag[i] = tag;
+}
+
+/*
+Mueve el lugar i de from a to, su otro bucket. Devuelve 0 si el lugar quedó libre (o ya lo
+estaba) y -1 si mientras tanto alguien lo cambió o llenó to.
+*/
+static int sr_ct_move(uint32_t from, unsigned int i, uint32_t to)
+{
+    uint32_t set[2] = { from, to };
+    unsigned int m = sr_ct_lock_set(set, 2);
+    int r = -1;
+
+    uint8_t tag = ct_buckets[from].tags.tag[i];
+    if (tag == 0) {
+        r = 0;
+    } else if (from != to && sr_ct_alt_bucket(from, tag) == to) {
+        int j = sr_ct_free_slot(to, -1);
+        if (j >= 0) {
+            /* Primero aparece en to y después se va de from: un lector lo ve siempre en alguno */
+            sr_ct_slot_put(to, j, tag, ct_buckets[from].slot[i]);
+            ct_buckets[from].tags.tag[i] = 0;
+            __atomic_add_fetch(&ct_stat_kicks, 1, __ATOMIC_RELAXED);
+            r = 0;
+        }
+    }
+    sr_ct_unlock_set(set, m);
+    return r;
+}
+
+/*
+Hace lugar en el bucket b corriendo otras claves a su bucket alternativo (cuckoo). Primero
+busca un camino sin lock hasta un bucket con lugar, y después lo recorre de atrás para
+adelante: cada movida libra el lugar que necesita la anterior, y cada una toma solo sus dos
+buckets. Si otro hilo cambió el camino en el medio la movida falla y quien llamó vuelve a
+probar. Devuelve -1 solo si no encontró camino (tabla demasiado llena).
+*/
+static int sr_ct_make_room(uint32_t b, unsigned int start)
+{
+    uint32_t path_b[CT_MAX_KICKS + 1];
+    unsigned int path_i[CT_MAX_KICKS];
+    int len;
+
+    path_b[0] = b;
+    for (len = 0; len < CT_MAX_KICKS; len++) {
+        unsigned int i = (start + len) % CT_BUCKET_SLOTS;
+        uint8_t tag = __atomic_load_n(&ct_buckets[path_b[len]].tags.tag[i], __ATOMIC_RELAXED);
+        if (tag == 0) {
+            break;
+        }
+        path_i[len] = i;
+        path_b[len + 1] = sr_ct_alt_bucket(path_b[len], tag);
+        if (sr_ct_free_slot(path_b[len + 1], -1) >= 0) {
+            len++;
+            break;
+        }
+    }
+    if (len == CT_MAX_KICKS) {
+        return -1;
+    }
+    while (--len >= 0) {
+        if (sr_ct_move(path_b[len], path_i[len], path_b[len + 1]) < 0) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static uint32_t sr_ct_timeout(const struct sr_ct_entry *e)
+{
+    if (e->tuple[0].proto == 6) {
+        return e->closing ? CT_TIMEOUT_TCP_CLOSING : CT_TIMEOUT_TCP;
+    }
+    if (e->tuple[0].proto == ip_protocol_udp) {
+        return CT_TIMEOUT_UDP;
+    }
+    return CT_TIMEOUT_OTHER;
+}
+
+/* La llenan los hilos que crean conexiones y el barrido al mismo tiempo, así que con CAS */
+static void sr_ct_wheel_add(uint32_t idx, uint32_t deadline)
+{
+    uint32_t *head = &ct_wheel[deadline % CT_WHEEL_SLOTS];
+    uint32_t old = __atomic_load_n(head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&ct_entries[idx].wheel_next, old, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(head, &old, idx, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+Una entrada sin usar. La lista de libres es una pila con CAS; el problema clásico (ABA: sacar
+una entrada que mientras tanto salió y volvió a entrar) no pasa porque se saca adentro de
+una época y solo vuelven entradas por sr_ct_free_retired, después de que terminen todas las
+épocas que las pudieron ver. La que se sacó y no se usó queda guardada en el hilo.
+*/
+static __thread uint32_t ct_spare = CT_NONE;
+
+static uint32_t sr_ct_alloc(void)
+{
+    uint32_t idx = ct_spare;
+    if (idx != CT_NONE) {
+        ct_spare = CT_NONE;
+        return idx;
+    }
+    idx = __atomic_load_n(&ct_free_head, __ATOMIC_ACQUIRE);
+    while (idx != CT_NONE) {
+        uint32_t next = __atomic_load_n(&ct_entries[idx].wheel_next, __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&ct_free_head, &idx, next, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return idx;
+        }
+    }
+    idx = __atomic_load_n(&ct_fresh, __ATOMIC_RELAXED);
+    while (idx < CT_MAX_ENTRIES) {
+        if (__atomic_compare_exchange_n(&ct_fresh, &idx, idx + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return idx;
+        }
+    }
+    return CT_NONE;
+}
+
+static int sr_ct_init_locked(uint32_t now)
+{
+    size_t buckets_size = (size_t)CT_BUCKETS * sizeof(struct sr_ct_bucket);
+    size_t entries_size = (size_t)CT_MAX_ENTRIES * sizeof(struct sr_ct_entry);
+
+    /* Anónimo: viene en cero y el kernel da las páginas recién cuando se tocan */
+    void *b = mmap(NULL, buckets_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    void *e = mmap(NULL, entries_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (b == MAP_FAILED || e == MAP_FAILED) {
+        perror("mmap (conntrack)");
+        if (b != MAP_FAILED) {
+            munmap(b, buckets_size);
+        }
+        if (e != MAP_FAILED) {
+            munmap(e, entries_size);
+        }
+        __atomic_store_n(&ct_ready, -1, __ATOMIC_RELEASE);
+        return -1;
+    }
+    ct_buckets = (struct sr_ct_bucket *)b;
+    ct_entries = (struct sr_ct_entry *)e;
+    ct_free_head = CT_NONE;
+    ct_fresh = 0;
+    for (unsigned int s = 0; s < CT_WHEEL_SLOTS; s++) {
+        ct_wheel[s] = CT_NONE;
+    }
+    ct_wheel_tick = now;
+    __atomic_store_n(&ct_ready, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+Crea una conexión. t[0] es el sentido original y t[1] el de la respuesta (que con NAT no es
+simplemente el original dado vuelta). Toma solo los (hasta 4) buckets donde pueden ir las dos
+claves, así dos conexiones nuevas que no comparten buckets se crean en paralelo. Si ya existe
+devuelve esa; si no hay lugar, CT_NONE.
+*/
+static uint32_t sr_ct_insert_one(const struct sr_flow_key t[2], uint32_t now)
+{
+    uint32_t h[2], b[2][2];
+    uint8_t tag[2];
+
+    for (int d = 0; d < 2; d++) {
+        h[d] = sr_flow_key_hash(&t[d]);
+        tag[d] = sr_ct_tag(h[d]);
+        b[d][0] = h[d] & (CT_BUCKETS - 1);
+        b[d][1] = sr_ct_alt_bucket(b[d][0], tag[d]);
+    }
+
+    uint32_t idx = sr_ct_alloc();
+    if (idx == CT_NONE) {
+        __atomic_add_fetch(&ct_stat_full, 1, __ATOMIC_RELAXED);
+        return CT_NONE;
+    }
+
+    for (int attempt = 0; attempt < CT_INSERT_TRIES; attempt++)
+    {
+        uint32_t set[4] = { b[0][0], b[0][1], b[1][0], b[1][1] };
+        unsigned int m = sr_ct_lock_set(set, 4);
+
+        uint32_t existing = sr_ct_find(&t[0]);
+        if (existing != CT_NONE || sr_ct_find(&t[1]) != CT_NONE) {
+            /* La creó otro hilo, quizás desde el otro lado; si solo choca la respuesta no hay
+            conexión que devolver */
+            sr_ct_unlock_set(set, m);
+            ct_spare = idx;
+            if (existing == CT_NONE) {
+                __atomic_add_fetch(&ct_stat_full, 1, __ATOMIC_RELAXED);
+            }
+            return existing;
+        }
+
+        int d0 = 0, i0 = sr_ct_free_slot(b[0][0], -1);
+        if (i0 < 0) {
+            d0 = 1;
+            i0 = sr_ct_free_slot(b[0][1], -1);
+        }
+        int d1 = 0, i1 = -1;
+        if (i0 >= 0) {
+            /* Si la respuesta cae en el mismo bucket, el lugar de recién ya está tomado */
+            for (d1 = 0; d1 < 2; d1++) {
+                i1 = sr_ct_free_slot(b[1][d1], b[1][d1] == b[0][d0] ? i0 : -1);
+                if (i1 >= 0) {
+                    break;
+                }
+            }
+        }
+
+        if (i0 >= 0 && i1 >= 0) {
+            struct sr_ct_entry *e = &ct_entries[idx];
+            e->tuple[0] = t[0];
+            e->tuple[1] = t[1];
+            e->in_use = 1;
+            e->seen_reply = 0;
+            e->fin = 0;
+            e->closing = 0;
+            e->nat = !(t[1].dst == t[0].src && t[1].dport == t[0].sport);
+            e->packets[0] = 0;
+            e->packets[1] = 0;
+            e->last_seen = now;
+            sr_ct_slot_put(b[0][d0], i0, tag[0], idx << 1);
+            sr_ct_slot_put(b[1][d1], i1, tag[1], (idx << 1) | 1);
+            sr_ct_unlock_set(set, m);
+
+            sr_ct_wheel_add(idx, now + sr_ct_timeout(e));
+            __atomic_add_fetch(&ct_count, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&ct_stat_inserts, 1, __ATOMIC_RELAXED);
+            return idx << 1;
+        }
+        sr_ct_unlock_set(set, m);
+
+        /* Sin lock: se corre a otras claves, desde el otro bucket si por el primero no hay
+        camino, y se vuelve a probar */
+        int d = (i0 < 0) ? 0 : 1;
+        if (sr_ct_make_room(b[d][0], h[d] >> 8) < 0 && sr_ct_make_room(b[d][1], h[d] >> 8) < 0) {
+            break;
+        }
+    }
+    ct_spare = idx;
+    __atomic_add_fetch(&ct_stat_full, 1, __ATOMIC_RELAXED);
+    return CT_NONE;
+}
+
+/*
+Crea varias conexiones, cada una con sr_ct_insert_one. tuples[i][0] es el sentido original y
+tuples[i][1] el de la respuesta. En val_out queda (índice << 1) | sentido de cada una, o
+CT_NONE si no hubo lugar: si otro hilo la creó antes, quizás desde el otro lado, el sentido
+es el de tuples[i][0] en esa conexión. Devuelve cuántas quedaron en la tabla.
+*/
+unsigned int sr_ct_insert_batch(const struct sr_flow_key (*tuples)[2], unsigned int n,
+                                uint32_t now, uint32_t *val_out)
+{
+    unsigned int done = 0;
+
+    if (__atomic_load_n(&ct_ready, __ATOMIC_ACQUIRE) == 0) {
+        /* Solo la primera conexión: las tablas todavía no existen */
+        pthread_mutex_lock(&ct_init_lock);
+        if (ct_ready == 0) {
+            sr_ct_init_locked(now);
+        }
+        pthread_mutex_unlock(&ct_init_lock);
+    }
+    if (__atomic_load_n(&ct_ready, __ATOMIC_ACQUIRE) != 1) {
+        for (unsigned int i = 0; i < n; i++) {
+            val_out[i] = CT_NONE;
+        }
+        return 0;
+    }
+    /* sr_ct_alloc necesita estar en una época; si quien llama ya está, esto solo anida */
+    sr_epoch_enter();
+    for (unsigned int i = 0; i < n; i++) {
+        val_out[i] = sr_ct_insert_one(tuples[i], now);
+        if (val_out[i] != CT_NONE) {
+            done++;
+        }
+    }
+    sr_epoch_exit();
+    return done;
+}
+
+/*
+Devuelve a la lista de libres un lote de entradas borradas; la llama sr_epoch_reclaim cuando
+ya ningún lector las puede estar mirando. Recién ahí se liberan los puertos de NAT, así el
+puerto no se le da a otra conexión mientras alguien todavía traduce con la vieja.
+*/
+static void sr_ct_free_retired(void *ptr)
+{
+    struct sr_ct_retired *r = (struct sr_ct_retired *)ptr;
+
+    for (uint32_t idx = r->head; idx != CT_NONE; idx = ct_entries[idx].wheel_next) {
+        struct sr_ct_entry *e = &ct_entries[idx];
+        if (e->nat) {
+            sr_nat_release_port(e->tuple[1].dst, e->tuple[1].proto, e->tuple[1].dport);
+        }
+    }
+    /* El lote entero de una vez a la pila de libres */
+    uint32_t head = __atomic_load_n(&ct_free_head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&ct_entries[r->tail].wheel_next, head, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&ct_free_head, &head, r->head, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    free(r);
+}
+
+/* Saca los dos lugares de una conexión juntos, con los buckets de las dos claves tomados */
+static void sr_ct_remove_entry(uint32_t idx)
+{
+    struct sr_ct_entry *e = &ct_entries[idx];
+    uint32_t set[4];
+    uint8_t tag[2];
+
+    for (int d = 0; d < 2; d++) {
+        uint32_t h = sr_flow_key_hash(&e->tuple[d]);
+        tag[d] = sr_ct_tag(h);
+        set[2 * d] = h & (CT_BUCKETS - 1);
+        set[2 * d + 1] = sr_ct_alt_bucket(set[2 * d], tag[d]);
+    }
+    unsigned int m = sr_ct_lock_set(set, 4);
+    for (int d = 0; d < 2; d++) {
+        for (unsigned int j = 0; j < m; j++) {
+            for (unsigned int i = 0; i < CT_BUCKET_SLOTS; i++) {
+                if (ct_buckets[set[j]].tags.tag[i] == tag[d] && ct_buckets[set[j]].slot[i] == ((idx << 1) | d)) {
+                    ct_buckets[set[j]].tags.tag[i] = 0;
+                }
+            }
+        }
+    }
+    sr_ct_unlock_set(set, m);
+}
+
+/*
+Avanza la rueda hasta now y borra las conexiones vencidas. La llama el hilo del caché ARP
+una vez por segundo.
+*/
+void sr_ct_expire(time_t now_t)
+{
+    uint32_t now = (uint32_t)now_t;
+
+    if (!CT_ENABLED || __atomic_load_n(&ct_ready, __ATOMIC_ACQUIRE) != 1) {
+        return;
+    }
+
+    pthread_mutex_lock(&ct_expire_lock);
+    if (now == ct_wheel_tick) {
+        pthread_mutex_unlock(&ct_expire_lock);
+        return;
+    }
+    /* Si quedó muy atrás alcanza con una vuelta entera */
+    uint32_t tick = ct_wheel_tick;
+    if (now - tick > CT_WHEEL_SLOTS) {
+        tick = now - CT_WHEEL_SLOTS;
+    }
+
+    while (tick != now)
+    {
+        tick++;
+        uint32_t s = tick % CT_WHEEL_SLOTS;
+        uint32_t idx = __atomic_exchange_n(&ct_wheel[s], CT_NONE, __ATOMIC_ACQUIRE);
+
+        while (idx != CT_NONE) {
+            struct sr_ct_entry *e = &ct_entries[idx];
+            uint32_t next = e->wheel_next;
+            uint32_t deadline = __atomic_load_n(&e->last_seen, __ATOMIC_RELAXED) + sr_ct_timeout(e);
+
+            if ((int32_t)(deadline - now) > 0) {
+                /* Tuvo tráfico desde que se puso en la rueda; la rueda no la mira ningún lector */
+                sr_ct_wheel_add(idx, deadline);
+            } else {
+                sr_ct_remove_entry(idx);
+                e->in_use = 0;
+                /* Al lote que espera la época, no a la lista de libres */
+                e->wheel_next = ct_limbo.head;
+                ct_limbo.head = idx;
+                if (ct_limbo.tail == CT_NONE) {
+                    ct_limbo.tail = idx;
+                }
+                ct_limbo.count++;
+                __atomic_sub_fetch(&ct_count, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&ct_stat_expired, 1, __ATOMIC_RELAXED);
+            }
+            idx = next;
+        }
+    }
+    ct_wheel_tick = now;
+
+    /* Si no hay memoria para el lote queda en ct_limbo y se prueba en el próximo barrido */
+    struct sr_ct_retired *r = NULL;
+    if (ct_limbo.count > 0 && (r = (struct sr_ct_retired *)malloc(sizeof(*r))) != NULL) {
+        *r = ct_limbo;
+        ct_limbo.head = CT_NONE;
+        ct_limbo.tail = CT_NONE;
+        ct_limbo.count = 0;
+    }
+    pthread_mutex_unlock(&ct_expire_lock);
+
+    /* Fuera del lock: si ya se puede, sr_ct_free_retired se llama acá mismo y lo toma */
+    if (r) {
+        sr_epoch_retire(r, sr_ct_free_retired);
+    }
+}
+
+/* Actualiza la conexión val = (índice << 1) | sentido con un paquete suyo. Adentro de una
+época: si justo venció, lo que se escribe cae en una entrada que todavía no se reutiliza. */
+void sr_ct_touch(uint32_t val, const struct sr_flow_key *k, sr_ip_hdr_t *ip_hdr,
+                 unsigned int ip_hdr_len, unsigned int avail_len)
+{
+    struct sr_ct_entry *e = &ct_entries[val >> 1];
+    __atomic_store_n(&e->last_seen, (uint32_t)time(NULL), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&e->packets[val & 1], 1, __ATOMIC_RELAXED);
+    if (val & 1) {
+        e->seen_reply = 1;
+    }
+    if (k->proto == 6 && avail_len >= ip_hdr_len + 14) {
+        uint8_t flags = ((uint8_t *)ip_hdr)[ip_hdr_len + 13];
+        if (flags & CT_TCP_FIN) {
+            uint8_t fin = __atomic_or_fetch(&e->fin, 1 << (val & 1), __ATOMIC_RELAXED);
+            if (fin == 3) {
+                e->closing = 1;
+            }
+        }
+        if (flags & CT_TCP_RST) {
+            e->closing = 1;
+        }
+    }
+}
+
+/*
+Registra un paquete que se está reenviando: lo busca (sin lock) y si no está crea la
+conexión. Devuelve (índice << 1) | sentido, o CT_NONE si la tabla está llena. Se llama
+adentro de una época (sr_handlepacket y sr_handlepacket_batch ya entran).
+*/
+uint32_t sr_ct_track(const struct sr_flow_key *k, sr_ip_hdr_t *ip_hdr,
+                     unsigned int ip_hdr_len, unsigned int avail_len)
+{
+    if (!CT_ENABLED) {
+        return CT_NONE;
+    }
+
+    __atomic_add_fetch(&ct_stat_lookups, 1, __ATOMIC_RELAXED);
+    uint32_t val = sr_ct_lookup(k);
+
+    if (val == CT_NONE) {
+        struct sr_flow_key pair[1][2];
+        pair[0][0] = *k;
+        pair[0][1].src = k->dst;
+        pair[0][1].dst = k->src;
+        pair[0][1].proto = k->proto;
+        pair[0][1].sport = k->dport;
+        pair[0][1].dport = k->sport;
+        if (sr_ct_insert_batch(pair, 1, (uint32_t)time(NULL), &val) == 0) {
+            return CT_NONE;
+        }
+    } else {
+        __atomic_add_fetch(&ct_stat_hits, 1, __ATOMIC_RELAXED);
+    }
+
+    sr_ct_touch(val, k, ip_hdr, ip_hdr_len, avail_len);
+    return val;
+}
+
+/* Para el NAT, que hace su propia búsqueda: la cuenta en las estadísticas */
+void sr_ct_count_lookup(int hit)
+{
+    __atomic_add_fetch(&ct_stat_lookups, 1, __ATOMIC_RELAXED);
+    if (hit) {
+        __atomic_add_fetch(&ct_stat_hits, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void sr_ct_print_stats(void)
+{
+    printf("Conntrack: %u conexiones, %lu búsquedas, %lu encontradas, %lu creadas, %lu vencidas, "
+           "%lu desplazamientos, %lu sin lugar\n",
+           ct_count, ct_stat_lookups, ct_stat_hits, ct_stat_inserts, ct_stat_expired,
+           ct_stat_kicks, ct_stat_full);
+}
+
+/*
+Para bench_ct.c: registra un paquete de esa 5-tupla como si se estuviera reenviando
+(direcciones en orden de red, puertos en orden de host). Devuelve 1 si la conexión quedó
+en la tabla y 0 si no hubo lugar.
+*/
+int sr_ct_track_tuple(uint32_t src, uint32_t dst, uint8_t proto, uint16_t sport, uint16_t dport)
+{
+    struct sr_flow_key k;
+    k.src = src;
+    k.dst = dst;
+    k.proto = proto;
+    k.sport = sport;
+    k.dport = dport;
+
+    sr_epoch_enter();
+    uint32_t val = sr_ct_track(&k, NULL, 0, 0);
+    sr_epoch_exit();
+    return val != CT_NONE;
+}
+
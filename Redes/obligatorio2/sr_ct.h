@@ -0,0 +1,41 @@
+/*
+Tabla de conexiones (ver sr_ct.c). El NAT guarda sus traducciones en las entradas, por eso
+la entrada y la búsqueda están acá.
+*/
+#ifndef SR_CT_H
+#define SR_CT_H
+
+#include <stdint.h>
+#include <time.h>
+#include "sr_protocol.h"
+#include "sr_flow.h"
+
+#define CT_NONE 0xFFFFFFFFu
+
+struct sr_ct_entry {
+    struct sr_flow_key tuple[2];  /* 0 = original, 1 = respuesta */
+    uint32_t last_seen;           /* Segundos, se actualiza sin lock */
+    uint32_t packets[2];
+    uint8_t in_use;
+    uint8_t seen_reply;
+    uint8_t fin;                  /* Un bit por sentido que ya mandó FIN */
+    uint8_t closing;              /* FIN de los dos lados o RST: timeout corto */
+    uint8_t nat;                  /* La respuesta no es el original dado vuelta (NAT) */
+    uint32_t wheel_next;          /* Siguiente en el slot de la rueda, o en la lista de libres */
+};
+
+extern struct sr_ct_entry *ct_entries;  /* Se indexa con (val >> 1) de lo que devuelve la búsqueda */
+
+uint32_t sr_ct_lookup(const struct sr_flow_key *k);
+void sr_ct_count_lookup(int hit);
+void sr_ct_touch(uint32_t val, const struct sr_flow_key *k, sr_ip_hdr_t *ip_hdr,
+                 unsigned int ip_hdr_len, unsigned int avail_len);
+unsigned int sr_ct_insert_batch(const struct sr_flow_key (*tuples)[2], unsigned int n,
+                                uint32_t now, uint32_t *val_out);
+uint32_t sr_ct_track(const struct sr_flow_key *k, sr_ip_hdr_t *ip_hdr,
+                     unsigned int ip_hdr_len, unsigned int avail_len);
+int sr_ct_track_tuple(uint32_t src, uint32_t dst, uint8_t proto, uint16_t sport, uint16_t dport);
+void sr_ct_expire(time_t now);
+void sr_ct_print_stats(void);
+
+#endif /* SR_CT_H */
@@ -0,0 +1,188 @@
+/**********************************************************************
+ * file:  sr_epoch.c
+ *
+ * Descripción:
+ *
+ * Liberación diferida por épocas para lo que se lee sin lock.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "sr_epoch.h"
+
+/*
+Liberación diferida por épocas, para lo que se lee sin lock y se reemplaza con un puntero
+atómico (ACLs, direcciones locales, FIB, configuración de la captura). El que lee encierra el
+uso entre sr_epoch_enter y sr_epoch_exit; el que reemplaza algo no lo libera, lo pasa a
+sr_epoch_retire, y se libera recién cuando ningún lector que pudo haberlo visto sigue adentro.
+
+Cada hilo lector anota en su lugar de sr_epoch_readers la época global al entrar (0 = afuera).
+Retirar anota la época actual y la avanza: lo retirado en la época R se puede liberar cuando
+todos los lectores adentro entraron después (época > R), porque esos ya ven el puntero nuevo.
+Entrar anidado no cuesta nada. Si se acaban los lugares, el hilo cuenta en readers_overflow y
+mientras haya alguno de esos adentro no se libera nada.
+*/
+#define SR_EPOCH_MAX_READERS 64
+
+struct sr_epoch_reader {
+    unsigned long epoch;
+    int in_use;
+} __attribute__ ((aligned(64)));
+
+struct sr_epoch_retired {
+    void *ptr;
+    void (*free_fn)(void *);
+    unsigned long epoch;
+    struct sr_epoch_retired *next;
+};
+
+static struct sr_epoch_reader sr_epoch_readers[SR_EPOCH_MAX_READERS];
+static unsigned long sr_epoch_global = 1;
+static unsigned int sr_epoch_overflow = 0;
+static struct sr_epoch_retired *sr_epoch_retired_list = NULL;
+static pthread_mutex_t sr_epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct sr_epoch_reader *sr_epoch_self = NULL;
+static __thread int sr_epoch_self_tried = 0;
+static __thread unsigned int sr_epoch_nest = 0;
+
+void sr_epoch_enter(void)
+{
+    if (sr_epoch_nest++ > 0) {
+        return;
+    }
+    if (!sr_epoch_self && !sr_epoch_self_tried) {
+        sr_epoch_self_tried = 1;
+        for (int i = 0; i < SR_EPOCH_MAX_READERS; i++) {
+            int expected = 0;
+            if (__atomic_compare_exchange_n(&sr_epoch_readers[i].in_use, &expected, 1, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                sr_epoch_self = &sr_epoch_readers[i];
+                break;
+            }
+        }
+    }
+    if (sr_epoch_self) {
+        __atomic_store_n(&sr_epoch_self->epoch, __atomic_load_n(&sr_epoch_global, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&sr_epoch_overflow, 1, __ATOMIC_RELAXED);
+    }
+    /* Lo anotado tiene que verse antes de leer cualquier puntero protegido */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void sr_epoch_exit(void)
+{
+    if (--sr_epoch_nest > 0) {
+        return;
+    }
+    if (sr_epoch_self) {
+        __atomic_store_n(&sr_epoch_self->epoch, 0, __ATOMIC_RELEASE);
+    } else {
+        __atomic_sub_fetch(&sr_epoch_overflow, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Libera lo retirado que ya ningún lector puede estar usando */
+void sr_epoch_reclaim(void)
+{
+    pthread_mutex_lock(&sr_epoch_lock);
+    /* Que el cambio de puntero que precedió al retire se vea antes de mirar los lectores */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sr_epoch_overflow, __ATOMIC_ACQUIRE) > 0) {
+        pthread_mutex_unlock(&sr_epoch_lock);
+        return;
+    }
+    unsigned long oldest = 0;
+    for (int i = 0; i < SR_EPOCH_MAX_READERS; i++) {
+        unsigned long e = __atomic_load_n(&sr_epoch_readers[i].epoch, __ATOMIC_ACQUIRE);
+        if (e != 0 && (oldest == 0 || e < oldest)) {
+            oldest = e;
+        }
+    }
+
+    struct sr_epoch_retired **link = &sr_epoch_retired_list;
+    struct sr_epoch_retired *done = NULL;
+    while (*link) {
+        struct sr_epoch_retired *r = *link;
+        if (oldest == 0 || r->epoch < oldest) {
+            *link = r->next;
+            r->next = done;
+            done = r;
+        } else {
+            link = &r->next;
+        }
+    }
+    pthread_mutex_unlock(&sr_epoch_lock);
+
+    while (done) {
+        struct sr_epoch_retired *next = done->next;
+        done->free_fn(done->ptr);
+        free(done);
+        done = next;
+    }
+}
+
+/* Espera a que no quede adentro ningún lector que haya entrado en la época epoch o antes */
+static void sr_epoch_wait(unsigned long epoch)
+{
+    while (1) {
+        int busy = __atomic_load_n(&sr_epoch_overflow, __ATOMIC_ACQUIRE) > 0;
+        for (int i = 0; i < SR_EPOCH_MAX_READERS && !busy; i++) {
+            unsigned long e = __atomic_load_n(&sr_epoch_readers[i].epoch, __ATOMIC_ACQUIRE);
+            busy = (e != 0 && e <= epoch);
+        }
+        if (!busy) {
+            return;
+        }
+        sched_yield();
+    }
+}
+
+/*
+Espera a que salgan los lectores que estaban adentro al llamarla (los que entran después ya
+ven el puntero nuevo). Para cuando no alcanza con liberar tarde y hay que saber que nadie sigue
+con lo viejo, como la captura al cambiar de archivo. No se llama desde adentro de una época.
+*/
+void sr_epoch_barrier(void)
+{
+    pthread_mutex_lock(&sr_epoch_lock);
+    unsigned long epoch = __atomic_fetch_add(&sr_epoch_global, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&sr_epoch_lock);
+    sr_epoch_wait(epoch);
+}
+
+/*
+Deja ptr para liberar con free_fn cuando ya no lo vea nadie. Se llama después de sacarlo del
+puntero atómico. Si no hay memoria para anotarlo, espera a que salgan los lectores y lo libera.
+*/
+void sr_epoch_retire(void *ptr, void (*free_fn)(void *))
+{
+    if (!ptr) {
+        return;
+    }
+    struct sr_epoch_retired *r = (struct sr_epoch_retired *)malloc(sizeof(*r));
+    pthread_mutex_lock(&sr_epoch_lock);
+    unsigned long epoch = __atomic_fetch_add(&sr_epoch_global, 1, __ATOMIC_SEQ_CST);
+    if (r) {
+        r->ptr = ptr;
+        r->free_fn = free_fn;
+        r->epoch = epoch;
+        r->next = sr_epoch_retired_list;
+        sr_epoch_retired_list = r;
+    }
+    pthread_mutex_unlock(&sr_epoch_lock);
+
+    if (!r) {
+        sr_epoch_wait(epoch);
+        free_fn(ptr);
+        return;
+    }
+    sr_epoch_reclaim();
+}
+
@@ -0,0 +1,14 @@
+/*
+Liberación diferida por épocas (ver sr_epoch.c). Lo que se lee sin lock se usa entre
+sr_epoch_enter y sr_epoch_exit, y lo que se reemplaza se pasa a sr_epoch_retire.
+*/
+#ifndef SR_EPOCH_H
+#define SR_EPOCH_H
+
+void sr_epoch_enter(void);
+void sr_epoch_exit(void);
+void sr_epoch_retire(void *ptr, void (*free_fn)(void *));
+void sr_epoch_reclaim(void);
+void sr_epoch_barrier(void);
+
+#endif /* SR_EPOCH_H */
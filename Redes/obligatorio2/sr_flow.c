@@ -0,0 +1,333 @@
+/**********************************************************************
+ * file:  sr_flow.c
+ *
+ * Descripción:
+ *
+ * Exportación de flujos muestreada, en IPFIX.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_flow.h"
+
+/*
+Exportación de flujos muestreada, con formato IPFIX (RFC 7011). Uno de cada
+SR_FLOW_SAMPLE_RATE paquetes reenviados se suma a una tabla de flujos del hilo que lo
+reenvía (5-tupla de adentro, antes del NAT, más la interfaz de salida). La tabla es de tamaño
+fijo, se pide la primera vez que el hilo muestrea, y cuando no hay lugar se exporta el registro
+más viejo de la zona. Los registros salen por vencimiento activo (el flujo lleva
+SR_FLOW_ACTIVE_SEC) o inactivo (sin muestras en SR_FLOW_INACTIVE_SEC), a un colector en
+localhost por UDP o, si SR_FLOW_COLLECTOR_UNIX no es NULL, por un socket UNIX de datagramas.
+
+Los vencimientos no los revisa el hilo que reenvía (si deja de recibir no volvería a mirar
+nunca) sino el tic de un segundo del hilo de ARP, con sr_flow_poll: las tablas quedan anotadas
+en una lista y cada una tiene su lock, que el dueño toma solo al sumar una muestra, así que
+casi nunca se cruzan. Un flujo que se corta sale a los SR_FLOW_INACTIVE_SEC, llegue o no
+otro paquete.
+Los contadores son los de la muestra: cada registro lleva samplingSize = 1 y samplingPopulation =
+SR_FLOW_SAMPLE_RATE (RFC 5477), y el colector los multiplica por population / size.
+*/
+#define SR_FLOW_TABLE_SIZE 1024         /* Potencia de 2 */
+#define SR_FLOW_PROBE 4                 /* Lugares donde puede estar un flujo */
+#define SR_FLOW_ACTIVE_SEC 60
+#define SR_FLOW_INACTIVE_SEC 15
+#define SR_FLOW_COLLECTOR_PORT 4739     /* El de IPFIX */
+#define SR_FLOW_COLLECTOR_UNIX NULL     /* Por ejemplo "/tmp/sr_flows.sock" */
+#define SR_FLOW_MSG_MAX 1400
+#define SR_FLOW_TEMPLATE_EVERY 20       /* Cada cuántos mensajes se repite el template (por UDP se pierden) */
+
+#define SR_FLOW_TEMPLATE_ID 256
+#define SR_FLOW_RECORD_LEN 58
+
+/* Motivos de fin de flujo (flowEndReason) */
+#define SR_FLOW_END_IDLE 1
+#define SR_FLOW_END_ACTIVE 2
+#define SR_FLOW_END_NO_ROOM 5
+
+/* Campos del template: {elemento IPFIX, largo} en el orden en que van en cada registro */
+static const uint16_t sr_flow_template[][2] = {
+    {8, 4},     /* sourceIPv4Address */
+    {12, 4},    /* destinationIPv4Address */
+    {7, 2},     /* sourceTransportPort */
+    {11, 2},    /* destinationTransportPort */
+    {4, 1},     /* protocolIdentifier */
+    {14, 4},    /* egressInterface */
+    {2, 8},     /* packetDeltaCount */
+    {1, 8},     /* octetDeltaCount */
+    {152, 8},   /* flowStartMilliseconds */
+    {153, 8},   /* flowEndMilliseconds */
+    {136, 1},   /* flowEndReason */
+    {309, 4},   /* samplingSize: se toma 1 paquete... */
+    {310, 4},   /* samplingPopulation: ...de cada SR_FLOW_SAMPLE_RATE */
+};
+
+struct sr_flow_rec {
+    struct sr_flow_key key;
+    uint32_t out_if;            /* Posición de la interfaz de salida en if_list, desde 1 (0 = libre) */
+    uint64_t packets;
+    uint64_t octets;
+    uint64_t first_ms;
+    uint64_t last_ms;
+};
+
+struct sr_flow_exporter {
+    pthread_mutex_t lock;       /* Entre el hilo dueño y sr_flow_poll */
+    struct sr_flow_exporter *next;
+    int fd;                     /* -1 hasta el primer envío */
+    uint32_t domain;            /* Observation domain: uno por hilo, así cada uno lleva su secuencia */
+    uint32_t seq;               /* Registros de datos exportados */
+    unsigned int msgs;
+    uint8_t msg[SR_FLOW_MSG_MAX];
+    unsigned int msg_len;       /* 0 = no hay mensaje abierto */
+    unsigned int set_off;       /* Dónde empieza el set de datos abierto */
+    struct sr_flow_rec table[SR_FLOW_TABLE_SIZE];
+};
+
+__thread unsigned int sr_flow_countdown = 0;
+static __thread struct sr_flow_exporter *flow_exp = NULL;
+static struct sr_flow_exporter *flow_exporters = NULL;  /* Todas las tablas, para sr_flow_poll */
+static pthread_mutex_t flow_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t flow_next_domain = 0;
+static unsigned long flow_stat_samples = 0;
+static unsigned long flow_stat_records = 0;
+static unsigned long flow_stat_msgs = 0;
+
+static uint64_t sr_flow_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint8_t *sr_flow_put16(uint8_t *p, uint16_t v) { v = htons(v); memcpy(p, &v, 2); return p + 2; }
+static uint8_t *sr_flow_put32(uint8_t *p, uint32_t v) { v = htonl(v); memcpy(p, &v, 4); return p + 4; }
+static uint8_t *sr_flow_put64(uint8_t *p, uint64_t v)
+{
+    p = sr_flow_put32(p, (uint32_t)(v >> 32));
+    return sr_flow_put32(p, (uint32_t)v);
+}
+
+/* Manda el mensaje armado (cerrando el set de datos) al colector */
+static void sr_flow_send_msg(struct sr_flow_exporter *exp)
+{
+    if (exp->msg_len == 0) {
+        return;
+    }
+    sr_flow_put16(exp->msg + exp->set_off + 2, exp->msg_len - exp->set_off);
+    sr_flow_put16(exp->msg + 2, exp->msg_len);
+
+    if (exp->fd < 0) {
+        if (SR_FLOW_COLLECTOR_UNIX) {
+            exp->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        } else {
+            exp->fd = socket(AF_INET, SOCK_DGRAM, 0);
+        }
+        if (exp->fd < 0) {
+            perror("socket (exportación de flujos)");
+        }
+    }
+    if (exp->fd >= 0) {
+        ssize_t r;
+        if (SR_FLOW_COLLECTOR_UNIX) {
+            struct sockaddr_un sun;
+            memset(&sun, 0, sizeof(sun));
+            sun.sun_family = AF_UNIX;
+            strncpy(sun.sun_path, SR_FLOW_COLLECTOR_UNIX ? SR_FLOW_COLLECTOR_UNIX : "", sizeof(sun.sun_path) - 1);
+            r = sendto(exp->fd, exp->msg, exp->msg_len, MSG_DONTWAIT, (struct sockaddr *)&sun, sizeof(sun));
+        } else {
+            struct sockaddr_in sin;
+            memset(&sin, 0, sizeof(sin));
+            sin.sin_family = AF_INET;
+            sin.sin_port = htons(SR_FLOW_COLLECTOR_PORT);
+            sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            r = sendto(exp->fd, exp->msg, exp->msg_len, MSG_DONTWAIT, (struct sockaddr *)&sin, sizeof(sin));
+        }
+        /* Si no hay colector escuchando se pierde, como cualquier exportación por UDP */
+        (void)r;
+    }
+    exp->msg_len = 0;
+    exp->msgs++;
+    __atomic_add_fetch(&flow_stat_msgs, 1, __ATOMIC_RELAXED);
+}
+
+/* Abre un mensaje: cabezal, template si toca y el cabezal del set de datos */
+static void sr_flow_open_msg(struct sr_flow_exporter *exp)
+{
+    uint8_t *p = exp->msg;
+    p = sr_flow_put16(p, 10);                       /* Versión IPFIX */
+    p = sr_flow_put16(p, 0);                        /* Largo, al cerrar */
+    p = sr_flow_put32(p, (uint32_t)time(NULL));
+    p = sr_flow_put32(p, exp->seq);
+    p = sr_flow_put32(p, exp->domain);
+
+    if (exp->msgs % SR_FLOW_TEMPLATE_EVERY == 0) {
+        unsigned int nfields = sizeof(sr_flow_template) / sizeof(sr_flow_template[0]);
+        p = sr_flow_put16(p, 2);                    /* Set de templates */
+        p = sr_flow_put16(p, 4 + 4 + 4 * nfields);
+        p = sr_flow_put16(p, SR_FLOW_TEMPLATE_ID);
+        p = sr_flow_put16(p, nfields);
+        for (unsigned int i = 0; i < nfields; i++) {
+            p = sr_flow_put16(p, sr_flow_template[i][0]);
+            p = sr_flow_put16(p, sr_flow_template[i][1]);
+        }
+    }
+
+    exp->set_off = p - exp->msg;
+    p = sr_flow_put16(p, SR_FLOW_TEMPLATE_ID);
+    p = sr_flow_put16(p, 0);                        /* Largo del set, al cerrar */
+    exp->msg_len = p - exp->msg;
+}
+
+/* Pasa el registro al mensaje (mandándolo si se llena) y libera el lugar */
+static void sr_flow_export(struct sr_flow_exporter *exp, struct sr_flow_rec *rec, uint8_t reason)
+{
+    if (exp->msg_len && exp->msg_len + SR_FLOW_RECORD_LEN > SR_FLOW_MSG_MAX) {
+        sr_flow_send_msg(exp);
+    }
+    if (exp->msg_len == 0) {
+        sr_flow_open_msg(exp);
+    }
+
+    uint8_t *p = exp->msg + exp->msg_len;
+    memcpy(p, &rec->key.src, 4);
+    memcpy(p + 4, &rec->key.dst, 4);
+    p = sr_flow_put16(p + 8, rec->key.sport);
+    p = sr_flow_put16(p, rec->key.dport);
+    *p++ = rec->key.proto;
+    p = sr_flow_put32(p, rec->out_if);
+    p = sr_flow_put64(p, rec->packets);
+    p = sr_flow_put64(p, rec->octets);
+    p = sr_flow_put64(p, rec->first_ms);
+    p = sr_flow_put64(p, rec->last_ms);
+    *p++ = reason;
+    p = sr_flow_put32(p, 1);
+    p = sr_flow_put32(p, SR_FLOW_SAMPLE_RATE);
+    exp->msg_len = p - exp->msg;
+
+    exp->seq++;
+    __atomic_add_fetch(&flow_stat_records, 1, __ATOMIC_RELAXED);
+    rec->out_if = 0;
+}
+
+/* Exporta lo vencido y manda lo que haya quedado en el mensaje */
+static void sr_flow_sweep(struct sr_flow_exporter *exp, uint64_t now_ms)
+{
+    for (unsigned int i = 0; i < SR_FLOW_TABLE_SIZE; i++) {
+        struct sr_flow_rec *rec = &exp->table[i];
+        if (rec->out_if == 0) {
+            continue;
+        }
+        if (now_ms - rec->last_ms >= SR_FLOW_INACTIVE_SEC * 1000ull) {
+            sr_flow_export(exp, rec, SR_FLOW_END_IDLE);
+        } else if (now_ms - rec->first_ms >= SR_FLOW_ACTIVE_SEC * 1000ull) {
+            sr_flow_export(exp, rec, SR_FLOW_END_ACTIVE);
+        }
+    }
+    sr_flow_send_msg(exp);
+}
+
+/*
+Revisa los vencimientos de todas las tablas y manda lo que quedó en los mensajes. La llama el
+hilo de ARP una vez por segundo. Las tablas no se liberan: si un hilo termina, lo suyo sale igual.
+*/
+void sr_flow_poll(void)
+{
+    uint64_t now_ms = sr_flow_now_ms();
+
+    pthread_mutex_lock(&flow_list_lock);
+    struct sr_flow_exporter *list = flow_exporters;
+    pthread_mutex_unlock(&flow_list_lock);
+    for (struct sr_flow_exporter *exp = list; exp; exp = exp->next) {
+        pthread_mutex_lock(&exp->lock);
+        sr_flow_sweep(exp, now_ms);
+        pthread_mutex_unlock(&exp->lock);
+    }
+}
+
+/* La tabla del hilo; la primera vez la pide y la anota en la lista. NULL si no hay memoria */
+static struct sr_flow_exporter *sr_flow_exporter_get(void)
+{
+    if (flow_exp) {
+        return flow_exp;
+    }
+    struct sr_flow_exporter *exp = calloc(1, sizeof(struct sr_flow_exporter));
+    if (!exp) {
+        return NULL;
+    }
+    pthread_mutex_init(&exp->lock, NULL);
+    exp->fd = -1;
+    exp->domain = __atomic_add_fetch(&flow_next_domain, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&flow_list_lock);
+    exp->next = flow_exporters;
+    flow_exporters = exp;
+    pthread_mutex_unlock(&flow_list_lock);
+    flow_exp = exp;
+    return exp;
+}
+
+/* Suma una muestra a la tabla del hilo. Solo se llama 1 de cada SR_FLOW_SAMPLE_RATE paquetes */
+void sr_flow_add_sample(struct sr_instance *sr, const struct sr_flow_key *key, uint32_t flow_hash,
+                        struct sr_if *iface_out, unsigned int ip_len)
+{
+    struct sr_flow_exporter *exp = sr_flow_exporter_get();
+    if (!exp) {
+        return;
+    }
+    uint64_t now_ms = sr_flow_now_ms();
+    __atomic_add_fetch(&flow_stat_samples, 1, __ATOMIC_RELAXED);
+
+    uint32_t out_if = 1;
+    for (struct sr_if *iface = sr->if_list; iface && iface != iface_out; iface = iface->next) {
+        out_if++;
+    }
+
+    pthread_mutex_lock(&exp->lock);
+    uint32_t base = (flow_hash ^ (out_if * 0x9E3779B1u)) & (SR_FLOW_TABLE_SIZE - 1);
+    struct sr_flow_rec *rec = NULL;
+    struct sr_flow_rec *victim = NULL;   /* Un lugar libre o, si no hay, el que hace más que no se usa */
+    for (unsigned int i = 0; i < SR_FLOW_PROBE; i++) {
+        struct sr_flow_rec *r = &exp->table[(base + i) & (SR_FLOW_TABLE_SIZE - 1)];
+        if (r->out_if == out_if && r->key.src == key->src && r->key.dst == key->dst
+            && r->key.proto == key->proto && r->key.sport == key->sport && r->key.dport == key->dport) {
+            rec = r;
+            break;
+        }
+        if (!victim || (victim->out_if != 0 && (r->out_if == 0 || r->last_ms < victim->last_ms))) {
+            victim = r;
+        }
+    }
+    if (!rec) {
+        rec = victim;
+        if (rec->out_if != 0) {
+            sr_flow_export(exp, rec, SR_FLOW_END_NO_ROOM);
+        }
+        rec->key = *key;
+        rec->out_if = out_if;
+        rec->packets = 0;
+        rec->octets = 0;
+        rec->first_ms = now_ms;
+    }
+    rec->packets++;
+    rec->octets += ip_len;
+    rec->last_ms = now_ms;
+    pthread_mutex_unlock(&exp->lock);
+}
+
+void sr_flow_print_stats(void)
+{
+    printf("Flujos: %lu muestras (1 de cada %d), %lu registros exportados en %lu mensajes\n",
+           flow_stat_samples, SR_FLOW_SAMPLE_RATE, flow_stat_records, flow_stat_msgs);
+}
+
@@ -0,0 +1,102 @@
+/*
+Exportación de flujos muestreada (ver sr_flow.c) y la 5-tupla de un paquete. La clave, su hash
+y el muestreo van inline: se usan en cada paquete desde sr_router.c, sr_acl.c, sr_ct.c y sr_nat.c.
+*/
+#ifndef SR_FLOW_H
+#define SR_FLOW_H
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "sr_protocol.h"
+
+#define SR_FLOW_EXPORT_ENABLED 1
+#define SR_FLOW_SAMPLE_RATE 1000
+
+struct sr_instance;
+struct sr_if;
+
+/*
+La 5-tupla de un paquete IP. Se arma una sola vez al parsear (queda en sr_pkt_meta) y la usan
+el hash de ECMP, las ACLs, conntrack y el NAT.
+*/
+struct sr_flow_key {
+    uint32_t src;
+    uint32_t dst;
+    uint8_t proto;
+    uint16_t sport; /* En orden de host; en ICMP echo es el id; 0 si no hay o es un fragmento del medio */
+    uint16_t dport;
+};
+
+static inline void sr_flow_key_extract(struct sr_flow_key *k, sr_ip_hdr_t *ip_hdr,
+                                       unsigned int ip_hdr_len, unsigned int avail_len)
+{
+    k->src = ip_hdr->ip_src;
+    k->dst = ip_hdr->ip_dst;
+    k->proto = ip_hdr->ip_p;
+    k->sport = 0;
+    k->dport = 0;
+
+    if ((ip_hdr->ip_p == ip_protocol_udp || ip_hdr->ip_p == 6)
+        && (ntohs(ip_hdr->ip_off) & IP_OFFMASK) == 0
+        && avail_len >= ip_hdr_len + 4) {
+        uint16_t ports[2];
+        memcpy(ports, (uint8_t *)ip_hdr + ip_hdr_len, sizeof(ports));
+        k->sport = ntohs(ports[0]);
+        k->dport = ntohs(ports[1]);
+    }
+
+    /* En los echo de ICMP el identificador hace de puerto en los dos sentidos, así el
+    request y el reply caen en la misma conexión */
+    if (ip_hdr->ip_p == ip_protocol_icmp
+        && (ntohs(ip_hdr->ip_off) & IP_OFFMASK) == 0
+        && avail_len >= ip_hdr_len + 8) {
+        uint8_t *icmp = (uint8_t *)ip_hdr + ip_hdr_len;
+        if (icmp[0] == 8 || icmp[0] == 0) {
+            uint16_t id;
+            memcpy(&id, icmp + 4, sizeof(id));
+            k->sport = ntohs(id);
+            k->dport = ntohs(id);
+        }
+    }
+}
+
+/*
+Hash del flujo: direcciones, protocolo y puertos (o id de ICMP echo). Lo usa ECMP, así todos
+los paquetes de un flujo salen por el mismo camino, y conntrack para ubicar la conexión.
+*/
+static inline uint32_t sr_flow_key_hash(const struct sr_flow_key *k)
+{
+    uint32_t h = k->src * 0x9E3779B1u;
+    h ^= k->dst * 0x85EBCA6Bu;
+    h ^= ((uint32_t)k->sport << 16 | k->dport) * 0xC2B2AE35u;
+    h ^= k->proto;
+
+    /* Mezcla final (la de murmur3) para que los bits bajos dependan de todo */
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+extern __thread unsigned int sr_flow_countdown;
+
+void sr_flow_add_sample(struct sr_instance *sr, const struct sr_flow_key *key, uint32_t flow_hash,
+                        struct sr_if *iface_out, unsigned int ip_len);
+
+/* Gancho del camino de reenvío: casi siempre es solo restar un contador del hilo */
+static inline void sr_flow_sample(struct sr_instance *sr, const struct sr_flow_key *key, uint32_t flow_hash,
+                                  struct sr_if *iface_out, unsigned int ip_len)
+{
+    if (SR_FLOW_EXPORT_ENABLED && sr_flow_countdown-- == 0) {
+        sr_flow_countdown = SR_FLOW_SAMPLE_RATE - 1;
+        sr_flow_add_sample(sr, key, flow_hash, iface_out, ip_len);
+    }
+}
+
+void sr_flow_poll(void);
+void sr_flow_print_stats(void);
+
+#endif /* SR_FLOW_H */
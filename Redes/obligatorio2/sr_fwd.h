@@ -0,0 +1,73 @@
+/*
+Lo que exporta sr_router.c además de lo del enunciado (sr_router.h): la búsqueda de rutas,
+los MTU por interfaz, el limitador de errores ICMP, las direcciones locales y la entrada por
+lotes que usan los backends de sr_io.c. Los checksums incrementales van inline porque los usa
+también el NAT en cada paquete.
+*/
+#ifndef SR_FWD_H
+#define SR_FWD_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define SR_MAX_MTU 9000
+#define SR_BATCH_MAX 32        /* Paquetes que entran de una vez a sr_handlepacket_batch */
+
+struct sr_instance;
+struct sr_rt;
+
+/* Suma de complemento a uno sin plegar, para ir armando checksums por partes */
+static inline uint32_t sr_cksum_add(const void *data, unsigned int len, uint32_t sum)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint16_t word;
+
+    while (len > 1) {
+        memcpy(&word, p, sizeof(word));
+        sum += word;
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        uint8_t last[2] = {*p, 0};
+        memcpy(&word, last, sizeof(word));
+        sum += word;
+    }
+    return sum;
+}
+
+/* Pliega la suma y la complementa: queda listo para guardar en el campo de checksum */
+static inline uint16_t sr_cksum_finish(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/* Ajusta un checksum cuando un campo de 16 bits pasa de old_val a new_val (RFC 1624) */
+static inline uint16_t sr_cksum_replace16(uint16_t sum, uint16_t old_val, uint16_t new_val)
+{
+    uint32_t acc = (uint16_t)~sum;
+    acc += (uint16_t)~old_val;
+    acc += new_val;
+    return sr_cksum_finish(acc);
+}
+
+struct sr_rt *sr_lpm_lookup(struct sr_instance *sr, uint32_t dest_ip);
+struct sr_rt *sr_lpm_lookup_linear(struct sr_instance *sr, uint32_t dest_ip);
+
+int sr_if_set_mtu(const char *ifname, unsigned int mtu);
+void sr_mtu_poll(void);
+
+int sr_icmp_ratelimit_set(uint32_t global_pps, uint32_t global_burst, uint32_t prefix_pps, uint32_t prefix_burst);
+void sr_icmp_ratelimit_poll(void);
+void sr_icmp_ratelimit_print_stats(void);
+
+void sr_local_addr_rebuild(struct sr_instance *sr);
+void sr_local_addr_poll(struct sr_instance *sr);
+
+void sr_handlepacket_batch(struct sr_instance* sr, uint8_t **packets, unsigned int *lens,
+                           unsigned int n, char* interface);
+
+#endif /* SR_FWD_H */
@@ -0,0 +1,1578 @@
+/**********************************************************************
+ * file:  sr_io.c
+ *
+ * Descripción:
+ *
+ * Buffers de paquete y backends de E/S: VNS, AF_PACKET crudo, anillo
+ * PACKET_MMAP, io_uring y AF_XDP.
+ *
+ **********************************************************************/
+
+#define _GNU_SOURCE /* recvmmsg/sendmmsg para el backend de E/S crudo */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <linux/io_uring.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/bpf.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_fwd.h"
+#include "sr_tap.h"
+#include "sr_io.h"
+#include "sr_txq.h"
+
+/*
+Buffers de paquete con contador de referencias. Los datos van en una ventana data/len dentro
+del bloque, con SR_PKTBUF_HEADROOM bytes libres adelante para agregar cabezales sin copiar.
+Cada uno que se guarda el buffer (la cola de ARP, un lote de envío pendiente) toma una
+referencia y la suelta al terminar; el último sr_pktbuf_put lo libera. Así el mismo paquete
+puede estar en la cola y en un envío a la vez sin que nadie lo copie.
+*/
+struct sr_pktbuf *sr_pktbuf_alloc(unsigned int len)
+{
+    struct sr_pktbuf *pb = (struct sr_pktbuf *)malloc(sizeof(struct sr_pktbuf) + SR_PKTBUF_HEADROOM + len);
+    if (!pb) {
+        return NULL;
+    }
+    pb->refcnt = 1;
+    pb->data = pb->mem + SR_PKTBUF_HEADROOM;
+    pb->len = len;
+    return pb;
+}
+
+/* Un buffer nuevo con una copia de data (para paquetes prestados, como los que da VNS) */
+struct sr_pktbuf *sr_pktbuf_copy(const uint8_t *data, unsigned int len)
+{
+    struct sr_pktbuf *pb = sr_pktbuf_alloc(len);
+    if (pb) {
+        memcpy(pb->data, data, len);
+    }
+    return pb;
+}
+
+uint8_t *sr_pktbuf_data(struct sr_pktbuf *pb)
+{
+    return pb->data;
+}
+
+/* Agranda la ventana n bytes hacia adelante; NULL si no queda headroom */
+uint8_t *sr_pktbuf_push(struct sr_pktbuf *pb, unsigned int n)
+{
+    if ((unsigned int)(pb->data - pb->mem) < n) {
+        return NULL;
+    }
+    pb->data -= n;
+    pb->len += n;
+    return pb->data;
+}
+
+struct sr_pktbuf *sr_pktbuf_get(struct sr_pktbuf *pb)
+{
+    __atomic_add_fetch(&pb->refcnt, 1, __ATOMIC_RELAXED);
+    return pb;
+}
+
+void sr_pktbuf_put(struct sr_pktbuf *pb)
+{
+    if (pb && __atomic_sub_fetch(&pb->refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(pb);
+    }
+}
+
+/*
+Backend de E/S alternativo al de VNS: sockets AF_PACKET crudos, uno por interfaz (sirve con
+veth), para probar el router en una máquina Linux común. Se recibe de a lotes con recvmmsg y
+cada lote entra entero a sr_handlepacket_batch. Lo que se manda mientras se procesa el lote
+se junta por interfaz y sale con un solo sendmmsg al final, así se paga una syscall por lote
+y no una por trama. Los envíos de otros hilos (RIP, ARP) salen directo con send.
+
+Para usarlo, main llama a sr_io_run(sr, "raw") en vez del loop de VNS, con sr->if_list ya
+cargada (sr_local.c es ese main: arma las interfaces desde las de Linux y elige el backend).
+Todos los envíos del router pasan por sr_io_send, que sin este backend es sr_send_packet.
+Se cuentan las syscalls para comparar syscalls por paquete contra el camino de VNS.
+*/
+#define SR_IO_RAW_ENABLED 1
+
+#define SR_IO_VNS 0
+#define SR_IO_RAW 1
+#define SR_IO_RING 2
+#define SR_IO_URING 3
+#define SR_IO_XDP 4
+
+/*
+Modo anillo (PACKET_MMAP, TPACKET_V2): el kernel deja las tramas en un anillo compartido y
+el router las procesa ahí mismo, sin copiarlas a un buffer propio; los envíos se escriben en
+el anillo de TX y se largan todos juntos con un send vacío al final del lote. Es lo más
+parecido a AF_XDP que se puede hacer sin cargar un programa XDP, y anda igual en veth.
+Se arranca con sr_io_run(sr, "ring").
+Los frames del anillo son de 2048 bytes: una trama más larga (jumbo) llega cortada y se
+descarta, y sr_io_ring_send rechaza lo que no entra. Para jumbo están los otros backends.
+*/
+#define SR_IO_RING_FRAME 2048
+#define SR_IO_RING_DATA_MAX (SR_IO_RING_FRAME - (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll)))
+#define SR_IO_RING_BLOCK (4096 * 4)
+#define SR_IO_RING_RX_BLOCKS 64
+#define SR_IO_RING_TX_BLOCKS 16
+
+struct sr_io_ring {
+  uint8_t *base;
+  unsigned int frames;
+  unsigned int next;
+};
+
+/* Un anillo de AF_XDP (RX, TX, fill o completion): productor y consumidor compartidos con el kernel */
+struct sr_io_xring {
+  uint32_t *producer;
+  uint32_t *consumer;
+  uint32_t *flags;
+  void *descs;
+  uint32_t mask;
+  void *map;       /* Lo que devolvió el mmap, para soltarlo */
+  size_t map_len;
+};
+
+struct sr_io_port {
+  char name[sr_IFACE_NAMELEN];
+  int fd;
+  int ifindex;
+  /* Envíos pendientes del hilo que recibe; se copian porque el que llama libera su buffer */
+  unsigned int tx_n;
+  struct mmsghdr tx_msgs[SR_BATCH_MAX];
+  struct iovec tx_iov[SR_BATCH_MAX];
+  uint8_t tx_bufs[SR_BATCH_MAX][SR_IO_FRAME_MAX];
+  struct sr_pktbuf *tx_refs[SR_BATCH_MAX]; /* Si no es NULL, el envío apunta a ese buffer en vez de a tx_bufs */
+  /* Solo en modo anillo. El de TX lo usan varios hilos, por eso el lock */
+  struct sr_io_ring rx;
+  struct sr_io_ring tx;
+  pthread_mutex_t tx_lock;
+  /* Solo en AF_XDP: anillos del socket y el programa XDP que le manda las tramas */
+  struct sr_io_xring xrx, xtx, xfill, xcomp;
+  int xsk_map_fd;
+  int xdp_prog_fd;
+  int xdp_link_fd;
+};
+
+static int sr_io_backend = SR_IO_VNS;
+static struct sr_io_port sr_io_ports[SR_IO_MAX_PORTS];
+static int sr_io_nports = 0;
+__thread int sr_io_batching = 0;
+static __thread int sr_io_direct = 0; /* Hilo que recibe en io_uring: manda sin pasar por las colas */
+
+static unsigned long io_stat_rx = 0;
+static unsigned long io_stat_tx = 0;
+static unsigned long io_stat_syscalls = 0;
+
+static struct sr_io_port *sr_io_port_get(const char *name)
+{
+  for (int i = 0; i < sr_io_nports; i++) {
+    if (strncmp(sr_io_ports[i].name, name, sr_IFACE_NAMELEN) == 0) {
+      return &sr_io_ports[i];
+    }
+  }
+  return NULL;
+}
+
+static struct tpacket2_hdr *sr_io_ring_frame(struct sr_io_ring *ring, unsigned int i)
+{
+  return (struct tpacket2_hdr *)(ring->base + (size_t)i * SR_IO_RING_FRAME);
+}
+
+/* Larga lo que haya en el anillo de TX. Con tx_lock tomado */
+static void sr_io_ring_kick(struct sr_io_port *port)
+{
+  if (send(port->fd, NULL, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN) {
+    perror("send(TX_RING)");
+  }
+  __atomic_add_fetch(&io_stat_syscalls, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&io_stat_tx, port->tx_n, __ATOMIC_RELAXED);
+  port->tx_n = 0;
+}
+
+static int sr_io_ring_send(struct sr_io_port *port, uint8_t *buf, unsigned int len)
+{
+  int ret = 0;
+
+  if (len > SR_IO_RING_DATA_MAX) {
+    return -1;
+  }
+  pthread_mutex_lock(&port->tx_lock);
+  struct tpacket2_hdr *hdr = sr_io_ring_frame(&port->tx, port->tx.next);
+  uint32_t status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+  if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT) {
+    /* Anillo lleno: se empuja lo pendiente y esta trama se pierde */
+    sr_io_ring_kick(port);
+    ret = -1;
+  } else {
+    memcpy((uint8_t *)hdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll), buf, len);
+    hdr->tp_len = len;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    port->tx.next = (port->tx.next + 1) % port->tx.frames;
+    port->tx_n++;
+    if (!sr_io_batching) {
+      sr_io_ring_kick(port);
+    }
+  }
+  pthread_mutex_unlock(&port->tx_lock);
+  return ret;
+}
+
+/*
+Backend io_uring, con las syscalls a mano (sin liburing). Un solo anillo para todos los puertos:
+- Los buffers de paquete salen de un pool mapeado una vez y registrado entero con
+  IORING_REGISTER_BUFFERS. Los primeros SR_IO_URING_RX_BUFS se le prestan al kernel como
+  anillo de buffers (IORING_REGISTER_PBUF_RING) y el resto son slots de TX.
+- Cada puerto tiene un recv multishot armado: una sola SQE que deja una CQE por trama, con el
+  buffer que el kernel sacó del anillo. Si una CQE viene sin IORING_CQE_F_MORE (por ejemplo
+  porque se quedó sin buffers) se vuelve a armar.
+- Lo que manda el hilo que recibe desde el buffer donde llegó la trama (el reenvío y el echo
+  reply, que la modifican en el lugar) sale con IORING_OP_WRITE_FIXED desde ese mismo buffer,
+  sin copiarlo; el buffer vuelve al anillo cuando llega la CQE del envío. Lo demás (errores
+  ICMP, ARP, RIP, otros hilos) se copia a un slot de TX.
+- Las SQE de la vuelta se entregan en el mismo io_uring_enter que espera las CQE siguientes,
+  así con tráfico hay una syscall por vuelta, no una por trama ni una por lote de cada puerto.
+El kernel igual copia la trama al skb al mandarla por AF_PACKET: lo que se ahorra es la copia
+en espacio de usuario y las syscalls. Necesita Linux 6.0 o más nuevo (recv multishot).
+El hilo que recibe manda directo (sr_io_direct) aunque estén las colas de salida: encolar
+obligaría a copiar la trama a un sr_pktbuf, que es justo lo que se quiere evitar. Las clases
+de las colas valen para lo que mandan los otros hilos.
+*/
+#define SR_IO_URING_ENTRIES 256
+#define SR_IO_URING_CQ_ENTRIES 4096
+#define SR_IO_URING_RX_BUFS 1024 /* Potencia de 2, lo pide el anillo de buffers */
+#define SR_IO_URING_TX_BUFS 256
+#define SR_IO_URING_BUF_SIZE ((SR_IO_FRAME_MAX + 63) & ~(size_t)63)
+#define SR_IO_URING_BGID 0
+
+/* Qué es cada CQE: va en el byte alto de user_data y el índice (puerto, buffer o slot) abajo */
+#define SR_IO_URING_RECV 1ULL
+#define SR_IO_URING_TX_RX 2ULL /* Envío desde el buffer de RX de la trama */
+#define SR_IO_URING_TX 3ULL    /* Envío desde un slot de TX */
+#define SR_IO_URING_TAG(op, i) (((op) << 56) | (i))
+
+struct sr_io_uring {
+  int fd;
+  unsigned int *sq_head, *sq_tail, *sq_array;
+  unsigned int sq_mask, sq_entries;
+  struct io_uring_sqe *sqes;
+  unsigned int *cq_head, *cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe *cqes;
+  /* La SQ y los slots de TX libres los usan todos los hilos; las CQE solo el que recibe */
+  pthread_mutex_t lock;
+  unsigned int sq_pending; /* SQE escritas que todavía no se le pasaron al kernel */
+  unsigned int tx_free[SR_IO_URING_TX_BUFS];
+  unsigned int tx_nfree;
+  uint8_t *pool;
+  struct io_uring_buf_ring *br;
+  unsigned short br_tail;
+  /* Solo del hilo que recibe */
+  unsigned short rx_refs[SR_IO_URING_RX_BUFS]; /* Envíos en vuelo desde el buffer */
+  unsigned char rx_busy[SR_IO_URING_RX_BUFS];  /* Está en el lote que se procesa */
+};
+
+static struct sr_io_uring sr_io_uring;
+
+static int sr_io_uring_enter(unsigned int to_submit, unsigned int wait)
+{
+  int r = syscall(__NR_io_uring_enter, sr_io_uring.fd, to_submit, wait,
+                  wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  __atomic_add_fetch(&io_stat_syscalls, 1, __ATOMIC_RELAXED);
+  return r;
+}
+
+/* Entrega las SQE pendientes. Con el lock tomado */
+static void sr_io_uring_submit_locked(struct sr_io_uring *u)
+{
+  while (u->sq_pending) {
+    int r = sr_io_uring_enter(u->sq_pending, 0);
+    if (r <= 0) {
+      if (r < 0 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    u->sq_pending -= r;
+  }
+}
+
+/* Próxima SQE libre (en cero) o NULL si la SQ está llena. Con el lock; se publica con _commit */
+static struct io_uring_sqe *sr_io_uring_sqe(struct sr_io_uring *u)
+{
+  unsigned int tail = *u->sq_tail;
+  if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries) {
+    sr_io_uring_submit_locked(u);
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) == u->sq_entries) {
+      return NULL;
+    }
+  }
+  struct io_uring_sqe *sqe = &u->sqes[tail & u->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+static void sr_io_uring_commit(struct sr_io_uring *u)
+{
+  unsigned int tail = *u->sq_tail;
+  u->sq_array[tail & u->sq_mask] = tail & u->sq_mask;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  u->sq_pending++;
+}
+
+static int sr_io_uring_send(struct sr_io_port *port, uint8_t *buf, unsigned int len)
+{
+  struct sr_io_uring *u = &sr_io_uring;
+  const size_t rx_area = (size_t)SR_IO_URING_RX_BUFS * SR_IO_URING_BUF_SIZE;
+  int from_rx = sr_io_direct && buf >= u->pool && buf + len <= u->pool + rx_area;
+  unsigned int idx;
+  uint8_t *src = buf;
+
+  pthread_mutex_lock(&u->lock);
+  if (from_rx) {
+    idx = (unsigned int)((buf - u->pool) / SR_IO_URING_BUF_SIZE);
+  } else {
+    if (u->tx_nfree == 0) {
+      pthread_mutex_unlock(&u->lock);
+      return -1;
+    }
+    idx = u->tx_free[--u->tx_nfree];
+    src = u->pool + rx_area + (size_t)idx * SR_IO_URING_BUF_SIZE;
+    memcpy(src, buf, len);
+  }
+  struct io_uring_sqe *sqe = sr_io_uring_sqe(u);
+  if (!sqe) {
+    if (!from_rx) {
+      u->tx_free[u->tx_nfree++] = idx;
+    }
+    pthread_mutex_unlock(&u->lock);
+    return -1;
+  }
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = port->fd;
+  sqe->addr = (uintptr_t)src;
+  sqe->len = len;
+  sqe->buf_index = 0; /* El pool está registrado como un solo buffer */
+  sqe->user_data = SR_IO_URING_TAG(from_rx ? SR_IO_URING_TX_RX : SR_IO_URING_TX, idx);
+  sr_io_uring_commit(u);
+  if (from_rx) {
+    u->rx_refs[idx]++;
+  } else if (sr_io_batching) {
+    /* El hilo de las colas: sale en el sr_io_flush del final de su lote */
+    port->tx_n++;
+  } else if (!sr_io_direct) {
+    sr_io_uring_submit_locked(u);
+  }
+  pthread_mutex_unlock(&u->lock);
+  return 0;
+}
+
+/*
+Backend AF_XDP. Un programa XDP chiquito (cargado a mano con bpf(), sin libbpf) manda cada
+trama de la interfaz al socket XDP del puerto por un XSKMAP. Todos los sockets comparten
+una sola UMEM (XDP_SHARED_UMEM), cada uno con sus anillos de fill y completion, así una
+trama recibida por un puerto se puede mandar por otro sin copiarla: se pone la misma
+dirección de la UMEM en el anillo de TX del puerto de salida, y el frame vuelve a la lista
+libre cuando aparece en el anillo de completion. Los envíos que no salen de una trama
+recibida (ICMP, ARP, RIP, otros hilos) toman un frame libre y se copian ahí.
+Los frames de la UMEM son de 4096 bytes: sin multi-buffer (XDP_USE_SG, no está hecho) no
+entran tramas jumbo, esas el kernel las descarta antes del socket.
+En veth el driver no tiene modo zero-copy, así que el socket es XDP_COPY (el kernel copia
+entre el skb y la UMEM); lo que se ahorra es la copia del router y las syscalls. Con una
+placa que soporte zero-copy alcanza con sacar XDP_COPY del bind.
+*/
+#define SR_IO_XDP_FRAME 4096
+#define SR_IO_XDP_FRAMES 8192
+#define SR_IO_XDP_RING 1024 /* Tamaño de cada anillo (potencia de 2) */
+#define SR_IO_XDP_DATA_MAX (SR_IO_XDP_FRAME - XDP_PACKET_HEADROOM)
+
+struct sr_io_xdp {
+  uint8_t *umem;
+  int umem_fd; /* El socket que registró la UMEM; los otros la comparten */
+  /* Lista libre, anillos de TX y completion, y referencias: de todos los hilos */
+  pthread_mutex_t lock;
+  uint32_t free[SR_IO_XDP_FRAMES];
+  unsigned int nfree;
+  unsigned short refs[SR_IO_XDP_FRAMES]; /* Envíos en vuelo desde el frame */
+  unsigned char busy[SR_IO_XDP_FRAMES];  /* Está en el lote que se procesa */
+};
+
+static struct sr_io_xdp sr_io_xdp;
+
+/* Lugar libre en un anillo en el que produce el router (fill, TX) */
+static uint32_t sr_io_xring_space(struct sr_io_xring *r)
+{
+  return r->mask + 1 - (*r->producer - __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE));
+}
+
+/* Entradas para leer en un anillo en el que produce el kernel (RX, completion) */
+static uint32_t sr_io_xring_avail(struct sr_io_xring *r)
+{
+  return __atomic_load_n(r->producer, __ATOMIC_ACQUIRE) - *r->consumer;
+}
+
+/* Suelta una referencia al frame; si nadie más lo usa vuelve a la lista libre. Con el lock */
+static void sr_io_xdp_put(struct sr_io_xdp *x, uint32_t frame)
+{
+  if (x->refs[frame] > 0) {
+    x->refs[frame]--;
+  }
+  if (x->refs[frame] == 0 && !x->busy[frame]) {
+    x->free[x->nfree++] = frame;
+  }
+}
+
+/* Lee el anillo de completion del puerto: lo que el kernel ya mandó. Con el lock */
+static void sr_io_xdp_reap(struct sr_io_xdp *x, struct sr_io_port *port)
+{
+  uint32_t n = sr_io_xring_avail(&port->xcomp);
+  uint32_t cons = *port->xcomp.consumer;
+  const uint64_t *addrs = (const uint64_t *)port->xcomp.descs;
+  for (uint32_t i = 0; i < n; i++) {
+    sr_io_xdp_put(x, (uint32_t)(addrs[(cons + i) & port->xcomp.mask] / SR_IO_XDP_FRAME));
+  }
+  __atomic_store_n(port->xcomp.consumer, cons + n, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&io_stat_tx, n, __ATOMIC_RELAXED);
+}
+
+/* Le pide al kernel que mande lo que hay en el anillo de TX (en modo copia hace falta siempre) */
+static void sr_io_xdp_kick(struct sr_io_port *port)
+{
+  /* Cada sendto manda a lo sumo un lote chico del anillo: se repite mientras quede algo */
+  for (int tries = 0; tries < 64; tries++) {
+    if (__atomic_load_n(port->xtx.consumer, __ATOMIC_ACQUIRE) == *port->xtx.producer) {
+      break;
+    }
+    int r = sendto(port->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+    __atomic_add_fetch(&io_stat_syscalls, 1, __ATOMIC_RELAXED);
+    if (r < 0 && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+      perror("sendto(AF_XDP)");
+      break;
+    }
+    if (r < 0 && errno != EAGAIN) {
+      break;
+    }
+  }
+  port->tx_n = 0;
+}
+
+static int sr_io_xdp_send(struct sr_io_port *port, uint8_t *buf, unsigned int len)
+{
+  struct sr_io_xdp *x = &sr_io_xdp;
+  const size_t umem_size = (size_t)SR_IO_XDP_FRAMES * SR_IO_XDP_FRAME;
+  int in_umem = sr_io_direct && buf >= x->umem && buf + len <= x->umem + umem_size;
+  uint64_t addr;
+  uint32_t frame;
+
+  if (!in_umem && len > SR_IO_XDP_DATA_MAX) {
+    return -1;
+  }
+  pthread_mutex_lock(&x->lock);
+  sr_io_xdp_reap(x, port);
+  if (sr_io_xring_space(&port->xtx) == 0) {
+    pthread_mutex_unlock(&x->lock);
+    return -1;
+  }
+  if (in_umem) {
+    /* La trama ya está en la UMEM: sale desde ahí */
+    addr = (uint64_t)(buf - x->umem);
+    frame = (uint32_t)(addr / SR_IO_XDP_FRAME);
+  } else {
+    if (x->nfree == 0) {
+      pthread_mutex_unlock(&x->lock);
+      return -1;
+    }
+    frame = x->free[--x->nfree];
+    addr = (uint64_t)frame * SR_IO_XDP_FRAME + XDP_PACKET_HEADROOM;
+    memcpy(x->umem + addr, buf, len);
+  }
+  x->refs[frame]++;
+  uint32_t prod = *port->xtx.producer;
+  struct xdp_desc *desc = &((struct xdp_desc *)port->xtx.descs)[prod & port->xtx.mask];
+  desc->addr = addr;
+  desc->len = len;
+  desc->options = 0;
+  __atomic_store_n(port->xtx.producer, prod + 1, __ATOMIC_RELEASE);
+  port->tx_n++;
+  if (!sr_io_direct && !sr_io_batching) {
+    sr_io_xdp_kick(port);
+  }
+  pthread_mutex_unlock(&x->lock);
+  return 0;
+}
+
+/* Larga el lote del puerto. En el backend crudo devuelve cuántas del lote salieron (las primeras) */
+static unsigned int sr_io_flush(struct sr_io_port *port)
+{
+  if (sr_io_backend == SR_IO_XDP) {
+    pthread_mutex_lock(&sr_io_xdp.lock);
+    sr_io_xdp_kick(port);
+    pthread_mutex_unlock(&sr_io_xdp.lock);
+    return 0;
+  }
+  if (sr_io_backend == SR_IO_URING) {
+    pthread_mutex_lock(&sr_io_uring.lock);
+    sr_io_uring_submit_locked(&sr_io_uring);
+    port->tx_n = 0;
+    pthread_mutex_unlock(&sr_io_uring.lock);
+    return 0;
+  }
+  if (sr_io_backend == SR_IO_RING) {
+    pthread_mutex_lock(&port->tx_lock);
+    sr_io_ring_kick(port);
+    pthread_mutex_unlock(&port->tx_lock);
+    return 0;
+  }
+
+  unsigned int done = 0;
+  while (done < port->tx_n) {
+    int r = sendmmsg(port->fd, &port->tx_msgs[done], port->tx_n - done, 0);
+    __atomic_add_fetch(&io_stat_syscalls, 1, __ATOMIC_RELAXED);
+    if (r <= 0) {
+      if (r < 0 && errno == EINTR) {
+        continue;
+      }
+      perror("sendmmsg");
+      break;
+    }
+    done += r;
+  }
+  __atomic_add_fetch(&io_stat_tx, done, __ATOMIC_RELAXED);
+  for (unsigned int i = 0; i < port->tx_n; i++) {
+    if (port->tx_refs[i]) {
+      sr_pktbuf_put(port->tx_refs[i]);
+      port->tx_refs[i] = NULL;
+    }
+  }
+  port->tx_n = 0;
+  return done;
+}
+
+/*
+Agrega un envío al lote del puerto; si ref no es NULL se manda desde ese buffer sin copiar. Con
+copy en 0 tampoco se copia: buf tiene que seguir ahí hasta el sr_io_flush (los buffers de las
+colas de salida).
+*/
+static void sr_io_tx_add(struct sr_io_port *port, uint8_t *buf, unsigned int len, struct sr_pktbuf *ref, int copy)
+{
+  if (port->tx_n == SR_BATCH_MAX) {
+    sr_io_flush(port);
+  }
+  unsigned int i = port->tx_n++;
+  if (ref) {
+    port->tx_refs[i] = sr_pktbuf_get(ref);
+  } else if (copy) {
+    memcpy(port->tx_bufs[i], buf, len);
+    buf = port->tx_bufs[i];
+  }
+  port->tx_iov[i].iov_base = buf;
+  port->tx_iov[i].iov_len = len;
+  memset(&port->tx_msgs[i], 0, sizeof(struct mmsghdr));
+  port->tx_msgs[i].msg_hdr.msg_iov = &port->tx_iov[i];
+  port->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+}
+
+/* Envío directo por el backend que esté activo (sin pasar por las colas de salida) */
+int sr_io_xmit(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface)
+{
+  SR_TAP(SR_TAP_EGRESS, buf, len, iface);
+  if (sr_io_backend == SR_IO_VNS) {
+    return sr_send_packet(sr, buf, len, iface);
+  }
+  struct sr_io_port *port = sr_io_port_get(iface);
+  if (!port || len > SR_IO_FRAME_MAX) {
+    return -1;
+  }
+  if (sr_io_backend == SR_IO_RING) {
+    return sr_io_ring_send(port, buf, len);
+  }
+  if (sr_io_backend == SR_IO_URING) {
+    return sr_io_uring_send(port, buf, len);
+  }
+  if (sr_io_backend == SR_IO_XDP) {
+    return sr_io_xdp_send(port, buf, len);
+  }
+
+  if (sr_io_batching) {
+    sr_io_tx_add(port, buf, len, NULL, 1);
+    return 0;
+  }
+
+  ssize_t r = send(port->fd, buf, len, 0);
+  __atomic_add_fetch(&io_stat_syscalls, 1, __ATOMIC_RELAXED);
+  if (r != (ssize_t)len) {
+    return -1;
+  }
+  __atomic_add_fetch(&io_stat_tx, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/*
+Como sr_io_xmit pero con un buffer con referencias: en un lote del backend crudo el envío
+apunta al buffer (tomando una referencia hasta el sendmmsg) en vez de copiarlo.
+*/
+int sr_io_xmit_buf(struct sr_instance *sr, struct sr_pktbuf *pb, const char *iface)
+{
+  struct sr_io_port *port = NULL;
+  if (sr_io_backend == SR_IO_RAW && sr_io_batching) {
+    port = sr_io_port_get(iface);
+  }
+  if (!port) {
+    return sr_io_xmit(sr, pb->data, pb->len, iface);
+  }
+  SR_TAP(SR_TAP_EGRESS, pb->data, pb->len, iface);
+  sr_io_tx_add(port, pb->data, pb->len, pb, 0);
+  return 0;
+}
+
+/*
+Para el hilo de las colas (sr_txq.c). sr_io_port_queue deja la trama en el lote del puerto si el
+backend es el crudo y devuelve -1 si no (hay que mandarla con sr_io_xmit); sr_io_port_flush larga
+el lote del puerto y devuelve cuántas de las n que sacó de la cola salieron.
+*/
+int sr_io_port_queue(const char *iface, uint8_t *buf, unsigned int len)
+{
+  struct sr_io_port *port = sr_io_backend == SR_IO_RAW ? sr_io_port_get(iface) : NULL;
+  if (!port) {
+    return -1;
+  }
+  SR_TAP(SR_TAP_EGRESS, buf, len, iface);
+  sr_io_tx_add(port, buf, len, NULL, 0);
+  return 0;
+}
+
+unsigned int sr_io_port_flush(const char *iface, unsigned int n)
+{
+  struct sr_io_port *port = sr_io_port_get(iface);
+  if (port && port->tx_n) {
+    unsigned int done = sr_io_flush(port);
+    if (sr_io_backend == SR_IO_RAW) {
+      return done;
+    }
+  }
+  return n;
+}
+
+int sr_io_send(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface)
+{
+  if (sr_io_direct || !__atomic_load_n(&sr_txq_running, __ATOMIC_ACQUIRE)) {
+    return sr_io_xmit(sr, buf, len, iface);
+  }
+  return sr_txq_enqueue(iface, buf, len, NULL, 0);
+}
+
+/* Como sr_io_send, para lo que genera el plano de control (ARP y RIP): sale en la clase de control */
+int sr_io_send_ctl(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface)
+{
+  if (sr_io_direct || !__atomic_load_n(&sr_txq_running, __ATOMIC_ACQUIRE)) {
+    return sr_io_xmit(sr, buf, len, iface);
+  }
+  return sr_txq_enqueue(iface, buf, len, NULL, 1);
+}
+
+/* Como sr_io_send pero sin copiar: la cola se queda con una referencia a pb */
+int sr_io_send_buf(struct sr_instance *sr, struct sr_pktbuf *pb, const char *iface)
+{
+  if (sr_io_direct || !__atomic_load_n(&sr_txq_running, __ATOMIC_ACQUIRE)) {
+    return sr_io_xmit_buf(sr, pb, iface);
+  }
+  return sr_txq_enqueue(iface, NULL, 0, sr_pktbuf_get(pb), 0);
+}
+
+void sr_io_print_stats(void)
+{
+  unsigned long pkts = io_stat_rx + io_stat_tx;
+  printf("E/S: %lu recibidos, %lu enviados, %lu syscalls (%.3f por paquete)\n",
+         io_stat_rx, io_stat_tx, io_stat_syscalls,
+         pkts ? (double)io_stat_syscalls / pkts : 0.0);
+  sr_txq_print_stats();
+}
+
+/* Pide los anillos de RX y TX y los mapea, uno atrás del otro */
+static int sr_io_port_map_rings(struct sr_io_port *port)
+{
+  int version = TPACKET_V2;
+  struct tpacket_req req;
+  const unsigned int per_block = SR_IO_RING_BLOCK / SR_IO_RING_FRAME;
+
+  if (setsockopt(port->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+    perror("PACKET_VERSION");
+    return -1;
+  }
+  req.tp_block_size = SR_IO_RING_BLOCK;
+  req.tp_frame_size = SR_IO_RING_FRAME;
+  req.tp_block_nr = SR_IO_RING_RX_BLOCKS;
+  req.tp_frame_nr = SR_IO_RING_RX_BLOCKS * per_block;
+  if (setsockopt(port->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+    perror("PACKET_RX_RING");
+    return -1;
+  }
+  port->rx.frames = req.tp_frame_nr;
+  req.tp_block_nr = SR_IO_RING_TX_BLOCKS;
+  req.tp_frame_nr = SR_IO_RING_TX_BLOCKS * per_block;
+  if (setsockopt(port->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+    perror("PACKET_TX_RING");
+    return -1;
+  }
+  port->tx.frames = req.tp_frame_nr;
+
+  size_t size = (size_t)(SR_IO_RING_RX_BLOCKS + SR_IO_RING_TX_BLOCKS) * SR_IO_RING_BLOCK;
+  uint8_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, port->fd, 0);
+  if (map == MAP_FAILED) {
+    perror("mmap(PACKET_MMAP)");
+    return -1;
+  }
+  port->rx.base = map;
+  port->tx.base = map + (size_t)SR_IO_RING_RX_BLOCKS * SR_IO_RING_BLOCK;
+  pthread_mutex_init(&port->tx_lock, NULL);
+  return 0;
+}
+
+static int sr_io_xdp_port_open(struct sr_io_port *port);
+
+/*
+Abre el socket del puerto según el backend: crudo atado a la interfaz (con anillos en modo
+anillo) o AF_XDP. Devuelve -1 si no se pudo.
+*/
+static int sr_io_port_open(struct sr_io_port *port, const char *name, int backend)
+{
+  int ring = (backend == SR_IO_RING);
+
+  memset(port, 0, sizeof(*port));
+  strncpy(port->name, name, sr_IFACE_NAMELEN - 1);
+  port->ifindex = if_nametoindex(name);
+  if (port->ifindex == 0) {
+    perror("if_nametoindex");
+    return -1;
+  }
+  if (backend == SR_IO_XDP) {
+    return sr_io_xdp_port_open(port);
+  }
+  port->fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_ALL));
+  if (port->fd < 0) {
+    perror("socket(AF_PACKET)");
+    return -1;
+  }
+  struct sockaddr_ll sll;
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family = AF_PACKET;
+  sll.sll_protocol = htons(ETH_P_ALL);
+  sll.sll_ifindex = port->ifindex;
+  if (bind(port->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+    perror("bind(AF_PACKET)");
+    close(port->fd);
+    return -1;
+  }
+#ifdef PACKET_IGNORE_OUTGOING
+  /* Que no vuelva lo que manda el propio router */
+  int one = 1;
+  setsockopt(port->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+  if (ring && sr_io_port_map_rings(port) < 0) {
+    close(port->fd);
+    return -1;
+  }
+  return 0;
+}
+
+/* Abre un puerto por interfaz y los mete en un epoll; devuelve el epoll o -1 */
+static int sr_io_open_ports(struct sr_instance *sr, int backend)
+{
+  static const char *names[] = { "VNS", "cruda", "anillo", "io_uring", "AF_XDP" };
+  int epfd = epoll_create1(0);
+  if (epfd < 0) {
+    perror("epoll_create1");
+    return -1;
+  }
+  for (struct sr_if *iface = sr->if_list; iface && sr_io_nports < SR_IO_MAX_PORTS; iface = iface->next) {
+    struct sr_io_port *port = &sr_io_ports[sr_io_nports];
+    if (sr_io_port_open(port, iface->name, backend) < 0) {
+      continue;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = sr_io_nports;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, port->fd, &ev);
+    printf("E/S %s: %s (ifindex %d)\n", names[backend], port->name, port->ifindex);
+    sr_io_nports++;
+  }
+  if (sr_io_nports == 0) {
+    close(epfd);
+    return -1;
+  }
+  return epfd;
+}
+
+/* Procesa el lote recibido en port y larga los envíos que haya dejado */
+static void sr_io_process_batch(struct sr_instance *sr, struct sr_io_port *port,
+                                uint8_t **pkts, unsigned int *lens, unsigned int n)
+{
+  __atomic_add_fetch(&io_stat_rx, n, __ATOMIC_RELAXED);
+  sr_io_batching = 1;
+  sr_handlepacket_batch(sr, pkts, lens, n, port->name);
+  sr_io_batching = 0;
+  if (sr_txq_running && !sr_io_direct) {
+    /* Los envíos quedaron en las colas; los puertos son del hilo que las vacía. Si alguna
+       estaba llena se le da una vuelta antes de leer más */
+    sr_txq_backoff();
+    return;
+  }
+  for (int p = 0; p < sr_io_nports; p++) {
+    if (sr_io_ports[p].tx_n) {
+      sr_io_flush(&sr_io_ports[p]);
+    }
+  }
+}
+
+/*
+Loop de recepción del backend crudo. No vuelve salvo por error.
+*/
+int sr_io_raw_run(struct sr_instance *sr)
+{
+  static uint8_t rx_bufs[SR_BATCH_MAX][SR_IO_FRAME_MAX];
+  struct mmsghdr rx_msgs[SR_BATCH_MAX];
+  struct iovec rx_iov[SR_BATCH_MAX];
+  uint8_t *pkts[SR_BATCH_MAX];
+  unsigned int lens[SR_BATCH_MAX];
+  unsigned long next_stats = SR_IO_STATS_EVERY;
+
+  if (!SR_IO_RAW_ENABLED) {
+    return -1;
+  }
+
+  int epfd = sr_io_open_ports(sr, SR_IO_RAW);
+  if (epfd < 0) {
+    return -1;
+  }
+  sr_io_backend = SR_IO_RAW;
+
+  for (int i = 0; i < SR_BATCH_MAX; i++) {
+    rx_iov[i].iov_base = rx_bufs[i];
+    rx_iov[i].iov_len = SR_IO_FRAME_MAX;
+    pkts[i] = rx_bufs[i];
+  }
+
+  while (1) {
+    struct epoll_event events[SR_IO_MAX_PORTS];
+    int nev = epoll_wait(epfd, events, SR_IO_MAX_PORTS, -1);
+    __atomic_add_fetch(&io_stat_syscalls, 1, __ATOMIC_RELAXED);
+    if (nev < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      return -1;
+    }
+    for (int e = 0; e < nev; e++) {
+      struct sr_io_port *port = &sr_io_ports[events[e].data.u32];
+      int n;
+      do {
+        memset(rx_msgs, 0, sizeof(rx_msgs));
+        for (int i = 0; i < SR_BATCH_MAX; i++) {
+          rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+          rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        n = recvmmsg(port->fd, rx_msgs, SR_BATCH_MAX, 0, NULL);
+        __atomic_add_fetch(&io_stat_syscalls, 1, __ATOMIC_RELAXED);
+        if (n <= 0) {
+          break;
+        }
+        for (int i = 0; i < n; i++) {
+          lens[i] = rx_msgs[i].msg_len;
+        }
+        sr_io_process_batch(sr, port, pkts, lens, n);
+      } while (n == SR_BATCH_MAX);
+
+      if (io_stat_rx >= next_stats) {
+        sr_io_print_stats();
+        next_stats += SR_IO_STATS_EVERY;
+      }
+    }
+  }
+}
+
+/*
+Loop de recepción del modo anillo. Las tramas se despachan desde el anillo y se le devuelven
+al kernel recién después de largar los envíos del lote. No vuelve salvo por error.
+*/
+int sr_io_ring_run(struct sr_instance *sr)
+{
+  uint8_t *pkts[SR_BATCH_MAX];
+  unsigned int lens[SR_BATCH_MAX];
+  struct tpacket2_hdr *hdrs[SR_BATCH_MAX];
+  unsigned long next_stats = SR_IO_STATS_EVERY;
+
+  if (!SR_IO_RAW_ENABLED) {
+    return -1;
+  }
+
+  int epfd = sr_io_open_ports(sr, SR_IO_RING);
+  if (epfd < 0) {
+    return -1;
+  }
+  sr_io_backend = SR_IO_RING;
+
+  while (1) {
+    struct epoll_event events[SR_IO_MAX_PORTS];
+    int nev = epoll_wait(epfd, events, SR_IO_MAX_PORTS, -1);
+    __atomic_add_fetch(&io_stat_syscalls, 1, __ATOMIC_RELAXED);
+    if (nev < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      return -1;
+    }
+    for (int e = 0; e < nev; e++) {
+      struct sr_io_port *port = &sr_io_ports[events[e].data.u32];
+      unsigned int n;
+      do {
+        n = 0;
+        while (n < SR_BATCH_MAX) {
+          struct tpacket2_hdr *hdr = sr_io_ring_frame(&port->rx, port->rx.next);
+          if (!(__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            break;
+          }
+          port->rx.next = (port->rx.next + 1) % port->rx.frames;
+          if (hdr->tp_snaplen < hdr->tp_len) {
+            /* No entró en el frame del anillo: cortada no sirve */
+            __atomic_store_n(&hdr->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            continue;
+          }
+          hdrs[n] = hdr;
+          pkts[n] = (uint8_t *)hdr + hdr->tp_mac;
+          lens[n] = hdr->tp_snaplen;
+          n++;
+        }
+        if (n == 0) {
+          break;
+        }
+        sr_io_process_batch(sr, port, pkts, lens, n);
+        for (unsigned int i = 0; i < n; i++) {
+          __atomic_store_n(&hdrs[i]->tp_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        }
+      } while (n == SR_BATCH_MAX);
+
+      if (io_stat_rx >= next_stats) {
+        sr_io_print_stats();
+        next_stats += SR_IO_STATS_EVERY;
+      }
+    }
+  }
+}
+
+/* Devuelve el buffer de RX al anillo del kernel; se publica con sr_io_uring_publish */
+static void sr_io_uring_recycle(struct sr_io_uring *u, unsigned int bid)
+{
+  /* No se toca resv: en bufs[0] ese lugar es la cola del anillo */
+  struct io_uring_buf *b = &u->br->bufs[u->br_tail & (SR_IO_URING_RX_BUFS - 1)];
+  b->addr = (uintptr_t)(u->pool + (size_t)bid * SR_IO_URING_BUF_SIZE);
+  b->len = SR_IO_URING_BUF_SIZE;
+  b->bid = bid;
+  u->br_tail++;
+}
+
+static void sr_io_uring_publish(struct sr_io_uring *u)
+{
+  __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+/* Crea el anillo, mapea SQ/CQ y registra el pool y el anillo de buffers */
+static int sr_io_uring_setup(struct sr_io_uring *u)
+{
+  struct io_uring_params params;
+  memset(u, 0, sizeof(*u));
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = SR_IO_URING_CQ_ENTRIES;
+  u->fd = syscall(__NR_io_uring_setup, SR_IO_URING_ENTRIES, &params);
+  if (u->fd < 0) {
+    perror("io_uring_setup");
+    return -1;
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_size = cq_size = (sq_size > cq_size) ? sq_size : cq_size;
+  }
+  uint8_t *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  uint8_t *cq = sq;
+  if (sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+  }
+  u->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || u->sqes == MAP_FAILED) {
+    perror("mmap(io_uring)");
+    return -1;
+  }
+  u->sq_head = (unsigned int *)(sq + params.sq_off.head);
+  u->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+  u->sq_array = (unsigned int *)(sq + params.sq_off.array);
+  u->sq_mask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+  u->sq_entries = *(unsigned int *)(sq + params.sq_off.ring_entries);
+  u->cq_head = (unsigned int *)(cq + params.cq_off.head);
+  u->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+  u->cq_mask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  /* Pool de RX y TX, registrado como un solo buffer fijo */
+  size_t pool_size = (size_t)(SR_IO_URING_RX_BUFS + SR_IO_URING_TX_BUFS) * SR_IO_URING_BUF_SIZE;
+  u->pool = mmap(NULL, pool_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (u->pool == MAP_FAILED) {
+    perror("mmap(pool)");
+    return -1;
+  }
+  struct iovec iov = { u->pool, pool_size };
+  if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+    perror("IORING_REGISTER_BUFFERS");
+    return -1;
+  }
+
+  u->br = mmap(NULL, SR_IO_URING_RX_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (u->br == MAP_FAILED) {
+    perror("mmap(buf ring)");
+    return -1;
+  }
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uintptr_t)u->br;
+  reg.ring_entries = SR_IO_URING_RX_BUFS;
+  reg.bgid = SR_IO_URING_BGID;
+  if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    perror("IORING_REGISTER_PBUF_RING");
+    return -1;
+  }
+  for (unsigned int bid = 0; bid < SR_IO_URING_RX_BUFS; bid++) {
+    sr_io_uring_recycle(u, bid);
+  }
+  sr_io_uring_publish(u);
+  for (unsigned int i = 0; i < SR_IO_URING_TX_BUFS; i++) {
+    u->tx_free[u->tx_nfree++] = i;
+  }
+  pthread_mutex_init(&u->lock, NULL);
+  return 0;
+}
+
+/* Arma (o vuelve a armar) el recv multishot del puerto p */
+static int sr_io_uring_arm_recv(struct sr_io_uring *u, unsigned int p)
+{
+  pthread_mutex_lock(&u->lock);
+  struct io_uring_sqe *sqe = sr_io_uring_sqe(u);
+  if (sqe) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sr_io_ports[p].fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = SR_IO_URING_BGID;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = SR_IO_URING_TAG(SR_IO_URING_RECV, p);
+    sr_io_uring_commit(u);
+  }
+  pthread_mutex_unlock(&u->lock);
+  return sqe ? 0 : -1;
+}
+
+/* Procesa el lote del puerto p y suelta los buffers que no quedaron en un envío */
+static void sr_io_uring_batch(struct sr_instance *sr, struct sr_io_uring *u, unsigned int p,
+                              uint8_t **pkts, unsigned int *lens, unsigned short *bids, unsigned int n)
+{
+  sr_io_process_batch(sr, &sr_io_ports[p], pkts, lens, n);
+  for (unsigned int i = 0; i < n; i++) {
+    u->rx_busy[bids[i]] = 0;
+    if (u->rx_refs[bids[i]] == 0) {
+      sr_io_uring_recycle(u, bids[i]);
+    }
+  }
+}
+
+/*
+Loop del backend io_uring. Cada vuelta entrega las SQE pendientes y espera CQE en la misma
+syscall, junta las tramas recibidas en un lote por puerto, las procesa, y devuelve al anillo
+los buffers que se liberaron. No vuelve salvo por error.
+*/
+int sr_io_uring_run(struct sr_instance *sr)
+{
+  static uint8_t *pkts[SR_IO_MAX_PORTS][SR_BATCH_MAX];
+  static unsigned int lens[SR_IO_MAX_PORTS][SR_BATCH_MAX];
+  static unsigned short bids[SR_IO_MAX_PORTS][SR_BATCH_MAX];
+  unsigned int nb[SR_IO_MAX_PORTS];
+  int rearm[SR_IO_MAX_PORTS];
+  struct sr_io_uring *u = &sr_io_uring;
+  unsigned long next_stats = SR_IO_STATS_EVERY;
+
+  if (!SR_IO_RAW_ENABLED) {
+    return -1;
+  }
+  int epfd = sr_io_open_ports(sr, SR_IO_URING);
+  if (epfd < 0) {
+    return -1;
+  }
+  close(epfd); /* Acá no se usa epoll: espera io_uring_enter */
+  if (sr_io_uring_setup(u) < 0) {
+    return -1;
+  }
+  for (int p = 0; p < sr_io_nports; p++) {
+    sr_io_uring_arm_recv(u, p);
+  }
+  sr_io_backend = SR_IO_URING;
+  sr_io_direct = 1;
+
+  while (1) {
+    pthread_mutex_lock(&u->lock);
+    unsigned int n = u->sq_pending;
+    u->sq_pending = 0;
+    pthread_mutex_unlock(&u->lock);
+    int r = sr_io_uring_enter(n, 1);
+    if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      perror("io_uring_enter");
+      return -1;
+    }
+    if (r < (int)n) {
+      /* Las que no entraron quedan para la próxima vuelta */
+      pthread_mutex_lock(&u->lock);
+      u->sq_pending += n - (r > 0 ? r : 0);
+      pthread_mutex_unlock(&u->lock);
+    }
+
+    memset(nb, 0, sizeof(nb));
+    memset(rearm, 0, sizeof(rearm));
+    unsigned int head = *u->cq_head;
+    unsigned int tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+      unsigned long long op = cqe->user_data >> 56;
+      unsigned int idx = (unsigned int)(cqe->user_data & 0xFFFFFFFFu);
+      int res = cqe->res;
+      unsigned int flags = cqe->flags;
+
+      if (op == SR_IO_URING_RECV) {
+        if (flags & IORING_CQE_F_BUFFER) {
+          unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+          if (res > 0) {
+            pkts[idx][nb[idx]] = u->pool + (size_t)bid * SR_IO_URING_BUF_SIZE;
+            lens[idx][nb[idx]] = res;
+            bids[idx][nb[idx]] = bid;
+            u->rx_busy[bid] = 1;
+            if (++nb[idx] == SR_BATCH_MAX) {
+              sr_io_uring_batch(sr, u, idx, pkts[idx], lens[idx], bids[idx], nb[idx]);
+              nb[idx] = 0;
+            }
+          } else {
+            sr_io_uring_recycle(u, bid);
+          }
+        }
+        if (!(flags & IORING_CQE_F_MORE)) {
+          if (res < 0 && res != -ENOBUFS) {
+            fprintf(stderr, "io_uring recv %s: %s\n", sr_io_ports[idx].name, strerror(-res));
+          }
+          rearm[idx] = 1;
+        }
+      } else if (op == SR_IO_URING_TX_RX) {
+        if (--u->rx_refs[idx] == 0 && !u->rx_busy[idx]) {
+          sr_io_uring_recycle(u, idx);
+        }
+      } else if (op == SR_IO_URING_TX) {
+        pthread_mutex_lock(&u->lock);
+        u->tx_free[u->tx_nfree++] = idx;
+        pthread_mutex_unlock(&u->lock);
+      }
+      if (op != SR_IO_URING_RECV && res >= 0) {
+        __atomic_add_fetch(&io_stat_tx, 1, __ATOMIC_RELAXED);
+      }
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    for (int p = 0; p < sr_io_nports; p++) {
+      if (nb[p]) {
+        sr_io_uring_batch(sr, u, p, pkts[p], lens[p], bids[p], nb[p]);
+      }
+    }
+    sr_io_uring_publish(u);
+    for (int p = 0; p < sr_io_nports; p++) {
+      if (rearm[p]) {
+        sr_io_uring_arm_recv(u, p);
+      }
+    }
+
+    if (io_stat_rx >= next_stats) {
+      sr_io_print_stats();
+      next_stats += SR_IO_STATS_EVERY;
+    }
+  }
+}
+
+static long sr_io_bpf(int cmd, union bpf_attr *attr)
+{
+  return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+Programa XDP del puerto, equivalente a
+  return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+armado instrucción por instrucción. Lo que no tiene socket en esa cola sigue a Linux.
+*/
+static int sr_io_xdp_load_prog(int map_fd)
+{
+  struct bpf_insn prog[] = {
+    { .code = BPF_LDX | BPF_MEM | BPF_W, .dst_reg = BPF_REG_2, .src_reg = BPF_REG_1,
+      .off = offsetof(struct xdp_md, rx_queue_index) },
+    { .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1, .src_reg = BPF_PSEUDO_MAP_FD, .imm = map_fd },
+    { 0 }, /* Segunda mitad del ld_imm64 */
+    { .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3, .imm = XDP_PASS },
+    { .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+    { .code = BPF_JMP | BPF_EXIT },
+  };
+  static char log[4096];
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = (uintptr_t)prog;
+  attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+  attr.license = (uintptr_t)"GPL";
+  attr.log_buf = (uintptr_t)log;
+  attr.log_size = sizeof(log);
+  attr.log_level = 1;
+  int fd = sr_io_bpf(BPF_PROG_LOAD, &attr);
+  if (fd < 0) {
+    perror("BPF_PROG_LOAD");
+    fprintf(stderr, "%s\n", log);
+  }
+  return fd;
+}
+
+/* Mapea uno de los anillos del socket XDP */
+static int sr_io_xring_map(int fd, struct sr_io_xring *r, const struct xdp_ring_offset *off,
+                           size_t desc_size, unsigned long long pgoff)
+{
+  size_t size = off->desc + SR_IO_XDP_RING * desc_size;
+  uint8_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+  if (map == MAP_FAILED) {
+    perror("mmap(AF_XDP)");
+    return -1;
+  }
+  r->producer = (uint32_t *)(map + off->producer);
+  r->consumer = (uint32_t *)(map + off->consumer);
+  r->flags = (uint32_t *)(map + off->flags);
+  r->descs = map + off->desc;
+  r->mask = SR_IO_XDP_RING - 1;
+  r->map = map;
+  r->map_len = size;
+  return 0;
+}
+
+/* Reparte frames libres al anillo de fill del puerto. Con el lock */
+static void sr_io_xdp_refill(struct sr_io_xdp *x, struct sr_io_port *port)
+{
+  uint32_t n = sr_io_xring_space(&port->xfill);
+  uint32_t prod = *port->xfill.producer;
+  uint64_t *addrs = (uint64_t *)port->xfill.descs;
+  /* Se deja una parte para los envíos que copian */
+  while (n > 0 && x->nfree > SR_IO_XDP_RING / 4) {
+    addrs[prod++ & port->xfill.mask] = (uint64_t)x->free[--x->nfree] * SR_IO_XDP_FRAME;
+    n--;
+  }
+  __atomic_store_n(port->xfill.producer, prod, __ATOMIC_RELEASE);
+}
+
+/*
+Deshace lo que haya llegado a armar sr_io_xdp_port_open: link, programa, mapa, anillos y
+socket. Los frames que quedaron en el anillo de fill vuelven a la lista libre (sin el
+programa enganchado el kernel no los usó). Si el socket era el que registró la UMEM, como
+todavía no la comparte nadie, se suelta también y el próximo puerto la registra de nuevo.
+*/
+static void sr_io_xdp_port_close(struct sr_io_port *port)
+{
+  struct sr_io_xdp *x = &sr_io_xdp;
+  int *fds[] = { &port->xdp_link_fd, &port->xdp_prog_fd, &port->xsk_map_fd };
+  for (unsigned int i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+    if (*fds[i] >= 0) {
+      close(*fds[i]);
+      *fds[i] = -1;
+    }
+  }
+  if (port->xfill.map) {
+    uint64_t *addrs = (uint64_t *)port->xfill.descs;
+    pthread_mutex_lock(&x->lock);
+    uint32_t cons = __atomic_load_n(port->xfill.consumer, __ATOMIC_ACQUIRE);
+    uint32_t prod = *port->xfill.producer;
+    while (cons != prod) {
+      x->free[x->nfree++] = (uint32_t)(addrs[cons++ & port->xfill.mask] / SR_IO_XDP_FRAME);
+    }
+    pthread_mutex_unlock(&x->lock);
+  }
+  struct sr_io_xring *rings[] = { &port->xrx, &port->xtx, &port->xfill, &port->xcomp };
+  for (unsigned int i = 0; i < sizeof(rings) / sizeof(rings[0]); i++) {
+    if (rings[i]->map) {
+      munmap(rings[i]->map, rings[i]->map_len);
+    }
+    memset(rings[i], 0, sizeof(*rings[i]));
+  }
+  if (port->fd >= 0) {
+    if (x->umem && x->umem_fd == port->fd) {
+      munmap(x->umem, (size_t)SR_IO_XDP_FRAMES * SR_IO_XDP_FRAME);
+      x->umem = NULL;
+      x->umem_fd = -1;
+      x->nfree = 0;
+      pthread_mutex_destroy(&x->lock);
+    }
+    close(port->fd);
+    port->fd = -1;
+  }
+}
+
+/*
+Socket AF_XDP del puerto en la cola 0, con la UMEM compartida (la registra el primero), y el
+programa XDP que le manda las tramas. Primero se prueba XDP nativo del driver y si no anda
+el genérico (SKB).
+*/
+static int sr_io_xdp_port_open(struct sr_io_port *port)
+{
+  struct sr_io_xdp *x = &sr_io_xdp;
+  int ring_size = SR_IO_XDP_RING;
+
+  /* Cada paso que falla suelta todo lo anterior con sr_io_xdp_port_close */
+  port->xsk_map_fd = -1;
+  port->xdp_prog_fd = -1;
+  port->xdp_link_fd = -1;
+  port->fd = socket(AF_XDP, SOCK_RAW, 0);
+  if (port->fd < 0) {
+    perror("socket(AF_XDP)");
+    return -1;
+  }
+  if (!x->umem) {
+    size_t size = (size_t)SR_IO_XDP_FRAMES * SR_IO_XDP_FRAME;
+    x->umem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (x->umem == MAP_FAILED) {
+      perror("mmap(UMEM)");
+      x->umem = NULL;
+      sr_io_xdp_port_close(port);
+      return -1;
+    }
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uintptr_t)x->umem;
+    reg.len = size;
+    reg.chunk_size = SR_IO_XDP_FRAME;
+    x->umem_fd = port->fd;
+    pthread_mutex_init(&x->lock, NULL);
+    if (setsockopt(port->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+      perror("XDP_UMEM_REG");
+      sr_io_xdp_port_close(port);
+      return -1;
+    }
+    for (uint32_t i = 0; i < SR_IO_XDP_FRAMES; i++) {
+      x->free[x->nfree++] = SR_IO_XDP_FRAMES - 1 - i;
+    }
+  }
+
+  /* Cada socket con sus cuatro anillos, también los de la UMEM compartida */
+  if (setsockopt(port->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) < 0 ||
+      setsockopt(port->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) < 0 ||
+      setsockopt(port->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) < 0 ||
+      setsockopt(port->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) < 0) {
+    perror("setsockopt(anillos AF_XDP)");
+    sr_io_xdp_port_close(port);
+    return -1;
+  }
+  struct xdp_mmap_offsets off;
+  socklen_t optlen = sizeof(off);
+  if (getsockopt(port->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0 ||
+      sr_io_xring_map(port->fd, &port->xrx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) < 0 ||
+      sr_io_xring_map(port->fd, &port->xtx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) < 0 ||
+      sr_io_xring_map(port->fd, &port->xfill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+      sr_io_xring_map(port->fd, &port->xcomp, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) < 0) {
+    sr_io_xdp_port_close(port);
+    return -1;
+  }
+  pthread_mutex_lock(&x->lock);
+  sr_io_xdp_refill(x, port);
+  pthread_mutex_unlock(&x->lock);
+
+  struct sockaddr_xdp sxdp;
+  memset(&sxdp, 0, sizeof(sxdp));
+  sxdp.sxdp_family = AF_XDP;
+  sxdp.sxdp_ifindex = port->ifindex;
+  sxdp.sxdp_queue_id = 0;
+  if (x->umem_fd == port->fd) {
+    sxdp.sxdp_flags = XDP_COPY;
+  } else {
+    /* El modo lo hereda del que registró la UMEM: acá no se puede repetir XDP_COPY */
+    sxdp.sxdp_flags = XDP_SHARED_UMEM;
+    sxdp.sxdp_shared_umem_fd = x->umem_fd;
+  }
+  if (bind(port->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+    perror("bind(AF_XDP)");
+    sr_io_xdp_port_close(port);
+    return -1;
+  }
+
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint32_t);
+  attr.max_entries = 64;
+  port->xsk_map_fd = sr_io_bpf(BPF_MAP_CREATE, &attr);
+  if (port->xsk_map_fd < 0) {
+    perror("BPF_MAP_CREATE(XSKMAP)");
+    sr_io_xdp_port_close(port);
+    return -1;
+  }
+  uint32_t key = 0, value = port->fd;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = port->xsk_map_fd;
+  attr.key = (uintptr_t)&key;
+  attr.value = (uintptr_t)&value;
+  if (sr_io_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+    perror("BPF_MAP_UPDATE_ELEM(XSKMAP)");
+    sr_io_xdp_port_close(port);
+    return -1;
+  }
+  port->xdp_prog_fd = sr_io_xdp_load_prog(port->xsk_map_fd);
+  if (port->xdp_prog_fd < 0) {
+    sr_io_xdp_port_close(port);
+    return -1;
+  }
+  /* El link se suelta solo cuando se cierra el fd (o termina el proceso) */
+  static const unsigned int modes[] = { XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE };
+  for (int m = 0; m < 2; m++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = port->xdp_prog_fd;
+    attr.link_create.target_ifindex = port->ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = modes[m];
+    port->xdp_link_fd = sr_io_bpf(BPF_LINK_CREATE, &attr);
+    if (port->xdp_link_fd >= 0) {
+      printf("XDP %s en %s\n", m ? "genérico (SKB)" : "nativo", port->name);
+      return 0;
+    }
+  }
+  perror("BPF_LINK_CREATE(XDP)");
+  sr_io_xdp_port_close(port);
+  return -1;
+}
+
+/*
+Loop del backend AF_XDP. Por cada lote del anillo de RX de un puerto: se procesa en la
+UMEM, los reenvíos quedan en los anillos de TX de los puertos de salida (con la misma
+dirección), se patean, y los frames que no se mandaron vuelven a la lista libre y de ahí a
+los anillos de fill. No vuelve salvo por error.
+*/
+int sr_io_xdp_run(struct sr_instance *sr)
+{
+  uint8_t *pkts[SR_BATCH_MAX];
+  unsigned int lens[SR_BATCH_MAX];
+  uint32_t frames[SR_BATCH_MAX];
+  struct sr_io_xdp *x = &sr_io_xdp;
+  unsigned long next_stats = SR_IO_STATS_EVERY;
+
+  if (!SR_IO_RAW_ENABLED) {
+    return -1;
+  }
+  int epfd = sr_io_open_ports(sr, SR_IO_XDP);
+  if (epfd < 0) {
+    return -1;
+  }
+  sr_io_backend = SR_IO_XDP;
+  sr_io_direct = 1;
+
+  while (1) {
+    struct epoll_event events[SR_IO_MAX_PORTS];
+    int nev = epoll_wait(epfd, events, SR_IO_MAX_PORTS, 100);
+    __atomic_add_fetch(&io_stat_syscalls, 1, __ATOMIC_RELAXED);
+    if (nev < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      return -1;
+    }
+    for (int e = 0; e < nev; e++) {
+      struct sr_io_port *port = &sr_io_ports[events[e].data.u32];
+      unsigned int n;
+      do {
+        uint32_t avail = sr_io_xring_avail(&port->xrx);
+        uint32_t cons = *port->xrx.consumer;
+        const struct xdp_desc *descs = (const struct xdp_desc *)port->xrx.descs;
+        n = avail < SR_BATCH_MAX ? avail : SR_BATCH_MAX;
+        for (unsigned int i = 0; i < n; i++) {
+          const struct xdp_desc *d = &descs[(cons + i) & port->xrx.mask];
+          pkts[i] = x->umem + d->addr;
+          lens[i] = d->len;
+          frames[i] = (uint32_t)(d->addr / SR_IO_XDP_FRAME);
+          x->busy[frames[i]] = 1;
+        }
+        __atomic_store_n(port->xrx.consumer, cons + n, __ATOMIC_RELEASE);
+        if (n == 0) {
+          break;
+        }
+        sr_io_process_batch(sr, port, pkts, lens, n);
+
+        pthread_mutex_lock(&x->lock);
+        for (unsigned int i = 0; i < n; i++) {
+          x->busy[frames[i]] = 0;
+          if (x->refs[frames[i]] == 0) {
+            x->free[x->nfree++] = frames[i];
+          }
+        }
+        pthread_mutex_unlock(&x->lock);
+      } while (n == SR_BATCH_MAX);
+
+      if (io_stat_rx >= next_stats) {
+        sr_io_print_stats();
+        next_stats += SR_IO_STATS_EVERY;
+      }
+    }
+
+    /* Lo ya mandado vuelve a la lista libre y de ahí a los fill de todos los puertos */
+    pthread_mutex_lock(&x->lock);
+    for (int p = 0; p < sr_io_nports; p++) {
+      sr_io_xdp_reap(x, &sr_io_ports[p]);
+    }
+    for (int p = 0; p < sr_io_nports; p++) {
+      sr_io_xdp_refill(x, &sr_io_ports[p]);
+    }
+    pthread_mutex_unlock(&x->lock);
+  }
+}
+
+/*
+Arranque por nombre del backend ("raw", "ring", "uring" o "xdp"), para que el main elija con
+una opción en vez de cambiar el código. No vuelve salvo por error.
+*/
+int sr_io_run(struct sr_instance *sr, const char *backend)
+{
+  if (strcmp(backend, "raw") == 0) {
+    return sr_io_raw_run(sr);
+  }
+  if (strcmp(backend, "ring") == 0) {
+    return sr_io_ring_run(sr);
+  }
+  if (strcmp(backend, "uring") == 0) {
+    return sr_io_uring_run(sr);
+  }
+  if (strcmp(backend, "xdp") == 0) {
+    return sr_io_xdp_run(sr);
+  }
+  fprintf(stderr, "Backend de E/S desconocido: %s (raw, ring, uring o xdp)\n", backend);
+  return -1;
+}
+
@@ -0,0 +1,48 @@
+/*
+Buffers de paquete y backends de E/S (ver sr_io.c). Todos los envíos del router pasan por
+sr_io_send, sr_io_send_ctl o sr_io_send_buf.
+*/
+#ifndef SR_IO_H
+#define SR_IO_H
+
+#include <stdint.h>
+#include "sr_protocol.h"
+#include "sr_fwd.h"
+
+#define SR_PKTBUF_HEADROOM 128 /* Entran Ethernet + IP con opciones (14 + 60) */
+
+struct sr_pktbuf {
+    unsigned int refcnt;
+    uint8_t *data;
+    unsigned int len;
+    uint8_t mem[];
+};
+
+struct sr_pktbuf *sr_pktbuf_alloc(unsigned int len);
+struct sr_pktbuf *sr_pktbuf_copy(const uint8_t *data, unsigned int len);
+uint8_t *sr_pktbuf_data(struct sr_pktbuf *pb);
+uint8_t *sr_pktbuf_push(struct sr_pktbuf *pb, unsigned int n);
+struct sr_pktbuf *sr_pktbuf_get(struct sr_pktbuf *pb);
+void sr_pktbuf_put(struct sr_pktbuf *pb);
+
+#define SR_IO_FRAME_MAX (sizeof(sr_ethernet_hdr_t) + SR_MAX_MTU) /* Entra una trama jumbo */
+#define SR_IO_MAX_PORTS 16
+#define SR_IO_STATS_EVERY 100000 /* Cada cuántos paquetes recibidos se imprimen los contadores */
+
+struct sr_instance;
+
+int sr_io_send(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface);
+int sr_io_send_ctl(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface);
+int sr_io_send_buf(struct sr_instance *sr, struct sr_pktbuf *pb, const char *iface);
+
+/* Para el hilo de sr_txq.c, que saca de las colas y manda por el backend */
+extern __thread int sr_io_batching;  /* El hilo junta sus envíos por puerto en vez de mandarlos */
+int sr_io_xmit(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface);
+int sr_io_xmit_buf(struct sr_instance *sr, struct sr_pktbuf *pb, const char *iface);
+int sr_io_port_queue(const char *iface, uint8_t *buf, unsigned int len);
+unsigned int sr_io_port_flush(const char *iface, unsigned int n);
+
+void sr_io_print_stats(void);
+int sr_io_run(struct sr_instance *sr, const char *backend);
+
+#endif /* SR_IO_H */
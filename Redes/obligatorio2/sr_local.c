@@ -0,0 +1,267 @@
+/*
+Arranque del router sobre interfaces Linux (veth o placas de verdad) en vez de VNS: arma
+sr->if_list con las interfaces que se le pasan, levanta todo con sr_init y entra al loop
+del backend de E/S elegido con -b:
+  frame  una trama por syscall, como el camino de VNS: espera con poll, un recv por trama,
+         sr_handlepacket por trama y un send por cada envío (sr_send_packet de acá). Es la
+         línea de base para comparar los otros.
+  raw    sockets AF_PACKET con recvmmsg/sendmmsg por lote (sr_io_run "raw").
+  ring   PACKET_MMAP, las tramas se procesan en el anillo (sr_io_run "ring").
+  uring  io_uring con recv multishot y buffers registrados (sr_io_run "uring").
+  xdp    AF_XDP con un programa XDP y una UMEM compartida por todos los puertos; el
+         reenvío sale desde el mismo frame de la UMEM (sr_io_run "xdp").
+Con Ctrl-C (o SIGTERM) imprime los contadores de E/S (paquetes y syscalls) y termina.
+
+Se compila con los fuentes del router, sin sr_main.c ni sr_vns_comm.c (este archivo pone
+su main y su sr_send_packet):
+  gcc -O2 -o sr_local sr_local.c sr_router.c sr_acl.c sr_ct.c sr_nat.c sr_flow.c sr_tap.c \
+      sr_io.c sr_txq.c sr_epoch.c sr_arpcache.c sr_rip.c sr_if.c sr_rt.c sr_utils.c -lpthread
+Uso (como root; a las interfaces no hay que ponerles IP en Linux, las IP son del router):
+  ./sr_local -b uring -i r0=10.1.0.1/24,r1=10.2.0.1/24 > /dev/null
+bench_io.c tiene el armado de veth y el generador para medir.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <errno.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "sr_io.h"
+
+/* En sr_rip.c */
+void sr_rip_set_snapshot_path(struct sr_instance* sr, const char* path);
+
+#define LOCAL_MAX_PORTS 16
+#define LOCAL_FRAME_MAX (sizeof(sr_ethernet_hdr_t) + 9000)
+
+struct local_port {
+    struct sr_if *iface;
+    int fd;
+};
+
+static struct local_port ports[LOCAL_MAX_PORTS];
+static int n_ports = 0;
+
+/* Contadores del modo frame (los otros backends cuentan en sr_io.c) */
+static unsigned long frame_rx = 0;
+static unsigned long frame_tx = 0;
+static unsigned long frame_syscalls = 0;
+
+static int local_open(const char *name)
+{
+    int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (fd < 0) {
+        perror("socket(AF_PACKET)");
+        return -1;
+    }
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = if_nametoindex(name);
+    if (sll.sll_ifindex == 0 || bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        perror(name);
+        close(fd);
+        return -1;
+    }
+#ifdef PACKET_IGNORE_OUTGOING
+    int one = 1;
+    setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif
+    return fd;
+}
+
+/* Agrega la interfaz "nombre=a.b.c.d/len" al final de if_list, con la MAC que tiene en Linux */
+static int local_add_iface(struct sr_instance *sr, char *spec)
+{
+    char *eq = strchr(spec, '=');
+    char *slash = eq ? strchr(eq, '/') : NULL;
+    if (!eq || !slash || n_ports == LOCAL_MAX_PORTS) {
+        fprintf(stderr, "Interfaz mal escrita: %s (nombre=a.b.c.d/len)\n", spec);
+        return -1;
+    }
+    *eq = '\0';
+    *slash = '\0';
+    int len = atoi(slash + 1);
+    struct in_addr ip;
+    if (inet_pton(AF_INET, eq + 1, &ip) != 1 || len < 1 || len > 32) {
+        fprintf(stderr, "IP o prefijo inválido en %s\n", spec);
+        return -1;
+    }
+
+    struct sr_if *iface = calloc(1, sizeof(struct sr_if));
+    if (!iface) {
+        perror("calloc");
+        return -1;
+    }
+    strncpy(iface->name, spec, sr_IFACE_NAMELEN - 1);
+    iface->ip = ip.s_addr;
+    iface->mask = htonl(0xFFFFFFFFu << (32 - len));
+    iface->cost = 1;
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, spec, IFNAMSIZ - 1);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 || ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+        perror(spec);
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(iface);
+        return -1;
+    }
+    close(fd);
+    memcpy(iface->addr, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
+
+    struct sr_if **tail = &sr->if_list;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = iface;
+    ports[n_ports].iface = iface;
+    ports[n_ports].fd = -1;
+    n_ports++;
+    return 0;
+}
+
+/* Envío del modo frame (con los otros backends sr_io_send no llega acá) */
+int sr_send_packet(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface)
+{
+    (void)sr;
+    for (int i = 0; i < n_ports; i++) {
+        if (strncmp(ports[i].iface->name, iface, sr_IFACE_NAMELEN) == 0) {
+            ssize_t r = send(ports[i].fd, buf, len, 0);
+            __atomic_add_fetch(&frame_syscalls, 1, __ATOMIC_RELAXED);
+            if (r != (ssize_t)len) {
+                return -1;
+            }
+            __atomic_add_fetch(&frame_tx, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Una trama por vuelta, como el loop de VNS: poll, recv, sr_handlepacket */
+static int local_frame_run(struct sr_instance *sr)
+{
+    static uint8_t buf[LOCAL_FRAME_MAX];
+    struct pollfd pfds[LOCAL_MAX_PORTS];
+
+    for (int i = 0; i < n_ports; i++) {
+        ports[i].fd = local_open(ports[i].iface->name);
+        if (ports[i].fd < 0) {
+            return -1;
+        }
+        pfds[i].fd = ports[i].fd;
+        pfds[i].events = POLLIN;
+    }
+    while (1) {
+        int n = poll(pfds, n_ports, -1);
+        __atomic_add_fetch(&frame_syscalls, 1, __ATOMIC_RELAXED);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return -1;
+        }
+        for (int i = 0; i < n_ports; i++) {
+            if (!(pfds[i].revents & POLLIN)) {
+                continue;
+            }
+            ssize_t len = recv(ports[i].fd, buf, sizeof(buf), MSG_DONTWAIT);
+            __atomic_add_fetch(&frame_syscalls, 1, __ATOMIC_RELAXED);
+            if (len <= 0) {
+                continue;
+            }
+            __atomic_add_fetch(&frame_rx, 1, __ATOMIC_RELAXED);
+            sr_handlepacket(sr, buf, (unsigned int)len, ports[i].iface->name);
+        }
+    }
+}
+
+/* Espera Ctrl-C en su propio hilo (las señales están bloqueadas en los demás) e imprime */
+static void *local_signal_thread(void *arg)
+{
+    sigset_t *set = (sigset_t *)arg;
+    int sig;
+    sigwait(set, &sig);
+    fflush(stdout);
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(stderr, "CPU del proceso: %.2f s de usuario, %.2f s de sistema\n",
+            ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6, ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+    if (frame_rx || frame_tx) {
+        unsigned long pkts = frame_rx + frame_tx;
+        fprintf(stderr, "E/S frame: %lu recibidos, %lu enviados, %lu syscalls (%.3f por paquete)\n",
+                frame_rx, frame_tx, frame_syscalls, pkts ? (double)frame_syscalls / pkts : 0.0);
+    }
+    /* Los contadores del backend salen por stdout: se redirigen a stderr para verlos con > /dev/null */
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    sr_io_print_stats();
+    fflush(stdout);
+    _exit(0);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    static struct sr_instance sr;
+    const char *backend = "raw";
+    char *ifaces = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "b:i:")) != -1) {
+        switch (c) {
+        case 'b': backend = optarg; break;
+        case 'i': ifaces = optarg; break;
+        default:
+            fprintf(stderr, "Uso: %s -b frame|raw|ring|uring|xdp -i r0=10.1.0.1/24,r1=10.2.0.1/24\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!ifaces) {
+        fprintf(stderr, "Falta -i con las interfaces\n");
+        return 1;
+    }
+    for (char *save = NULL, *tok = strtok_r(ifaces, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if (local_add_iface(&sr, tok) < 0) {
+            return 1;
+        }
+    }
+
+    static sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    pthread_t sig_thread;
+    pthread_create(&sig_thread, NULL, local_signal_thread, &set);
+
+    sr_rip_set_snapshot_path(&sr, NULL);
+    sr_init(&sr);
+
+    if (strcmp(backend, "frame") == 0) {
+        return local_frame_run(&sr) < 0 ? 1 : 0;
+    }
+    /* Los otros backends abren sus propios sockets y mandan por sr_io_send */
+    return sr_io_run(&sr, backend) < 0 ? 1 : 0;
+}
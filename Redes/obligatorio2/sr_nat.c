@@ -0,0 +1,410 @@
+/**********************************************************************
+ * file:  sr_nat.c
+ *
+ * Descripción:
+ *
+ * NAT de origen por interfaz, sobre las entradas de conntrack.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_fwd.h"
+#include "sr_ct.h"
+#include "sr_nat.h"
+
+/*
+NAT de origen (masquerade) para las interfaces que dan hacia afuera. Lo que sale por una de
+esas interfaces se reescribe con la IP pública y un puerto (o id de ICMP echo) libre, y la
+conexión se guarda en conntrack con la respuesta ya traducida, así la vuelta se encuentra con
+la misma búsqueda sin lock y se le devuelve la dirección de adentro antes de rutear.
+
+Los puertos se reparten con un bitmap por IP pública y protocolo, buscando el primer bit en
+cero desde la última palabra usada y reservándolo con un compare-and-swap, sin locks. Los
+checksums se arreglan de forma incremental (RFC 1624). Los errores ICMP que citan un paquete
+traducido también se traducen, por fuera y por dentro.
+
+Para activarlo en una interfaz agregar {"nombre", NULL} (usa la IP de la interfaz) o
+{"nombre", "a.b.c.d"} antes del {NULL, NULL}, o llamar a sr_nat_add_iface antes de que
+arranque el forwarding.
+
+El TTL, las ACL y el MTU se deciden antes de traducir a la salida, así los errores ICMP que
+genera el router citan el paquete como lo mandó el host de adentro y le llegan a él (si no,
+el Fragmentation Needed iría a la IP pública y se rompe PMTUD), y no se reserva un puerto
+para algo que después se descarta. A la entrada hay que traducir antes de saber si el paquete
+es para el router, así que sr_ip_input se guarda lo citable del paquete como llegó y los
+errores de ahí en adelante citan eso.
+*/
+#define NAT_ENABLED 1
+#define NAT_PORT_MIN 1024
+#define NAT_MAX_PUBLIC_IPS 4
+#define NAT_PROTO_TCP 0
+#define NAT_PROTO_UDP 1
+#define NAT_PROTO_ICMP 2
+#define NAT_PROTOS 3
+#define NAT_BITMAP_WORDS (65536 / 64)
+#define NAT_MAX_IFACES 8
+
+struct sr_nat_conf {
+    const char *ifname;
+    const char *public_ip;
+};
+
+static const struct sr_nat_conf sr_nat_table[] = {
+    /* {"eth3", NULL}, */
+    {NULL, NULL}
+};
+
+struct sr_nat_pool {
+    uint32_t public_ip;                         /* 0 = pool sin usar */
+    uint32_t hint[NAT_PROTOS];                  /* Palabra donde empezar a buscar */
+    uint64_t used[NAT_PROTOS][NAT_BITMAP_WORDS];
+};
+
+/* Las que se agregan con sr_nat_add_iface */
+struct sr_nat_iface {
+    char ifname[sr_IFACE_NAMELEN];
+    uint32_t public_ip;                         /* 0 = la de la interfaz */
+};
+
+static struct sr_nat_iface nat_ifaces[NAT_MAX_IFACES];
+static unsigned int nat_n_ifaces = 0;
+
+static struct sr_nat_pool nat_pools[NAT_MAX_PUBLIC_IPS];
+static unsigned long nat_stat_translated = 0;
+static unsigned long nat_stat_no_ports = 0;
+
+/* IP pública (en orden de red) si la interfaz hace NAT, 0 si no */
+static uint32_t sr_nat_outside_ip(struct sr_if *iface)
+{
+    for (const struct sr_nat_conf *c = sr_nat_table; c->ifname; c++) {
+        if (strcmp(c->ifname, iface->name) == 0) {
+            return c->public_ip ? inet_addr(c->public_ip) : iface->ip;
+        }
+    }
+    unsigned int n = __atomic_load_n(&nat_n_ifaces, __ATOMIC_ACQUIRE);
+    for (unsigned int i = 0; i < n; i++) {
+        if (strncmp(nat_ifaces[i].ifname, iface->name, sr_IFACE_NAMELEN) == 0) {
+            return nat_ifaces[i].public_ip ? nat_ifaces[i].public_ip : iface->ip;
+        }
+    }
+    return 0;
+}
+
+/*
+Hace NAT en ifname con public_ip (orden de red; 0 = la IP de la interfaz), además de las de
+sr_nat_table. Antes de que arranque el forwarding. Devuelve -1 si no hay más lugar.
+*/
+int sr_nat_add_iface(const char *ifname, uint32_t public_ip)
+{
+    if (nat_n_ifaces >= NAT_MAX_IFACES) {
+        return -1;
+    }
+    struct sr_nat_iface *ni = &nat_ifaces[nat_n_ifaces];
+    strncpy(ni->ifname, ifname, sr_IFACE_NAMELEN - 1);
+    ni->public_ip = public_ip;
+    __atomic_store_n(&nat_n_ifaces, nat_n_ifaces + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int sr_nat_proto_index(uint8_t proto)
+{
+    if (proto == 6) {
+        return NAT_PROTO_TCP;
+    }
+    if (proto == ip_protocol_udp) {
+        return NAT_PROTO_UDP;
+    }
+    if (proto == ip_protocol_icmp) {
+        return NAT_PROTO_ICMP;
+    }
+    return -1;
+}
+
+/* Busca el pool de la IP; si create, lo crea en el primer lugar libre */
+static struct sr_nat_pool *sr_nat_get_pool(uint32_t public_ip, int create)
+{
+    for (int i = 0; i < NAT_MAX_PUBLIC_IPS; i++) {
+        uint32_t ip = __atomic_load_n(&nat_pools[i].public_ip, __ATOMIC_ACQUIRE);
+        if (ip == public_ip) {
+            return &nat_pools[i];
+        }
+        if (ip == 0 && create) {
+            uint32_t expected = 0;
+            if (__atomic_compare_exchange_n(&nat_pools[i].public_ip, &expected, public_ip, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+                || expected == public_ip) {
+                return &nat_pools[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Reserva un puerto libre (en orden de host), o devuelve 0 si no queda ninguno */
+static uint16_t sr_nat_alloc_port(struct sr_nat_pool *pool, int p)
+{
+    uint32_t start = __atomic_load_n(&pool->hint[p], __ATOMIC_RELAXED);
+
+    for (uint32_t n = 0; n < NAT_BITMAP_WORDS; n++)
+    {
+        uint32_t w = (start + n) % NAT_BITMAP_WORDS;
+        if (w < NAT_PORT_MIN / 64) {
+            continue;
+        }
+        uint64_t cur = __atomic_load_n(&pool->used[p][w], __ATOMIC_RELAXED);
+        while (~cur) {
+            unsigned int bit = __builtin_ctzll(~cur);
+            if (__atomic_compare_exchange_n(&pool->used[p][w], &cur, cur | (1ull << bit), 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                __atomic_store_n(&pool->hint[p], w, __ATOMIC_RELAXED);
+                return (uint16_t)(w * 64 + bit);
+            }
+            /* Otro hilo ganó; cur quedó con el valor nuevo, se vuelve a probar */
+        }
+    }
+    return 0;
+}
+
+void sr_nat_release_port(uint32_t public_ip, uint8_t proto, uint16_t port)
+{
+    struct sr_nat_pool *pool = sr_nat_get_pool(public_ip, 0);
+    int p = sr_nat_proto_index(proto);
+    if (pool && p >= 0) {
+        __atomic_and_fetch(&pool->used[p][port / 64], ~(1ull << (port % 64)), __ATOMIC_RELEASE);
+    }
+}
+
+/* Ajusta un checksum cuando un campo de 32 bits cambia, como dos campos de 16 */
+static uint16_t sr_cksum_replace32_16(uint16_t sum, uint32_t old_val, uint32_t new_val)
+{
+    sum = sr_cksum_replace16(sum, (uint16_t)(old_val >> 16), (uint16_t)(new_val >> 16));
+    return sr_cksum_replace16(sum, (uint16_t)old_val, (uint16_t)new_val);
+}
+
+/*
+Cambia la dirección (origen si is_src, si no destino) y el puerto del mismo lado (el id en
+ICMP echo) de un paquete, arreglando el checksum IP y el de TCP/UDP/ICMP. new_port va en orden
+de host. Lo que no entra en avail_len no se toca.
+*/
+static void sr_nat_rewrite(sr_ip_hdr_t *ip_hdr, unsigned int avail_len, int is_src,
+                           uint32_t new_ip, uint16_t new_port)
+{
+    unsigned int ip_hdr_len = ip_hdr->ip_hl * 4;
+    uint8_t *l4 = (uint8_t *)ip_hdr + ip_hdr_len;
+    uint32_t old_ip = is_src ? ip_hdr->ip_src : ip_hdr->ip_dst;
+    int first_frag = (ntohs(ip_hdr->ip_off) & IP_OFFMASK) == 0;
+
+    ip_hdr->ip_sum = sr_cksum_replace32_16(ip_hdr->ip_sum, old_ip, new_ip);
+    if (is_src) {
+        ip_hdr->ip_src = new_ip;
+    } else {
+        ip_hdr->ip_dst = new_ip;
+    }
+    if (!first_frag) {
+        return;
+    }
+
+    uint16_t new_port_n = htons(new_port);
+    uint16_t old_port_n, sum;
+    if (ip_hdr->ip_p == 6 || ip_hdr->ip_p == ip_protocol_udp) {
+        unsigned int sum_off = (ip_hdr->ip_p == 6) ? 16 : 6;
+        unsigned int port_off = is_src ? 0 : 2;
+        if (avail_len < ip_hdr_len + 4) {
+            return;
+        }
+        memcpy(&old_port_n, l4 + port_off, 2);
+        memcpy(l4 + port_off, &new_port_n, 2);
+        if (avail_len < ip_hdr_len + sum_off + 2) {
+            return;
+        }
+        memcpy(&sum, l4 + sum_off, 2);
+        /* En UDP un checksum en 0 quiere decir que no se usa */
+        if (ip_hdr->ip_p == ip_protocol_udp && sum == 0) {
+            return;
+        }
+        /* El pseudo-cabezal incluye las direcciones */
+        sum = sr_cksum_replace32_16(sum, old_ip, new_ip);
+        sum = sr_cksum_replace16(sum, old_port_n, new_port_n);
+        if (ip_hdr->ip_p == ip_protocol_udp && sum == 0) {
+            sum = 0xFFFF;
+        }
+        memcpy(l4 + sum_off, &sum, 2);
+    } else if (ip_hdr->ip_p == ip_protocol_icmp && avail_len >= ip_hdr_len + 8
+               && (l4[0] == 8 || l4[0] == 0)) {
+        memcpy(&old_port_n, l4 + 4, 2);
+        memcpy(l4 + 4, &new_port_n, 2);
+        memcpy(&sum, l4 + 2, 2);
+        sum = sr_cksum_replace16(sum, old_port_n, new_port_n);
+        memcpy(l4 + 2, &sum, 2);
+    }
+}
+
+int sr_nat_is_public(uint32_t ip)
+{
+    return NAT_ENABLED && ip != 0 && sr_nat_get_pool(ip, 0) != NULL;
+}
+
+/*
+Traduce un error ICMP (destino inalcanzable o tiempo excedido) que cita un paquete de una
+conexión con NAT. inbound = 1 si viene de afuera hacia la IP pública. Devuelve 1 si se tradujo.
+*/
+static int sr_nat_icmp_error(sr_ip_hdr_t *ip_hdr, unsigned int avail_len, int inbound)
+{
+    unsigned int ip_hdr_len = ip_hdr->ip_hl * 4;
+    unsigned int ip_len = ntohs(ip_hdr->ip_len);
+    uint8_t *icmp = (uint8_t *)ip_hdr + ip_hdr_len;
+
+    if (avail_len < ip_len || ip_len < ip_hdr_len + 8 + sizeof(sr_ip_hdr_t) + 8
+        || (icmp[0] != 3 && icmp[0] != 11)) {
+        return 0;
+    }
+    sr_ip_hdr_t *inner = (sr_ip_hdr_t *)(icmp + 8);
+    unsigned int inner_avail = ip_len - ip_hdr_len - 8;
+    if (inner->ip_hl < 5 || inner_avail < inner->ip_hl * 4u + 8) {
+        return 0;
+    }
+
+    /* El paquete citado va en el sentido contrario al error */
+    struct sr_flow_key ik, k;
+    sr_flow_key_extract(&ik, inner, inner->ip_hl * 4, inner_avail);
+    k.src = ik.dst;
+    k.dst = ik.src;
+    k.proto = ik.proto;
+    k.sport = ik.dport;
+    k.dport = ik.sport;
+
+    uint32_t val = sr_ct_lookup(&k);
+    if (val == CT_NONE || (val & 1) != (uint32_t)inbound || !ct_entries[val >> 1].nat) {
+        return 0;
+    }
+    struct sr_ct_entry *e = &ct_entries[val >> 1];
+
+    if (inbound) {
+        sr_nat_rewrite(inner, inner_avail, 1, e->tuple[0].src, e->tuple[0].sport);
+        ip_hdr->ip_sum = sr_cksum_replace32_16(ip_hdr->ip_sum, ip_hdr->ip_dst, e->tuple[0].src);
+        ip_hdr->ip_dst = e->tuple[0].src;
+    } else {
+        sr_nat_rewrite(inner, inner_avail, 0, e->tuple[1].dst, e->tuple[1].dport);
+        ip_hdr->ip_sum = sr_cksum_replace32_16(ip_hdr->ip_sum, ip_hdr->ip_src, e->tuple[1].dst);
+        ip_hdr->ip_src = e->tuple[1].dst;
+    }
+
+    /* Cambió lo citado, así que el checksum ICMP se recalcula entero (es un camino de error) */
+    sr_icmp_hdr_t *icmp_hdr = (sr_icmp_hdr_t *)icmp;
+    icmp_hdr->icmp_sum = 0;
+    icmp_hdr->icmp_sum = sr_cksum_finish(sr_cksum_add(icmp, ip_len - ip_hdr_len, 0));
+    __atomic_add_fetch(&nat_stat_translated, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/*
+Entrada: si el paquete va a una IP pública y es la respuesta de una conexión con NAT, le
+devuelve la dirección y el puerto de adentro (antes de rutear). Devuelve 1 si se tradujo, y en
+ese caso la conexión ya quedó actualizada.
+*/
+int sr_nat_ingress(sr_ip_hdr_t *ip_hdr, unsigned int avail_len, struct sr_flow_key *k)
+{
+    if (!sr_nat_is_public(ip_hdr->ip_dst)) {
+        return 0;
+    }
+
+    if (k->proto == ip_protocol_icmp && sr_nat_icmp_error(ip_hdr, avail_len, 1)) {
+        sr_flow_key_extract(k, ip_hdr, ip_hdr->ip_hl * 4, avail_len);
+        return 1;
+    }
+
+    uint32_t val = sr_ct_lookup(k);
+    if (val == CT_NONE || !(val & 1) || !ct_entries[val >> 1].nat) {
+        return 0;
+    }
+    struct sr_ct_entry *e = &ct_entries[val >> 1];
+
+    sr_ct_touch(val, k, ip_hdr, ip_hdr->ip_hl * 4, avail_len);
+    sr_nat_rewrite(ip_hdr, avail_len, 0, e->tuple[0].src, e->tuple[0].sport);
+    sr_flow_key_extract(k, ip_hdr, ip_hdr->ip_hl * 4, avail_len);
+    __atomic_add_fetch(&nat_stat_translated, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/*
+Salida: si la interfaz hace NAT, reescribe el origen (creando la conexión y reservando un
+puerto si es nueva). Devuelve 1 si se encargó del paquete (incluido registrarlo en conntrack),
+0 si la interfaz no hace NAT y -1 si hay que descartarlo (no quedan puertos).
+*/
+int sr_nat_egress(struct sr_if *iface_out, sr_ip_hdr_t *ip_hdr, unsigned int avail_len,
+                  struct sr_flow_key *k)
+{
+    uint32_t public_ip = NAT_ENABLED ? sr_nat_outside_ip(iface_out) : 0;
+    unsigned int ip_hdr_len = ip_hdr->ip_hl * 4;
+    int p = sr_nat_proto_index(k->proto);
+
+    if (public_ip == 0 || k->src == public_ip) {
+        return 0;
+    }
+    if (k->proto == ip_protocol_icmp && sr_nat_icmp_error(ip_hdr, avail_len, 0)) {
+        return 1;
+    }
+    /* Otros protocolos y fragmentos del medio no se pueden demultiplexar a la vuelta */
+    if (p < 0 || (ntohs(ip_hdr->ip_off) & IP_OFFMASK) != 0) {
+        return 0;
+    }
+    /* De ICMP solo los echo request abren una conexión nueva */
+    int can_create = (k->proto != ip_protocol_icmp)
+                     || (avail_len >= ip_hdr_len + 8 && ((uint8_t *)ip_hdr)[ip_hdr_len] == 8);
+
+    uint32_t val = sr_ct_lookup(k);
+    sr_ct_count_lookup(val != CT_NONE);
+    if (val == CT_NONE && !can_create) {
+        return 0;
+    }
+    if (val == CT_NONE)
+    {
+        struct sr_nat_pool *pool = sr_nat_get_pool(public_ip, 1);
+        uint16_t port = pool ? sr_nat_alloc_port(pool, p) : 0;
+        if (port == 0) {
+            __atomic_add_fetch(&nat_stat_no_ports, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+
+        struct sr_flow_key pair[1][2];
+        pair[0][0] = *k;
+        pair[0][1].src = k->dst;
+        pair[0][1].dst = public_ip;
+        pair[0][1].proto = k->proto;
+        pair[0][1].sport = (k->proto == ip_protocol_icmp) ? port : k->dport;
+        pair[0][1].dport = port;
+        if (sr_ct_insert_batch(pair, 1, (uint32_t)time(NULL), &val) == 0) {
+            sr_nat_release_port(public_ip, k->proto, port);
+            return -1;
+        }
+        /* Si otro hilo la creó primero (quizás desde el otro lado), el puerto reservado sobra */
+        struct sr_ct_entry *made = &ct_entries[val >> 1];
+        if ((val & 1) || made->tuple[1].dport != port || made->tuple[1].dst != public_ip) {
+            sr_nat_release_port(public_ip, k->proto, port);
+        }
+    }
+
+    sr_ct_touch(val, k, ip_hdr, ip_hdr_len, avail_len);
+    struct sr_ct_entry *e = &ct_entries[val >> 1];
+    if ((val & 1) == 0 && e->nat) {
+        sr_nat_rewrite(ip_hdr, avail_len, 1, e->tuple[1].dst, e->tuple[1].dport);
+        __atomic_add_fetch(&nat_stat_translated, 1, __ATOMIC_RELAXED);
+    }
+    return 1;
+}
+
+void sr_nat_print_stats(void)
+{
+    printf("NAT: %lu paquetes traducidos, %lu descartados por falta de puertos\n",
+           nat_stat_translated, nat_stat_no_ports);
+}
+
@@ -0,0 +1,20 @@
+/*
+NAT de origen por interfaz de salida (ver sr_nat.c). Las traducciones viven en las entradas
+de conntrack.
+*/
+#ifndef SR_NAT_H
+#define SR_NAT_H
+
+#include <stdint.h>
+#include "sr_protocol.h"
+#include "sr_flow.h"
+
+int sr_nat_add_iface(const char *ifname, uint32_t public_ip);
+int sr_nat_is_public(uint32_t ip);
+int sr_nat_ingress(sr_ip_hdr_t *ip_hdr, unsigned int avail_len, struct sr_flow_key *k);
+int sr_nat_egress(struct sr_if *iface_out, sr_ip_hdr_t *ip_hdr, unsigned int avail_len,
+                  struct sr_flow_key *k);
+void sr_nat_release_port(uint32_t public_ip, uint8_t proto, uint16_t port);
+void sr_nat_print_stats(void);
+
+#endif /* SR_NAT_H */
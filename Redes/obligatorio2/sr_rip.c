@@ -13,13 +13,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include "sr_router.h"
 #include "sr_rt.h"
 #include "sr_rip.h"
+#include "sr_fwd.h"
+#include "sr_epoch.h"
+#include "sr_io.h"
+#include "sr_txq.h"
 
 #define SPLIT_HORIZON_POISONED_REVERSE_ENABLED 1
 #define TRIGGERED_UPDATE_ENABLED 1
@@ -31,7 +40,217 @@ Apagar y prender esto*/
 
 #define RIP_MAX_ENTRIES 25
 
-static pthread_mutex_t rip_metadata_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Todo el trabajo de RIP lo hace un único hilo (sr_rip_event_loop) con epoll y timerfd.
+   El hilo de recepción no procesa los paquetes RIP, solo los copia en una cola
+   (un productor, un consumidor, sin locks) y despierta al loop con un eventfd. */
+#define RIP_RX_QUEUE_SZ 64 /* Tiene que ser potencia de 2 */
+#define RIP_RX_SLOT_LEN 1600
+#define RIP_STARTUP_DELAY_SEC 2 /* Lo que antes era el sleep(2) del hilo de anuncios */
+#define RIP_REQUEST_DELAY_SEC 3 /* Lo que antes era el sleep(3) del hilo de requests */
+
+struct sr_rip_rx_slot {
+    unsigned int pkt_len;
+    unsigned int ip_off;
+    unsigned int rip_off;
+    unsigned int rip_len;
+    char ifname[sr_IFACE_NAMELEN];
+    uint8_t buf[RIP_RX_SLOT_LEN];
+};
+
+struct sr_rip_ecmp_group;
+struct sr_fib;
+struct sr_rip_response_cache;
+struct sr_rip_summary;
+
+#define FIB_NOTES_MAX 65536 /* Prefijos anotados por vuelta (sr_rip_fib_note); con más la FIB se arma de cero */
+
+/* Prefijo que cambió, para actualizar la FIB sin rearmarla (en orden de host) */
+struct sr_rip_fib_note {
+    uint32_t net;
+    uint32_t mask;
+    int nh;               /* Lo completa sr_rip_fib_apply */
+};
+
+/*
+Estado de RIP de una instancia. Antes eran variables globales de este archivo, y con eso no
+se podían tener varios routers en el mismo proceso (ver rip_sim.c). sr_instance no tiene
+dónde colgarlo, así que se busca por sr en una lista (sr_rip_ctx_get / sr_rip_ctx_find).
+*/
+struct sr_rip_ctx {
+    struct sr_instance* sr;
+    struct sr_rip_ctx* next;
+
+    pthread_mutex_t metadata_lock;
+
+    /* Se incrementa cada vez que cambia algo que se anuncia (ruta, métrica, tag o interfaz).
+       Invalida las respuestas RIP cacheadas por interfaz (ver sr_rip_get_response). */
+    unsigned int table_generation;
+
+    /* Hay que rearmar la FIB de cero (ver sr_rip_fib_update). Lo marcan los cambios sin anotar */
+    int fib_dirty;
+    /* Prefijos que cambiaron desde la última vuelta (ver sr_rip_fib_note) */
+    struct sr_rip_fib_note* fib_notes;
+    unsigned int n_fib_notes;
+    unsigned int cap_fib_notes;
+
+    /* Contadores del plano de control (ver sr_rip_print_stats) */
+    unsigned long stat_rx_packets;
+    unsigned long stat_tx_responses;
+    unsigned long stat_tx_requests;
+    unsigned long stat_tx_drops;    /* Paquetes que la cola de salida no aceptó ni reintentando */
+    unsigned long stat_table_changes;
+    struct timespec stat_cpu;
+
+    /* Cola de recepción */
+    struct sr_rip_rx_slot* rx_queue;
+    unsigned int rx_head;   /* Lo avanza solo el productor (hilo de recepción) */
+    unsigned int rx_tail;   /* Lo avanza solo el consumidor (loop de RIP) */
+    int rx_evfd;
+
+    struct sr_rip_ecmp_group* ecmp_table;
+    unsigned int ecmp_tombstones;
+
+    struct sr_fib* fib;
+
+    struct sr_rip_response_cache* response_cache;
+
+    struct sr_rip_summary* summaries;
+    int n_summaries;        /* -1 = todavía no se leyó rip_summary_table. Con metadata_lock */
+
+    /* Triggered updates con freno (ver sr_rip_send_triggered_update) */
+    time_t triggered_hold_until;
+    int triggered_pending;
+
+    const char* snapshot_path; /* NULL = sin snapshot */
+    int snapshot_loaded;    /* Ya se cargó en sr_rip_init (o en el arranque si no había interfaces) */
+
+    /* Próximo vencimiento de cada timer cuando se corre con sr_rip_poll (0 = no armado) */
+    time_t poll_startup_at;
+    time_t poll_request_at;
+    time_t poll_advert_at;
+    time_t poll_snapshot_at;
+};
+
+static struct sr_rip_ctx* rip_ctx_list = NULL;
+static pthread_mutex_t rip_ctx_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct sr_rip_ctx* rip_ctx_last = NULL; /* La última que buscó este hilo */
+
+/* El estado de RIP de sr, o NULL si todavía no tiene. Se puede llamar desde cualquier hilo */
+static struct sr_rip_ctx* sr_rip_ctx_find(struct sr_instance* sr)
+{
+    struct sr_rip_ctx* rip = rip_ctx_last;
+    if (rip && rip->sr == sr) {
+        return rip;
+    }
+    for (rip = __atomic_load_n(&rip_ctx_list, __ATOMIC_ACQUIRE); rip; rip = rip->next) {
+        if (rip->sr == sr) {
+            rip_ctx_last = rip;
+            return rip;
+        }
+    }
+    return NULL;
+}
+
+static struct sr_rip_ctx* sr_rip_ctx_get(struct sr_instance* sr);
+
+/* Cambió lo que se anuncia y los prefijos que cambiaron ya se anotaron con sr_rip_fib_note */
+static void sr_rip_routes_changed(struct sr_rip_ctx* rip)
+{
+    __atomic_add_fetch(&rip->table_generation, 1, __ATOMIC_RELEASE);
+    rip->stat_table_changes++;
+}
+
+/* Cambió la tabla sin decir dónde: la FIB se arma de cero */
+static void sr_rip_table_changed(struct sr_rip_ctx* rip)
+{
+    sr_rip_routes_changed(rip);
+    rip->fib_dirty = 1;
+}
+
+/*
+Anota un prefijo (en orden de red, como en la sr_rt) cuya ruta se agregó, se borró o cambió
+de next hop, para que sr_rip_fib_update lo cambie en la FIB sin rearmarla entera.
+*/
+static void sr_rip_fib_note(struct sr_rip_ctx* rip, uint32_t dest, uint32_t mask)
+{
+    if (rip->fib_dirty) {
+        return; /* Se arma de cero igual */
+    }
+    if (rip->n_fib_notes == rip->cap_fib_notes) {
+        unsigned int cap = rip->cap_fib_notes ? rip->cap_fib_notes * 2 : 64;
+        struct sr_rip_fib_note* notes = cap <= FIB_NOTES_MAX
+            ? realloc(rip->fib_notes, cap * sizeof(struct sr_rip_fib_note)) : NULL;
+        if (!notes) {
+            rip->fib_dirty = 1;
+            return;
+        }
+        rip->fib_notes = notes;
+        rip->cap_fib_notes = cap;
+    }
+    rip->fib_notes[rip->n_fib_notes].net = ntohl(dest & mask);
+    rip->fib_notes[rip->n_fib_notes].mask = ntohl(mask);
+    rip->n_fib_notes++;
+}
+
+/*
+Reloj de RIP. Por defecto es time(), pero un simulador puede poner su propio reloj
+con sr_rip_set_clock y llamar a sr_rip_poll en vez de levantar el loop con sr_rip_init.
+Es uno solo para todo el proceso: en la simulación todos los routers comparten el tiempo.
+*/
+static time_t (*rip_clock)(void) = NULL;
+
+static time_t sr_rip_now(void)
+{
+    return rip_clock ? rip_clock() : time(NULL);
+}
+
+void sr_rip_set_clock(time_t (*now_fn)(void))
+{
+    rip_clock = now_fn;
+}
+
+/* Suma a stat_cpu el tiempo de CPU del hilo desde 'start' */
+static void sr_rip_account_cpu(struct sr_rip_ctx* rip, const struct timespec* start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    rip->stat_cpu.tv_sec += end.tv_sec - start->tv_sec;
+    rip->stat_cpu.tv_nsec += end.tv_nsec - start->tv_nsec;
+    if (rip->stat_cpu.tv_nsec < 0) {
+        rip->stat_cpu.tv_sec--;
+        rip->stat_cpu.tv_nsec += 1000000000L;
+    } else if (rip->stat_cpu.tv_nsec >= 1000000000L) {
+        rip->stat_cpu.tv_sec++;
+        rip->stat_cpu.tv_nsec -= 1000000000L;
+    }
+}
+
+void sr_rip_print_stats(struct sr_instance* sr)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_find(sr);
+    if (!rip) {
+        return;
+    }
+    printf("-> RIP stats: recibidos %lu, responses enviados %lu, requests enviados %lu, "
+           "descartados al enviar %lu, cambios de tabla %lu, CPU %ld.%06ld s\n",
+           rip->stat_rx_packets, rip->stat_tx_responses, rip->stat_tx_requests,
+           rip->stat_tx_drops, rip->stat_table_changes, (long)rip->stat_cpu.tv_sec, rip->stat_cpu.tv_nsec / 1000);
+}
+
+/* Los mismos contadores, para el simulador. Devuelve -1 si sr no tiene RIP */
+int sr_rip_get_stats(struct sr_instance* sr, unsigned long* rx_packets, unsigned long* tx_packets,
+                     unsigned long* table_changes, double* cpu_sec)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_find(sr);
+    if (!rip) {
+        return -1;
+    }
+    *rx_packets = rip->stat_rx_packets;
+    *tx_packets = rip->stat_tx_responses + rip->stat_tx_requests;
+    *table_changes = rip->stat_table_changes;
+    *cpu_sec = rip->stat_cpu.tv_sec + rip->stat_cpu.tv_nsec / 1e9;
+    return 0;
+}
 
 /* Dirección MAC de multicast para los paquetes RIP */
 uint8_t rip_multicast_mac[6] = {0x01, 0x00, 0x5E, 0x00, 0x00, 0x09};
@@ -80,11 +299,1139 @@ static struct sr_rt* sr_rt_find_exact(struct sr_rt* rt_table, uint32_t dest, uin
     return NULL;
 }
 
+/*
+ECMP: la ruta "principal" sigue estando en la sr_rt (gw, interface, learned_from).
+Acá se guardan los next hops EXTRA que anunciaron el mismo destino con la misma métrica,
+en una tabla hash por (destino, máscara). Solo la escribe el loop de RIP; el forwarding
+la lee sin lock usando el contador seq (si es impar se está escribiendo, si cambió se reintenta).
+*/
+#define ECMP_ENABLED 1
+#define ECMP_MAX_PATHS 4   /* Incluye el next hop que está en la sr_rt */
+#define ECMP_TABLE_SZ 256  /* Tiene que ser potencia de 2 */
+
+#define ECMP_SLOT_FREE 0
+#define ECMP_SLOT_USED 1
+#define ECMP_SLOT_DELETED 2
+
+struct sr_rip_ecmp_hop {
+    uint32_t gw;
+    char ifname[sr_IFACE_NAMELEN];
+    time_t last_updated;
+};
+
+struct sr_rip_ecmp_group {
+    unsigned int seq;
+    uint8_t state;
+    uint32_t dest;
+    uint32_t mask;
+    int n_extra;
+    struct sr_rip_ecmp_hop extra[ECMP_MAX_PATHS - 1];
+};
+
+static unsigned int sr_rip_ecmp_slot(uint32_t dest, uint32_t mask)
+{
+    uint32_t h = dest * 0x9E3779B1u ^ mask;
+    h ^= h >> 16;
+    return h & (ECMP_TABLE_SZ - 1);
+}
+
+static void sr_rip_ecmp_write_begin(struct sr_rip_ecmp_group* g)
+{
+    __atomic_store_n(&g->seq, g->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void sr_rip_ecmp_write_end(struct sr_rip_ctx* rip, struct sr_rip_ecmp_group* g)
+{
+    __atomic_store_n(&g->seq, g->seq + 1, __ATOMIC_RELEASE);
+    /* Con o sin next hops extra, la ruta tiene o no su propio next hop en la FIB */
+    sr_rip_fib_note(rip, g->dest, g->mask);
+    /* Los next hops extra entran en el split horizon, así que cambia lo que se anuncia */
+    __atomic_add_fetch(&rip->table_generation, 1, __ATOMIC_RELEASE);
+}
+
+/*
+Los slots borrados quedan como DELETED (lápida) para no cortar la búsqueda de los que están
+más adelante. Si el siguiente está FREE ninguna búsqueda pasa por ahí, así que se pueden
+volver FREE esa lápida y las anteriores. Si igual se juntan muchas se rearma la tabla.
+*/
+#define ECMP_MAX_TOMBSTONES (ECMP_TABLE_SZ / 4)
+
+static void sr_rip_ecmp_set_state(struct sr_rip_ctx* rip, struct sr_rip_ecmp_group* g, uint8_t state)
+{
+    sr_rip_ecmp_write_begin(g);
+    __atomic_store_n(&g->state, state, __ATOMIC_RELAXED);
+    sr_rip_ecmp_write_end(rip, g);
+}
+
+static void sr_rip_ecmp_compact(struct sr_rip_ctx* rip, unsigned int slot)
+{
+    if (rip->ecmp_table[(slot + 1) & (ECMP_TABLE_SZ - 1)].state != ECMP_SLOT_FREE) {
+        return;
+    }
+    for (unsigned int i = 0; i < ECMP_TABLE_SZ; i++) {
+        struct sr_rip_ecmp_group* g = &rip->ecmp_table[(slot - i) & (ECMP_TABLE_SZ - 1)];
+        if (g->state != ECMP_SLOT_DELETED) {
+            break;
+        }
+        sr_rip_ecmp_set_state(rip, g, ECMP_SLOT_FREE);
+        rip->ecmp_tombstones--;
+    }
+}
+
+static struct sr_rip_ecmp_group* sr_rip_ecmp_find(struct sr_rip_ctx* rip, uint32_t dest, uint32_t mask, int create);
+
+/*
+Rearma la tabla sin lápidas. Mientras tanto un lector puede no encontrar un grupo y usar el
+next hop de la sr_rt, que sigue siendo un camino válido; nunca ve un grupo a medio escribir.
+*/
+static void sr_rip_ecmp_rehash(struct sr_rip_ctx* rip)
+{
+    static struct sr_rip_ecmp_group used[ECMP_TABLE_SZ];
+    unsigned int n = 0;
+
+    for (unsigned int i = 0; i < ECMP_TABLE_SZ; i++) {
+        struct sr_rip_ecmp_group* g = &rip->ecmp_table[i];
+        if (g->state == ECMP_SLOT_USED) {
+            used[n++] = *g;
+        }
+        if (g->state != ECMP_SLOT_FREE) {
+            sr_rip_ecmp_set_state(rip, g, ECMP_SLOT_FREE);
+        }
+    }
+    rip->ecmp_tombstones = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        struct sr_rip_ecmp_group* g = sr_rip_ecmp_find(rip, used[i].dest, used[i].mask, 1);
+        sr_rip_ecmp_write_begin(g);
+        g->n_extra = used[i].n_extra;
+        memcpy(g->extra, used[i].extra, sizeof(g->extra));
+        sr_rip_ecmp_write_end(rip, g);
+    }
+}
+
+/* Busca el grupo de (dest, mask). Si create es 1 y no existe lo crea. Solo el loop de RIP */
+static struct sr_rip_ecmp_group* sr_rip_ecmp_find(struct sr_rip_ctx* rip, uint32_t dest, uint32_t mask, int create)
+{
+    unsigned int slot = sr_rip_ecmp_slot(dest, mask);
+    struct sr_rip_ecmp_group* reuse = NULL;
+
+    for (unsigned int i = 0; i < ECMP_TABLE_SZ; i++)
+    {
+        struct sr_rip_ecmp_group* g = &rip->ecmp_table[(slot + i) & (ECMP_TABLE_SZ - 1)];
+
+        if (g->state == ECMP_SLOT_USED && g->dest == dest && g->mask == mask) {
+            return g;
+        }
+        if (g->state == ECMP_SLOT_DELETED && !reuse) {
+            reuse = g;
+        }
+        if (g->state == ECMP_SLOT_FREE) {
+            if (!reuse) {
+                reuse = g;
+            }
+            break;
+        }
+    }
+
+    if (!create || !reuse) {
+        return NULL;
+    }
+
+    /* Un lector puede estar mirando este slot (era de otro grupo o una lápida en su camino):
+       se cambia la clave dentro de la sección de escritura para que lo note y reintente */
+    if (reuse->state == ECMP_SLOT_DELETED) {
+        rip->ecmp_tombstones--;
+    }
+    sr_rip_ecmp_write_begin(reuse);
+    __atomic_store_n(&reuse->dest, dest, __ATOMIC_RELAXED);
+    __atomic_store_n(&reuse->mask, mask, __ATOMIC_RELAXED);
+    reuse->n_extra = 0;
+    __atomic_store_n(&reuse->state, ECMP_SLOT_USED, __ATOMIC_RELAXED);
+    sr_rip_ecmp_write_end(rip, reuse);
+    return reuse;
+}
+
+/* Borra el grupo dejando una lápida (o nada, si se puede compactar) */
+static void sr_rip_ecmp_delete(struct sr_rip_ctx* rip, struct sr_rip_ecmp_group* g)
+{
+    sr_rip_ecmp_write_begin(g);
+    g->n_extra = 0;
+    __atomic_store_n(&g->state, ECMP_SLOT_DELETED, __ATOMIC_RELAXED);
+    sr_rip_ecmp_write_end(rip, g);
+    rip->ecmp_tombstones++;
+
+    sr_rip_ecmp_compact(rip, (unsigned int)(g - rip->ecmp_table));
+    if (rip->ecmp_tombstones > ECMP_MAX_TOMBSTONES) {
+        sr_rip_ecmp_rehash(rip);
+    }
+}
+
+static void sr_rip_ecmp_remove_at(struct sr_rip_ctx* rip, struct sr_rip_ecmp_group* g, int i)
+{
+    sr_rip_ecmp_write_begin(g);
+    g->extra[i] = g->extra[g->n_extra - 1];
+    g->n_extra--;
+    sr_rip_ecmp_write_end(rip, g);
+}
+
+/* Agrega (o refresca) un next hop extra. Devuelve 1 si lo agregó. */
+static int sr_rip_ecmp_add_hop(struct sr_rip_ctx* rip, uint32_t dest, uint32_t mask, uint32_t gw, const char* ifname, time_t now)
+{
+    struct sr_rip_ecmp_group* g = sr_rip_ecmp_find(rip, dest, mask, 1);
+    if (!g) {
+        return 0;
+    }
+
+    for (int i = 0; i < g->n_extra; i++) {
+        if (g->extra[i].gw == gw) {
+            g->extra[i].last_updated = now;
+            return 0;
+        }
+    }
+
+    if (g->n_extra >= ECMP_MAX_PATHS - 1) {
+        return 0;
+    }
+
+    sr_rip_ecmp_write_begin(g);
+    g->extra[g->n_extra].gw = gw;
+    strncpy(g->extra[g->n_extra].ifname, ifname, sr_IFACE_NAMELEN - 1);
+    g->extra[g->n_extra].ifname[sr_IFACE_NAMELEN - 1] = '\0';
+    g->extra[g->n_extra].last_updated = now;
+    g->n_extra++;
+    sr_rip_ecmp_write_end(rip, g);
+    return 1;
+}
+
+/* Saca un next hop extra (el vecino empeoró la métrica o anunció infinito) */
+static void sr_rip_ecmp_remove_hop(struct sr_rip_ctx* rip, uint32_t dest, uint32_t mask, uint32_t gw)
+{
+    struct sr_rip_ecmp_group* g = sr_rip_ecmp_find(rip, dest, mask, 0);
+    if (!g) {
+        return;
+    }
+    for (int i = 0; i < g->n_extra; i++) {
+        if (g->extra[i].gw == gw) {
+            sr_rip_ecmp_remove_at(rip, g, i);
+            return;
+        }
+    }
+}
+
+/* Vacía el grupo (cambió la métrica de la ruta principal) o lo borra si forget es 1 */
+static void sr_rip_ecmp_clear(struct sr_rip_ctx* rip, uint32_t dest, uint32_t mask, int forget)
+{
+    struct sr_rip_ecmp_group* g = sr_rip_ecmp_find(rip, dest, mask, 0);
+    if (!g) {
+        return;
+    }
+    if (forget) {
+        sr_rip_ecmp_delete(rip, g);
+    } else if (g->n_extra > 0) {
+        sr_rip_ecmp_write_begin(g);
+        g->n_extra = 0;
+        sr_rip_ecmp_write_end(rip, g);
+    }
+}
+
+/*
+Si se cae el next hop principal y hay otros de igual costo, en vez de invalidar la ruta
+se pasa uno de los extra a la sr_rt. Devuelve 1 si pudo.
+*/
+static int sr_rip_ecmp_promote(struct sr_rip_ctx* rip, struct sr_rt* rt)
+{
+    struct sr_rip_ecmp_group* g = sr_rip_ecmp_find(rip, rt->dest.s_addr, rt->mask.s_addr, 0);
+    if (!g || g->n_extra == 0) {
+        return 0;
+    }
+
+    struct sr_rip_ecmp_hop hop = g->extra[0];
+    sr_rip_ecmp_remove_at(rip, g, 0);
+
+    rt->gw.s_addr = hop.gw;
+    rt->learned_from = hop.gw;
+    strncpy(rt->interface, hop.ifname, sr_IFACE_NAMELEN);
+    rt->last_updated = hop.last_updated;
+
+    /* Cambió la interfaz de la ruta, así que cambia el split horizon */
+    sr_rip_fib_note(rip, rt->dest.s_addr, rt->mask.s_addr);
+    sr_rip_routes_changed(rip);
+
+    printf("RIP: ECMP, next hop principal caído para %s, pasa a %s\n",
+          inet_ntoa(rt->dest), inet_ntoa(rt->gw));
+    return 1;
+}
+
+/* Saca los next hops extra que no se refrescaron en RIP_TIMEOUT_SEC */
+static void sr_rip_ecmp_expire(struct sr_rip_ctx* rip, struct sr_rt* rt, time_t now)
+{
+    struct sr_rip_ecmp_group* g = sr_rip_ecmp_find(rip, rt->dest.s_addr, rt->mask.s_addr, 0);
+    if (!g) {
+        return;
+    }
+    for (int i = g->n_extra - 1; i >= 0; i--) {
+        if ((now - g->extra[i].last_updated) >= RIP_TIMEOUT_SEC) {
+            sr_rip_ecmp_remove_at(rip, g, i);
+        }
+    }
+}
+
+/* El vencimiento más cercano de los next hops extra de la ruta (0 si no tiene) */
+static time_t sr_rip_ecmp_next_deadline(struct sr_rip_ctx* rip, struct sr_rt* rt)
+{
+    struct sr_rip_ecmp_group* g = sr_rip_ecmp_find(rip, rt->dest.s_addr, rt->mask.s_addr, 0);
+    time_t next = 0;
+    if (!g) {
+        return 0;
+    }
+    for (int i = 0; i < g->n_extra; i++) {
+        time_t deadline = g->extra[i].last_updated + RIP_TIMEOUT_SEC;
+        if (next == 0 || deadline < next) {
+            next = deadline;
+        }
+    }
+    return next;
+}
+
+/* 1 si alguno de los next hops extra de la ruta sale por ifname (para el split horizon) */
+static int sr_rip_ecmp_uses_if(struct sr_rip_ctx* rip, struct sr_rt* rt, const char* ifname)
+{
+    if (!ECMP_ENABLED || rt->learned_from == 0) {
+        return 0;
+    }
+    struct sr_rip_ecmp_group* g = sr_rip_ecmp_find(rip, rt->dest.s_addr, rt->mask.s_addr, 0);
+    if (!g) {
+        return 0;
+    }
+    for (int i = 0; i < g->n_extra; i++) {
+        if (strcmp(g->extra[i].ifname, ifname) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+La usa el forwarding (sr_handle_ip_packet) después del LPM. Con el hash del flujo elige
+uno de los caminos de igual costo: 0 es el de la sr_rt, los demás son los extra.
+Devuelve 1 y completa gw/ifname si tocó un extra, 0 si hay que usar la sr_rt.
+
+No usa sr_rip_ecmp_find: el loop de RIP puede estar reusando o borrando el slot, así que
+la clave y el estado de cada slot del recorrido se leen también dentro del seq.
+*/
+int sr_rip_ecmp_select(struct sr_instance* sr, struct sr_rt* rt, uint32_t flow_hash, uint32_t* gw, char* ifname)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_find(sr);
+    if (!ECMP_ENABLED || !rip || rt->learned_from == 0) {
+        return 0;
+    }
+
+    uint32_t dest = rt->dest.s_addr;
+    uint32_t mask = rt->mask.s_addr;
+    unsigned int slot = sr_rip_ecmp_slot(dest, mask);
+
+    for (unsigned int i = 0; i < ECMP_TABLE_SZ; i++)
+    {
+        struct sr_rip_ecmp_group* g = &rip->ecmp_table[(slot + i) & (ECMP_TABLE_SZ - 1)];
+        unsigned int seq;
+        uint8_t state;
+        int match;
+        int picked;
+        uint32_t pick_gw = 0;
+        char pick_ifname[sr_IFACE_NAMELEN];
+
+        do {
+            seq = __atomic_load_n(&g->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) {
+                continue;
+            }
+            state = __atomic_load_n(&g->state, __ATOMIC_RELAXED);
+            match = state == ECMP_SLOT_USED
+                && __atomic_load_n(&g->dest, __ATOMIC_RELAXED) == dest
+                && __atomic_load_n(&g->mask, __ATOMIC_RELAXED) == mask;
+            picked = 0;
+            if (match) {
+                int n_extra = g->n_extra;
+                int idx = (n_extra > 0 && n_extra < ECMP_MAX_PATHS) ? flow_hash % (unsigned int)(n_extra + 1) : 0;
+                if (idx > 0) {
+                    pick_gw = g->extra[idx - 1].gw;
+                    memcpy(pick_ifname, g->extra[idx - 1].ifname, sr_IFACE_NAMELEN);
+                    picked = 1;
+                }
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while ((seq & 1) || seq != __atomic_load_n(&g->seq, __ATOMIC_RELAXED));
+
+        if (match) {
+            if (picked) {
+                *gw = pick_gw;
+                memcpy(ifname, pick_ifname, sr_IFACE_NAMELEN);
+            }
+            return picked;
+        }
+        if (state == ECMP_SLOT_FREE) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/*
+FIB comprimida. RIP llena la tabla con muchos prefijos vecinos que salen por el mismo next hop
+y la misma interfaz; antes de buscar se arma un conjunto mínimo de prefijos que reenvía igual
+que la tabla entera, con ORTC (Draves et al., "Constructing Optimal IP Routing Tables"):
+  1. Se arma un trie binario con las rutas. A un nodo que tiene un solo hijo se le cuenta el
+     otro como una hoja que hereda el next hop del ancestro más cercano con ruta (o "sin ruta");
+     esa hoja solo se crea de verdad si en el paso 3 tiene que generar un prefijo.
+  2. De abajo hacia arriba, cada nodo se queda con la intersección de los conjuntos de next
+     hops de sus hijos, o con la unión si la intersección es vacía.
+  3. De arriba hacia abajo, un nodo genera un prefijo solo si el next hop que hereda no está
+     en su conjunto. "Sin ruta" también es un next hop: puede salir un prefijo que tapa un
+     hueco y que en la búsqueda devuelve NULL.
+El trie queda armado entre cambios y es lo mismo que se busca: cada nodo tiene en 'emit' el
+next hop del prefijo que genera (o -1) y la búsqueda baja con los bits del destino quedándose
+con el último emit que vio (a lo sumo 32 pasos). Los next hops distintos (mismo gw e interfaz)
+tienen una copia de la sr_rt en nh_rt, que es lo que devuelve la búsqueda; así no depende de
+que la lista no cambie. Las rutas con ECMP activo tienen su propio next hop (el grupo se busca
+por su destino) y nunca se juntan con otras. Los conjuntos son bitsets del tamaño de la
+cantidad de next hops distintos, no de la cantidad de rutas.
+
+Los cambios se aplican de a poco: el que cambia una ruta anota el prefijo con sr_rip_fib_note
+y en la vuelta del loop de RIP (sr_rip_fib_update) se busca la primera ruta de cada prefijo
+anotado, en una sola pasada por la lista, se cambia el next hop de su nodo y se recalculan los
+conjuntos solo en lo que hereda de ese nodo y en sus ancestros. El paso 3 baja solo por los
+nodos recalculados o cuyo next hop heredado cambió. Los emit nuevos se escriben todos juntos
+dentro de un seq, como los grupos ECMP: la búsqueda reintenta si es impar o si cambió, así
+nunca ve media actualización.
+
+Se arma de cero desde la lista si alguien marcó fib_dirty (cambios sin anotar: rutas conectadas,
+snapshot), si se anotaron demás o si no alcanza el lugar reservado para nodos o next hops. La
+nueva se publica con un puntero atómico y la vieja se retira con sr_epoch_retire: un forwarding
+que todavía tiene un puntero a su nh_rt lo sigue pudiendo usar hasta que sale de su época.
+Se respeta lo que hace el recorrido lineal de sr_lpm_lookup: una máscara 0 nunca se elige y
+entre dos rutas iguales gana la primera de la lista.
+*/
+#define FIB_COMPRESS_ENABLED 1
+#define FIB_CHECK_ON_REBUILD 0    /* Comparar contra la lista después de cada cambio (debug) */
+#define FIB_CHECK_SAMPLES 10000   /* Direcciones al azar que prueba sr_rip_fib_check */
+#define FIB_SPARE_NODES 4096      /* Nodos de margen para los cambios, además del doble de los usados */
+
+/* Lo que mira la búsqueda */
+struct sr_fib_node {
+    int32_t child[2];
+    int32_t emit;          /* Next hop del prefijo que genera el nodo (0 = sin ruta), -1 si no genera */
+};
+
+/* Lo que usa solo el hilo de RIP para recalcular */
+struct sr_fib_wnode {
+    int32_t nh;            /* Next hop propio (-1 si el prefijo no está en la tabla) */
+    int32_t in;            /* Next hop que heredó en el último paso 3 (-1 = todavía no pasó) */
+    uint32_t gen;          /* Vuelta en que se recalculó su conjunto */
+};
+
+struct sr_fib_emit {
+    int32_t node;
+    int32_t emit;
+};
+
+struct sr_fib {
+    unsigned int seq;             /* Impar mientras se escriben los emit */
+    struct sr_fib_node* nodes;    /* El 0 es la raíz */
+    struct sr_rt* nh_rt;          /* nh_rt[i] = ruta del next hop i (el 0 es "sin ruta") */
+
+    /* De acá para abajo solo el hilo de RIP */
+    struct sr_fib_wnode* wnodes;
+    uint64_t* sets;               /* Conjunto de next hops de cada nodo, 'words' palabras */
+    uint64_t* scratch;            /* Conjunto de un hijo que no existe */
+    unsigned int words;
+    unsigned int n_nodes;
+    unsigned int cap_nodes;
+    unsigned int n_nh;
+    unsigned int cap_nh;
+    uint8_t* nh_ecmp;             /* El next hop es de una ruta con ECMP (no se comparte) */
+    int32_t* nh_hash;             /* (gw, interfaz[, prefijo]) -> next hop, 2 * cap_nh lugares */
+    int published;                /* Ya la puede estar leyendo el forwarding: no se agranda más */
+    uint32_t gen;
+    unsigned int n_routes;
+    unsigned int n_prefixes;
+    struct sr_fib_emit* pending;  /* Emits que cambiaron en el paso 3, para escribir juntos */
+    unsigned int n_pending;
+    unsigned int cap_pending;
+};
+
+void sr_rip_fib_free(struct sr_fib* fib)
+{
+    if (fib) {
+        free(fib->nodes);
+        free(fib->nh_rt);
+        free(fib->wnodes);
+        free(fib->sets);
+        free(fib->scratch);
+        free(fib->nh_ecmp);
+        free(fib->nh_hash);
+        free(fib->pending);
+        free(fib);
+    }
+}
+
+static void sr_rip_fib_free_retired(void* fib)
+{
+    sr_rip_fib_free((struct sr_fib*)fib);
+}
+
+/*
+Memoria de la FIB: la que mira la búsqueda y el total con lo que usa RIP para los cambios.
+Esta y sr_rip_fib_counts son para bench_lpm.c, que no ve struct sr_fib.
+*/
+void sr_rip_fib_mem(struct sr_fib* fib, size_t* lookup, size_t* total)
+{
+    *lookup = (size_t)fib->cap_nodes * sizeof(struct sr_fib_node) + (size_t)fib->cap_nh * sizeof(struct sr_rt);
+    *total = *lookup + (size_t)fib->cap_nodes * (sizeof(struct sr_fib_wnode) + fib->words * sizeof(uint64_t))
+        + (size_t)fib->cap_nh * (1 + 2 * sizeof(int32_t)) + (size_t)fib->cap_pending * sizeof(struct sr_fib_emit);
+}
+
+/* Prefijos, nodos y next hops (sin contar el 0, "sin ruta") */
+void sr_rip_fib_counts(struct sr_fib* fib, unsigned int* prefixes, unsigned int* nodes, unsigned int* next_hops)
+{
+    *prefixes = fib->n_prefixes;
+    *nodes = fib->n_nodes;
+    *next_hops = fib->n_nh - 1;
+}
+
+/* Mientras se arma (antes de publicarla) los arreglos crecen; después no se mueven más */
+static int sr_rip_fib_grow_nodes(struct sr_fib* fib, unsigned int cap)
+{
+    struct sr_fib_node* nodes = realloc(fib->nodes, (size_t)cap * sizeof(struct sr_fib_node));
+    if (!nodes) {
+        return -1;
+    }
+    fib->nodes = nodes;
+    struct sr_fib_wnode* wnodes = realloc(fib->wnodes, (size_t)cap * sizeof(struct sr_fib_wnode));
+    if (!wnodes) {
+        return -1;
+    }
+    fib->wnodes = wnodes;
+    fib->cap_nodes = cap;
+    return 0;
+}
+
+static uint32_t sr_rip_fib_nh_hash(struct sr_rt* rt, int ecmp)
+{
+    uint32_t h = rt->gw.s_addr * 0x9E3779B1u;
+    for (int i = 0; i < sr_IFACE_NAMELEN && rt->interface[i]; i++) {
+        h = (h ^ (uint8_t)rt->interface[i]) * 16777619u;
+    }
+    if (ecmp) {
+        h ^= ((rt->dest.s_addr & rt->mask.s_addr) * 0x85EBCA6Bu) ^ rt->mask.s_addr;
+    }
+    h ^= h >> 16;
+    return h;
+}
+
+static int sr_rip_fib_nh_same(struct sr_fib* fib, int id, struct sr_rt* rt, int ecmp)
+{
+    struct sr_rt* x = &fib->nh_rt[id];
+    if (fib->nh_ecmp[id] != ecmp || x->gw.s_addr != rt->gw.s_addr
+        || strncmp(x->interface, rt->interface, sr_IFACE_NAMELEN) != 0) {
+        return 0;
+    }
+    return !ecmp || ((x->dest.s_addr & x->mask.s_addr) == (rt->dest.s_addr & rt->mask.s_addr)
+                     && x->mask.s_addr == rt->mask.s_addr);
+}
+
+static int sr_rip_fib_grow_nh(struct sr_fib* fib, unsigned int cap)
+{
+    struct sr_rt* nh_rt = realloc(fib->nh_rt, (size_t)cap * sizeof(struct sr_rt));
+    if (!nh_rt) {
+        return -1;
+    }
+    fib->nh_rt = nh_rt;
+    uint8_t* nh_ecmp = realloc(fib->nh_ecmp, cap);
+    if (!nh_ecmp) {
+        return -1;
+    }
+    fib->nh_ecmp = nh_ecmp;
+    int32_t* nh_hash = malloc((size_t)cap * 2 * sizeof(int32_t));
+    if (!nh_hash) {
+        return -1;
+    }
+    memset(nh_hash, 0xFF, (size_t)cap * 2 * sizeof(int32_t));
+    for (unsigned int id = 1; id < fib->n_nh; id++) {
+        uint32_t i = sr_rip_fib_nh_hash(&nh_rt[id], nh_ecmp[id]) & (cap * 2 - 1);
+        while (nh_hash[i] >= 0) {
+            i = (i + 1) & (cap * 2 - 1);
+        }
+        nh_hash[i] = (int32_t)id;
+    }
+    free(fib->nh_hash);
+    fib->nh_hash = nh_hash;
+    fib->cap_nh = cap;
+    return 0;
+}
+
+/* Dos rutas reenvían igual si tienen el mismo gw e interfaz y ninguna tiene ECMP activo */
+static int sr_rip_fib_has_ecmp(struct sr_rip_ctx* rip, struct sr_rt* rt)
+{
+    if (!ECMP_ENABLED || !rip || rt->learned_from == 0) {
+        return 0;
+    }
+    struct sr_rip_ecmp_group* g = sr_rip_ecmp_find(rip, rt->dest.s_addr, rt->mask.s_addr, 0);
+    return g && g->n_extra > 0;
+}
+
+/* Next hop de la ruta: el que ya hay con el mismo gw e interfaz, o uno nuevo. -1 si no entra */
+static int sr_rip_fib_nh(struct sr_fib* fib, struct sr_rip_ctx* rip, struct sr_rt* rt)
+{
+    int ecmp = sr_rip_fib_has_ecmp(rip, rt);
+    uint32_t h = sr_rip_fib_nh_hash(rt, ecmp);
+    uint32_t i;
+    for (i = h & (fib->cap_nh * 2 - 1); fib->nh_hash[i] >= 0; i = (i + 1) & (fib->cap_nh * 2 - 1)) {
+        if (sr_rip_fib_nh_same(fib, fib->nh_hash[i], rt, ecmp)) {
+            return fib->nh_hash[i];
+        }
+    }
+    if (fib->n_nh == fib->cap_nh) {
+        if (fib->published || sr_rip_fib_grow_nh(fib, fib->cap_nh * 2) < 0) {
+            return -1;
+        }
+        return sr_rip_fib_nh(fib, rip, rt);
+    }
+    int id = (int)fib->n_nh++;
+    fib->nh_rt[id] = *rt;
+    fib->nh_rt[id].next = NULL;
+    if (!ecmp) {
+        /* La copia representa solo al next hop: que sr_rip_ecmp_select no busque un grupo con ella */
+        fib->nh_rt[id].learned_from = 0;
+    }
+    fib->nh_ecmp[id] = (uint8_t)ecmp;
+    fib->nh_hash[i] = id;
+    return id;
+}
+
+/* Nodo nuevo sin hijos ni prefijo. -1 si no hay lugar (con la FIB publicada no se agranda) */
+static int sr_rip_fib_new_node(struct sr_fib* fib)
+{
+    if (fib->n_nodes == fib->cap_nodes
+        && (fib->published || sr_rip_fib_grow_nodes(fib, fib->cap_nodes * 2) < 0)) {
+        return -1;
+    }
+    int i = (int)fib->n_nodes++;
+    fib->nodes[i].child[0] = -1;
+    fib->nodes[i].child[1] = -1;
+    fib->nodes[i].emit = -1;
+    fib->wnodes[i].nh = -1;
+    fib->wnodes[i].in = -1;
+    fib->wnodes[i].gen = fib->gen;
+    if (fib->sets) {
+        memset(&fib->sets[(size_t)i * fib->words], 0, fib->words * sizeof(uint64_t));
+    }
+    return i;
+}
+
+/* Cuelga el nodo de su padre; recién ahí lo puede ver la búsqueda, ya inicializado */
+static void sr_rip_fib_link(struct sr_fib* fib, int parent, int bit, int child)
+{
+    __atomic_store_n(&fib->nodes[parent].child[bit], child, __ATOMIC_RELEASE);
+}
+
+static uint64_t* sr_rip_fib_set(struct sr_fib* fib, int node)
+{
+    return &fib->sets[(size_t)node * fib->words];
+}
+
+static int sr_rip_fib_set_has(struct sr_fib* fib, int node, int nh)
+{
+    return (sr_rip_fib_set(fib, node)[nh / 64] >> (nh % 64)) & 1;
+}
+
+static void sr_rip_fib_set_single(struct sr_fib* fib, uint64_t* set, int nh)
+{
+    memset(set, 0, fib->words * sizeof(uint64_t));
+    set[nh / 64] |= 1ULL << (nh % 64);
+}
+
+/* Paso 2 en un nodo; 'inherited' es lo que heredan sus hijos (su next hop si tiene) */
+static void sr_rip_fib_combine(struct sr_fib* fib, int node, int inherited)
+{
+    uint64_t* set = sr_rip_fib_set(fib, node);
+    int c0 = fib->nodes[node].child[0];
+    int c1 = fib->nodes[node].child[1];
+    fib->wnodes[node].gen = fib->gen;
+
+    if (c0 < 0 && c1 < 0) {
+        sr_rip_fib_set_single(fib, set, inherited);
+        return;
+    }
+    /* El hijo que falta es una hoja que hereda */
+    if (c0 < 0 || c1 < 0) {
+        sr_rip_fib_set_single(fib, fib->scratch, inherited);
+    }
+    const uint64_t* a = c0 >= 0 ? sr_rip_fib_set(fib, c0) : fib->scratch;
+    const uint64_t* b = c1 >= 0 ? sr_rip_fib_set(fib, c1) : fib->scratch;
+    int empty = 1;
+    for (unsigned int w = 0; w < fib->words; w++) {
+        set[w] = a[w] & b[w];
+        if (set[w]) {
+            empty = 0;
+        }
+    }
+    if (empty) {
+        for (unsigned int w = 0; w < fib->words; w++) {
+            set[w] = a[w] | b[w];
+        }
+    }
+}
+
+/*
+Paso 2 en el subárbol de node. Armando de cero se recorre todo; en un cambio no hace falta
+bajar a los hijos que tienen ruta propia, porque no heredan nada de arriba.
+*/
+static void sr_rip_fib_pass_up(struct sr_fib* fib, int node, int inherited, int full)
+{
+    if (fib->wnodes[node].nh >= 0) {
+        inherited = fib->wnodes[node].nh;
+    }
+    for (int c = 0; c < 2; c++) {
+        int child = fib->nodes[node].child[c];
+        if (child >= 0 && (full || fib->wnodes[child].nh < 0)) {
+            sr_rip_fib_pass_up(fib, child, inherited, full);
+        }
+    }
+    sr_rip_fib_combine(fib, node, inherited);
+}
+
+static int sr_rip_fib_set_emit(struct sr_fib* fib, int node, int emit)
+{
+    int old = fib->nodes[node].emit;
+    if (old == emit) {
+        return 0;
+    }
+    fib->n_prefixes += (emit >= 0) - (old >= 0);
+    if (!fib->published) {
+        fib->nodes[node].emit = emit;
+        return 0;
+    }
+    if (fib->n_pending == fib->cap_pending) {
+        unsigned int cap = fib->cap_pending ? fib->cap_pending * 2 : 256;
+        struct sr_fib_emit* p = realloc(fib->pending, cap * sizeof(struct sr_fib_emit));
+        if (!p) {
+            return -1;
+        }
+        fib->pending = p;
+        fib->cap_pending = cap;
+    }
+    fib->pending[fib->n_pending].node = node;
+    fib->pending[fib->n_pending].emit = emit;
+    fib->n_pending++;
+    return 0;
+}
+
+/*
+Paso 3. 'inherited' es el next hop que le llega de los prefijos de arriba y 'route' el de la
+ruta más específica de arriba (lo que hereda una hoja que no existe). En un cambio se saltea
+el subárbol de un nodo que no se recalculó y al que le llega lo mismo que la vez anterior.
+*/
+static int sr_rip_fib_pass_down(struct sr_fib* fib, int node, int inherited, int route, int full)
+{
+    struct sr_fib_wnode* w = &fib->wnodes[node];
+    if (!full && w->gen != fib->gen && w->in == inherited) {
+        return 0;
+    }
+    w->in = inherited;
+    if (w->nh >= 0) {
+        route = w->nh;
+    }
+
+    int chosen = inherited;
+    int emit = -1;
+    if (!sr_rip_fib_set_has(fib, node, inherited)) {
+        uint64_t* set = sr_rip_fib_set(fib, node);
+        for (unsigned int i = 0; i < fib->words; i++) {
+            if (set[i]) {
+                chosen = (int)(i * 64 + __builtin_ctzll(set[i]));
+                break;
+            }
+        }
+        emit = chosen;
+    }
+    if (sr_rip_fib_set_emit(fib, node, emit) < 0) {
+        return -1;
+    }
+
+    for (int c = 0; c < 2; c++) {
+        int child = fib->nodes[node].child[c];
+        if (child < 0) {
+            if (chosen == route) {
+                continue;
+            }
+            /* La hoja que falta tiene que generar un prefijo: ahora sí se crea */
+            child = sr_rip_fib_new_node(fib);
+            if (child < 0) {
+                return -1;
+            }
+            sr_rip_fib_set_single(fib, sr_rip_fib_set(fib, child), route);
+            sr_rip_fib_link(fib, node, c, child);
+        }
+        if (sr_rip_fib_pass_down(fib, child, chosen, route, full) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Máscara contigua en orden de host: largo del prefijo, o -1 si no se puede poner en un trie */
+static int sr_rip_fib_plen(uint32_t mask)
+{
+    if ((~mask & (~mask + 1)) != 0) {
+        return -1;
+    }
+    return __builtin_popcount(mask);
+}
+
+/*
+Baja hasta el nodo del prefijo creando lo que falte. Deja en path[d] el nodo de profundidad d
+y en route[d] el next hop que heredan sus hijos. -1 si no hay lugar.
+*/
+static int sr_rip_fib_walk(struct sr_fib* fib, uint32_t net, int plen, int* path, int* route)
+{
+    int node = 0;
+    int inherited = 0;
+    for (int d = 0; ; d++) {
+        path[d] = node;
+        if (fib->wnodes[node].nh >= 0) {
+            inherited = fib->wnodes[node].nh;
+        }
+        route[d] = inherited;
+        if (d == plen) {
+            return node;
+        }
+        int bit = (net >> (31 - d)) & 1;
+        int child = fib->nodes[node].child[bit];
+        if (child < 0) {
+            child = sr_rip_fib_new_node(fib);
+            if (child < 0) {
+                return -1;
+            }
+            if (fib->sets) {
+                sr_rip_fib_set_single(fib, sr_rip_fib_set(fib, child), inherited);
+            }
+            sr_rip_fib_link(fib, node, bit, child);
+        }
+        node = child;
+    }
+}
+
+/* Arma la FIB a partir de la tabla. Devuelve NULL si no se pudo (se busca en la lista) */
+struct sr_fib* sr_rip_fib_build(struct sr_instance* sr)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_find(sr); /* NULL en el banco de pruebas: sin ECMP */
+    for (struct sr_rt* rt = sr->routing_table; rt; rt = rt->next) {
+        if (sr_rip_fib_plen(ntohl(rt->mask.s_addr)) < 0) {
+            return NULL; /* Máscara no contigua */
+        }
+    }
+
+    struct sr_fib* fib = calloc(1, sizeof(struct sr_fib));
+    if (!fib || sr_rip_fib_grow_nodes(fib, 1024) < 0 || sr_rip_fib_grow_nh(fib, 64) < 0) {
+        sr_rip_fib_free(fib);
+        return NULL;
+    }
+    fib->n_nh = 1; /* El 0 es "sin ruta" */
+    int root = sr_rip_fib_new_node(fib);
+
+    /* Paso 1: el trie y los next hops, sin conjuntos todavía (no se sabe cuántos next hops hay) */
+    int path[33];
+    int route[33];
+    for (struct sr_rt* rt = sr->routing_table; rt; rt = rt->next) {
+        uint32_t mask = ntohl(rt->mask.s_addr);
+        if (mask == 0) {
+            continue;
+        }
+        int node = sr_rip_fib_walk(fib, ntohl(rt->dest.s_addr) & mask, sr_rip_fib_plen(mask), path, route);
+        if (node < 0) {
+            sr_rip_fib_free(fib);
+            return NULL;
+        }
+        if (fib->wnodes[node].nh >= 0) {
+            continue; /* Ruta repetida: gana la primera, como en la lista */
+        }
+        int nh = sr_rip_fib_nh(fib, rip, rt);
+        if (nh < 0) {
+            sr_rip_fib_free(fib);
+            return NULL;
+        }
+        fib->wnodes[node].nh = nh;
+        fib->n_routes++;
+    }
+
+    /* Lugar para los cambios: el doble de next hops y de nodos (las hojas del paso 3 entran ahí) */
+    unsigned int cap_nh = 64;
+    while (cap_nh < 2 * fib->n_nh) {
+        cap_nh *= 2;
+    }
+    fib->words = cap_nh / 64;
+    if (sr_rip_fib_grow_nh(fib, cap_nh) < 0
+        || sr_rip_fib_grow_nodes(fib, 2 * fib->n_nodes + FIB_SPARE_NODES) < 0
+        || !(fib->sets = malloc((size_t)fib->cap_nodes * fib->words * sizeof(uint64_t)))
+        || !(fib->scratch = malloc(fib->words * sizeof(uint64_t)))) {
+        sr_rip_fib_free(fib);
+        return NULL;
+    }
+
+    sr_rip_fib_pass_up(fib, root, 0, 1);
+    if (sr_rip_fib_pass_down(fib, root, 0, 0, 1) < 0) {
+        sr_rip_fib_free(fib);
+        return NULL;
+    }
+    fib->published = 1;
+    return fib;
+}
+
+/*
+Aplica los prefijos anotados a una FIB ya publicada. Devuelve -1 si no alcanzó el lugar: la
+FIB sigue igual para la búsqueda (los nodos que se colgaron no generan nada) y hay que armarla
+de cero.
+*/
+static int sr_rip_fib_apply(struct sr_instance* sr, struct sr_rip_ctx* rip, struct sr_fib* fib)
+{
+    unsigned int n = rip->n_fib_notes;
+    unsigned int cap = 16;
+    while (cap < 2 * n) {
+        cap *= 2;
+    }
+    int32_t* index = malloc(cap * sizeof(int32_t));
+    if (!index) {
+        return -1;
+    }
+    memset(index, 0xFF, cap * sizeof(int32_t));
+
+    /* Índice de los prefijos anotados (los repetidos quedan una sola vez); nh -1 = sin ruta */
+    struct sr_rip_fib_note* notes = rip->fib_notes;
+    unsigned int n_unique = 0;
+    for (unsigned int k = 0; k < n; k++) {
+        uint32_t h = notes[k].net * 0x9E3779B1u ^ notes[k].mask;
+        h ^= h >> 16;
+        uint32_t i;
+        for (i = h & (cap - 1); index[i] >= 0; i = (i + 1) & (cap - 1)) {
+            if (notes[index[i]].net == notes[k].net && notes[index[i]].mask == notes[k].mask) {
+                break;
+            }
+        }
+        if (index[i] < 0) {
+            notes[n_unique] = notes[k];
+            notes[n_unique].nh = -1;
+            index[i] = (int32_t)n_unique++;
+        }
+    }
+
+    /* Una pasada por la lista: la primera ruta de cada prefijo anotado */
+    int ret = 0;
+    for (struct sr_rt* rt = sr->routing_table; rt && ret == 0; rt = rt->next) {
+        uint32_t mask = ntohl(rt->mask.s_addr);
+        uint32_t net = ntohl(rt->dest.s_addr) & mask;
+        if (mask == 0) {
+            continue;
+        }
+        uint32_t h = net * 0x9E3779B1u ^ mask;
+        h ^= h >> 16;
+        for (uint32_t i = h & (cap - 1); index[i] >= 0; i = (i + 1) & (cap - 1)) {
+            struct sr_rip_fib_note* note = &notes[index[i]];
+            if (note->net == net && note->mask == mask) {
+                if (note->nh < 0) {
+                    note->nh = sr_rip_fib_nh(fib, rip, rt);
+                    ret = note->nh < 0 ? -1 : 0;
+                }
+                break;
+            }
+        }
+    }
+    free(index);
+
+    /* Pasos 1 y 2 solo donde cambió algo */
+    fib->gen++;
+    fib->n_pending = 0;
+    int path[33];
+    int route[33];
+    for (unsigned int k = 0; k < n_unique && ret == 0; k++) {
+        int plen = sr_rip_fib_plen(notes[k].mask);
+        if (plen <= 0) {
+            /* Una máscara no contigua no se puede poner; una 0 nunca se elige */
+            ret = plen < 0 ? -1 : 0;
+            continue;
+        }
+        int node = sr_rip_fib_walk(fib, notes[k].net, plen, path, route);
+        if (node < 0) {
+            ret = -1;
+            break;
+        }
+        if (fib->wnodes[node].nh == notes[k].nh) {
+            continue;
+        }
+        fib->n_routes += (notes[k].nh >= 0) - (fib->wnodes[node].nh >= 0);
+        fib->wnodes[node].nh = notes[k].nh;
+        sr_rip_fib_pass_up(fib, node, route[plen - 1], 0);
+        for (int d = plen - 1; d >= 0; d--) {
+            sr_rip_fib_combine(fib, path[d], route[d]);
+        }
+    }
+
+    /* Paso 3 y los emit nuevos todos juntos */
+    if (ret == 0) {
+        ret = sr_rip_fib_pass_down(fib, 0, 0, 0, 0);
+    }
+    if (ret == 0 && fib->n_pending > 0) {
+        __atomic_store_n(&fib->seq, fib->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        for (unsigned int i = 0; i < fib->n_pending; i++) {
+            __atomic_store_n(&fib->nodes[fib->pending[i].node].emit, fib->pending[i].emit, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&fib->seq, fib->seq + 1, __ATOMIC_RELEASE);
+    }
+    return ret;
+}
+
+/*
+La usa sr_lpm_lookup. Si hay FIB pone *found en 1 y devuelve la ruta (o NULL si no hay);
+si no hay FIB pone *found en 0 y hay que buscar en la lista.
+*/
+struct sr_rt* sr_rip_fib_find(struct sr_fib* fib, uint32_t dest_ip)
+{
+    uint32_t ip = ntohl(dest_ip);
+    unsigned int seq;
+    int best = 0;
+
+    do {
+        seq = __atomic_load_n(&fib->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        best = 0;
+        int node = 0;
+        for (int d = 0; node >= 0; d++) {
+            int emit = __atomic_load_n(&fib->nodes[node].emit, __ATOMIC_RELAXED);
+            if (emit >= 0) {
+                best = emit;
+            }
+            if (d == 32) {
+                break;
+            }
+            node = __atomic_load_n(&fib->nodes[node].child[(ip >> (31 - d)) & 1], __ATOMIC_ACQUIRE);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&fib->seq, __ATOMIC_RELAXED));
+
+    return best ? &fib->nh_rt[best] : NULL;
+}
+
+struct sr_rt* sr_rip_fib_lookup(struct sr_instance* sr, uint32_t dest_ip, int* found)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_find(sr);
+    struct sr_fib* fib = rip ? __atomic_load_n(&rip->fib, __ATOMIC_ACQUIRE) : NULL;
+    if (!fib) {
+        *found = 0;
+        return NULL;
+    }
+    *found = 1;
+    return sr_rip_fib_find(fib, dest_ip);
+}
+
+/* Reenvían igual: las dos sin ruta, o mismo gw e interfaz (y mismo destino si hay ECMP) */
+static int sr_rip_fib_same_hop(struct sr_rip_ctx* rip, struct sr_rt* a, struct sr_rt* b)
+{
+    if (!a || !b) {
+        return a == b;
+    }
+    if (a->gw.s_addr != b->gw.s_addr || strncmp(a->interface, b->interface, sr_IFACE_NAMELEN) != 0) {
+        return 0;
+    }
+    if (sr_rip_fib_has_ecmp(rip, a) || sr_rip_fib_has_ecmp(rip, b)) {
+        return a->dest.s_addr == b->dest.s_addr && a->mask.s_addr == b->mask.s_addr;
+    }
+    return 1;
+}
+
+static int sr_rip_fib_check_addr(struct sr_instance* sr, uint32_t ip_host)
+{
+    int found;
+    uint32_t ip = htonl(ip_host);
+    struct sr_rt* fast = sr_rip_fib_lookup(sr, ip, &found);
+    if (!found) {
+        return 1;
+    }
+    if (!sr_rip_fib_same_hop(sr_rip_ctx_find(sr), fast, sr_lpm_lookup_linear(sr, ip))) {
+        printf("FIB: ERROR, %s reenvía distinto con la FIB comprimida\n",
+               inet_ntoa((struct in_addr){.s_addr = ip}));
+        return 0;
+    }
+    return 1;
+}
+
+/*
+Verificador: compara la FIB con el recorrido de la lista en 'samples' direcciones al azar y
+en los bordes de cada ruta (primera, última y las de al lado). Devuelve la cantidad de
+direcciones que dieron distinto. Tiene que correr en el hilo de RIP (o con la tabla quieta).
+*/
+int sr_rip_fib_check(struct sr_instance* sr, unsigned int samples)
+{
+    unsigned int seed = (unsigned int)time(NULL);
+    int errors = 0;
+
+    for (unsigned int i = 0; i < samples; i++) {
+        uint32_t ip = ((uint32_t)rand_r(&seed) << 16) ^ (uint32_t)rand_r(&seed);
+        errors += !sr_rip_fib_check_addr(sr, ip);
+    }
+    for (struct sr_rt* rt = sr->routing_table; rt; rt = rt->next) {
+        uint32_t mask = ntohl(rt->mask.s_addr);
+        uint32_t first = ntohl(rt->dest.s_addr) & mask;
+        uint32_t last = first | ~mask;
+        errors += !sr_rip_fib_check_addr(sr, first);
+        errors += !sr_rip_fib_check_addr(sr, last);
+        errors += !sr_rip_fib_check_addr(sr, first - 1);
+        errors += !sr_rip_fib_check_addr(sr, last + 1);
+    }
+
+    printf("FIB: verificación %s (%d diferencias)\n", errors ? "FALLÓ" : "ok", errors);
+    return errors;
+}
+/*
+Lleva a la FIB los cambios de la tabla: los prefijos anotados sobre la que está publicada, o
+una nueva armada de cero (la vieja se libera cuando ya no la mira ningún forwarding). Solo
+desde el hilo de RIP.
+*/
+static void sr_rip_fib_update(struct sr_instance* sr)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    if (!FIB_COMPRESS_ENABLED || !rip || (!rip->fib_dirty && rip->n_fib_notes == 0)) {
+        return;
+    }
+
+    struct sr_fib* fib = rip->fib;
+    if (!rip->fib_dirty && fib && sr_rip_fib_apply(sr, rip, fib) == 0) {
+        printf("-> RIP: FIB actualizada, %u prefijos anotados, %u rutas -> %u prefijos\n",
+               rip->n_fib_notes, fib->n_routes, fib->n_prefixes);
+    } else {
+        fib = sr_rip_fib_build(sr);
+        sr_epoch_retire(__atomic_exchange_n(&rip->fib, fib, __ATOMIC_ACQ_REL), sr_rip_fib_free_retired);
+        if (fib) {
+            printf("-> RIP: FIB comprimida, %u rutas -> %u prefijos\n", fib->n_routes, fib->n_prefixes);
+        }
+    }
+    rip->fib_dirty = 0;
+    rip->n_fib_notes = 0;
+    if (fib && FIB_CHECK_ON_REBUILD) {
+        sr_rip_fib_check(sr, FIB_CHECK_SAMPLES);
+    }
+}
+
 int sr_rip_update_route(struct sr_instance* sr,
                         const struct sr_rip_entry_t* rte,
                         uint32_t src_ip,
                         const char* in_ifname)
 {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    if (!rip) {
+        return -1;
+    }
     /*
     ESTE ES EL COMENTARIO QUE PUSIERON ELLOS COMO GUÍA PARA LA FUNCIÓN, YA ESTABA
      * Procesa una entrada RIP recibida por una interfaz.
@@ -118,7 +1465,7 @@ int sr_rip_update_route(struct sr_instance* sr,
     /*ES EN ESTA FUNCIÓN (UPDATE) QUE SE APLICA EL VECTOR DE DISTANCIA, 
     ESTO HACE FUNCIONAR TODAS LAS TABLAS*/
 
-    time_t now = time(NULL);
+    time_t now = sr_rip_now();
 
     /* 1 Obtener detalles de la entrada anunciada */
     uint32_t dest_ip = rte->ip;
@@ -151,6 +1498,10 @@ int sr_rip_update_route(struct sr_instance* sr,
         /* Si existe una ruta coincidente aprendida *desde el mismo vecino*... */
         if (is_dynamic && existing_route->learned_from == new_gateway_ip)
         {
+            /* Si hay otro next hop de igual costo, la ruta sigue viva por ese (ECMP) */
+            if (existing_route->valid && ECMP_ENABLED && sr_rip_ecmp_promote(rip, existing_route)) {
+                return 1; /* La tabla fue modificada */
+            }
             /* ...marca la ruta como inválida (si no lo estaba ya) */
             if (existing_route->valid) {
                 printf("RIP: Marcando ruta como inválida (vecino anunció INFINITO): %s/%s\n",
@@ -161,6 +1512,10 @@ int sr_rip_update_route(struct sr_instance* sr,
                 return 1; /* La tabla fue modificada */
             }
         }
+        /* Si vino de uno de los next hops extra (ECMP), se lo saca del grupo */
+        if (is_dynamic) {
+            sr_rip_ecmp_remove_hop(rip, dest_ip, dest_mask, new_gateway_ip);
+        }
         /* Si no, ignora el anuncio de infinito (vino de otro vecino, o no existía) */
         return 0; /* No se realizaron cambios */
     }
@@ -188,6 +1543,9 @@ int sr_rip_update_route(struct sr_instance* sr,
               new_metric,
               in_ifname);
               
+        /* Por si quedó un grupo ECMP viejo de esta misma red */
+        sr_rip_ecmp_clear(rip, dest_ip, dest_mask, 0);
+
         /* Inserta una nueva entrada en la tabla de enrutamiento */
         sr_add_rt_entry(sr,
                         *(struct in_addr*)&dest_ip,
@@ -229,6 +1587,8 @@ int sr_rip_update_route(struct sr_instance* sr,
               new_metric,
               in_ifname);
 
+        sr_rip_ecmp_clear(rip, dest_ip, dest_mask, 0);
+
         /*La revive actualizando métrica, gateway, learned_from, etc. */
         existing_route->metric = (uint8_t)new_metric;
         existing_route->gw.s_addr = new_gateway_ip;
@@ -251,6 +1611,8 @@ int sr_rip_update_route(struct sr_instance* sr,
         /* Actualiza métrica/gateway/timestamps si cambian */
         if (existing_route->metric != (uint8_t)new_metric) {
             existing_route->metric = (uint8_t)new_metric;
+            /* Los next hops extra ya no son de igual costo */
+            sr_rip_ecmp_clear(rip, dest_ip, dest_mask, 0);
             changed = 1;
         }
         if (existing_route->gw.s_addr != new_gateway_ip) {
@@ -289,6 +1651,7 @@ int sr_rip_update_route(struct sr_instance* sr,
             printf("RIP: Reemplazando ruta (mejor métrica de nuevo vecino): %s/%s\n",
                   inet_ntoa(existing_route->dest), inet_ntoa(existing_route->mask));
                   
+            sr_rip_ecmp_clear(rip, dest_ip, dest_mask, 0);
             existing_route->metric = (uint8_t)new_metric;
             existing_route->gw.s_addr = new_gateway_ip;
             existing_route->route_tag = new_route_tag;
@@ -307,6 +1670,21 @@ int sr_rip_update_route(struct sr_instance* sr,
             return 0; /* No se realizaron cambios, igual actualizas last updated pq chequeaste*/
         }
 
+        /* Misma métrica por otro vecino: se agrega como camino extra (ECMP).
+           Lo que se anuncia no cambia, así que no hace falta triggered update. */
+        if (ECMP_ENABLED && new_metric == existing_route->metric)
+        {
+            if (sr_rip_ecmp_add_hop(rip, dest_ip, dest_mask, new_gateway_ip, in_ifname, now)) {
+                printf("RIP: ECMP, nuevo next hop %s para %s/%s\n",
+                      inet_ntoa(*(struct in_addr*)&new_gateway_ip),
+                      inet_ntoa(existing_route->dest), inet_ntoa(existing_route->mask));
+            }
+            return 0;
+        }
+
+        /* Peor métrica: si era uno de los caminos extra deja de serlo */
+        sr_rip_ecmp_remove_hop(rip, dest_ip, dest_mask, new_gateway_ip);
+
         /*En caso contrario (peor métrica o diferente camino), ignora la actualización */
         return 0; /* No se realizaron cambios */
     }
@@ -316,14 +1694,18 @@ int sr_rip_update_route(struct sr_instance* sr,
 }
 
 
-void sr_handle_rip_packet(struct sr_instance* sr,
-                          const uint8_t* packet,
-                          unsigned int pkt_len,
-                          unsigned int ip_off,
-                          unsigned int rip_off,
-                          unsigned int rip_len,
-                          const char* in_ifname)
+static void sr_rip_send_triggered_update(struct sr_instance* sr);
+
+/* Procesa un paquete RIP ya sacado de la cola. Solo se llama desde el loop de RIP. */
+static void sr_rip_process_packet(struct sr_instance* sr,
+                                  const uint8_t* packet,
+                                  unsigned int pkt_len,
+                                  unsigned int ip_off,
+                                  unsigned int rip_off,
+                                  unsigned int rip_len,
+                                  const char* in_ifname)
 {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
     /* 1 Validar paquete RIP */
 
     /* 2 Si es un RIP_COMMAND_REQUEST, enviar respuesta por la interfaz donde llegó, se sugiere usar función auxiliar sr_rip_send_response */
@@ -350,6 +1732,8 @@ void sr_handle_rip_packet(struct sr_instance* sr,
         return;
     }
 
+    rip->stat_rx_packets++;
+
     /* 1 Validar paquete RIP */
     if (!sr_rip_validate_packet(rip_packet, rip_len)) {
         printf("RIP: Paquete RIP inválido recibido. Descartando.\n");
@@ -364,84 +1748,329 @@ void sr_handle_rip_packet(struct sr_instance* sr,
         printf("-> RIP: Recibió REQUEST en interfaz %s de %s. Enviando respuesta.\n",
               in_ifname, inet_ntoa(*(struct in_addr*)&src_ip));
 
-        /* Usamos la función auxiliar para enviar la respuesta a la IP de origen, como sugiere arriba */
-        sr_rip_send_response(sr, in_iface, src_ip);
+        /* Usamos la función auxiliar para enviar la respuesta a la IP de origen, como sugiere arriba */
+        sr_rip_send_response(sr, in_iface, src_ip);
+    }
+    else if (rip_packet->command == RIP_COMMAND_RESPONSE)
+    {
+        /* * 3 Si es un RIP_COMMAND_RESPONSE, procesar las entradas
+         * Y si es otra cosa no pasa la validación */
+        printf("-> RIP: Recibió RESPONSE en interfaz %s de %s. Procesando entradas.\n",
+              in_ifname, inet_ntoa(*(struct in_addr*)&src_ip));
+
+        int cambios = 0;
+        int num_entries = (rip_len - sizeof(sr_rip_packet_t)) / sizeof(sr_rip_entry_t);
+
+        /* * Bloqueo la tabla de enrutamiento para evitar que cambie mientras la estás revisando, 
+        Y estas viendo si cambia o no
+         */
+        pthread_mutex_lock(&rip->metadata_lock);
+
+        for (int i = 0; i < num_entries; i++)
+        {
+            struct sr_rip_entry_t* entry = &rip_packet->entries[i];
+            
+            /* * 4 Usamos la función auxiliar como dice arriba para procesar cada entrada de ruta.
+             * El 'neighbor_ip' (src_ip) es el router que nos anunció esta ruta.
+             */
+            if (sr_rip_update_route(sr, entry, src_ip, in_ifname) == 1) {
+                /* Marcamos que la tabla cambió*/
+                cambios = 1;
+                sr_rip_fib_note(rip, entry->ip, entry->mask);
+                sr_rip_routes_changed(rip);
+            }
+        }
+        
+        pthread_mutex_unlock(&rip->metadata_lock);
+
+        /* * 5 Si hubo un cambio en la tabla, generar triggered update 
+         * e imprimir la tabla.
+         */
+        if (cambios)
+        {
+            printf("-> RIP: Tabla de enrutamiento cambió. \n");
+
+            /* * Un "triggered update" es una respuesta a todos los vecinos avisando del cambio
+             * Envia un RESPONSE a la dirección multicast RIP_IP
+             * Osea a todas las interfaces
+             */
+            if(TRIGGERED_UPDATE_ENABLED){
+                printf("TRIGGERED UPDATE ACTIVADO\n");
+                /* * La función sr_rip_send_response debe implementar la lógica de "split horizon"
+                Que es lo de que un router nunca debe anunciar una ruta de vuelta 
+                por la misma interfaz por la que la aprendió porque si hace eso 
+                empieza a loopear hasta infinito
+                */
+                sr_rip_send_triggered_update(sr);
+            }
+            
+            printf("\n-> RIP: Imprimiendo tabla de enrutamiento luego de procesar:\n");
+            print_routing_table(sr);
+        }
+    }
+}
+
+/* 
+Lo llama el hilo de recepción (sr_handle_ip_packet). No toca la tabla ni toma locks:
+copia el paquete en la cola y despierta al loop de RIP. Si la cola está llena se descarta,
+RIP se recupera solo con el próximo anuncio periódico.
+*/
+void sr_handle_rip_packet(struct sr_instance* sr,
+                          const uint8_t* packet,
+                          unsigned int pkt_len,
+                          unsigned int ip_off,
+                          unsigned int rip_off,
+                          unsigned int rip_len,
+                          const char* in_ifname)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_find(sr);
+    if (!rip) {
+        /* RIP todavía no arrancó en esta instancia */
+        return;
+    }
+    if (pkt_len > RIP_RX_SLOT_LEN || rip_off + rip_len > pkt_len) {
+        printf("RIP: Paquete demasiado grande o mal formado (%u bytes). Descartando.\n", pkt_len);
+        return;
+    }
+
+    unsigned int head = rip->rx_head;
+    unsigned int tail = __atomic_load_n(&rip->rx_tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= RIP_RX_QUEUE_SZ) {
+        printf("RIP: Cola de recepción llena. Descartando paquete.\n");
+        return;
+    }
+
+    struct sr_rip_rx_slot* slot = &rip->rx_queue[head & (RIP_RX_QUEUE_SZ - 1)];
+    memcpy(slot->buf, packet, pkt_len);
+    slot->pkt_len = pkt_len;
+    slot->ip_off = ip_off;
+    slot->rip_off = rip_off;
+    slot->rip_len = rip_len;
+    strncpy(slot->ifname, in_ifname, sr_IFACE_NAMELEN - 1);
+    slot->ifname[sr_IFACE_NAMELEN - 1] = '\0';
+
+    /* El release publica el contenido del slot antes que el nuevo head */
+    __atomic_store_n(&rip->rx_head, head + 1, __ATOMIC_RELEASE);
+
+    uint64_t one = 1;
+    if (rip->rx_evfd >= 0 && write(rip->rx_evfd, &one, sizeof(one)) < 0) {
+        perror("RIP: write eventfd");
+    }
+}
+
+/* Saca todos los paquetes encolados y los procesa */
+static void sr_rip_drain_rx_queue(struct sr_instance* sr)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    unsigned int tail = rip->rx_tail;
+    unsigned int head = __atomic_load_n(&rip->rx_head, __ATOMIC_ACQUIRE);
+
+    while (tail != head)
+    {
+        struct sr_rip_rx_slot* slot = &rip->rx_queue[tail & (RIP_RX_QUEUE_SZ - 1)];
+        sr_rip_process_packet(sr, slot->buf, slot->pkt_len, slot->ip_off,
+                              slot->rip_off, slot->rip_len, slot->ifname);
+        tail++;
+        /* Recién ahora el productor puede reutilizar el slot */
+        __atomic_store_n(&rip->rx_tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+Cache de respuestas RIP por interfaz. Los paquetes multicast de cada interfaz (con split horizon
+ya aplicado y los checksums calculados) se arman una vez y se reutilizan tal cual mientras
+rip->table_generation no cambie. Solo lo usa el loop de RIP, así que no necesita lock propio.
+Un RESPONSE lleva hasta RIP_MAX_ENTRIES rutas; si la tabla tiene más se arman varios.
+*/
+#define RIP_RESPONSE_CACHE_SZ 16 /* Cantidad máxima de interfaces cacheadas */
+#define RIP_RESPONSE_MAX_LEN (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_udp_hdr_t) \
+                              + sizeof(sr_rip_packet_t) + RIP_MAX_ENTRIES * sizeof(sr_rip_entry_t))
+
+struct sr_rip_response_pkt {
+    unsigned int len;
+    int num_routes;
+    uint16_t udp_sum;          /* Checksum UDP calculado para ip_dst = RIP_IP */
+    uint8_t buf[RIP_RESPONSE_MAX_LEN];
+};
+
+struct sr_rip_response_cache {
+    char ifname[sr_IFACE_NAMELEN];
+    unsigned int generation;   /* 0 = nunca se armó */
+    int num_routes;            /* En todos los paquetes */
+    int payload_changed;       /* Al rearmarla cambiaron las entradas (si no, no hace falta triggered update) */
+    time_t rebuild_at;         /* Si hay un agregado retirándose, cuándo sacarlo aunque la tabla no cambie */
+    struct sr_rip_entry_t* entries; /* Lo que se anuncia, en orden; sirve para ver si cambió */
+    int cap_entries;
+    struct sr_rip_response_pkt* pkts;
+    int n_pkts;
+    int cap_pkts;
+};
+
+/*
+Sumarización por interfaz. Para cada {interfaz, red/len} configurado, las rutas que caen
+adentro de esa red y están detrás de este router (no se aprendieron por esa interfaz) no
+se anuncian una por una: va un solo agregado con la menor métrica de sus componentes. Si se
+caen todas las componentes el agregado se anuncia con métrica INFINITY durante
+RIP_GARBAGE_COLLECTION_SEC y después desaparece. Las rutas aprendidas por la misma interfaz
+siguen saliendo sueltas con su reversa envenenada.
+
+Los agregados de arranque salen de rip_summary_table (por ejemplo {"eth0", "10.0.0.0/16"}
+antes del {NULL, NULL}); con el router andando se cambian por instancia con
+sr_rip_add_summary y sr_rip_clear_summaries. Un agregado que se saca no se envenena: los
+vecinos lo vencen solos, y mientras tanto ya reciben las rutas sueltas, que son más largas.
+*/
+#define RIP_SUMMARY_MAX 16
+
+struct sr_rip_summary_conf {
+    const char* ifname;
+    const char* prefix;
+};
+
+static const struct sr_rip_summary_conf rip_summary_table[] = {
+    /* {"eth0", "10.0.0.0/16"}, */
+    {NULL, NULL}
+};
+
+struct sr_rip_summary {
+    char ifname[sr_IFACE_NAMELEN];
+    uint32_t net;             /* En orden de red */
+    uint32_t mask;
+    int active;               /* La última vez tenía componentes vivas */
+    time_t withdraw_until;    /* Hasta cuándo se anuncia con INFINITY después de quedar vacío */
+};
+
+/* Agrega "red/len" en ifname. Con metadata_lock. -1 si no se entiende, ya está o no hay lugar */
+static int sr_rip_summary_add(struct sr_rip_ctx* rip, const char* ifname, const char* prefix)
+{
+    char ip[32];
+    unsigned int len;
+    struct in_addr in;
+    if (!ifname || !prefix || sscanf(prefix, "%31[0-9.]/%u", ip, &len) != 2 || len == 0 || len > 32
+        || inet_aton(ip, &in) == 0) {
+        printf("RIP: Sumarización inválida %s en %s, se ignora\n", prefix ? prefix : "(null)",
+               ifname ? ifname : "(null)");
+        return -1;
+    }
+    uint32_t mask = htonl(0xFFFFFFFFu << (32 - len));
+    for (int i = 0; i < rip->n_summaries; i++) {
+        if (rip->summaries[i].net == (in.s_addr & mask) && rip->summaries[i].mask == mask
+            && strncmp(rip->summaries[i].ifname, ifname, sr_IFACE_NAMELEN) == 0) {
+            return -1;
+        }
+    }
+    if (rip->n_summaries >= RIP_SUMMARY_MAX) {
+        printf("RIP: Ya hay %d sumarizaciones, %s en %s se ignora\n", RIP_SUMMARY_MAX, prefix, ifname);
+        return -1;
+    }
+    struct sr_rip_summary* sum = &rip->summaries[rip->n_summaries++];
+    memset(sum, 0, sizeof(*sum));
+    strncpy(sum->ifname, ifname, sr_IFACE_NAMELEN - 1);
+    sum->mask = mask;
+    sum->net = in.s_addr & mask;
+    return 0;
+}
+
+static void sr_rip_summary_load(struct sr_rip_ctx* rip)
+{
+    rip->n_summaries = 0;
+    for (int i = 0; rip_summary_table[i].ifname; i++) {
+        sr_rip_summary_add(rip, rip_summary_table[i].ifname, rip_summary_table[i].prefix);
     }
-    else if (rip_packet->command == RIP_COMMAND_RESPONSE)
-    {
-        /* * 3 Si es un RIP_COMMAND_RESPONSE, procesar las entradas
-         * Y si es otra cosa no pasa la validación */
-        printf("-> RIP: Recibió RESPONSE en interfaz %s de %s. Procesando entradas.\n",
-              in_ifname, inet_ntoa(*(struct in_addr*)&src_ip));
+}
 
-        int cambios = 0;
-        int num_entries = (rip_len - sizeof(sr_rip_packet_t)) / sizeof(sr_rip_entry_t);
+/* La ruta va adentro de algún agregado de la interfaz (y entonces no se anuncia sola) */
+static struct sr_rip_summary* sr_rip_summary_covering(struct sr_rip_ctx* rip, struct sr_rt* rt, struct sr_if* interface)
+{
+    for (int i = 0; i < rip->n_summaries; i++) {
+        struct sr_rip_summary* sum = &rip->summaries[i];
+        if (strcmp(sum->ifname, interface->name) == 0
+            && ntohl(rt->mask.s_addr) >= ntohl(sum->mask)
+            && (rt->dest.s_addr & sum->mask) == sum->net) {
+            return sum;
+        }
+    }
+    return NULL;
+}
 
-        /* * Bloqueo la tabla de enrutamiento para evitar que cambie mientras la estás revisando, 
-        Y estas viendo si cambia o no
-         */
-        pthread_mutex_lock(&rip_metadata_lock);
+/*
+Escribe en entries los agregados de la interfaz que haya que anunciar y devuelve cuántos.
+La métrica de cada uno es la menor de sus componentes vivas.
+*/
+static int sr_rip_summary_entries(struct sr_instance* sr, struct sr_if* interface,
+                                  struct sr_rip_entry_t* entries, int max, time_t* rebuild_at)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    time_t now = sr_rip_now();
+    int n = 0;
 
-        for (int i = 0; i < num_entries; i++)
-        {
-            struct sr_rip_entry_t* entry = &rip_packet->entries[i];
-            
-            /* * 4 Usamos la función auxiliar como dice arriba para procesar cada entrada de ruta.
-             * El 'neighbor_ip' (src_ip) es el router que nos anunció esta ruta.
-             */
-            int cambios = sr_rip_update_route(sr, entry, src_ip, in_ifname);
-            /* Marcamos que la tabla cambió*/
-            
+    for (int i = 0; i < rip->n_summaries && n < max; i++) {
+        struct sr_rip_summary* sum = &rip->summaries[i];
+        if (strcmp(sum->ifname, interface->name) != 0) {
+            continue;
         }
-        
-        pthread_mutex_unlock(&rip_metadata_lock);
-
-        /* * 5 Si hubo un cambio en la tabla, generar triggered update 
-         * e imprimir la tabla.
-         */
-        if (cambios)
-        {
-            printf("-> RIP: Tabla de enrutamiento cambió. \n");
 
-            /* * Un "triggered update" es una respuesta a todos los vecinos avisando del cambio
-             * Envia un RESPONSE a la dirección multicast RIP_IP
-             * Osea a todas las interfaces
-             */
-            if(TRIGGERED_UPDATE_ENABLED){
-                printf("TRIGGERED UPDATE ACTIVADO\n");
-                struct sr_if* if_walker = sr->if_list;
-                while (if_walker)
-                {
-                    /* * La función sr_rip_send_response debe implementar la lógica de "split horizon"
-                    Que es lo de que un router nunca debe anunciar una ruta de vuelta 
-                    por la misma interfaz por la que la aprendió porque si hace eso 
-                    empieza a loopear hasta infinito
-                    
-                    */
-                    sr_rip_send_response(sr, if_walker, htonl(RIP_IP));
-                    if_walker = if_walker->next;
-                }    
+        uint32_t best = INFINITY;
+        for (struct sr_rt* rt = sr->routing_table; rt; rt = rt->next) {
+            int learned_on_this_if = rt->learned_from != 0
+                && (strcmp(rt->interface, interface->name) == 0 || sr_rip_ecmp_uses_if(rip, rt, interface->name));
+            if (!learned_on_this_if && rt->metric < best && sr_rip_summary_covering(rip, rt, interface) == sum) {
+                best = rt->metric;
             }
-            
-            printf("\n-> RIP: Imprimiendo tabla de enrutamiento luego de procesar:\n");
-            print_routing_table(sr);
         }
+
+        if (best < INFINITY) {
+            sum->active = 1;
+        } else if (sum->active) {
+            /* Se cayó la última componente: se retira el agregado */
+            sum->active = 0;
+            sum->withdraw_until = now + RIP_GARBAGE_COLLECTION_SEC;
+        } else if (now >= sum->withdraw_until) {
+            continue;
+        }
+        if (!sum->active && (*rebuild_at == 0 || sum->withdraw_until < *rebuild_at)) {
+            *rebuild_at = sum->withdraw_until;
+        }
+
+        struct sr_rip_entry_t* entry = &entries[n++];
+        entry->family_identifier = htons(RIP_VERSION); /* 2 = IPv4 */
+        entry->route_tag = 0;
+        entry->ip = sum->net;
+        entry->mask = sum->mask;
+        entry->next_hop = 0x00000000;
+        entry->metric = htonl(best);
     }
+    return n;
 }
 
-void sr_rip_send_response(struct sr_instance* sr, struct sr_if* interface, uint32_t ipDst) {
-    /*ESTOS SON LOS COMENTARIOS QUE YA ESTABAN:*/   
-    /* Reservar buffer para paquete completo con cabecera Ethernet */
-    
-    /* Construir cabecera Ethernet */
-    
-    /* Construir cabecera IP */
-        /* RIP usa TTL=1 */
-    
-    /* Construir cabecera UDP */
-    
+/* Que entren n entradas en cache->entries. Devuelve -1 si no hay memoria */
+static int sr_rip_response_reserve(struct sr_rip_response_cache* cache, int n)
+{
+    if (n <= cache->cap_entries) {
+        return 0;
+    }
+    int cap = cache->cap_entries ? cache->cap_entries : RIP_MAX_ENTRIES;
+    while (cap < n) {
+        cap *= 2;
+    }
+    struct sr_rip_entry_t* entries = realloc(cache->entries, cap * sizeof(struct sr_rip_entry_t));
+    if (!entries) {
+        return -1;
+    }
+    cache->entries = entries;
+    cache->cap_entries = cap;
+    return 0;
+}
+
+/*
+Junta en cache->entries lo que se anuncia por la interfaz: primero los agregados y después
+las rutas de la tabla, con split horizon y reversa envenenada. Devuelve cuántas son.
+*/
+static int sr_rip_collect_entries(struct sr_instance* sr, struct sr_if* interface,
+                                  struct sr_rip_response_cache* cache)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    /*ESTOS SON LOS COMENTARIOS QUE YA ESTABAN:*/
     /* Construir paquete RIP con las entradas de la tabla */
-        /* Armar encabezado RIP de la respuesta */
         /* Recorrer toda la tabla de enrutamiento  */
         /* Considerar split horizon con poisoned reverse y rutas expiradas por timeout cuando corresponda */
         /* Normalizar métrica a rango RIP (1..INFINITY) */
@@ -452,48 +2081,42 @@ void sr_rip_send_response(struct sr_instance* sr, struct sr_if* interface, uint3
            - ip/mask toman los valores de la tabla
            - next_hop: siempre 0.0.0.0 */
 
-    /* Calcular longitudes del paquete */
-    
-    /* Calcular checksums */
-    
-    /* Enviar paquete */
-
+    /*Recorrer toda la tabla de enrutamiento */
+    pthread_mutex_lock(&rip->metadata_lock); /* Proteger la tabla */
 
-    /* 1 Reservar buffer para paquete completo (tamaño MÁXIMO) */
-    /* Asumimos un máximo de 25 entradas (RIP_MAX_ENTRIES) */
-    unsigned int eth_len = sizeof(sr_ethernet_hdr_t);
-    unsigned int ip_len = sizeof(sr_ip_hdr_t);
-    unsigned int udp_len = sizeof(sr_udp_hdr_t);
-    unsigned int rip_max_payload_len = sizeof(sr_rip_packet_t) + (RIP_MAX_ENTRIES * sizeof(sr_rip_entry_t));
-    
-    unsigned int max_buf_len = eth_len + ip_len + udp_len + rip_max_payload_len;
-    uint8_t* packet = (uint8_t*)calloc(1, max_buf_len);
-    if (!packet) {
-        printf("ERROR: Falla al reservar memoria para paquete RIP de respuesta.\n");
-        return;
+    if (rip->n_summaries < 0) {
+        sr_rip_summary_load(rip);
     }
 
-    /* Punteros a las cabeceras */
-    sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*)packet;
-    sr_ip_hdr_t* ip_hdr = (sr_ip_hdr_t*)(packet + eth_len);
-    sr_udp_hdr_t* udp_hdr = (sr_udp_hdr_t*)(packet + eth_len + ip_len);
-    sr_rip_packet_t* rip_packet = (sr_rip_packet_t*)(packet + eth_len + ip_len + udp_len);
-
-    /* 2 Construir paquete RIP (el payload) */
-    /*Armar encabezado RIP de la respuesta */
-    rip_packet->command = RIP_COMMAND_RESPONSE;
-    rip_packet->version = RIP_VERSION;
-    rip_packet->zero = 0;
-
-    /*Recorrer toda la tabla de enrutamiento */
-    pthread_mutex_lock(&rip_metadata_lock); /* Proteger la tabla */
+    int n_routes = 0;
+    for (struct sr_rt* rt = sr->routing_table; rt; rt = rt->next) {
+        n_routes++;
+    }
+    if (sr_rip_response_reserve(cache, RIP_SUMMARY_MAX + n_routes) < 0) {
+        pthread_mutex_unlock(&rip->metadata_lock);
+        return 0;
+    }
 
+    /* Primero los agregados */
     struct sr_rt* rt_walker = sr->routing_table;
-    int num_routes_sent = 0;
+    cache->rebuild_at = 0;
+    int num_routes_sent = sr_rip_summary_entries(sr, interface, cache->entries, RIP_SUMMARY_MAX,
+                                                 &cache->rebuild_at);
 
-    while (rt_walker && num_routes_sent < RIP_MAX_ENTRIES)
+    while (rt_walker)
     {
-        struct sr_rip_entry_t* entry = &rip_packet->entries[num_routes_sent];
+        int is_dynamic_route = (rt_walker->learned_from != 0);
+        /* Cuenta también si alguno de los caminos ECMP extra sale por esta interfaz */
+        int learned_on_this_if = (strcmp(rt_walker->interface, interface->name) == 0)
+            || sr_rip_ecmp_uses_if(rip, rt_walker, interface->name);
+
+        if (!(is_dynamic_route && learned_on_this_if) && sr_rip_summary_covering(rip, rt_walker, interface)) {
+            /* Va dentro del agregado */
+            rt_walker = rt_walker->next;
+            continue;
+        }
+
+        struct sr_rip_entry_t* entry = &cache->entries[num_routes_sent];
 
         /* Armar la entrada RIP */
         entry->family_identifier = htons(RIP_VERSION); /* 2 = IPv4 */
@@ -517,24 +2140,61 @@ void sr_rip_send_response(struct sr_instance* sr, struct sr_if* interface, uint3
          * es la MISMA que por la que vamos a enviar (interface->name)
          * -> Anunciamos la ruta con métrica INFINITO (16).
          */
-        int is_dynamic_route = (rt_walker->learned_from != 0);
-        int learned_on_this_if = (strcmp(rt_walker->interface, interface->name) == 0);
-
         if (SPLIT_HORIZON_POISONED_REVERSE_ENABLED && is_dynamic_route && learned_on_this_if)
         {
             metric_to_send = INFINITY;
         }
-        
+
         entry->metric = htonl(metric_to_send);
 
         num_routes_sent++;
         rt_walker = rt_walker->next;
     }
-    
-    pthread_mutex_unlock(&rip_metadata_lock); /* Liberar la tabla */
+
+    pthread_mutex_unlock(&rip->metadata_lock); /* Liberar la tabla */
+    return num_routes_sent;
+}
+
+/* Arma un RESPONSE multicast con n entradas (a lo sumo RIP_MAX_ENTRIES) */
+static void sr_rip_build_response(struct sr_if* interface, struct sr_rip_response_pkt* pkt,
+                                  const struct sr_rip_entry_t* entries, int n)
+{
+    /* Reservar buffer para paquete completo con cabecera Ethernet */
+
+    /* Construir cabecera Ethernet */
+
+    /* Construir cabecera IP */
+        /* RIP usa TTL=1 */
+
+    /* Construir cabecera UDP */
+
+    /* Calcular longitudes del paquete */
+
+    /* Calcular checksums */
+
+
+    /* 1 El buffer es el del paquete cacheado (tamaño MÁXIMO) */
+    unsigned int eth_len = sizeof(sr_ethernet_hdr_t);
+    unsigned int ip_len = sizeof(sr_ip_hdr_t);
+    unsigned int udp_len = sizeof(sr_udp_hdr_t);
+    uint8_t* packet = pkt->buf;
+    memset(packet, 0, sizeof(pkt->buf));
+
+    /* Punteros a las cabeceras */
+    sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*)packet;
+    sr_ip_hdr_t* ip_hdr = (sr_ip_hdr_t*)(packet + eth_len);
+    sr_udp_hdr_t* udp_hdr = (sr_udp_hdr_t*)(packet + eth_len + ip_len);
+    sr_rip_packet_t* rip_packet = (sr_rip_packet_t*)(packet + eth_len + ip_len + udp_len);
+
+    /* 2 Construir paquete RIP (el payload) */
+    /*Armar encabezado RIP de la respuesta */
+    rip_packet->command = RIP_COMMAND_RESPONSE;
+    rip_packet->version = RIP_VERSION;
+    rip_packet->zero = 0;
+    memcpy(rip_packet->entries, entries, n * sizeof(sr_rip_entry_t));
 
     /* 3 Calcular longitudes FINALES del paquete */
-    unsigned int actual_rip_len = sizeof(sr_rip_packet_t) + (num_routes_sent * sizeof(sr_rip_entry_t));
+    unsigned int actual_rip_len = sizeof(sr_rip_packet_t) + (n * sizeof(sr_rip_entry_t));
     unsigned int actual_ip_payload_len = udp_len + actual_rip_len;
     unsigned int actual_total_len = eth_len + ip_len + actual_ip_payload_len;
 
@@ -549,187 +2209,383 @@ void sr_rip_send_response(struct sr_instance* sr, struct sr_if* interface, uint3
     ip_hdr->ip_hl = 5; /* 20 bytes */
     ip_hdr->ip_tos = 0;
     ip_hdr->ip_len = htons(ip_len + actual_ip_payload_len);
-    ip_hdr->ip_id = 0; 
+    ip_hdr->ip_id = 0;
     ip_hdr->ip_off = htons(IP_DF); /* No Fragmentar */
     ip_hdr->ip_ttl = 1; /* "Todos los mensajes RIP enviados deben tener... TTL fijado en 1." (PDF) */
     ip_hdr->ip_p = ip_protocol_udp;
     ip_hdr->ip_src = interface->ip; /* IP de la interfaz de SALIDA */
-    ip_hdr->ip_dst = ipDst;         /* IP de destino (parámetro) */
+    ip_hdr->ip_dst = htonl(RIP_IP); /* La versión cacheada es la multicast */
     ip_hdr->ip_sum = 0; /* Se calcula al final */
 
     /* 6 Construir cabecera Ethernet */
     /* MAC Origen (siempre la de nuestra interfaz de salida) */
     memcpy(eth_hdr->ether_shost, interface->addr, ETHER_ADDR_LEN);
     eth_hdr->ether_type = htons(ethertype_ip);
+    /* Es Multicast: Usamos la MAC multicast de RIP */
+    memcpy(eth_hdr->ether_dhost, rip_multicast_mac, ETHER_ADDR_LEN);
+
+    /* 7 Calcular checksums */
+
+    ip_hdr->ip_sum = ip_cksum(ip_hdr, ip_len);
+
+    /* Checksum UDP (incluye pseudo-cabecera) */
+    /* Asumimos que la función udp_cksum (de sr_utils.c) maneja la lógica */
+    /* de la pseudo-cabecera internamente, recibiendo el ip_hdr y el udp_hdr. */
+    udp_hdr->checksum = udp_cksum(ip_hdr, udp_hdr, (const uint8_t*)rip_packet);
+
+    pkt->len = actual_total_len;
+    pkt->num_routes = n;
+    pkt->udp_sum = udp_hdr->checksum;
+}
+
+/* Rearma los paquetes de la entrada de cache. Solo si cambiaron las entradas */
+static void sr_rip_rebuild_response(struct sr_instance* sr, struct sr_if* interface,
+                                    struct sr_rip_response_cache* cache)
+{
+    /* Se guardan las entradas de antes para saber si el triggered update hace falta */
+    int old_n = cache->generation ? cache->num_routes : -1;
+    struct sr_rip_entry_t* old_entries = NULL;
+    if (old_n > 0) {
+        old_entries = malloc(old_n * sizeof(struct sr_rip_entry_t));
+        if (old_entries) {
+            memcpy(old_entries, cache->entries, old_n * sizeof(struct sr_rip_entry_t));
+        }
+    }
+
+    int n = sr_rip_collect_entries(sr, interface, cache);
+    int n_pkts = n ? (n + RIP_MAX_ENTRIES - 1) / RIP_MAX_ENTRIES : 1; /* Vacío también sale */
+    if (n_pkts > cache->cap_pkts) {
+        struct sr_rip_response_pkt* pkts = realloc(cache->pkts, n_pkts * sizeof(struct sr_rip_response_pkt));
+        if (!pkts) {
+            n_pkts = cache->cap_pkts;
+            n = n_pkts * RIP_MAX_ENTRIES < n ? n_pkts * RIP_MAX_ENTRIES : n;
+        } else {
+            cache->pkts = pkts;
+            cache->cap_pkts = n_pkts;
+        }
+    }
+    for (int i = 0; i < n_pkts; i++) {
+        int first = i * RIP_MAX_ENTRIES;
+        int count = n - first < RIP_MAX_ENTRIES ? n - first : RIP_MAX_ENTRIES;
+        sr_rip_build_response(interface, &cache->pkts[i], cache->entries + first, count);
+    }
+    cache->n_pkts = n_pkts;
+    cache->num_routes = n;
+
+    cache->payload_changed = (old_n != n || (n > 0 && (!old_entries
+                              || memcmp(old_entries, cache->entries, n * sizeof(struct sr_rip_entry_t)) != 0)));
+    free(old_entries);
+}
+
+/* Devuelve la respuesta cacheada de la interfaz, rearmándola si la tabla cambió */
+static struct sr_rip_response_cache* sr_rip_get_response(struct sr_instance* sr, struct sr_if* interface)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    struct sr_rip_response_cache* cache = NULL;
+    unsigned int generation = __atomic_load_n(&rip->table_generation, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < RIP_RESPONSE_CACHE_SZ; i++) {
+        if (rip->response_cache[i].ifname[0] == '\0' && !cache) {
+            cache = &rip->response_cache[i];
+        } else if (strcmp(rip->response_cache[i].ifname, interface->name) == 0) {
+            cache = &rip->response_cache[i];
+            break;
+        }
+    }
+
+    if (!cache) {
+        /* Más interfaces que entradas: se pisa la primera, se rearma cuando le toque */
+        cache = &rip->response_cache[0];
+        cache->generation = 0;
+    }
+
+    if (strcmp(cache->ifname, interface->name) != 0) {
+        strncpy(cache->ifname, interface->name, sr_IFACE_NAMELEN - 1);
+        cache->ifname[sr_IFACE_NAMELEN - 1] = '\0';
+        cache->generation = 0;
+    }
+
+    if (cache->generation != generation || (cache->rebuild_at && sr_rip_now() >= cache->rebuild_at)) {
+        sr_rip_rebuild_response(sr, interface, cache);
+        cache->generation = generation;
+    }
+
+    return cache;
+}
+
+/* Actualiza un checksum de Internet cuando cambia un campo de 32 bits (RFC 1624) */
+static uint16_t sr_rip_cksum_replace32(uint16_t sum, uint32_t old_val, uint32_t new_val)
+{
+    uint32_t acc = (uint16_t)~sum;
+    acc += (uint16_t)~(old_val >> 16);
+    acc += (uint16_t)~(old_val & 0xFFFF);
+    acc += (new_val >> 16);
+    acc += (new_val & 0xFFFF);
+    while (acc >> 16) {
+        acc = (acc & 0xFFFF) + (acc >> 16);
+    }
+    return (uint16_t)~acc;
+}
+
+/* Lo mismo para el checksum UDP, donde 0 quiere decir "sin checksum" (RFC 768): si la cuenta
+   da 0 se manda 0xFFFF, que en complemento a uno es el mismo número */
+static uint16_t sr_rip_udp_cksum_replace32(uint16_t sum, uint32_t old_val, uint32_t new_val)
+{
+    uint16_t r = sr_rip_cksum_replace32(sum, old_val, new_val);
+    return r == 0 ? 0xFFFF : r;
+}
+
+/*
+Manda un paquete RIP. Si la cola de salida de la interfaz está llena (un anuncio de una tabla
+grande son miles de paquetes de golpe) espera a que el hilo que la vacía dé una vuelta y
+reintenta, en vez de perder pedazos del anuncio. Devuelve -1 si no entró igual.
+*/
+#define RIP_TX_RETRIES 20
+#define RIP_TX_WAIT_US 1000
+
+static int sr_rip_send(struct sr_instance* sr, struct sr_rip_ctx* rip, uint8_t* buf, unsigned int len,
+                       const char* ifname)
+{
+    for (int i = 0; sr_io_send_ctl(sr, buf, len, ifname) < 0; i++) {
+        if (i == RIP_TX_RETRIES) {
+            rip->stat_tx_drops++;
+            return -1;
+        }
+        sr_txq_wait_room(RIP_TX_WAIT_US);
+    }
+    return 0;
+}
 
-    /* MAC Destino (depende de ipDst) */
-    uint8_t dest_mac[ETHER_ADDR_LEN];
-    int found_mac = 0;
+void sr_rip_send_response(struct sr_instance* sr, struct sr_if* interface, uint32_t ipDst) {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    if (!rip) {
+        return;
+    }
+    struct sr_rip_response_cache* cache = sr_rip_get_response(sr, interface);
 
     if (ipDst == htonl(RIP_IP))
     {
-        /* Es Multicast: Usamos la MAC multicast de RIP */
-        memcpy(dest_mac, rip_multicast_mac, ETHER_ADDR_LEN);
-        found_mac = 1;
+        /* Multicast: se mandan los paquetes cacheados tal cual */
+        printf("-> RIP: Enviando RESPUESTA por %s (hacia %s, %d rutas en %d paquetes)\n",
+              interface->name, inet_ntoa(*(struct in_addr*)&ipDst), cache->num_routes, cache->n_pkts);
+        for (int i = 0; i < cache->n_pkts; i++) {
+            if (sr_rip_send(sr, rip, cache->pkts[i].buf, cache->pkts[i].len, interface->name) == 0) {
+                rip->stat_tx_responses++;
+            }
+        }
+        return;
     }
-    else
+
+    /* Es Unicast (respuesta a un REQUEST): Buscamos en caché ARP */
+    struct sr_arpentry* arp_entry = sr_arpcache_lookup(&(sr->cache), ipDst);
+    if (!arp_entry)
     {
-        /* Es Unicast (respuesta a un REQUEST): Buscamos en caché ARP */
-        struct sr_arpentry* arp_entry = sr_arpcache_lookup(&(sr->cache), ipDst);
-        if (arp_entry)
-        {
-            memcpy(dest_mac, arp_entry->mac, ETHER_ADDR_LEN);
-            found_mac = 1;
-            free(arp_entry);
-        }
-        else
-        {
-            /* * No se encontró la MAC. Idealmente, encolaríamos el paquete y enviaríamos 
-             * un ARP Request. Pero para RIP, asumimos que si respondemos a un request,
-             * acabamos de recibir un paquete de él, por lo que su MAC *debería* estar
-             * en la caché. Si no está, descartamos.
-             */
-            printf("RIP: ERROR! No hay entrada ARP para respuesta unicast a %s. Descartando.\n",
-                  inet_ntoa(*(struct in_addr*)&ipDst));
-            free(packet);
-            return;
-        }
+        /* * No se encontró la MAC. Idealmente, encolaríamos el paquete y enviaríamos
+         * un ARP Request. Pero para RIP, asumimos que si respondemos a un request,
+         * acabamos de recibir un paquete de él, por lo que su MAC *debería* estar
+         * en la caché. Si no está, descartamos.
+         */
+        printf("RIP: ERROR! No hay entrada ARP para respuesta unicast a %s. Descartando.\n",
+              inet_ntoa(*(struct in_addr*)&ipDst));
+        return;
     }
-    memcpy(eth_hdr->ether_dhost, dest_mac, ETHER_ADDR_LEN);
 
-    /* 7 Calcular checksums */
+    printf("-> RIP: Enviando RESPUESTA por %s (hacia %s, %d rutas en %d paquetes)\n",
+          interface->name, inet_ntoa(*(struct in_addr*)&ipDst), cache->num_routes, cache->n_pkts);
 
-    ip_hdr->ip_sum = ip_cksum(ip_hdr, ip_len);
-    
-    /* Checksum UDP (incluye pseudo-cabecera) */
-    /* Asumimos que la función udp_cksum (de sr_utils.c) maneja la lógica */
-    /* de la pseudo-cabecera internamente, recibiendo el ip_hdr y el udp_hdr. */
-    udp_hdr->checksum = udp_cksum(ip_hdr, udp_hdr, (const uint8_t*)rip_packet);
+    /* Se copia cada cacheado y solo se cambian MAC/IP destino y los checksums */
+    for (int i = 0; i < cache->n_pkts; i++) {
+        uint8_t packet[RIP_RESPONSE_MAX_LEN];
+        memcpy(packet, cache->pkts[i].buf, cache->pkts[i].len);
 
-    /* 8 Enviar paquete */
-    printf("-> RIP: Enviando RESPUESTA por %s (hacia %s, %d rutas)\n",
-          interface->name, inet_ntoa(*(struct in_addr*)&ipDst), num_routes_sent);
-    
-    sr_send_packet(sr, packet, actual_total_len, interface->name);
+        sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*)packet;
+        sr_ip_hdr_t* ip_hdr = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+        sr_udp_hdr_t* udp_hdr = (sr_udp_hdr_t*)((uint8_t*)ip_hdr + sizeof(sr_ip_hdr_t));
 
-    /* 9 Liberar buffer */
-    free(packet);
+        memcpy(eth_hdr->ether_dhost, arp_entry->mac, ETHER_ADDR_LEN);
+
+        uint32_t old_dst = ip_hdr->ip_dst;
+        ip_hdr->ip_dst = ipDst;
+        ip_hdr->ip_sum = sr_rip_cksum_replace32(ip_hdr->ip_sum, old_dst, ipDst);
+        /* La IP destino está en la pseudo-cabecera UDP */
+        udp_hdr->checksum = sr_rip_udp_cksum_replace32(cache->pkts[i].udp_sum, old_dst, ipDst);
+
+        if (sr_rip_send(sr, rip, packet, cache->pkts[i].len, interface->name) == 0) {
+            rip->stat_tx_responses++;
+        }
+    }
+    free(arp_entry);
 }
 
-void* sr_rip_send_requests(void* arg) {
-    sleep(3); // Esperar a que se inicialice todo
-    struct sr_instance* sr = arg;
+/* Envía un RIP Request por cada interfaz. Lo dispara el timer de requests del loop. */
+static void sr_rip_send_requests(struct sr_instance* sr) {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
     struct sr_if* interface = sr->if_list;
     // Se envia un Request RIP por cada interfaz:
         /* Reservar buffer para paquete completo con cabecera Ethernet */
-        
+
         /* Construir cabecera Ethernet */
-        
+
         /* Construir cabecera IP */
             /* RIP usa TTL=1 */
-        
+
         /* Construir cabecera UDP */
-        
+
         /* Construir paquete RIP */
 
         /* Entrada para solicitar la tabla de ruteo completa (ver RFC) */
 
         /* Calcular longitudes del paquete */
-        
+
         /* Calcular checksums */
-        
+
         /* Enviar paquete */
 
 
-        printf("-> RIP: Enviando REQUESTS iniciales...\n");
+        printf("-> RIP: Enviando REQUESTS iniciales...\n");
+
+    /* El REQUEST es igual en todas las interfaces salvo la MAC y la IP de origen: se arma una
+    sola vez y por cada interfaz se cambian esos dos campos, ajustando los checksums (RFC 1624) */
+
+    /* 1 Buffer para paquete (Eth + IP + UDP + Encabezado RIP + 1 entrada) */
+    unsigned int eth_len = sizeof(sr_ethernet_hdr_t);
+    unsigned int ip_len = sizeof(sr_ip_hdr_t);
+    unsigned int udp_len = sizeof(sr_udp_hdr_t);
+    /* El payload es un encabezado RIP + 1 entrada especial */
+    unsigned int rip_payload_len = sizeof(sr_rip_packet_t) + sizeof(sr_rip_entry_t);
+    unsigned int total_len = eth_len + ip_len + udp_len + rip_payload_len;
+
+    uint8_t packet[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_udp_hdr_t)
+                   + sizeof(sr_rip_packet_t) + sizeof(sr_rip_entry_t)];
+    memset(packet, 0, sizeof(packet));
+
+    /* Punteros a las cabeceras */
+    sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*)packet;
+    sr_ip_hdr_t* ip_hdr = (sr_ip_hdr_t*)(packet + eth_len);
+    sr_udp_hdr_t* udp_hdr = (sr_udp_hdr_t*)(packet + eth_len + ip_len);
+    sr_rip_packet_t* rip_packet = (sr_rip_packet_t*)(packet + eth_len + ip_len + udp_len);
+
+    /* 2 Construir paquete RIP (REQUEST) */
+    rip_packet->command = RIP_COMMAND_REQUEST;
+    rip_packet->version = RIP_VERSION;
+    rip_packet->zero = 0;
+
+    /* 3 Entrada para solicitar la tabla de ruteo completa (RFC 2453) */
+    /* Un REQUEST con 1 entrada, AFI=0 y Métrica=16 pide la tabla completa */
+    sr_rip_entry_t* entry = &rip_packet->entries[0];
+    entry->family_identifier = htons(0); /* AFI = 0 */
+    entry->route_tag = 0;
+    entry->ip = 0;
+    entry->mask = 0;
+    entry->next_hop = 0;
+    entry->metric = htonl(INFINITY); /* Métrica = 16 */
+
+    /* 4 Construir cabecera UDP */
+    udp_hdr->src_port = htons(RIP_PORT);
+    udp_hdr->dst_port = htons(RIP_PORT);
+    udp_hdr->length = htons(udp_len + rip_payload_len);
+    udp_hdr->checksum = 0;
+
+    /* 5 Construir cabecera IP (el origen se completa por interfaz) */
+    ip_hdr->ip_v = 4;
+    ip_hdr->ip_hl = 5;
+    ip_hdr->ip_len = htons(ip_len + udp_len + rip_payload_len);
+    ip_hdr->ip_ttl = 1; /* "Todos los mensajes RIP enviados deben tener TTL fijado en 1" (letra) */
+    ip_hdr->ip_p = ip_protocol_udp;
+    ip_hdr->ip_src = 0;
+    ip_hdr->ip_dst = htonl(RIP_IP); /* Los Requests van a la IP multicast */
+    ip_hdr->ip_sum = 0;
+
+    /* 6 Construir cabecera Ethernet */
+    memcpy(eth_hdr->ether_dhost, rip_multicast_mac, ETHER_ADDR_LEN); /* MAC multicast */
+    eth_hdr->ether_type = htons(ethertype_ip);
+
+    /* 7 Calcular checksums con origen 0.0.0.0 */
+    ip_hdr->ip_sum = ip_cksum(ip_hdr, ip_len);
+    udp_hdr->checksum = udp_cksum(ip_hdr, udp_hdr, (const uint8_t*)rip_packet);
 
     // Se envia un Request RIP por cada interfaz:
+    uint32_t prev_src = 0;
     while (interface)
     {
-        /* 1 Reservar buffer para paquete (Eth + IP + UDP + Encabezado RIP + 1 entrada) */
-        unsigned int eth_len = sizeof(sr_ethernet_hdr_t);
-        unsigned int ip_len = sizeof(sr_ip_hdr_t);
-        unsigned int udp_len = sizeof(sr_udp_hdr_t);
-        /* El payload es un encabezado RIP + 1 entrada especial */
-        unsigned int rip_payload_len = sizeof(sr_rip_packet_t) + sizeof(sr_rip_entry_t);
-        unsigned int total_len = eth_len + ip_len + udp_len + rip_payload_len;
-
-        uint8_t* packet = (uint8_t*)calloc(1, total_len);
-        if (!packet) {
-            printf("ERROR: Falla al reservar memoria para paquete RIP de solicitud.\n");
-            interface = interface->next;
-            continue;
-        }
-
-        /* Punteros a las cabeceras */
-        sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*)packet;
-        sr_ip_hdr_t* ip_hdr = (sr_ip_hdr_t*)(packet + eth_len);
-        sr_udp_hdr_t* udp_hdr = (sr_udp_hdr_t*)(packet + eth_len + ip_len);
-        sr_rip_packet_t* rip_packet = (sr_rip_packet_t*)(packet + eth_len + ip_len + udp_len);
-
-        /* 2 Construir paquete RIP (REQUEST) */
-        rip_packet->command = RIP_COMMAND_REQUEST;
-        rip_packet->version = RIP_VERSION;
-        rip_packet->zero = 0;
-
-        /* 3 Entrada para solicitar la tabla de ruteo completa (RFC 2453) */
-        /* Un REQUEST con 1 entrada, AFI=0 y Métrica=16 pide la tabla completa */
-        sr_rip_entry_t* entry = &rip_packet->entries[0];
-        entry->family_identifier = htons(0); /* AFI = 0 */
-        entry->route_tag = 0;
-        entry->ip = 0;
-        entry->mask = 0;
-        entry->next_hop = 0;
-        entry->metric = htonl(INFINITY); /* Métrica = 16 */
-
-        /* 4 Construir cabecera UDP */
-        udp_hdr->src_port = htons(RIP_PORT);
-        udp_hdr->dst_port = htons(RIP_PORT);
-        udp_hdr->length = htons(udp_len + rip_payload_len);
-        udp_hdr->checksum = 0;
-
-        /* 5 Construir cabecera IP */
-        ip_hdr->ip_v = 4;
-        ip_hdr->ip_hl = 5;
-        ip_hdr->ip_len = htons(ip_len + udp_len + rip_payload_len);
-        ip_hdr->ip_ttl = 1; /* "Todos los mensajes RIP enviados deben tener TTL fijado en 1" (letra) */
-        ip_hdr->ip_p = ip_protocol_udp;
-        ip_hdr->ip_src = interface->ip;
-        ip_hdr->ip_dst = htonl(RIP_IP); /* Los Requests van a la IP multicast */
-        ip_hdr->ip_sum = 0;
-
-        /* 6 Construir cabecera Ethernet */
         memcpy(eth_hdr->ether_shost, interface->addr, ETHER_ADDR_LEN);
-        memcpy(eth_hdr->ether_dhost, rip_multicast_mac, ETHER_ADDR_LEN); /* MAC multicast */
-        eth_hdr->ether_type = htons(ethertype_ip);
+        ip_hdr->ip_src = interface->ip;
+        ip_hdr->ip_sum = sr_rip_cksum_replace32(ip_hdr->ip_sum, prev_src, interface->ip);
+        /* La IP origen está en la pseudo-cabecera UDP */
+        udp_hdr->checksum = sr_rip_udp_cksum_replace32(udp_hdr->checksum, prev_src, interface->ip);
+        prev_src = interface->ip;
 
-        /* 7 Calcular checksums */
-        ip_hdr->ip_sum = ip_cksum(ip_hdr, ip_len);
-        udp_hdr->checksum = udp_cksum(ip_hdr, udp_hdr, (const uint8_t*)rip_packet);
-        
         /* 8 Enviar paquete */
         printf("-> RIP: Enviando REQUEST por %s\n", interface->name);
-        sr_send_packet(sr, packet, total_len, interface->name);
-        
-        free(packet);
+        if (sr_rip_send(sr, rip, packet, total_len, interface->name) == 0) {
+            rip->stat_tx_requests++;
+        }
+
         interface = interface->next;
     }
-        
-    return NULL;
 }
-  
 
 
-/* Periodic advertisement thread */
-void* sr_rip_periodic_advertisement(void* arg) {
-    
-    struct sr_instance* sr = arg;
+/* Un RESPONSE multicast por todas las interfaces (anuncio periódico o triggered update) */
+void sr_rip_advertise_all(struct sr_instance* sr) {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    /* El anuncio lleva todo: un triggered update frenado ya no hace falta */
+    rip->triggered_pending = 0;
 
-    sleep(2); // Esperar a que se inicialice todo
-    
+    /* Recorre la lista de interfaces (sr->if_list) */
+    struct sr_if* if_walker = sr->if_list;
+    while (if_walker)
+    {
+        /* Y envía una respuesta RIP por cada una,
+         * utilizando la dirección de multicast definida (RIP_IP)
+         */
+        sr_rip_send_response(sr, if_walker, htonl(RIP_IP));
+        if_walker = if_walker->next;
+    }
+}
+
+/*
+Freno de los triggered updates (RFC 2453 3.10.1): después de mandar uno, los cambios que
+lleguen durante un tiempo al azar de entre 1 y 5 segundos salen juntos en uno solo al final.
+Sin esto, en una malla cada RESPONSE recibido que mueve algo dispara la tabla entera por todas
+las interfaces y los vecinos contestan igual: el simulador lo muestra como una tormenta.
+*/
+#define RIP_TRIGGERED_HOLD_MIN_SEC 1
+#define RIP_TRIGGERED_HOLD_MAX_SEC 5
+
+/* Como el anuncio periódico, pero se saltea las interfaces cuyo RESPONSE quedó igual
+   (por ejemplo si lo que cambió va dentro de un agregado y su métrica mínima no se movió) */
+static void sr_rip_send_triggered_update(struct sr_instance* sr) {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    time_t now = sr_rip_now();
+    if (now < rip->triggered_hold_until) {
+        /* Sale cuando venza el freno (ver sr_rip_run_route_timers) */
+        rip->triggered_pending = 1;
+        return;
+    }
+    rip->triggered_pending = 0;
+    rip->triggered_hold_until = now + RIP_TRIGGERED_HOLD_MIN_SEC
+        + rand() % (RIP_TRIGGERED_HOLD_MAX_SEC - RIP_TRIGGERED_HOLD_MIN_SEC + 1);
+
+    struct sr_if* if_walker = sr->if_list;
+    while (if_walker)
+    {
+        struct sr_rip_response_cache* cache = sr_rip_get_response(sr, if_walker);
+        if (cache->payload_changed) {
+            sr_rip_send_response(sr, if_walker, htonl(RIP_IP));
+        } else {
+            printf("-> RIP: Sin cambios para %s, no se manda triggered update\n", if_walker->name);
+        }
+        if_walker = if_walker->next;
+    }
+}
+
+/* Agrega las rutas directamente conectadas. Antes lo hacía el hilo de anuncios al arrancar. */
+static void sr_rip_add_connected_routes(struct sr_instance* sr) {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
     // Agregar las rutas directamente conectadas
     /************************************************************************************/
-    pthread_mutex_lock(&rip_metadata_lock);
+    pthread_mutex_lock(&rip->metadata_lock);
     struct sr_if* int_temp = sr->if_list;
     while(int_temp != NULL)
     {
@@ -757,243 +2613,821 @@ void* sr_rip_periodic_advertisement(void* arg) {
                         metric,
                         0,
                         htonl(0),
-                        time(NULL),
+                        sr_rip_now(),
                         1,
                         0);
         int_temp = int_temp->next;
     }
-    
-    pthread_mutex_unlock(&rip_metadata_lock);
+
+    pthread_mutex_unlock(&rip->metadata_lock);
+    sr_rip_table_changed(rip);
     printf("\n-> RIP: Printing the forwarding table\n");
     print_routing_table(sr);
     /************************************************************************************/
+}
 
-    /* A PARTIR DE ACÁ VA LO NUEVO, QUE ES CON ESTE COMENTARIO QUE DEJARON
-        Espera inicial de RIP_ADVERT_INTERVAL_SEC antes del primer envío.
-        A continuación entra en un bucle infinito que, cada RIP_ADVERT_INTERVAL_SEC segundos,
-        recorre la lista de interfaces (sr->if_list) y envía una respuesta RIP por cada una,
-        utilizando la dirección de multicast definida (RIP_IP).
-        Esto implementa el envío periódico de rutas (anuncios no solicitados) en RIPv2.
-    */
+/*
+Snapshot binario de la tabla para arrancar "en caliente". Se guardan solo las rutas
+dinámicas (las conectadas salen de las interfaces) con su metadata de RIP y la edad de
+sus timers, así al cargarlas los timeouts siguen corriendo desde donde estaban.
+Se escribe en un .tmp y se renombra, para no dejar nunca un archivo a medias.
+Se reescribe en cada intervalo aunque table_generation no haya cambiado: un refresco de ruta
+no la toca (el FIB no cambia) pero sí reinicia la edad, y si el archivo quedara con la edad
+vieja al cargarlo se le sumaría también el tiempo apagado y vencerían rutas que estaban vivas.
+*/
+#define RIP_SNAPSHOT_ENABLED 1
+#define RIP_SNAPSHOT_PATH "rip_table.snap"
+#define RIP_SNAPSHOT_INTERVAL_SEC 5 /* Cada cuánto se reescribe; es lo más que pueden quedar viejas las edades */
+#define RIP_SNAPSHOT_MAGIC 0x52495053 /* "RIPS" */
+#define RIP_SNAPSHOT_VERSION 1
+
+struct sr_rip_snapshot_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    int64_t saved_at;
+} __attribute__ ((packed));
+
+struct sr_rip_snapshot_rec {
+    uint32_t dest;
+    uint32_t mask;
+    uint32_t gw;
+    uint32_t learned_from;
+    uint32_t age;      /* Segundos desde last_updated */
+    uint32_t gc_age;   /* Segundos en garbage collection (si valid == 0) */
+    uint16_t route_tag;
+    uint8_t metric;
+    uint8_t valid;
+    char ifname[sr_IFACE_NAMELEN];
+} __attribute__ ((packed));
+
+/* Guarda la tabla con las edades de ahora. Devuelve 0 si salió bien. */
+static int sr_rip_save_snapshot(struct sr_instance* sr)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    if (!rip->snapshot_path) {
+        return 0;
+    }
 
-    /* En la letra dice que 10 segundos para el timer de avisos no solicitados */
-    
-    sleep(RIP_ADVERT_INTERVAL_SEC); 
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", rip->snapshot_path);
+    FILE* f = fopen(tmp_path, "wb");
+    if (!f) {
+        perror("RIP: No se pudo abrir el snapshot");
+        return -1;
+    }
 
-    while (1)
+    time_t now = sr_rip_now();
+    struct sr_rip_snapshot_hdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = RIP_SNAPSHOT_MAGIC;
+    hdr.version = RIP_SNAPSHOT_VERSION;
+    hdr.saved_at = now;
+    /* El count se completa al final, cuando se sabe cuántas se escribieron */
+    fwrite(&hdr, sizeof(hdr), 1, f);
+
+    pthread_mutex_lock(&rip->metadata_lock);
+    for (struct sr_rt* rt = sr->routing_table; rt; rt = rt->next)
     {
-        printf("-> RIP: Enviando anuncio periódico no solicitado (multicast)...\n");
-
-        /* Recorre la lista de interfaces (sr->if_list) */
-        struct sr_if* if_walker = sr->if_list;
-        while (if_walker)
-        {
-            /* Y envía una respuesta RIP por cada una,
-             * utilizando la dirección de multicast definida (RIP_IP)
-             */
-            sr_rip_send_response(sr, if_walker, htonl(RIP_IP));
-            if_walker = if_walker->next;
+        if (rt->learned_from == 0) {
+            continue;
         }
+        struct sr_rip_snapshot_rec rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.dest = rt->dest.s_addr;
+        rec.mask = rt->mask.s_addr;
+        rec.gw = rt->gw.s_addr;
+        rec.learned_from = rt->learned_from;
+        rec.age = now > rt->last_updated ? (uint32_t)(now - rt->last_updated) : 0;
+        rec.gc_age = (!rt->valid && now > rt->garbage_collection_time)
+                     ? (uint32_t)(now - rt->garbage_collection_time) : 0;
+        rec.route_tag = rt->route_tag;
+        rec.metric = rt->metric;
+        rec.valid = rt->valid;
+        strncpy(rec.ifname, rt->interface, sr_IFACE_NAMELEN - 1);
+        fwrite(&rec, sizeof(rec), 1, f);
+        hdr.count++;
+    }
+    pthread_mutex_unlock(&rip->metadata_lock);
+
+    fseek(f, 0, SEEK_SET);
+    fwrite(&hdr, sizeof(hdr), 1, f);
 
-        /* Cada RIP_ADVERT_INTERVAL_SEC segundos */
-        sleep(RIP_ADVERT_INTERVAL_SEC);
+    int write_error = ferror(f);
+    if (fclose(f) != 0 || write_error) {
+        printf("RIP: Error escribiendo el snapshot.\n");
+        unlink(tmp_path);
+        return -1;
     }
-    return NULL;
+    if (rename(tmp_path, rip->snapshot_path) != 0) {
+        perror("RIP: No se pudo renombrar el snapshot");
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
 }
 
-/* Chequea las rutas y marca las que expiran por timeout */
-void* sr_rip_timeout_manager(void* arg) {
-    struct sr_instance* sr = arg;
-    /*ESTE ES COMENTARIO QUE YA ESTABA:*/
-    /*  - Bucle periódico que espera 1 segundo entre comprobaciones.
-        - Recorre la tabla de enrutamiento y para cada ruta dinámica (aprendida de un vecino) que no se haya actualizado
-        en el intervalo de timeout (RIP_TIMEOUT_SEC), marca la ruta como inválida, fija su métrica a
-        INFINITY y anota el tiempo de inicio del proceso de garbage collection.
-        - Si se detectan cambios, se desencadena una actualización (triggered update)
-        hacia los vecinos y se actualiza/visualiza la tabla de enrutamiento.
-        - Imprimir la tabla si hay cambios
-        - Se debe usar el mutex rip_metadata_lock para proteger el acceso concurrente
-          a la tabla de enrutamiento.
-    */
+/*
+Conjunto de prefijos (destino, máscara) para la carga: las rutas que ya estaban más las que
+se van cargando. Direccionamiento abierto con sondeo lineal, para no recorrer la tabla por
+cada registro (eso era O(n²) con tablas grandes).
+*/
+struct sr_rip_prefix_set {
+    uint32_t* dest;
+    uint32_t* mask;
+    uint8_t* used;
+    unsigned int cap; /* Potencia de 2 */
+};
+
+static int sr_rip_prefix_set_init(struct sr_rip_prefix_set* set, unsigned int n)
+{
+    set->cap = 16;
+    while (set->cap < 2 * n) {
+        set->cap *= 2;
+    }
+    set->dest = malloc(set->cap * sizeof(uint32_t));
+    set->mask = malloc(set->cap * sizeof(uint32_t));
+    set->used = calloc(set->cap, 1);
+    return (set->dest && set->mask && set->used) ? 0 : -1;
+}
+
+static void sr_rip_prefix_set_free(struct sr_rip_prefix_set* set)
+{
+    free(set->dest);
+    free(set->mask);
+    free(set->used);
+}
+
+/* Devuelve 1 si lo agregó y 0 si ya estaba */
+static int sr_rip_prefix_set_add(struct sr_rip_prefix_set* set, uint32_t dest, uint32_t mask)
+{
+    uint32_t h = dest * 0x9E3779B1u ^ mask;
+    h ^= h >> 16;
+    for (unsigned int i = h & (set->cap - 1); ; i = (i + 1) & (set->cap - 1)) {
+        if (!set->used[i]) {
+            set->used[i] = 1;
+            set->dest[i] = dest;
+            set->mask[i] = mask;
+            return 1;
+        }
+        if (set->dest[i] == dest && set->mask[i] == mask) {
+            return 0;
+        }
+    }
+}
+
+/*
+Carga el snapshot de una sola pasada: arma los nodos sr_rt directamente y los cuelga al
+final de la tabla, en vez de llamar a sr_add_rt_entry por cada uno (que recorre la lista).
+Se saltean las rutas cuyo timer ya venció del todo mientras el router estaba apagado, las
+que apuntan a interfaces que no existen y las que ya están en la tabla (o repetidas en el
+archivo). Devuelve la cantidad de rutas cargadas.
+*/
+static int sr_rip_load_snapshot(struct sr_instance* sr)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    if (!rip->snapshot_path) {
+        return 0;
+    }
+    FILE* f = fopen(rip->snapshot_path, "rb");
+    if (!f) {
+        return 0;
+    }
+
+    struct sr_rip_snapshot_hdr hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1
+        || hdr.magic != RIP_SNAPSHOT_MAGIC || hdr.version != RIP_SNAPSHOT_VERSION) {
+        printf("RIP: Snapshot inválido, se ignora.\n");
+        fclose(f);
+        return 0;
+    }
+
+    /* El count no puede ser más que lo que entra en el archivo (si está roto, no se reserva de más) */
+    long data_start = ftell(f);
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long n_recs = (ftell(f) - data_start) / (long)sizeof(struct sr_rip_snapshot_rec);
+        if (n_recs >= 0 && hdr.count > (uint32_t)n_recs) {
+            hdr.count = (uint32_t)n_recs;
+        }
+    }
+    fseek(f, data_start, SEEK_SET);
 
-    /* La letra dice 60 segundos para el timer de timeout */
-    while(1)
+    time_t now = sr_rip_now();
+    /* El tiempo que estuvo apagado también cuenta para los timers */
+    time_t downtime = now > hdr.saved_at ? now - (time_t)hdr.saved_at : 0;
+
+    /* Los prefijos que ya están: la tabla solo la escribe RIP, no cambia durante la carga */
+    unsigned int n_existing = 0;
+    for (struct sr_rt* rt = sr->routing_table; rt; rt = rt->next) {
+        n_existing++;
+    }
+    struct sr_rip_prefix_set present;
+    if (sr_rip_prefix_set_init(&present, n_existing + hdr.count) < 0) {
+        sr_rip_prefix_set_free(&present);
+        fclose(f);
+        return 0;
+    }
+    for (struct sr_rt* rt = sr->routing_table; rt; rt = rt->next) {
+        sr_rip_prefix_set_add(&present, rt->dest.s_addr, rt->mask.s_addr);
+    }
+
+    struct sr_rt* head = NULL;
+    struct sr_rt* tail = NULL;
+    int loaded = 0;
+
+    for (uint32_t i = 0; i < hdr.count; i++)
     {
-        /* Loop periódico que espera 1 segundo entre comprobaciones */
-        sleep(1); 
-        
-        time_t now = time(NULL);
-        int changes_made = 0;
+        struct sr_rip_snapshot_rec rec;
+        if (fread(&rec, sizeof(rec), 1, f) != 1) {
+            break;
+        }
+        rec.ifname[sr_IFACE_NAMELEN - 1] = '\0';
+
+        time_t age = (time_t)rec.age + downtime;
+        time_t gc_age = (time_t)rec.gc_age + downtime;
+        if (rec.valid && age >= RIP_TIMEOUT_SEC) {
+            /* Venció mientras estaba apagado: entra directo a garbage collection */
+            rec.valid = 0;
+            rec.metric = INFINITY;
+            gc_age = age - RIP_TIMEOUT_SEC;
+        }
+        if (!rec.valid && gc_age >= RIP_GARBAGE_COLLECTION_SEC) {
+            continue;
+        }
+        if (!sr_get_interface(sr, rec.ifname)) {
+            continue;
+        }
+        if (!sr_rip_prefix_set_add(&present, rec.dest, rec.mask)) {
+            continue;
+        }
+
+        struct sr_rt* rt = (struct sr_rt*)calloc(1, sizeof(struct sr_rt));
+        if (!rt) {
+            break;
+        }
+        rt->dest.s_addr = rec.dest;
+        rt->mask.s_addr = rec.mask;
+        rt->gw.s_addr = rec.gw;
+        strncpy(rt->interface, rec.ifname, sr_IFACE_NAMELEN);
+        rt->metric = rec.metric;
+        rt->route_tag = rec.route_tag;
+        rt->learned_from = rec.learned_from;
+        rt->last_updated = now - age;
+        rt->valid = rec.valid;
+        rt->garbage_collection_time = rec.valid ? 0 : now - gc_age;
+        rt->next = NULL;
+
+        if (tail) {
+            tail->next = rt;
+        } else {
+            head = rt;
+        }
+        tail = rt;
+        loaded++;
+    }
+    fclose(f);
+    sr_rip_prefix_set_free(&present);
+
+    if (!head) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&rip->metadata_lock);
+    struct sr_rt** link = &sr->routing_table;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = head;
+    pthread_mutex_unlock(&rip->metadata_lock);
+
+    sr_rip_table_changed(rip);
+    printf("-> RIP: Cargadas %d rutas del snapshot %s\n", loaded, rip->snapshot_path);
+    return loaded;
+}
+
+/*
+    Recorre la tabla de enrutamiento y para cada ruta dinámica (aprendida de un vecino) que no se haya actualizado
+    en el intervalo de timeout (RIP_TIMEOUT_SEC), marca la ruta como inválida, fija su métrica a
+    INFINITY y anota el tiempo de inicio del proceso de garbage collection.
+    Devuelve 1 si marcó alguna ruta.
+*/
+static int sr_rip_expire_routes(struct sr_instance* sr, time_t now) {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    int changes_made = 0;
 
-        /* Se debe usar el mutex rip_metadata_lock */
-        pthread_mutex_lock(&rip_metadata_lock);
+    /* Se debe usar el mutex rip->metadata_lock */
+    pthread_mutex_lock(&rip->metadata_lock);
 
-        /* Recorre la tabla de enrutamiento */
-        struct sr_rt* rt_walker = sr->routing_table;
-        while (rt_walker)
+    /* Recorre la tabla de enrutamiento */
+    struct sr_rt* rt_walker = sr->routing_table;
+    while (rt_walker)
+    {
+        /* Para cada ruta dinámica pasada por vecino
+        que no se haya actualizado y siga válida */
+        if (rt_walker->learned_from != 0 && rt_walker->valid)
         {
-            /* Para cada ruta dinámica pasada por vecino
-            que no se haya actualizado y siga válida */
-            if (rt_walker->learned_from != 0 && rt_walker->valid)
+            sr_rip_ecmp_expire(rip, rt_walker, now);
+
+            /* En el intervalo de timeout (RIP_TIMEOUT_SEC) */
+            if ((now - rt_walker->last_updated) >= RIP_TIMEOUT_SEC
+                && !(ECMP_ENABLED && sr_rip_ecmp_promote(rip, rt_walker)))
             {
-                /* En el intervalo de timeout (RIP_TIMEOUT_SEC) */
-                if ((now - rt_walker->last_updated) >= RIP_TIMEOUT_SEC)
-                {
-                    printf("RIP: Ruta expirada (timeout): %s/%s via %s\n",
-                          inet_ntoa(rt_walker->dest), 
-                          inet_ntoa(rt_walker->mask),
-                          inet_ntoa(rt_walker->gw));
-
-                    /* Marca la ruta como inválida */
-                    rt_walker->valid = 0;
-                    /* Fija su métrica a INFINITY */
-                    rt_walker->metric = INFINITY;
-                    /* Anota el tiempo de inicio del proceso de garbage collection */
-                    rt_walker->garbage_collection_time = now;
-                    
-                    changes_made = 1;
-                }
+                printf("RIP: Ruta expirada (timeout): %s/%s via %s\n",
+                      inet_ntoa(rt_walker->dest),
+                      inet_ntoa(rt_walker->mask),
+                      inet_ntoa(rt_walker->gw));
+
+                /* Marca la ruta como inválida */
+                rt_walker->valid = 0;
+                /* Fija su métrica a INFINITY */
+                rt_walker->metric = INFINITY;
+                /* Anota el tiempo de inicio del proceso de garbage collection */
+                rt_walker->garbage_collection_time = now;
+                sr_rip_fib_note(rip, rt_walker->dest.s_addr, rt_walker->mask.s_addr);
+
+                changes_made = 1;
             }
-            rt_walker = rt_walker->next;
         }
+        rt_walker = rt_walker->next;
+    }
+
+    pthread_mutex_unlock(&rip->metadata_lock);
+
+    if (changes_made) {
+        sr_rip_routes_changed(rip);
+    }
+
+    return changes_made;
+}
 
-        pthread_mutex_unlock(&rip_metadata_lock);
+/*
+    Elimina las rutas que estén marcadas como inválidas (valid == 0) y
+    lleven más tiempo en garbage collection que RIP_GARBAGE_COLLECTION_SEC.
+    Devuelve 1 si eliminó alguna ruta.
+*/
+static int sr_rip_collect_garbage(struct sr_instance* sr, time_t now) {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    int routes_deleted = 0;
 
-        /* Si se detectan cambios, marca triggered update */
-        if (changes_made)
+    /* Se debe usar el mutex rip->metadata_lock */
+    pthread_mutex_lock(&rip->metadata_lock);
+
+    struct sr_rt* rt_walker = sr->routing_table;
+    struct sr_rt* rt_next = NULL;
+
+    /* * Iteramos de forma segura, guardando el 'next' antes de
+     * potencialmente eliminar el nodo actual
+     */
+    while (rt_walker)
+    {
+        rt_next = rt_walker->next; /* Guardar el siguiente puntero */
+
+        /* hay una comprobación de que el timer se haya iniciado */
+        if (rt_walker->valid == 0 && rt_walker->garbage_collection_time != 0)
         {
-            printf("-> RIP: Rutas expiradas. Enviando triggered update...\n");
-            
-            struct sr_if* if_walker = sr->if_list;
-            while (if_walker)
+            if ((now - rt_walker->garbage_collection_time) >= RIP_GARBAGE_COLLECTION_SEC)
             {
-                /* Un triggered update es un RESPONSE multicast por todas las interfaces */
-                sr_rip_send_response(sr, if_walker, htonl(RIP_IP));
-                if_walker = if_walker->next;
+                printf("RIP: Eliminando ruta (garbage collection): %s/%s\n",
+                      inet_ntoa(rt_walker->dest),
+                      inet_ntoa(rt_walker->mask));
+
+                sr_rip_ecmp_clear(rip, rt_walker->dest.s_addr, rt_walker->mask.s_addr, 1);
+                sr_rip_fib_note(rip, rt_walker->dest.s_addr, rt_walker->mask.s_addr);
+
+                /* sr_del_rt_entry se encarga de liberar la memoria y mantener
+                enlazada la lista */
+                sr_del_rt_entry(&(sr->routing_table), rt_walker);
+                routes_deleted = 1;
             }
+        }
 
-            /* Y se actualiza e imprime la tabla de enrutamiento */
-            printf("\n-> RIP: Imprimiendo tabla de rutas (post-timeout):\n");
-            print_routing_table(sr);
+        rt_walker = rt_next; /* Moverse al siguiente nodo guardado ya */
+    }
+
+    pthread_mutex_unlock(&rip->metadata_lock);
+
+    if (routes_deleted) {
+        sr_rip_routes_changed(rip);
+    }
+
+    return routes_deleted;
+}
+
+/*
+    Calcula el próximo instante en que vence algún timer de ruta (timeout o garbage collection).
+    Devuelve 0 si no hay nada pendiente.
+*/
+static time_t sr_rip_next_route_deadline(struct sr_instance* sr) {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    time_t next = 0;
+
+    pthread_mutex_lock(&rip->metadata_lock);
+    for (struct sr_rt* rt = sr->routing_table; rt; rt = rt->next) {
+        time_t deadline = 0;
+        if (rt->learned_from != 0 && rt->valid) {
+            deadline = rt->last_updated + RIP_TIMEOUT_SEC;
+            time_t ecmp_deadline = sr_rip_ecmp_next_deadline(rip, rt);
+            if (ecmp_deadline != 0 && ecmp_deadline < deadline) {
+                deadline = ecmp_deadline;
+            }
+        } else if (rt->valid == 0 && rt->garbage_collection_time != 0) {
+            deadline = rt->garbage_collection_time + RIP_GARBAGE_COLLECTION_SEC;
+        }
+        if (deadline != 0 && (next == 0 || deadline < next)) {
+            next = deadline;
         }
     }
+    pthread_mutex_unlock(&rip->metadata_lock);
 
-    return NULL;
+    if (rip->triggered_pending && (next == 0 || rip->triggered_hold_until < next)) {
+        next = rip->triggered_hold_until;
+    }
+
+    return next;
+}
+
+/* Arma un timerfd para que dispare una sola vez en el instante absoluto 'when' (0 lo desarma) */
+static void sr_rip_arm_timer_at(int tfd, time_t when) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = when;
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("RIP: timerfd_settime");
+    }
+}
+
+/* Arma un timerfd relativo a ahora, con período opcional */
+static void sr_rip_arm_timer_in(int tfd, time_t first, time_t interval) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = first;
+    its.it_interval.tv_sec = interval;
+    if (timerfd_settime(tfd, 0, &its, NULL) < 0) {
+        perror("RIP: timerfd_settime");
+    }
+}
+
+/* Lee el fd para que deje de estar listo (timerfd y eventfd devuelven un uint64_t) */
+static void sr_rip_consume_fd(int fd) {
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0) {
+        perror("RIP: read");
+    }
+}
+
+/* Procesa los timeouts y el garbage collection que ya vencieron según sr_rip_now() */
+static void sr_rip_run_route_timers(struct sr_instance* sr) {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    time_t now = sr_rip_now();
+
+    if (rip->triggered_pending && now >= rip->triggered_hold_until) {
+        printf("-> RIP: Venció el freno, enviando el triggered update pendiente...\n");
+        sr_rip_send_triggered_update(sr);
+    }
+
+    /* Si se detectan cambios, marca triggered update */
+    if (sr_rip_expire_routes(sr, now)) {
+        printf("-> RIP: Rutas expiradas. Enviando triggered update...\n");
+        sr_rip_send_triggered_update(sr);
+
+        printf("\n-> RIP: Imprimiendo tabla de rutas (post-timeout):\n");
+        print_routing_table(sr);
+    }
+
+    /* Si se detectan eliminaciones, se imprime la tabla */
+    if (sr_rip_collect_garbage(sr, now)) {
+        printf("\n-> RIP: Imprimiendo tabla de rutas (post-garbage-collection):\n");
+        print_routing_table(sr);
+    }
+}
+
+/*
+Hace en el hilo que la llama lo mismo que el loop, pero mirando sr_rip_now() en vez de los
+timerfd: arranque (rutas conectadas y snapshot), requests iniciales, anuncio periódico,
+paquetes encolados, timers de ruta y guardado del snapshot. Es para correr RIP con un reloj
+simulado (sr_rip_set_clock); el router normal no la usa. La primera llamada cuenta como
+el arranque del router.
+*/
+void sr_rip_poll(struct sr_instance* sr) {
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    if (!rip) {
+        return;
+    }
+    struct timespec cpu_start;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    time_t now = sr_rip_now();
+
+    if (rip->poll_startup_at == 0 && rip->poll_request_at == 0) {
+        rip->poll_startup_at = now + RIP_STARTUP_DELAY_SEC;
+        rip->poll_request_at = now + RIP_REQUEST_DELAY_SEC;
+    }
+
+    sr_rip_drain_rx_queue(sr);
+
+    if (rip->poll_startup_at > 0 && now >= rip->poll_startup_at) {
+        rip->poll_startup_at = -1;
+        sr_rip_add_connected_routes(sr);
+        if (RIP_SNAPSHOT_ENABLED && rip->snapshot_path) {
+            if (!rip->snapshot_loaded) {
+                sr_rip_load_snapshot(sr);
+                rip->snapshot_loaded = 1;
+            }
+            rip->poll_snapshot_at = now + RIP_SNAPSHOT_INTERVAL_SEC;
+        }
+        rip->poll_advert_at = now + RIP_ADVERT_INTERVAL_SEC;
+    }
+    if (rip->poll_request_at > 0 && now >= rip->poll_request_at) {
+        rip->poll_request_at = -1;
+        sr_rip_send_requests(sr);
+    }
+    if (rip->poll_advert_at > 0 && now >= rip->poll_advert_at) {
+        rip->poll_advert_at = now + RIP_ADVERT_INTERVAL_SEC;
+        sr_rip_advertise_all(sr);
+    }
+
+    sr_rip_run_route_timers(sr);
+
+    if (rip->poll_snapshot_at > 0 && now >= rip->poll_snapshot_at) {
+        rip->poll_snapshot_at = now + RIP_SNAPSHOT_INTERVAL_SEC;
+        sr_rip_save_snapshot(sr);
+    }
+
+    sr_rip_fib_update(sr);
+
+    sr_rip_account_cpu(rip, &cpu_start);
+}
+
+/* Cambia el archivo del snapshot de sr (NULL lo apaga). Antes de sr_rip_init o del primer poll */
+void sr_rip_set_snapshot_path(struct sr_instance* sr, const char* path)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    if (rip) {
+        rip->snapshot_path = path;
+    }
+}
+
+/* Agrega un agregado "red/len" a los que se anuncian por ifname. Se puede llamar en cualquier
+   momento: el próximo anuncio ya sale sumarizado. -1 si no se entiende, ya estaba o no hay lugar */
+int sr_rip_add_summary(struct sr_instance* sr, const char* ifname, const char* prefix)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    if (!rip) {
+        return -1;
+    }
+    pthread_mutex_lock(&rip->metadata_lock);
+    if (rip->n_summaries < 0) {
+        sr_rip_summary_load(rip);
+    }
+    int r = sr_rip_summary_add(rip, ifname, prefix);
+    if (r == 0) {
+        /* Cambia lo que se anuncia aunque la tabla sea la misma */
+        __atomic_add_fetch(&rip->table_generation, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&rip->metadata_lock);
+    return r;
+}
+
+/* Saca todos los agregados de sr (también los de rip_summary_table): se anuncia todo suelto */
+void sr_rip_clear_summaries(struct sr_instance* sr)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    if (!rip) {
+        return;
+    }
+    pthread_mutex_lock(&rip->metadata_lock);
+    rip->n_summaries = 0;
+    __atomic_add_fetch(&rip->table_generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&rip->metadata_lock);
 }
 
-/* Chequea las rutas marcadas como garbage collection y las elimina si expira el timer */
-void* sr_rip_garbage_collection_manager(void* arg) {
+/*
+    Hilo único de RIP. Reemplaza a los cuatro hilos que hacían polling con sleep():
+    - startup_tfd: a los RIP_STARTUP_DELAY_SEC agrega las rutas conectadas.
+    - request_tfd: a los RIP_REQUEST_DELAY_SEC manda los requests iniciales.
+    - advert_tfd: anuncio periódico cada RIP_ADVERT_INTERVAL_SEC.
+    - route_tfd: dispara justo en el próximo vencimiento de timeout o garbage collection.
+    - snapshot_tfd: cada RIP_SNAPSHOT_INTERVAL_SEC guarda la tabla.
+    - rip->rx_evfd: hay paquetes RIP en la cola.
+*/
+static void* sr_rip_event_loop(void* arg) {
     struct sr_instance* sr = arg;
-    /* COMENTARIO QUE YA ESTABA:
-        - Bucle infinito que espera 1 segundo entre comprobaciones.
-        - Recorre la tabla de enrutamiento y elimina aquellas rutas que:
-            * estén marcadas como inválidas (valid == 0) y
-            * lleven más tiempo en garbage collection que RIP_GARBAGE_COLLECTION_SEC
-              (current_time >= garbage_collection_time + RIP_GARBAGE_COLLECTION_SEC).
-        - Si se detectan eliminaciones, se imprime la tabla.
-        - Se debe usar el mutex rip_metadata_lock para proteger el acceso concurrente
-          a la tabla de enrutamiento.
-    */
-    /* En letra dice 40 segundos para el timer de garbage collection */
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+
+    int epfd = epoll_create1(0);
+    int startup_tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+    int request_tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+    int advert_tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+    /* time() es reloj de pared, así que los vencimientos de ruta van en CLOCK_REALTIME */
+    int route_tfd = timerfd_create(CLOCK_REALTIME, 0);
+    int snapshot_tfd = timerfd_create(CLOCK_MONOTONIC, 0);
+
+    if (epfd < 0 || startup_tfd < 0 || request_tfd < 0 || advert_tfd < 0 || route_tfd < 0
+        || snapshot_tfd < 0) {
+        perror("RIP: Error creando epoll/timerfd");
+        return NULL;
+    }
+
+    int fds[] = {rip->rx_evfd, startup_tfd, request_tfd, advert_tfd, route_tfd, snapshot_tfd};
+    for (unsigned int i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fds[i];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+            perror("RIP: epoll_ctl");
+            return NULL;
+        }
+    }
+
+    sr_rip_arm_timer_in(startup_tfd, RIP_STARTUP_DELAY_SEC, 0);
+    sr_rip_arm_timer_in(request_tfd, RIP_REQUEST_DELAY_SEC, 0);
 
-    /* Bucle infinito que espera 1 segundo entre comprobaciones. */
     while (1)
     {
-        sleep(1);
-
-        time_t now = time(NULL);
-        int routes_deleted = 0;
+        struct epoll_event events[8];
+        int n = epoll_wait(epfd, events, 8, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("RIP: epoll_wait");
+            break;
+        }
 
-        /* Se debe usar el mutex rip_metadata_lock */
-        pthread_mutex_lock(&rip_metadata_lock);
+        struct timespec cpu_start;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
 
-        struct sr_rt* rt_walker = sr->routing_table;
-        struct sr_rt* rt_next = NULL; 
-        
-        /* * Iteramos de forma segura, guardando el 'next' antes de 
-         * potencialmente eliminar el nodo actual
-         */
-        while (rt_walker)
+        for (int i = 0; i < n; i++)
         {
-            rt_next = rt_walker->next; /* Guardar el siguiente puntero */
-
-            /* Recorre la tabla y elimina aquellas rutas que: 
-             estén marcadas como inválidas (osea valid == 0) y 
-             hay una comprobación de que el timer se haya iniciado */
-            if (rt_walker->valid == 0 && rt_walker->garbage_collection_time != 0)
-            {
-                /* * lleven más tiempo en garbage collection que RIP_GARBAGE_COLLECTION_SEC */
-                if ((now - rt_walker->garbage_collection_time) >= RIP_GARBAGE_COLLECTION_SEC)
-                {
-                    printf("RIP: Eliminando ruta (garbage collection): %s/%s\n",
-                          inet_ntoa(rt_walker->dest), 
-                          inet_ntoa(rt_walker->mask));
-                    
-                    /* sr_del_rt_entry se encarga de liberar la memoria y mantener
-                    enlazada la lista */
-                    sr_del_rt_entry(&(sr->routing_table), rt_walker);
-                    routes_deleted = 1;
+            int fd = events[i].data.fd;
+            sr_rip_consume_fd(fd);
+
+            if (fd == rip->rx_evfd) {
+                sr_rip_drain_rx_queue(sr);
+            } else if (fd == startup_tfd) {
+                sr_rip_add_connected_routes(sr);
+                if (RIP_SNAPSHOT_ENABLED) {
+                    if (!rip->snapshot_loaded) {
+                        /* sr_rip_init no tenía interfaces: se cargan ahora */
+                        sr_rip_load_snapshot(sr);
+                        rip->snapshot_loaded = 1;
+                    }
+                    sr_rip_arm_timer_in(snapshot_tfd, RIP_SNAPSHOT_INTERVAL_SEC, RIP_SNAPSHOT_INTERVAL_SEC);
                 }
+                /* En la letra dice 10 segundos para el timer de avisos no solicitados */
+                sr_rip_arm_timer_in(advert_tfd, RIP_ADVERT_INTERVAL_SEC, RIP_ADVERT_INTERVAL_SEC);
+            } else if (fd == request_tfd) {
+                sr_rip_send_requests(sr);
+            } else if (fd == advert_tfd) {
+                printf("-> RIP: Enviando anuncio periódico no solicitado (multicast)...\n");
+                sr_rip_advertise_all(sr);
+            } else if (fd == route_tfd) {
+                sr_rip_run_route_timers(sr);
+            } else if (fd == snapshot_tfd) {
+                sr_rip_save_snapshot(sr);
             }
-            
-            rt_walker = rt_next; /* Moverse al siguiente nodo guardado ya */
         }
 
-        pthread_mutex_unlock(&rip_metadata_lock);
+        /* Todos los cambios de esta vuelta juntos: la FIB se rearma una sola vez */
+        sr_rip_fib_update(sr);
 
-        /* Si se detectan eliminaciones, se imprime la tabla */
-        if (routes_deleted)
-        {
-            printf("\n-> RIP: Imprimiendo tabla de rutas (post-garbage-collection):\n");
-            print_routing_table(sr);
-        }
+        sr_rip_account_cpu(rip, &cpu_start);
+
+        /* Cualquier evento pudo mover los vencimientos (refresco, ruta nueva, expiración) */
+        sr_rip_arm_timer_at(route_tfd, sr_rip_next_route_deadline(sr));
     }
-    
+
+    close(epfd);
+    close(startup_tfd);
+    close(request_tfd);
+    close(advert_tfd);
+    close(route_tfd);
+    close(snapshot_tfd);
     return NULL;
 }
 
 
+static void sr_rip_ctx_free(struct sr_rip_ctx* rip)
+{
+    free(rip->rx_queue);
+    free(rip->ecmp_table);
+    for (int i = 0; rip->response_cache && i < RIP_RESPONSE_CACHE_SZ; i++) {
+        free(rip->response_cache[i].entries);
+        free(rip->response_cache[i].pkts);
+    }
+    free(rip->response_cache);
+    free(rip->summaries);
+    sr_rip_fib_free(rip->fib);
+    free(rip->fib_notes);
+    pthread_mutex_destroy(&rip->metadata_lock);
+    free(rip);
+}
+
+/* Como sr_rip_ctx_find pero lo crea si no existe. NULL solo si no hay memoria */
+static struct sr_rip_ctx* sr_rip_ctx_get(struct sr_instance* sr)
+{
+    struct sr_rip_ctx* rip = sr_rip_ctx_find(sr);
+    if (rip) {
+        return rip;
+    }
+
+    pthread_mutex_lock(&rip_ctx_list_lock);
+    for (rip = rip_ctx_list; rip && rip->sr != sr; rip = rip->next) {
+    }
+    if (!rip) {
+        rip = calloc(1, sizeof(struct sr_rip_ctx));
+        if (rip) {
+            rip->sr = sr;
+            pthread_mutex_init(&rip->metadata_lock, NULL);
+            rip->table_generation = 1;
+            rip->fib_dirty = 1;
+            rip->rx_evfd = -1;
+            rip->n_summaries = -1;
+            rip->snapshot_path = RIP_SNAPSHOT_PATH;
+            rip->rx_queue = calloc(RIP_RX_QUEUE_SZ, sizeof(struct sr_rip_rx_slot));
+            rip->ecmp_table = calloc(ECMP_TABLE_SZ, sizeof(struct sr_rip_ecmp_group));
+            rip->response_cache = calloc(RIP_RESPONSE_CACHE_SZ, sizeof(struct sr_rip_response_cache));
+            rip->summaries = calloc(RIP_SUMMARY_MAX, sizeof(struct sr_rip_summary));
+            if (!rip->rx_queue || !rip->ecmp_table || !rip->response_cache || !rip->summaries) {
+                sr_rip_ctx_free(rip);
+                rip = NULL;
+            } else {
+                rip->next = rip_ctx_list;
+                __atomic_store_n(&rip_ctx_list, rip, __ATOMIC_RELEASE);
+            }
+        }
+    }
+    pthread_mutex_unlock(&rip_ctx_list_lock);
+    return rip;
+}
+
+/*
+Libera el estado de RIP de sr. Es para el simulador, que arma y desarma topologías en el
+mismo proceso: no puede haber ningún otro hilo usando esta instancia.
+*/
+void sr_rip_destroy(struct sr_instance* sr)
+{
+    pthread_mutex_lock(&rip_ctx_list_lock);
+    struct sr_rip_ctx** link = &rip_ctx_list;
+    while (*link && (*link)->sr != sr) {
+        link = &(*link)->next;
+    }
+    struct sr_rip_ctx* rip = *link;
+    if (rip) {
+        *link = rip->next;
+    }
+    pthread_mutex_unlock(&rip_ctx_list_lock);
+
+    if (rip) {
+        if (rip_ctx_last == rip) {
+            rip_ctx_last = NULL;
+        }
+        sr_rip_ctx_free(rip);
+    }
+}
+
 /* Inicialización subsistema RIP */
 int sr_rip_init(struct sr_instance* sr) {
-    /* Inicializar mutex */
-    if(pthread_mutex_init(&sr->rip_subsys.lock, NULL) != 0) {
-        printf("RIP: Error initializing mutex\n");
+    struct sr_rip_ctx* rip = sr_rip_ctx_get(sr);
+    if (!rip) {
+        printf("RIP: Error allocating state\n");
         return -1;
     }
 
-    /* Iniciar hilo avisos periódicos */
-    if(pthread_create(&sr->rip_subsys.thread, NULL, sr_rip_periodic_advertisement, sr) != 0) {
-        printf("RIP: Error creating advertisement thread\n");
-        pthread_mutex_destroy(&sr->rip_subsys.lock);
+    /* Inicializar mutex */
+    if(pthread_mutex_init(&sr->rip_subsys.lock, NULL) != 0) {
+        printf("RIP: Error initializing mutex\n");
         return -1;
     }
 
-    /* Iniciar hilo timeouts */
-    pthread_t timeout_thread;
-    if(pthread_create(&timeout_thread, NULL, sr_rip_timeout_manager, sr) != 0) {
-        printf("RIP: Error creating timeout thread\n");
-        pthread_cancel(sr->rip_subsys.thread);
-        pthread_mutex_destroy(&sr->rip_subsys.lock);
-        return -1;
+    /*
+    Si ya se conocen las interfaces, el snapshot se carga acá, antes de arrancar el loop:
+    así la FIB sale con las rutas de antes del reinicio desde el primer paquete, en vez de
+    esperar al timer de arranque. Si no, lo carga el loop cuando agrega las conectadas.
+    */
+    if (RIP_SNAPSHOT_ENABLED && sr->if_list && !rip->snapshot_loaded) {
+        sr_rip_load_snapshot(sr);
+        rip->snapshot_loaded = 1;
+        sr_rip_fib_update(sr);
     }
 
-    /* Iniciar hilo garbage collection */
-    pthread_t garbage_collection_thread;
-    if(pthread_create(&garbage_collection_thread, NULL, sr_rip_garbage_collection_manager, sr) != 0) {
-        printf("RIP: Error creating garbage collection thread\n");
-        pthread_cancel(sr->rip_subsys.thread);
+    /* eventfd con el que el hilo de recepción avisa que encoló paquetes */
+    rip->rx_evfd = eventfd(0, EFD_NONBLOCK);
+    if (rip->rx_evfd < 0) {
+        printf("RIP: Error creating eventfd\n");
         pthread_mutex_destroy(&sr->rip_subsys.lock);
         return -1;
     }
 
-    /* Iniciar hilo requests */
-    pthread_t requests_thread;
-    if(pthread_create(&requests_thread, NULL, sr_rip_send_requests, sr) != 0) {
-        printf("RIP: Error creating requests thread\n");
-        pthread_cancel(sr->rip_subsys.thread);
+    /* Iniciar el hilo único de RIP (anuncios, timeouts, garbage collection, requests y paquetes) */
+    if(pthread_create(&sr->rip_subsys.thread, NULL, sr_rip_event_loop, sr) != 0) {
+        printf("RIP: Error creating event loop thread\n");
+        close(rip->rx_evfd);
+        rip->rx_evfd = -1;
         pthread_mutex_destroy(&sr->rip_subsys.lock);
         return -1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -12,7 +12,11 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "sr_if.h"
 #include "sr_rt.h"
@@ -23,6 +27,15 @@
 #include "sr_protocol.h" /* <-- Necesario para lo nuevo */
 #include "sr_rip.h"      /* <-- Necesario para lo nuevo*/
 #include <arpa/inet.h> /* <-- Necesario para htonl() que chequea lo de multicast*/
+#include "sr_fwd.h"
+#include "sr_epoch.h"
+#include "sr_flow.h"
+#include "sr_acl.h"
+#include "sr_ct.h"
+#include "sr_nat.h"
+#include "sr_tap.h"
+#include "sr_io.h"
+#include "sr_txq.h"
 
 /*---------------------------------------------------------------------
  * Method: sr_init(void)
@@ -49,21 +62,324 @@ void sr_init(struct sr_instance* sr)
     /* Hilo para gestionar el timeout del caché ARP */
     pthread_create(&thread, &(sr->attr), sr_arpcache_timeout, sr);
 
+    /* Las ACLs se cargan antes de empezar a recibir paquetes (después las recarga el hilo de la caché) */
+    sr_acl_poll();
+
+    /* Hilo que vacía las colas de salida */
+    sr_txq_start(sr);
+
+    /* Hilo que escribe la captura (se prende con SR_TAP_CONF_PATH) */
+    sr_tap_start(sr);
+
     sr_rip_init(sr);
 
 } /* -- sr_init -- */
 
-struct sr_rt *sr_lpm_lookup(struct sr_instance *sr, uint32_t dest_ip);
+int sr_rip_ecmp_select(struct sr_instance *sr, struct sr_rt *rt, uint32_t flow_hash, uint32_t *gw, char *ifname); /* En sr_rip.c */
+int sr_arpcache_update(struct sr_arpcache *cache, unsigned char *mac, uint32_t ip); /* En sr_arpcache.c */
+struct sr_pktbuf *sr_arpcache_packet_buf(struct sr_packet *pkt); /* En sr_arpcache.c */
+struct sr_arpreq *sr_arpcache_queuereq_buf(struct sr_arpcache *cache, uint32_t ip,
+                                           struct sr_pktbuf *pb, unsigned int packet_len, char *iface);
 
-/* Envía un paquete ICMP de error */
-void sr_send_icmp_error_packet(uint8_t type,
-                              uint8_t code,
-                              struct sr_instance *sr,
-                              uint32_t ipDst,
-                              uint8_t *ipPacket)
+/*
+Limitador de errores ICMP (RFC 1812, 4.3.2.8): un token bucket global y uno por prefijo
+de destino (el origen del paquete que causó el error). Los buckets por prefijo están en una
+tabla fija indexada por hash; si dos prefijos caen en el mismo lugar, el nuevo pisa al viejo.
+Nunca se reserva memoria. Los tokens se cuentan en milésimas para no perder precisión.
+
+Sin lock: cada bucket guarda los tokens y el último ms en una sola palabra de 64 bits que se
+cambia con CAS, así en una tormenta de errores los hilos de recepción no se ponen en fila.
+Cuando falta un token no se escribe nada (lo que se recargó se vuelve a calcular la próxima
+vez), así que los que se descartan sólo leen. El prefijo va aparte: si otro hilo pisa el
+bucket en el medio, como mucho se gasta un token del prefijo nuevo, que pasa igual con las
+colisiones.
+
+Los de defecto son los ICMP_RATELIMIT_*; se cambian en ICMP_RATELIMIT_CONF_PATH, una línea
+"global <pps> <burst>" y/o "prefix <pps> <burst>" (# comenta), que se vuelve a leer cuando
+cambia (lo revisa el hilo de la caché ARP con sr_icmp_ratelimit_poll), o desde el código con
+sr_icmp_ratelimit_set.
+*/
+#define ICMP_RATELIMIT_ENABLED 1
+#define ICMP_RATELIMIT_GLOBAL_PPS 100    /* Errores por segundo en total */
+#define ICMP_RATELIMIT_GLOBAL_BURST 200
+#define ICMP_RATELIMIT_PREFIX_PPS 10     /* Errores por segundo hacia un mismo prefijo */
+#define ICMP_RATELIMIT_PREFIX_BURST 20
+#define ICMP_RATELIMIT_MAX 1000000       /* Tope de pps y burst, para que los tokens entren en 32 bits */
+#define ICMP_RATELIMIT_PREFIX_MASK 0xFFFFFF00 /* /24, en orden de host */
+#define ICMP_RATELIMIT_TABLE_SZ 1024     /* Tiene que ser potencia de 2 */
+#define ICMP_RATELIMIT_CONF_PATH "icmp_ratelimit.conf"
+
+/* state: ms del último token sacado (32 bits de abajo del reloj) << 32 | tokens en milésimas.
+   0 = nunca se usó, arranca lleno */
+struct sr_icmp_bucket {
+    uint32_t prefix;
+    uint64_t state;
+};
+
+struct sr_icmp_ratelimit_conf {
+    uint32_t global_pps;
+    uint32_t global_burst;
+    uint32_t prefix_pps;
+    uint32_t prefix_burst;
+};
+
+static uint64_t icmp_global_state = 0;
+static struct sr_icmp_bucket icmp_prefix_buckets[ICMP_RATELIMIT_TABLE_SZ];
+static struct sr_icmp_ratelimit_conf icmp_rl_conf = {
+    ICMP_RATELIMIT_GLOBAL_PPS, ICMP_RATELIMIT_GLOBAL_BURST,
+    ICMP_RATELIMIT_PREFIX_PPS, ICMP_RATELIMIT_PREFIX_BURST
+};
+
+static unsigned long icmp_errors_sent = 0;
+static unsigned long icmp_errors_suppressed_global = 0;
+static unsigned long icmp_errors_suppressed_prefix = 0;
+
+static uint64_t sr_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Recarga el bucket según el tiempo pasado e intenta sacar un token */
+static int sr_icmp_bucket_take(uint64_t *state, uint32_t now_ms, uint32_t pps, uint32_t burst)
+{
+    uint64_t max = (uint64_t)burst * 1000;
+    uint64_t old = __atomic_load_n(state, __ATOMIC_RELAXED);
+    while (1) {
+        uint32_t last_ms = now_ms;
+        uint64_t tokens = max;
+        if (old != 0) {
+            /* Otro hilo pudo haber leído el reloj después que nosotros: no se vuelve para atrás */
+            int32_t elapsed = (int32_t)(now_ms - (uint32_t)(old >> 32));
+            if (elapsed < 0) {
+                elapsed = 0;
+                last_ms = (uint32_t)(old >> 32);
+            }
+            tokens = (uint32_t)old + (uint64_t)elapsed * pps;
+            if (tokens > max) {
+                tokens = max;
+            }
+        }
+        if (tokens < 1000) {
+            return 0;
+        }
+        uint64_t new_state = (uint64_t)last_ms << 32 | (tokens - 1000);
+        if (__atomic_compare_exchange_n(state, &old, new_state, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+}
+
+/* Devuelve 1 si se puede generar un error ICMP hacia dst_ip (orden de red) */
+static int sr_icmp_ratelimit_allow(uint32_t dst_ip)
+{
+    if (!ICMP_RATELIMIT_ENABLED) {
+        return 1;
+    }
+
+    uint32_t now_ms = (uint32_t)sr_now_ms();
+    uint32_t prefix = ntohl(dst_ip) & ICMP_RATELIMIT_PREFIX_MASK;
+    uint32_t h = prefix * 0x9E3779B1u;
+    struct sr_icmp_bucket *b = &icmp_prefix_buckets[(h >> 16) & (ICMP_RATELIMIT_TABLE_SZ - 1)];
+
+    uint32_t old_prefix = __atomic_load_n(&b->prefix, __ATOMIC_RELAXED);
+    if (old_prefix != prefix
+        && __atomic_compare_exchange_n(&b->prefix, &old_prefix, prefix, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        /* Lo ganamos nosotros: el prefijo nuevo arranca lleno */
+        __atomic_store_n(&b->state, 0, __ATOMIC_RELAXED);
+    }
+
+    if (!sr_icmp_bucket_take(&b->state, now_ms, __atomic_load_n(&icmp_rl_conf.prefix_pps, __ATOMIC_RELAXED),
+                             __atomic_load_n(&icmp_rl_conf.prefix_burst, __ATOMIC_RELAXED))) {
+        __atomic_fetch_add(&icmp_errors_suppressed_prefix, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    if (!sr_icmp_bucket_take(&icmp_global_state, now_ms, __atomic_load_n(&icmp_rl_conf.global_pps, __ATOMIC_RELAXED),
+                             __atomic_load_n(&icmp_rl_conf.global_burst, __ATOMIC_RELAXED))) {
+        __atomic_fetch_add(&icmp_errors_suppressed_global, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    __atomic_fetch_add(&icmp_errors_sent, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/* Cambia los ritmos del limitador. Los buckets no se tocan: el burst nuevo corre desde la
+   próxima recarga. -1 si algún valor se pasa de ICMP_RATELIMIT_MAX o un burst es 0 */
+int sr_icmp_ratelimit_set(uint32_t global_pps, uint32_t global_burst, uint32_t prefix_pps, uint32_t prefix_burst)
+{
+    if (global_pps > ICMP_RATELIMIT_MAX || global_burst > ICMP_RATELIMIT_MAX || global_burst == 0
+        || prefix_pps > ICMP_RATELIMIT_MAX || prefix_burst > ICMP_RATELIMIT_MAX || prefix_burst == 0) {
+        return -1;
+    }
+    __atomic_store_n(&icmp_rl_conf.global_pps, global_pps, __ATOMIC_RELAXED);
+    __atomic_store_n(&icmp_rl_conf.global_burst, global_burst, __ATOMIC_RELAXED);
+    __atomic_store_n(&icmp_rl_conf.prefix_pps, prefix_pps, __ATOMIC_RELAXED);
+    __atomic_store_n(&icmp_rl_conf.prefix_burst, prefix_burst, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Lee el archivo entero y recién ahí cambia los ritmos. Lo que no está queda con el de defecto */
+static int sr_icmp_ratelimit_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    struct sr_icmp_ratelimit_conf conf = {
+        ICMP_RATELIMIT_GLOBAL_PPS, ICMP_RATELIMIT_GLOBAL_BURST,
+        ICMP_RATELIMIT_PREFIX_PPS, ICMP_RATELIMIT_PREFIX_BURST
+    };
+    char line[256], which[16];
+    unsigned int pps, burst;
+    int line_no = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+        char *p = line + strspn(line, " \t\r\n");
+        if (*p == '#' || *p == '\0') {
+            continue;
+        }
+        if (sscanf(p, "%15s %u %u", which, &pps, &burst) != 3
+            || pps > ICMP_RATELIMIT_MAX || burst > ICMP_RATELIMIT_MAX || burst == 0) {
+            printf("ICMP: línea %d de %s inválida, se ignora.\n", line_no, path);
+            continue;
+        }
+        if (strcmp(which, "global") == 0) {
+            conf.global_pps = pps;
+            conf.global_burst = burst;
+        } else if (strcmp(which, "prefix") == 0) {
+            conf.prefix_pps = pps;
+            conf.prefix_burst = burst;
+        } else {
+            printf("ICMP: línea %d de %s inválida, se ignora.\n", line_no, path);
+        }
+    }
+    fclose(f);
+    return sr_icmp_ratelimit_set(conf.global_pps, conf.global_burst, conf.prefix_pps, conf.prefix_burst);
+}
+
+/* Si ICMP_RATELIMIT_CONF_PATH cambió (o apareció, o se borró) vuelve a cargar los ritmos. Una vez por segundo */
+void sr_icmp_ratelimit_poll(void)
+{
+    static struct timespec conf_mtime = {0, 0};
+    struct stat st;
+    if (stat(ICMP_RATELIMIT_CONF_PATH, &st) != 0) {
+        if (conf_mtime.tv_sec != 0 || conf_mtime.tv_nsec != 0) {
+            conf_mtime.tv_sec = 0;
+            conf_mtime.tv_nsec = 0;
+            sr_icmp_ratelimit_set(ICMP_RATELIMIT_GLOBAL_PPS, ICMP_RATELIMIT_GLOBAL_BURST,
+                                  ICMP_RATELIMIT_PREFIX_PPS, ICMP_RATELIMIT_PREFIX_BURST);
+            printf("ICMP: %s ya no está, límites de defecto.\n", ICMP_RATELIMIT_CONF_PATH);
+        }
+        return;
+    }
+    if (st.st_mtim.tv_sec == conf_mtime.tv_sec && st.st_mtim.tv_nsec == conf_mtime.tv_nsec) {
+        return;
+    }
+    conf_mtime = st.st_mtim;
+    if (sr_icmp_ratelimit_load(ICMP_RATELIMIT_CONF_PATH) == 0) {
+        printf("ICMP: límites desde %s: global %u/s (burst %u), por prefijo %u/s (burst %u).\n",
+               ICMP_RATELIMIT_CONF_PATH, icmp_rl_conf.global_pps, icmp_rl_conf.global_burst,
+               icmp_rl_conf.prefix_pps, icmp_rl_conf.prefix_burst);
+    }
+}
+
+void sr_icmp_ratelimit_print_stats(void)
+{
+    printf("ICMP errores: enviados %lu, suprimidos por prefijo %lu, suprimidos global %lu\n",
+           __atomic_load_n(&icmp_errors_sent, __ATOMIC_RELAXED),
+           __atomic_load_n(&icmp_errors_suppressed_prefix, __ATOMIC_RELAXED),
+           __atomic_load_n(&icmp_errors_suppressed_global, __ATOMIC_RELAXED));
+}
+
+/*
+Plantillas de errores ICMP por interfaz y por (tipo, código). Tienen armado todo lo que no
+depende del paquete original (Ethernet origen/tipo, IP con la dirección de la interfaz,
+tipo/código ICMP) y las sumas parciales de los checksums. Para mandar un error se copia la
+plantilla, se ponen la IP destino y los 28 bytes citados y se terminan los checksums sumando
+solo eso. Las plantillas viven en el conjunto de direcciones locales (sr_local_addr_build):
+se arman todas juntas apenas se conocen las interfaces y se rearman con él cuando cambian
+(sr_local_addr_poll) o cuando alguien llama a sr_local_addr_rebuild, así una interfaz que
+cambia de IP o de MAC no sigue mandando errores con la dirección vieja.
+*/
+#define ICMP_ERROR_FRAME_LEN (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t))
+
+static const uint8_t icmp_template_kinds[][2] = {
+    {3, 0},  /* Net unreachable */
+    {3, 1},  /* Host unreachable */
+    {3, 3},  /* Port unreachable */
+    {3, 4},  /* Fragmentation needed (lleva next_mtu) */
+    {11, 0}, /* Time exceeded */
+};
+#define ICMP_TEMPLATE_KINDS (sizeof(icmp_template_kinds) / sizeof(icmp_template_kinds[0]))
+
+struct sr_icmp_template {
+    uint32_t ip_partial;    /* Suma del cabezal IP sin ip_dst ni ip_sum */
+    uint32_t icmp_partial;  /* Suma del cabezal ICMP sin los datos citados */
+    uint8_t frame[ICMP_ERROR_FRAME_LEN];
+};
+
+static void sr_icmp_build_template(struct sr_icmp_template *tpl, struct sr_if *iface,
+                                   uint8_t type, uint8_t code)
+{
+    memset(tpl->frame, 0, sizeof(tpl->frame));
+
+    sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)tpl->frame;
+    sr_ip_hdr_t *ip = (sr_ip_hdr_t *)(tpl->frame + sizeof(sr_ethernet_hdr_t));
+    sr_icmp_t3_hdr_t *icmp = (sr_icmp_t3_hdr_t *)((uint8_t *)ip + sizeof(sr_ip_hdr_t));
+
+    /* MAC de Origen: MAC de la interfaz de salida*/
+    memcpy(eth->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+
+    ip->ip_v = 4;
+    ip->ip_hl = 5; // sin opciones?
+    ip->ip_tos = 0;
+    ip->ip_len = htons(sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
+    ip->ip_id = htons(0); // Puede ser cualquier ID?
+    ip->ip_off = htons(0); // Sin fragmentación?
+    ip->ip_ttl = 64;       // TTL default (?)
+    ip->ip_p = ip_protocol_icmp;
+    /* IP de Origen: La IP de la interfaz por donde sale el error*/
+    ip->ip_src = iface->ip;
+
+    icmp->icmp_type = type;
+    icmp->icmp_code = code;
+
+    /* ip_dst, ip_sum, icmp_sum y los datos están en cero, así que no suman */
+    tpl->ip_partial = sr_cksum_add(ip, sizeof(sr_ip_hdr_t), 0);
+    tpl->icmp_partial = sr_cksum_add(icmp, sizeof(sr_icmp_t3_hdr_t) - ICMP_DATA_SIZE, 0);
+}
+
+/* El índice del tipo en icmp_template_kinds, o -1 si no tiene plantilla */
+static int sr_icmp_template_kind(uint8_t type, uint8_t code)
+{
+    for (unsigned int kind = 0; kind < ICMP_TEMPLATE_KINDS; kind++) {
+        if (icmp_template_kinds[kind][0] == type && icmp_template_kinds[kind][1] == code) {
+            return kind;
+        }
+    }
+    return -1;
+}
+
+static const struct sr_icmp_template *sr_icmp_get_template(struct sr_instance *sr, struct sr_if *iface,
+                                                           uint8_t type, uint8_t code);
+
+/* Envía un paquete ICMP de error. next_mtu solo se usa en el tipo 3 código 4 (en orden de host) */
+static void sr_send_icmp_error(uint8_t type,
+                               uint8_t code,
+                               struct sr_instance *sr,
+                               uint32_t ipDst,
+                               uint8_t *ipPacket,
+                               uint16_t next_mtu)
 {
   
     /* COLOQUE AQUÍ SU CÓDIGO*/
+
+    /* Antes de hacer nada (LPM, malloc, checksums) se fija si hay tokens */
+    if (!sr_icmp_ratelimit_allow(ipDst)) {
+        return;
+    }
   
     /* Obtener el encabezado IP del paquete que causó el error*/
     sr_ip_hdr_t *original_ip_hdr = (sr_ip_hdr_t *)ipPacket;
@@ -90,51 +406,56 @@ void sr_send_icmp_error_packet(uint8_t type,
     El tamaño del paquete de error es fijo para Tipo 3 o Tipo 11:
     Ethernet (14) + IP (20) + ICMP T3/T11 Header (8 + 28 bytes)*/
     unsigned int ip_hdr_len = sizeof(sr_ip_hdr_t);
-    unsigned int icmp_error_len = sizeof(sr_icmp_t3_hdr_t); 
-    unsigned int total_len = sizeof(sr_ethernet_hdr_t) + ip_hdr_len + icmp_error_len;
+    unsigned int total_len = ICMP_ERROR_FRAME_LEN;
 
-    uint8_t *pkt_reply = (uint8_t *)malloc(total_len);
-    memset(pkt_reply, 0, total_len); // Limpiar la memoria
+    /* Como el tamaño es fijo, alcanza con un buffer en el stack */
+    uint8_t pkt_reply[ICMP_ERROR_FRAME_LEN];
 
     sr_ethernet_hdr_t *eth_reply = (sr_ethernet_hdr_t *)pkt_reply;
     sr_ip_hdr_t *ip_reply = (sr_ip_hdr_t *)(pkt_reply + sizeof(sr_ethernet_hdr_t));
     sr_icmp_t3_hdr_t *icmp_reply = (sr_icmp_t3_hdr_t *)((uint8_t *)ip_reply + ip_hdr_len);
 
-    /* Construir encabezado (tipo 3 o tipo 11)*/
-    icmp_reply->icmp_type = type; 
-    icmp_reply->icmp_code = code; 
+    /* Copiar la plantilla (Ethernet origen, cabezal IP, tipo/código ICMP). Es del conjunto de
+    direcciones locales, que se puede rearmar en cualquier momento: se copia adentro de una época */
+    uint32_t ip_partial, icmp_partial;
+    sr_epoch_enter();
+    const struct sr_icmp_template *tpl = sr_icmp_get_template(sr, iface_out, type, code);
+    struct sr_icmp_template tpl_local;
+    if (!tpl) {
+        /* Tipo no previsto o interfaz que el conjunto todavía no tiene: se arma en el momento */
+        sr_icmp_build_template(&tpl_local, iface_out, type, code);
+        tpl = &tpl_local;
+    }
+    memcpy(pkt_reply, tpl->frame, total_len);
+    ip_partial = tpl->ip_partial;
+    icmp_partial = tpl->icmp_partial;
+    sr_epoch_exit();
 
     /* Copiar los 28 bytes de datos: IP Header original + 8 bytes de payload original
-    El RFC dice 20 bytes del IP original + 8 bytes del payload original.*/
-    memcpy(icmp_reply->data, original_ip_hdr, ICMP_DATA_SIZE); 
-    
-    /* Calcular Checksum ICMP*/
-    icmp_reply->icmp_sum = 0;
-    icmp_reply->icmp_sum = icmp3_cksum(icmp_reply, icmp_error_len);
-
-
-    /* Construir encabezado IP*/
-    ip_reply->ip_v = 4;
-    ip_reply->ip_hl = 5; // sin opciones?
-    ip_reply->ip_tos = 0;
-    ip_reply->ip_len = htons(ip_hdr_len + icmp_error_len);
-    ip_reply->ip_id = htons(0); // Puede ser cualquier ID?
-    ip_reply->ip_off = htons(0); // Sin fragmentación?
-    ip_reply->ip_ttl = 64;       // TTL default (?)
-    ip_reply->ip_p = ip_protocol_icmp;
-
-    /* IP de Origen: La IP de la interfaz por donde sale el error (la que recibió el paquete original)*/
-    ip_reply->ip_src = iface_out->ip;
+    El RFC dice 20 bytes del IP original + 8 bytes del payload original.
+    Si el original es más corto (ip_len < 28, ya validado contra el buffer) se copia hasta
+    ip_len y el resto va en cero, para no leer afuera del paquete.*/
+    unsigned int quote_len = ntohs(original_ip_hdr->ip_len);
+    if (quote_len > ICMP_DATA_SIZE) {
+        quote_len = ICMP_DATA_SIZE;
+    }
+    memcpy(icmp_reply->data, original_ip_hdr, quote_len);
+    memset(icmp_reply->data + quote_len, 0, ICMP_DATA_SIZE - quote_len);
     
+    /* Checksum ICMP: la parte del cabezal ya está sumada en la plantilla*/
+    uint32_t icmp_sum = sr_cksum_add(icmp_reply->data, ICMP_DATA_SIZE, icmp_partial);
+    if (next_mtu) {
+        /* Fragmentation needed: el MTU del siguiente salto también entra en el checksum */
+        icmp_reply->next_mtu = htons(next_mtu);
+        icmp_sum = sr_cksum_add(&icmp_reply->next_mtu, sizeof(uint16_t), icmp_sum);
+    }
+    icmp_reply->icmp_sum = sr_cksum_finish(icmp_sum);
+
     /* IP de Destino: La IP de origen del paquete que causó el error*/
     ip_reply->ip_dst = original_ip_hdr->ip_src;
 
-    printf("DEBUG ICMP ERROR: Longitud calculada (IP Hdr + ICMP Seg): %u bytes.\n", ip_hdr_len + icmp_error_len);
-    printf("DEBUG ICMP ERROR: Longitud en IP Hdr (ntohs): %u bytes.\n", ntohs(ip_reply->ip_len));
-
-    /* Calcular Checksum IP*/
-    ip_reply->ip_sum = 0;
-    ip_reply->ip_sum = ip_cksum(ip_reply, ip_hdr_len);
+    /* Checksum IP: solo falta sumar la IP destino*/
+    ip_reply->ip_sum = sr_cksum_finish(sr_cksum_add(&ip_reply->ip_dst, sizeof(uint32_t), ip_partial));
 
 
     /* Encabezado ethernet y envío
@@ -157,15 +478,11 @@ void sr_send_icmp_error_packet(uint8_t type,
         memcpy(eth_reply->ether_dhost, arp_entry->mac, ETHER_ADDR_LEN);
         free(arp_entry); // Liberar la estructura de caché
         
-        /* MAC de Origen: MAC de la interfaz de salida*/
-        memcpy(eth_reply->ether_shost, iface_out->addr, ETHER_ADDR_LEN);
-
-        eth_reply->ether_type = htons(ethertype_ip);
-        
+        /* (MAC de Origen y tipo ya vienen de la plantilla)*/
         printf("Enviar ICMP Error (Tipo %d, Código %d).\n", type, code);
-        sr_send_packet(sr, pkt_reply, total_len, iface_out->name);
-        
-        free(pkt_reply);
+        if (sr_io_send(sr, pkt_reply, total_len, iface_out->name) < 0) {
+            printf("Cola de salida de %s llena, no sale el ICMP Error.\n", iface_out->name);
+        }
         
     } else {
         /* NO se encontró MAC, hay que encolar y enviar ARP request*/
@@ -173,19 +490,705 @@ void sr_send_icmp_error_packet(uint8_t type,
         printf("MAC no encontrada para el próximo salto (%s). Encolar ICMP Error (Tipo %d, Código %d).\n", 
                 inet_ntoa( (struct in_addr){.s_addr = next_hop_ip} ), type, code);
         
+        /* La caché COPIA el contenido, así que el buffer del stack alcanza.*/
         sr_arpcache_queuereq(&(sr->cache), next_hop_ip, pkt_reply, total_len, iface_out->name);
         
-        /* La caché COPIA el contenido, creo que habría que liberar el buffer original.*/
-        free(pkt_reply);
-        
     }  
+} /* -- sr_send_icmp_error -- */
+
+void sr_send_icmp_error_packet(uint8_t type,
+                              uint8_t code,
+                              struct sr_instance *sr,
+                              uint32_t ipDst,
+                              uint8_t *ipPacket)
+{
+    sr_send_icmp_error(type, code, sr, ipDst, ipPacket, 0);
 } /* -- sr_send_icmp_error_packet -- */
 
-void sr_handle_ip_packet(struct sr_instance *sr,
+/*
+MTU por interfaz. Las que no están en la tabla usan SR_DEFAULT_MTU.
+Se configuran en SR_MTU_CONF_PATH, una por línea "<interfaz> <mtu>" (# comenta), que se vuelve
+a leer cuando cambia (lo revisa el hilo de la caché ARP con sr_mtu_poll), o desde el código
+con sr_if_set_mtu. El forwarding lee la tabla sin lock, con el mismo esquema de seq que ECMP:
+impar = se está escribiendo, si cambió entre el principio y el final se vuelve a leer.
+*/
+#define SR_DEFAULT_MTU 1500
+#define SR_MIN_MTU 68          /* El mínimo de RFC 791 */
+#define SR_MTU_MAX_IFS 32
+#define SR_MTU_CONF_PATH "mtu.conf"
+
+struct sr_mtu_conf {
+    char ifname[sr_IFACE_NAMELEN];
+    uint16_t mtu;
+};
+
+static struct sr_mtu_conf sr_mtu_table[SR_MTU_MAX_IFS];
+static unsigned int sr_mtu_n = 0;
+static unsigned int sr_mtu_seq = 0;
+static pthread_mutex_t sr_mtu_lock = PTHREAD_MUTEX_INITIALIZER; /* Entre escritores */
+
+static unsigned int sr_if_mtu(struct sr_if *iface)
+{
+    while (1) {
+        unsigned int seq = __atomic_load_n(&sr_mtu_seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        unsigned int mtu = SR_DEFAULT_MTU;
+        unsigned int n = __atomic_load_n(&sr_mtu_n, __ATOMIC_RELAXED);
+        for (unsigned int i = 0; i < n && i < SR_MTU_MAX_IFS; i++) {
+            if (strncmp(sr_mtu_table[i].ifname, iface->name, sr_IFACE_NAMELEN) == 0) {
+                mtu = sr_mtu_table[i].mtu;
+                break;
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&sr_mtu_seq, __ATOMIC_RELAXED) == seq) {
+            return mtu;
+        }
+    }
+}
+
+static void sr_mtu_write_begin(void)
+{
+    __atomic_store_n(&sr_mtu_seq, sr_mtu_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void sr_mtu_write_end(void)
+{
+    __atomic_store_n(&sr_mtu_seq, sr_mtu_seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Cambia el MTU de una interfaz (0 vuelve al de defecto). Devuelve -1 si el valor no sirve */
+int sr_if_set_mtu(const char *ifname, unsigned int mtu)
+{
+    if (mtu != 0 && (mtu < SR_MIN_MTU || mtu > SR_MAX_MTU)) {
+        return -1;
+    }
+    pthread_mutex_lock(&sr_mtu_lock);
+    unsigned int i = 0;
+    while (i < sr_mtu_n && strncmp(sr_mtu_table[i].ifname, ifname, sr_IFACE_NAMELEN) != 0) {
+        i++;
+    }
+    int r = 0;
+    sr_mtu_write_begin();
+    if (mtu == 0) {
+        if (i < sr_mtu_n) {
+            sr_mtu_table[i] = sr_mtu_table[--sr_mtu_n];
+        }
+    } else if (i < sr_mtu_n) {
+        sr_mtu_table[i].mtu = mtu;
+    } else if (sr_mtu_n < SR_MTU_MAX_IFS) {
+        memset(&sr_mtu_table[i], 0, sizeof(sr_mtu_table[i]));
+        strncpy(sr_mtu_table[i].ifname, ifname, sr_IFACE_NAMELEN - 1);
+        sr_mtu_table[i].mtu = mtu;
+        sr_mtu_n++;
+    } else {
+        r = -1;
+    }
+    sr_mtu_write_end();
+    pthread_mutex_unlock(&sr_mtu_lock);
+    return r;
+}
+
+/* Lee el archivo entero y recién ahí reemplaza la tabla. Devuelve las interfaces configuradas o -1 */
+static int sr_mtu_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    struct sr_mtu_conf table[SR_MTU_MAX_IFS];
+    unsigned int n = 0;
+    char line[256], ifname[sr_IFACE_NAMELEN];
+    unsigned int mtu;
+    int line_no = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+        char *p = line + strspn(line, " \t\r\n");
+        if (*p == '#' || *p == '\0') {
+            continue;
+        }
+        if (sscanf(p, "%31s %u", ifname, &mtu) != 2 || mtu < SR_MIN_MTU || mtu > SR_MAX_MTU) {
+            printf("MTU: línea %d de %s inválida, se ignora.\n", line_no, path);
+            continue;
+        }
+        if (n == SR_MTU_MAX_IFS) {
+            printf("MTU: más de %d interfaces en %s, el resto se ignora.\n", SR_MTU_MAX_IFS, path);
+            break;
+        }
+        memset(&table[n], 0, sizeof(table[n]));
+        strncpy(table[n].ifname, ifname, sr_IFACE_NAMELEN - 1);
+        table[n].mtu = mtu;
+        n++;
+    }
+    fclose(f);
+
+    pthread_mutex_lock(&sr_mtu_lock);
+    sr_mtu_write_begin();
+    memcpy(sr_mtu_table, table, n * sizeof(table[0]));
+    __atomic_store_n(&sr_mtu_n, n, __ATOMIC_RELAXED);
+    sr_mtu_write_end();
+    pthread_mutex_unlock(&sr_mtu_lock);
+    return (int)n;
+}
+
+/* Si SR_MTU_CONF_PATH cambió (o apareció, o se borró) vuelve a cargar la tabla. Una vez por segundo */
+void sr_mtu_poll(void)
+{
+    static struct timespec conf_mtime = {0, 0};
+    struct stat st;
+    if (stat(SR_MTU_CONF_PATH, &st) != 0) {
+        if (conf_mtime.tv_sec != 0 || conf_mtime.tv_nsec != 0) {
+            /* Se borró: todas vuelven al de defecto */
+            conf_mtime.tv_sec = 0;
+            conf_mtime.tv_nsec = 0;
+            pthread_mutex_lock(&sr_mtu_lock);
+            sr_mtu_write_begin();
+            __atomic_store_n(&sr_mtu_n, 0, __ATOMIC_RELAXED);
+            sr_mtu_write_end();
+            pthread_mutex_unlock(&sr_mtu_lock);
+            printf("MTU: %s ya no está, todas las interfaces con %d.\n", SR_MTU_CONF_PATH, SR_DEFAULT_MTU);
+        }
+        return;
+    }
+    if (st.st_mtim.tv_sec == conf_mtime.tv_sec && st.st_mtim.tv_nsec == conf_mtime.tv_nsec) {
+        return;
+    }
+    conf_mtime = st.st_mtim;
+    int n = sr_mtu_load(SR_MTU_CONF_PATH);
+    if (n >= 0) {
+        printf("MTU: %d interfaces configuradas desde %s.\n", n, SR_MTU_CONF_PATH);
+    }
+}
+
+/*
+Arma en out el cabezal IP de los fragmentos que no son el primero: el fijo más solo las
+opciones con el bit de copia (0x80, RFC 791), rellenado con EOL hasta múltiplo de 4.
+Devuelve el largo del cabezal armado.
+*/
+static unsigned int sr_frag_tail_header(const sr_ip_hdr_t *ip_hdr, uint8_t *out)
+{
+    const uint8_t *opts = (const uint8_t *)ip_hdr + sizeof(sr_ip_hdr_t);
+    unsigned int opts_len = ip_hdr->ip_hl * 4 - sizeof(sr_ip_hdr_t);
+    unsigned int len = sizeof(sr_ip_hdr_t);
+
+    memcpy(out, ip_hdr, sizeof(sr_ip_hdr_t));
+    for (unsigned int i = 0; i < opts_len; ) {
+        uint8_t type = opts[i];
+        if (type == 0) {
+            break; /* EOL */
+        }
+        if (type == 1) {
+            i++; /* NOP: no se copia, el relleno del final lo reemplaza */
+            continue;
+        }
+        if (i + 1 >= opts_len || opts[i + 1] < 2 || i + opts[i + 1] > opts_len) {
+            break; /* Opción mal formada: lo que sigue no se copia */
+        }
+        unsigned int opt_len = opts[i + 1];
+        if (type & 0x80) {
+            memcpy(out + len, opts + i, opt_len);
+            len += opt_len;
+        }
+        i += opt_len;
+    }
+    while (len % 4) {
+        out[len++] = 0;
+    }
+    ((sr_ip_hdr_t *)out)->ip_hl = len / 4;
+    return len;
+}
+
+/*
+Parte un paquete IP (sin DF) en fragmentos que entren en el MTU y los manda (o los encola
+esperando ARP si dhost es NULL). Cada fragmento es un sr_pktbuf con solo el pedazo de datos;
+los cabezales IP y Ethernet se le agregan adelante con sr_pktbuf_push, en el headroom. El
+mismo buffer sale por sr_io_send_buf o se lo queda la cola de ARP, sin otra copia. El primero
+lleva el cabezal original entero y su checksum se ajusta solo por ip_len e ip_off; los demás
+llevan solo las opciones con el bit de copia (sr_frag_tail_header), así que pueden llevar más
+datos, y el checksum se calcula.
+*/
+static void sr_fragment_and_send(struct sr_instance *sr,
+                                 uint8_t *packet,
+                                 struct sr_if *iface_out,
+                                 uint32_t next_hop_ip,
+                                 const uint8_t *dhost,
+                                 unsigned int mtu)
+{
+    unsigned int eth_hdr_len = sizeof(sr_ethernet_hdr_t);
+    sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + eth_hdr_len);
+    unsigned int ip_hdr_len = ip_hdr->ip_hl * 4;
+    unsigned int data_len = ntohs(ip_hdr->ip_len) - ip_hdr_len;
+
+    uint8_t tail_hdr[60];
+    unsigned int tail_hdr_len = sr_frag_tail_header(ip_hdr, tail_hdr);
+
+    /* Los datos de cada fragmento (menos el último) tienen que ser múltiplo de 8 */
+    unsigned int first_max = (mtu - ip_hdr_len) & ~7u;
+    unsigned int tail_max = (mtu - tail_hdr_len) & ~7u;
+    if (mtu <= ip_hdr_len || first_max == 0) {
+        printf("MTU %u demasiado chico para fragmentar. Descartar.\n", mtu);
+        return;
+    }
+
+    uint16_t orig_len_n = ip_hdr->ip_len;
+    uint16_t orig_off_n = ip_hdr->ip_off;
+    uint16_t orig_off = ntohs(orig_off_n);
+    uint16_t base_units = orig_off & IP_OFFMASK;
+    uint16_t orig_mf = orig_off & IP_MF;
+    uint16_t orig_sum = ip_hdr->ip_sum;
+
+    /* Cabezal Ethernet de todos los fragmentos */
+    sr_ethernet_hdr_t frag_eth;
+    memcpy(&frag_eth, packet, eth_hdr_len);
+    memcpy(frag_eth.ether_shost, iface_out->addr, ETHER_ADDR_LEN);
+    if (dhost) {
+        memcpy(frag_eth.ether_dhost, dhost, ETHER_ADDR_LEN);
+    }
+
+    unsigned int n_frags = 0;
+    unsigned int chunk = 0;
+    for (unsigned int offset = 0; offset < data_len; offset += chunk)
+    {
+        int first = (offset == 0);
+        unsigned int hdr_len = first ? ip_hdr_len : tail_hdr_len;
+        unsigned int max_data = first ? first_max : tail_max;
+        chunk = data_len - offset;
+        int more = 0;
+        if (chunk > max_data) {
+            chunk = max_data;
+            more = 1;
+        }
+
+        unsigned int frag_len = eth_hdr_len + hdr_len + chunk;
+        struct sr_pktbuf *pb = sr_pktbuf_alloc(chunk);
+        if (!pb) {
+            break;
+        }
+        memcpy(sr_pktbuf_data(pb), packet + eth_hdr_len + ip_hdr_len + offset, chunk);
+        sr_ip_hdr_t *out_ip = (sr_ip_hdr_t *)sr_pktbuf_push(pb, hdr_len);
+        memcpy(out_ip, first ? (const uint8_t *)ip_hdr : tail_hdr, hdr_len);
+        memcpy(sr_pktbuf_push(pb, eth_hdr_len), &frag_eth, eth_hdr_len);
+
+        uint16_t new_len_n = htons(hdr_len + chunk);
+        uint16_t new_off_n = htons((base_units + offset / 8) | (more ? IP_MF : orig_mf));
+        out_ip->ip_len = new_len_n;
+        out_ip->ip_off = new_off_n;
+        if (first) {
+            out_ip->ip_sum = sr_cksum_replace16(sr_cksum_replace16(orig_sum, orig_len_n, new_len_n),
+                                                orig_off_n, new_off_n);
+        } else {
+            out_ip->ip_sum = 0;
+            out_ip->ip_sum = ip_cksum(out_ip, hdr_len);
+        }
+
+        if (dhost) {
+            if (sr_io_send_buf(sr, pb, iface_out->name) < 0) {
+                /* Sin uno el resto no sirve: el destino no puede rearmar el paquete */
+                printf("Cola de salida de %s llena, se descarta el paquete fragmentado.\n", iface_out->name);
+                sr_pktbuf_put(pb);
+                return;
+            }
+        } else {
+            sr_arpcache_queuereq_buf(&(sr->cache), next_hop_ip, pb, frag_len, iface_out->name);
+        }
+        sr_pktbuf_put(pb);
+        n_frags++;
+    }
+
+    printf("Paquete de %u bytes fragmentado en %u fragmentos (MTU %u) por %s.\n",
+           ntohs(orig_len_n), n_frags, mtu, iface_out->name);
+}
+
+/*
+Validación de la trama en un solo lugar, antes de cualquier búsqueda. Todos los largos del
+cabezal (Ethernet, ARP, IP y el de transporte) se chequean contra el buffer, y lo que sale
+queda en un descriptor para que los handlers no vuelvan a parsear ni confíen en campos que
+vienen del cable. Las condiciones se juntan con | y se decide con un único if.
+El descriptor viaja por puntero por todo el camino del paquete, junto con la interfaz de
+entrada ya resuelta y la 5-tupla y su hash calculados una sola vez.
+*/
+struct sr_pkt_meta {
+    struct sr_if *in_iface;         /* Interfaz de entrada (la resuelve el que llama) */
+    struct sr_flow_key key;         /* Solo IP; el NAT de entrada la actualiza */
+    uint32_t flow_hash;             /* sr_flow_key_hash(&key) */
+    uint16_t ethertype;   /* En orden de host */
+    uint16_t l3_off;      /* Cabezal IP (o ARP) */
+    uint16_t ip_hdr_len;
+    uint16_t ip_len;      /* Largo del datagrama, ya verificado contra el buffer (sin el relleno Ethernet) */
+    uint16_t l4_off;      /* Cabezal de transporte, si first_frag */
+    uint16_t l4_len;      /* ip_len - ip_hdr_len */
+    uint16_t l7_off;      /* Datos UDP si el datagrama está entero, si no 0 */
+    uint16_t l7_len;
+    uint8_t proto;
+    uint8_t first_frag;   /* 1 si el paquete trae el cabezal de transporte (offset 0) */
+};
+
+/* Devuelve 0 si la trama se puede procesar, -1 si hay que descartarla */
+static int sr_parse_frame(const uint8_t *packet, unsigned int len, struct sr_pkt_meta *meta)
+{
+    const unsigned int eth_hdr_len = sizeof(sr_ethernet_hdr_t);
+
+    struct sr_if *in_iface = meta->in_iface;
+    memset(meta, 0, sizeof(*meta));
+    meta->in_iface = in_iface;
+    if (len < eth_hdr_len) {
+        return -1;
+    }
+    meta->ethertype = ntohs(((const sr_ethernet_hdr_t *)packet)->ether_type);
+    meta->l3_off = eth_hdr_len;
+
+    if (meta->ethertype == ethertype_arp) {
+        return len < eth_hdr_len + sizeof(sr_arp_hdr_t) ? -1 : 0;
+    }
+    if (meta->ethertype != ethertype_ip) {
+        return -1;
+    }
+
+    if (len < eth_hdr_len + sizeof(sr_ip_hdr_t)) {
+        return -1;
+    }
+    const sr_ip_hdr_t *ip_hdr = (const sr_ip_hdr_t *)(packet + eth_hdr_len);
+    unsigned int ip_hdr_len = ip_hdr->ip_hl * 4;
+    unsigned int ip_len = ntohs(ip_hdr->ip_len);
+    uint16_t ip_off = ntohs(ip_hdr->ip_off);
+
+    int bad = (ip_hdr->ip_v != 4)
+              | (ip_hdr_len < sizeof(sr_ip_hdr_t))
+              | (ip_len < ip_hdr_len)
+              | (eth_hdr_len + ip_len > len);
+    if (bad) {
+        return -1;
+    }
+
+    meta->ip_hdr_len = ip_hdr_len;
+    meta->ip_len = ip_len;
+    meta->proto = ip_hdr->ip_p;
+    meta->l4_off = eth_hdr_len + ip_hdr_len;
+    meta->l4_len = ip_len - ip_hdr_len;
+    meta->first_frag = (ip_off & IP_OFFMASK) == 0;
+    sr_flow_key_extract(&meta->key, (sr_ip_hdr_t *)ip_hdr, ip_hdr_len, ip_len);
+    meta->flow_hash = sr_flow_key_hash(&meta->key);
+    if (!meta->first_frag) {
+        return 0;
+    }
+
+    /* Cabezal de transporte: tiene que entrar entero en lo que queda del datagrama */
+    const uint8_t *l4 = packet + meta->l4_off;
+    int whole = !(ip_off & IP_MF);
+    if (meta->proto == ip_protocol_udp) {
+        unsigned int udp_len = meta->l4_len >= sizeof(sr_udp_hdr_t)
+                               ? ntohs(((const sr_udp_hdr_t *)l4)->length) : 0;
+        bad = (meta->l4_len < sizeof(sr_udp_hdr_t))
+              | (udp_len < sizeof(sr_udp_hdr_t))
+              | (whole & (udp_len > meta->l4_len));
+        if (!bad && whole) {
+            meta->l7_off = meta->l4_off + sizeof(sr_udp_hdr_t);
+            meta->l7_len = udp_len - sizeof(sr_udp_hdr_t);
+        }
+    } else if (meta->proto == 6) {
+        bad = (meta->l4_len < 20) | (meta->l4_len >= 20 && (l4[12] >> 4) * 4u > meta->l4_len)
+              | (meta->l4_len >= 20 && (l4[12] >> 4) < 5);
+    } else if (meta->proto == ip_protocol_icmp) {
+        bad = meta->l4_len < 8;
+    }
+    return bad ? -1 : 0;
+}
+
+/*
+Direcciones locales del router en un hash perfecto: se busca un multiplicador con el que
+ninguna de las IPs de las interfaces choque, así "¿es para mí?" es una multiplicación y una
+comparación en vez de recorrer la lista de interfaces.
+
+Hay un conjunto por sr_instance (en local_addrs, un lugar por instancia; con una sola, la
+búsqueda mira el primero y listo). Se arma la primera vez que se usa, porque las interfaces
+llegan de VNS después de sr_init, y después el hilo del caché ARP llama a sr_local_addr_poll
+una vez por segundo: si la lista de interfaces cambió (otra huella) se rearma. El conjunto
+nuevo se publica con un puntero atómico y el viejo va a sr_epoch_retire, como las ACLs; los
+que buscan están adentro de la época del paquete. Armar y publicar va con local_addrs_lock,
+así dos hilos que lo arman a la vez no publican dos veces. El conjunto lleva también las
+plantillas de errores ICMP de cada interfaz, que dependen de su IP y su MAC.
+*/
+#define LOCAL_ADDR_MAX_TRIES 256
+#define LOCAL_ADDR_MAX_INSTANCES 8
+
+struct sr_local_addr_set {
+    struct sr_instance *sr;
+    uint32_t fingerprint;       /* sr_local_addr_fingerprint de la lista con la que se armó */
+    uint32_t mult;
+    unsigned int shift;         /* Índice = (ip * mult) >> shift */
+    unsigned int size;          /* 1 << (32 - shift) */
+    uint32_t *keys;             /* 0 = lugar vacío (0.0.0.0 nunca es local) */
+    struct sr_if **ifaces;
+    unsigned int n_ifaces;      /* Todas, en el orden de if_list (también las sin IP) */
+    struct sr_if **tpl_ifaces;
+    struct sr_icmp_template (*templates)[ICMP_TEMPLATE_KINDS];
+};
+
+/* Los lugares se llenan en orden y no se vacían; el de una instancia solo cambia de conjunto */
+static struct sr_local_addr_set *local_addrs[LOCAL_ADDR_MAX_INSTANCES];
+static pthread_mutex_t local_addrs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void sr_local_addr_free(void *ptr)
+{
+    struct sr_local_addr_set *set = (struct sr_local_addr_set *)ptr;
+    if (set) {
+        free(set->keys);
+        free(set->ifaces);
+        free(set->tpl_ifaces);
+        free(set->templates);
+        free(set);
+    }
+}
+
+/* Resume la lista de interfaces (cuáles son, sus IPs y sus MACs); si cambia hay que rearmar */
+static uint32_t sr_local_addr_fingerprint(struct sr_if *if_list)
+{
+    uint32_t h = 0x811C9DC5u;
+    for (struct sr_if *iface = if_list; iface; iface = iface->next) {
+        h = (h ^ iface->ip) * 0x01000193u;
+        h = (h ^ (uint32_t)(uintptr_t)iface) * 0x01000193u;
+        for (int i = 0; i < ETHER_ADDR_LEN; i++) {
+            h = (h ^ iface->addr[i]) * 0x01000193u;
+        }
+    }
+    return h;
+}
+
+/* Intenta llenar la tabla con ese multiplicador; devuelve 0 si no hubo choques */
+static int sr_local_addr_fill(struct sr_local_addr_set *set, struct sr_if *if_list)
+{
+    memset(set->keys, 0, set->size * sizeof(uint32_t));
+    for (struct sr_if *iface = if_list; iface; iface = iface->next) {
+        if (iface->ip == 0) {
+            continue;
+        }
+        uint32_t idx = (iface->ip * set->mult) >> set->shift;
+        if (set->keys[idx] == iface->ip) {
+            continue; /* Dos interfaces con la misma IP: queda la primera */
+        }
+        if (set->keys[idx] != 0) {
+            return -1;
+        }
+        set->keys[idx] = iface->ip;
+        set->ifaces[idx] = iface;
+    }
+    return 0;
+}
+
+/* Arma un conjunto nuevo para la lista de interfaces de sr, o NULL si no se pudo */
+static struct sr_local_addr_set *sr_local_addr_build(struct sr_instance *sr)
+{
+    unsigned int n = 0;
+    for (struct sr_if *iface = sr->if_list; iface; iface = iface->next) {
+        n++;
+    }
+    if (n == 0) {
+        return NULL;
+    }
+
+    struct sr_local_addr_set *set = (struct sr_local_addr_set *)calloc(1, sizeof(*set));
+    if (!set) {
+        return NULL;
+    }
+    set->sr = sr;
+    set->fingerprint = sr_local_addr_fingerprint(sr->if_list);
+
+    /* Las plantillas ICMP de todas las interfaces, de una vez */
+    set->tpl_ifaces = (struct sr_if **)calloc(n, sizeof(struct sr_if *));
+    set->templates = calloc(n, sizeof(*set->templates));
+    if (!set->tpl_ifaces || !set->templates) {
+        sr_local_addr_free(set);
+        return NULL;
+    }
+    for (struct sr_if *iface = sr->if_list; iface; iface = iface->next) {
+        set->tpl_ifaces[set->n_ifaces] = iface;
+        for (unsigned int kind = 0; kind < ICMP_TEMPLATE_KINDS; kind++) {
+            sr_icmp_build_template(&set->templates[set->n_ifaces][kind], iface,
+                                   icmp_template_kinds[kind][0], icmp_template_kinds[kind][1]);
+        }
+        set->n_ifaces++;
+    }
+
+    /* Tabla de al menos el doble de lugares que interfaces; si no aparece un multiplicador
+    sin choques, se agranda */
+    unsigned int bits = 2;
+    while ((1u << bits) < 2 * n) {
+        bits++;
+    }
+    int found = 0;
+    for (; bits <= 16 && !found; bits++)
+    {
+        set->shift = 32 - bits;
+        set->size = 1u << bits;
+        free(set->keys);
+        free(set->ifaces);
+        set->keys = (uint32_t *)calloc(set->size, sizeof(uint32_t));
+        set->ifaces = (struct sr_if **)calloc(set->size, sizeof(struct sr_if *));
+        if (!set->keys || !set->ifaces) {
+            sr_local_addr_free(set);
+            return NULL;
+        }
+        for (uint32_t t = 0; t < LOCAL_ADDR_MAX_TRIES && !found; t++) {
+            set->mult = 0x9E3779B1u + 2 * t * 0x85EBCA6Bu; /* Siempre impar */
+            found = (sr_local_addr_fill(set, sr->if_list) == 0);
+        }
+    }
+    if (!found) {
+        printf("No se pudo armar el hash de direcciones locales.\n");
+        sr_local_addr_free(set);
+        return NULL;
+    }
+    printf("Direcciones locales: %u interfaces en una tabla de %u lugares.\n", n, set->size);
+    return set;
+}
+
+/* El lugar de sr en local_addrs (o uno libre), o -1 si ya hay demasiadas instancias */
+static int sr_local_addr_slot(struct sr_instance *sr, struct sr_local_addr_set **set_out)
+{
+    for (int i = 0; i < LOCAL_ADDR_MAX_INSTANCES; i++) {
+        struct sr_local_addr_set *set = __atomic_load_n(&local_addrs[i], __ATOMIC_ACQUIRE);
+        if (!set || set->sr == sr) {
+            *set_out = set;
+            return i;
+        }
+    }
+    *set_out = NULL;
+    return -1;
+}
+
+/*
+(Re)arma el conjunto de direcciones locales de sr. Con force = 0 solo si no existe o si la
+lista de interfaces cambió desde la última vez.
+*/
+static void sr_local_addr_update(struct sr_instance *sr, int force)
+{
+    pthread_mutex_lock(&local_addrs_lock);
+    struct sr_local_addr_set *old;
+    int slot = sr_local_addr_slot(sr, &old);
+    if (slot < 0
+        || (!force && old && old->fingerprint == sr_local_addr_fingerprint(sr->if_list))) {
+        pthread_mutex_unlock(&local_addrs_lock);
+        return;
+    }
+    struct sr_local_addr_set *set = sr_local_addr_build(sr);
+    if (set) {
+        __atomic_store_n(&local_addrs[slot], set, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&local_addrs_lock);
+
+    if (set && old) {
+        sr_epoch_retire(old, sr_local_addr_free);
+    }
+}
+
+/* Para el que cambie las interfaces a mano; si no, sr_local_addr_poll lo nota solo */
+void sr_local_addr_rebuild(struct sr_instance *sr)
+{
+    sr_local_addr_update(sr, 1);
+}
+
+/* La llama el hilo del caché ARP una vez por segundo */
+void sr_local_addr_poll(struct sr_instance *sr)
+{
+    sr_local_addr_update(sr, 0);
+}
+
+/* La interfaz que tiene esa IP, o NULL si no es una dirección del router. Adentro de una época. */
+static struct sr_if *sr_local_addr_lookup(struct sr_instance *sr, uint32_t ip)
+{
+    struct sr_local_addr_set *set;
+    if (sr_local_addr_slot(sr, &set) >= 0 && !set) {
+        sr_local_addr_update(sr, 0);
+        sr_local_addr_slot(sr, &set);
+    }
+    if (!set) {
+        /* Sin interfaces todavía, o más instancias que lugares */
+        return sr_get_interface_given_ip(sr, ip);
+    }
+    uint32_t idx = (ip * set->mult) >> set->shift;
+    return (set->keys[idx] == ip && ip != 0) ? set->ifaces[idx] : NULL;
+}
+
+/* La plantilla de (interfaz, tipo, código) del conjunto de sr, o NULL. Adentro de una época. */
+static const struct sr_icmp_template *sr_icmp_get_template(struct sr_instance *sr, struct sr_if *iface,
+                                                           uint8_t type, uint8_t code)
+{
+    int kind = sr_icmp_template_kind(type, code);
+    if (kind < 0) {
+        return NULL;
+    }
+    struct sr_local_addr_set *set;
+    if (sr_local_addr_slot(sr, &set) >= 0 && !set) {
+        sr_local_addr_update(sr, 0);
+        sr_local_addr_slot(sr, &set);
+    }
+    if (!set) {
+        return NULL;
+    }
+    for (unsigned int i = 0; i < set->n_ifaces; i++) {
+        if (set->tpl_ifaces[i] == iface) {
+            return &set->templates[i][kind];
+        }
+    }
+    return NULL;
+}
+
+/*
+Respuesta rápida a los ping al router: se da vuelta la trama en el mismo buffer (MACs, IPs,
+TTL y tipo ICMP) y se ajustan los checksums de forma incremental. Intercambiar origen y
+destino no cambia la suma, así que el checksum IP solo se corrige por el TTL.
+El checksum ICMP se verifica (como pide el RFC 792, un echo con checksum malo se descarta)
+sumando el mensaje una vez con el campo incluido, sin copiarlo; ECHO_FAST_VERIFY_CKSUM en 0
+lo saltea para medir, pero entonces se contesta también a los echo corruptos.
+*/
+#define ECHO_FAST_VERIFY_CKSUM 1
+#define ECHO_REPLY_TTL 64
+
+static void sr_icmp_echo_fast_reply(struct sr_instance *sr, uint8_t *packet,
+                                    const struct sr_pkt_meta *meta, char *interface)
+{
+    sr_ethernet_hdr_t *eth_hdr = (sr_ethernet_hdr_t *)packet;
+    sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + meta->l3_off);
+    sr_icmp_hdr_t *icmp_hdr = (sr_icmp_hdr_t *)(packet + meta->l4_off);
+
+    /* Con el checksum adentro, un mensaje sano suma 0xFFFF (y el complemento da 0) */
+    if (ECHO_FAST_VERIFY_CKSUM && sr_cksum_finish(sr_cksum_add(icmp_hdr, meta->l4_len, 0)) != 0) {
+        printf("ERROR: Checksum ICMP incorrecto. Descartar.\n");
+        return;
+    }
+
+    memcpy(eth_hdr->ether_dhost, eth_hdr->ether_shost, ETHER_ADDR_LEN);
+    memcpy(eth_hdr->ether_shost, meta->in_iface->addr, ETHER_ADDR_LEN);
+
+    uint32_t tmp_ip = ip_hdr->ip_src;
+    ip_hdr->ip_src = ip_hdr->ip_dst;
+    ip_hdr->ip_dst = tmp_ip;
+
+    /* TTL y protocolo comparten palabra de 16 bits */
+    uint16_t old_word = htons((uint16_t)(ip_hdr->ip_ttl << 8 | ip_hdr->ip_p));
+    ip_hdr->ip_ttl = ECHO_REPLY_TTL;
+    uint16_t new_word = htons((uint16_t)(ip_hdr->ip_ttl << 8 | ip_hdr->ip_p));
+    ip_hdr->ip_sum = sr_cksum_replace16(ip_hdr->ip_sum, old_word, new_word);
+
+    /* Tipo y código también: 8/0 pasa a 0/0 */
+    old_word = htons((uint16_t)(icmp_hdr->icmp_type << 8 | icmp_hdr->icmp_code));
+    icmp_hdr->icmp_type = 0;
+    icmp_hdr->icmp_code = 0;
+    icmp_hdr->icmp_sum = sr_cksum_replace16(icmp_hdr->icmp_sum, old_word, 0);
+
+    if (sr_io_send(sr, packet, meta->l3_off + meta->ip_len, interface) < 0) {
+        printf("Cola de salida de %s llena, no sale el echo reply.\n", interface);
+    }
+}
+
+/* Procesa un paquete IP ya validado por sr_parse_frame */
+static void sr_ip_input(struct sr_instance *sr,
         uint8_t *packet /* lent */,
         unsigned int len,
-        uint8_t *srcAddr,
-        uint8_t *destAddr,
+        struct sr_pkt_meta *meta,
         char *interface /* lent */,
         sr_ethernet_hdr_t *eHdr) {
 
@@ -200,24 +1203,53 @@ void sr_handle_ip_packet(struct sr_instance *sr,
   * - No olvide imprimir los mensajes de depuración
   */
 
-      /*Cabezal:*/
-      unsigned int eth_hdr_len = sizeof(sr_ethernet_hdr_t);
+      /*Cabezal (los largos ya están verificados contra el buffer):*/
+      unsigned int eth_hdr_len = meta->l3_off;
       sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t *)(packet + eth_hdr_len);
 
-      unsigned int ip_hdr_len = ip_hdr->ip_hl * 4;
-      unsigned int ip_pkt_len = ntohs(ip_hdr->ip_len);
-      unsigned int total_pkt_len = eth_hdr_len + ip_pkt_len;
+      unsigned int ip_hdr_len = meta->ip_hdr_len;
+      unsigned int ip_pkt_len = meta->ip_len;
       
       /*Chequear checksum IP*/
       if (ip_cksum(ip_hdr, ip_hdr_len) != ip_hdr->ip_sum){
         printf("ERROR: Checksum IP incorrecto. Descartar.\n");
-        free(srcAddr);
-        free(destAddr);
         return;
       }
 
+      /* ACL de entrada de la interfaz por la que llegó */
+      if (!sr_acl_permit(interface, ACL_DIR_IN, &meta->key)) {
+        printf("Paquete descartado por la ACL de entrada de %s.\n", interface);
+        return;
+      }
+
+      /* Si es la respuesta de una conexión con NAT, se le devuelve la dirección de adentro
+      antes de decidir si es para mí. Los errores que se generen después citan el paquete
+      como llegó (quote), no con la dirección de adentro */
+      uint8_t nat_quote[ICMP_DATA_SIZE];
+      uint8_t *quote = (uint8_t *)ip_hdr;
+      int nat_done = 0;
+      if (sr_nat_is_public(ip_hdr->ip_dst)) {
+        unsigned int n = ip_pkt_len < ICMP_DATA_SIZE ? ip_pkt_len : ICMP_DATA_SIZE;
+        memcpy(nat_quote, ip_hdr, n);
+        memset(nat_quote + n, 0, ICMP_DATA_SIZE - n);
+        nat_done = sr_nat_ingress(ip_hdr, ip_pkt_len, &meta->key);
+      }
+      if (nat_done) {
+        meta->flow_hash = sr_flow_key_hash(&meta->key);
+        quote = nat_quote;
+      }
+
       /* Verificar si el paquete es para una de mis interfaces*/
-      struct sr_if *coincide = sr_get_interface_given_ip(sr, ip_hdr->ip_dst);
+      struct sr_if *coincide = sr_local_addr_lookup(sr, ip_hdr->ip_dst);
+
+      /* Ping a una dirección del router: se contesta en el lugar, sin pasar por el resto */
+      if (coincide && meta->proto == ip_protocol_icmp && meta->first_frag
+          && !(ntohs(ip_hdr->ip_off) & IP_MF)
+          && packet[meta->l4_off] == 8 && packet[meta->l4_off + 1] == 0) {
+        printf("ICMP Echo Request para %s. Respondiendo.\n", coincide->name);
+        sr_icmp_echo_fast_reply(sr, packet, meta, interface);
+        return;
+      }
       /* (RIP_IP debería estar definido en sr_rip.h como 224.0.0.9) 
       ESTO DE MULTICAST ES AGREGADO PARA LA PARTE 2*/
         
@@ -233,6 +1265,12 @@ void sr_handle_ip_packet(struct sr_instance *sr,
         if (coincide) {
           printf("Paquete IP LOCAL destinado al router: %s.\n", coincide->name);
         }
+
+        /* No se reensambla: sin el cabezal de transporte no hay nada que hacer */
+        if (!meta->first_frag) {
+          printf("Fragmento (no el primero) destinado al router. Descartar.\n");
+          return;
+        }
  
         /*verificar si es un paquete ICMP */
         if (ip_hdr->ip_p == ip_protocol_icmp){
@@ -245,73 +1283,32 @@ void sr_handle_ip_packet(struct sr_instance *sr,
           /*Checksum ICMP*/
           if (icmp_cksum(icmp_hdr, icmp_data_len) != icmp_hdr->icmp_sum){
             printf("ERROR: Checksum ICMP incorrecto. Descartar.\n");
-            free(srcAddr);
-            free(destAddr);
             return;
           }
 
-          /*verificar si es un echo request*/
-          if (icmp_hdr->icmp_type == 8 && icmp_hdr->icmp_code == 0) {
-            printf("Se recibió un ICMP Echo Request.\n");
-            
-            /*responder con un echo reply*/
-            
-            /*Armar el paquete*/
-            uint8_t *pkt_reply = (uint8_t *)malloc(total_pkt_len);
-            memcpy(pkt_reply, packet, total_pkt_len);
-            
-            sr_ethernet_hdr_t *eth_reply_hdr = (sr_ethernet_hdr_t *)pkt_reply;
-            sr_ip_hdr_t *ip_reply_hdr = (sr_ip_hdr_t *)(pkt_reply + eth_hdr_len);
-            sr_icmp_hdr_t *icmp_reply_hdr = (sr_icmp_hdr_t *)((uint8_t *)ip_reply_hdr + ip_hdr_len);
-            
-            /* Encabezado Ethernet (Invertir MACs)*/
-            memcpy(eth_reply_hdr->ether_dhost, eHdr->ether_shost, ETHER_ADDR_LEN);
-            struct sr_if *iface_out = sr_get_interface(sr, interface);
-            memcpy(eth_reply_hdr->ether_shost, iface_out->addr, ETHER_ADDR_LEN);
-
-            /* Encabezado IP (Invertir IPs, TTL y Checksum)*/
-            uint32_t temp_ip = ip_reply_hdr->ip_src;
-            ip_reply_hdr->ip_src = ip_reply_hdr->ip_dst;
-            ip_reply_hdr->ip_dst = temp_ip;
-
-
-            ip_reply_hdr->ip_ttl = 64; // TTL default, no sé si elegir este
-            ip_reply_hdr->ip_sum = 0; 
-            ip_reply_hdr->ip_sum = ip_cksum(ip_reply_hdr, ip_hdr_len);
-
-            /* Encabezado ICMP (Cambiar Tipo/Código y Checksum)*/
-            icmp_reply_hdr->icmp_type = 0; // Tipo 0 (Reply)
-            icmp_reply_hdr->icmp_code = 0;
-              
-            icmp_reply_hdr->icmp_sum = 0; 
-            icmp_reply_hdr->icmp_sum = icmp_cksum(icmp_reply_hdr, icmp_data_len);
-              
-            /* Enviar*/
-            print_hdrs(pkt_reply, total_pkt_len);
-            sr_send_packet(sr, pkt_reply, total_pkt_len, interface);
-            free(pkt_reply);
-  
-          } else {
-            /*Otros tipos de ICMP*/
-            printf("Paquete ICMP recibido, pero no un Echo Request. Descartar.\n");
-          }
+          /* Los Echo Request ya se contestaron en sr_icmp_echo_fast_reply */
+          printf("Paquete ICMP recibido, pero no un Echo Request. Descartar.\n");
         
           /*NO SÉ SI ESTO ES ASÍ, NO ESTÁ DEFINIDO CUANDO ES TCP(6) O UDP(17): 
           ESTO ESTÁ MODIFICADO PARA QUE USE LO DE PARTE 2 AHORA*/
         }  else if (ip_hdr->ip_p == ip_protocol_udp) { /* Protocolo UDP (17) */
             
             /* Obtiene cabecera UDP */
-            sr_udp_hdr_t *udp_hdr = (sr_udp_hdr_t *)((uint8_t *)ip_hdr + ip_hdr_len);
-            unsigned int udp_hdr_len = sizeof(sr_udp_hdr_t);
+            sr_udp_hdr_t *udp_hdr = (sr_udp_hdr_t *)(packet + meta->l4_off);
 
             /* (RIP_PORT debería estar definido en enrutamiento como 520) */
-            if (udp_hdr->dst_port == htons(RIP_PORT)) {
+            if (meta->first_frag && udp_hdr->dst_port == htons(RIP_PORT)) {
+              if (meta->l7_off == 0) {
+                /* Un fragmento de RIP no se puede procesar sin reensamblar */
+                printf("-> Fragmento UDP para RIP. Descartar.\n");
+                return;
+              }
               printf("-> Paquete UDP para el puerto RIP (520) recibido. Procesando...\n");
               
-              /* Calcular offsets para la función de RIP */
-              unsigned int ip_off = eth_hdr_len;
-              unsigned int rip_off = eth_hdr_len + ip_hdr_len + udp_hdr_len;
-              unsigned int rip_len = ntohs(udp_hdr->length) - udp_hdr_len;
+              /* Los offsets salen del descriptor (udp length ya verificado) */
+              unsigned int ip_off = meta->l3_off;
+              unsigned int rip_off = meta->l7_off;
+              unsigned int rip_len = meta->l7_len;
               
               /* (interface es el nombre de la interfaz de llegada) */
               sr_handle_rip_packet(sr, packet, len, ip_off, rip_off, rip_len, interface);
@@ -336,7 +1333,7 @@ void sr_handle_ip_packet(struct sr_instance *sr,
             printf("TTL expirado (%d). Enviar ICMP Time Exceeded.\n", ip_hdr->ip_ttl);
             /*HAY QUE HACER ESTA FUNCIÓN
             Tipo 11, Código 0*/
-            sr_send_icmp_error_packet(11, 0, sr, ip_hdr->ip_src, (uint8_t *)ip_hdr);
+            sr_send_icmp_error_packet(11, 0, sr, ip_hdr->ip_src, quote);
           } else{
             /*Buscar en la Tabla de Enrutamiento (LPF)
             Terminé haciendo una función auxiliar*/
@@ -346,7 +1343,7 @@ void sr_handle_ip_packet(struct sr_instance *sr,
             if (!next_hop_rt){
               printf("No se encontró ruta para el destino. Enviar ICMP Net Unreachable.\n");
               /* Tipo 3, Código 0*/
-              sr_send_icmp_error_packet(3, 0, sr, ip_hdr->ip_src, (uint8_t *)ip_hdr);
+              sr_send_icmp_error_packet(3, 0, sr, ip_hdr->ip_src, quote);
             } else {
               /*forwarding*/
               printf("Ruta encontrada. Preparando para reenviar por interfaz: %s.\n", next_hop_rt->interface);
@@ -361,23 +1358,72 @@ void sr_handle_ip_packet(struct sr_instance *sr,
 
               /*Lógica ARP*/
               uint32_t next_hop_ip = next_hop_rt->gw.s_addr;
+              char *out_ifname = next_hop_rt->interface;
+
+              /* Si la ruta tiene varios next hops de igual costo, el hash del flujo elige uno.
+              Cada next hop se resuelve por ARP por separado, abajo. */
+              uint32_t ecmp_gw;
+              char ecmp_ifname[sr_IFACE_NAMELEN];
+              if (sr_rip_ecmp_select(sr, next_hop_rt, meta->flow_hash, &ecmp_gw, ecmp_ifname)) {
+                next_hop_ip = ecmp_gw;
+                out_ifname = ecmp_ifname;
+              }
+
               if(next_hop_ip == 0){
                 next_hop_ip = ip_hdr->ip_dst;
               }
 
-              struct sr_if *iface_out = sr_get_interface(sr, next_hop_rt->interface);
+              struct sr_if *iface_out = sr_get_interface(sr, out_ifname);
+
+              /* ACL de salida */
+              if (!sr_acl_permit(iface_out->name, ACL_DIR_OUT, &meta->key)) {
+                printf("Paquete descartado por la ACL de salida de %s.\n", iface_out->name);
+                return;
+              }
+
+              /* Si no entra en el MTU de salida: con DF se avisa al origen (PMTUD),
+              sin DF se fragmenta. Antes del NAT, así el error va al host de adentro */
+              unsigned int mtu = sr_if_mtu(iface_out);
+              int needs_frag = ip_pkt_len > mtu;
+              if (needs_frag && (ntohs(ip_hdr->ip_off) & IP_DF)) {
+                printf("Paquete de %u bytes con DF y MTU %u. Enviar ICMP Fragmentation Needed.\n", ip_pkt_len, mtu);
+                /* Tipo 3, Código 4*/
+                sr_send_icmp_error(3, 4, sr, ip_hdr->ip_src, quote, mtu);
+                return;
+              }
+
+              /* NAT de origen si la interfaz de salida lo hace; si no, solo se registra el flujo */
+              int nat_res = nat_done ? 1 : sr_nat_egress(iface_out, ip_hdr, ip_pkt_len, &meta->key);
+              if (nat_res < 0) {
+                printf("NAT sin puertos libres en %s. Descartar.\n", iface_out->name);
+                return;
+              }
+              if (nat_res == 0) {
+                sr_ct_track(&meta->key, ip_hdr, ip_hdr_len, ip_pkt_len);
+              }
+
+              sr_flow_sample(sr, &meta->key, meta->flow_hash, iface_out, ip_pkt_len);
+              SR_TAP(SR_TAP_LOOKUP, packet, len, iface_out->name);
 
               /*Buscar la MAC en la caché ARP (se necesita para construir la trama)*/
               struct sr_arpentry *arp_entry = sr_arpcache_lookup(&(sr->cache), next_hop_ip);
 
-              if (arp_entry) {
+              if (needs_frag) {
+                sr_fragment_and_send(sr, packet, iface_out, next_hop_ip,
+                                     arp_entry ? arp_entry->mac : NULL, mtu);
+                if (arp_entry) {
+                  free(arp_entry);
+                }
+              } else if (arp_entry) {
                 memcpy(eHdr->ether_dhost, arp_entry->mac, ETHER_ADDR_LEN);
                 /* Se encontró MAC, hay que modificar ethernet y enviar*/
                 memcpy(eHdr->ether_shost, iface_out->addr, ETHER_ADDR_LEN);
                 free(arp_entry);        
                 printf("MAC encontrada en caché ARP. Reenviar paquete.\n");
-                print_hdrs(packet, len); // Imprimir headers modificados
-                sr_send_packet(sr, packet, len, iface_out->name);            
+                if (sr_io_send(sr, packet, len, iface_out->name) < 0) {
+                  /* El que recibe frena al final del lote (sr_txq_wait_room) */
+                  printf("Cola de salida de %s llena, paquete descartado.\n", iface_out->name);
+                }
               } else {
                 /* No se encontró MAC, encolar y enviar ARP Request.*/
                 printf("MAC no encontrada. Encolar paquete y enviar ARP Request.\n");
@@ -392,9 +1438,24 @@ void sr_handle_ip_packet(struct sr_instance *sr,
 
           }
       }
-      
-      free(srcAddr);
-      free(destAddr);
+}
+
+void sr_handle_ip_packet(struct sr_instance *sr,
+        uint8_t *packet /* lent */,
+        unsigned int len,
+        uint8_t *srcAddr,
+        uint8_t *destAddr,
+        char *interface /* lent */,
+        sr_ethernet_hdr_t *eHdr) {
+  struct sr_pkt_meta meta;
+  meta.in_iface = sr_get_interface(sr, interface);
+  if (meta.in_iface && sr_parse_frame(packet, len, &meta) == 0 && meta.ethertype == ethertype_ip) {
+    sr_ip_input(sr, packet, len, &meta, interface, eHdr);
+  } else {
+    printf("Paquete IP inválido. Descartar.\n");
+  }
+  free(srcAddr);
+  free(destAddr);
 }
 
 void sr_arp_reply_send_pending_packets(struct sr_instance *sr,
@@ -413,9 +1474,8 @@ void sr_handle_arp_packet(struct sr_instance *sr,
         char *interface /* lent */,
         sr_ethernet_hdr_t *eHdr) {
 
-  /* Imprimo el cabezal ARP */
-  printf("*** -> It is an ARP packet. Print ARP header.\n");
-  print_hdr_arp(packet + sizeof(sr_ethernet_hdr_t));
+  /* Los cabezales ya no se imprimen acá: para verlos, capturar con SR_TAP_CONF_PATH */
+  printf("*** -> It is an ARP packet.\n");
 
   /* COLOQUE SU CÓDIGO AQUÍ
   
@@ -428,13 +1488,19 @@ void sr_handle_arp_packet(struct sr_instance *sr,
     /*Extraer y convertir el código de operación (si es request o reply)*/
     unsigned short op_code = ntohs(arp_hdr->ar_op);
 
+    /* Si el que manda ya está en la caché se actualiza enseguida (incluye los ARP gratuitos,
+    que tienen ar_sip == ar_tip y si no, se descartarían más abajo) */
+    if (sr_arpcache_update(&(sr->cache), arp_hdr->ar_sha, arp_hdr->ar_sip)) {
+        printf("Entrada ARP de %s actualizada.\n", inet_ntoa((struct in_addr){.s_addr = arp_hdr->ar_sip}));
+    }
+
     if (op_code == arp_op_request) {
         printf("Es un ARP Request.\n");
         /*- Si es una ARP request, antes de responder verifique si el mensaje consulta 
         por la dirección MAC asociada a una dirección IP configurada en una interfaz 
         del propio router*/
         
-        struct sr_if *es_igual = sr_get_interface_given_ip(sr, arp_hdr->ar_tip);
+        struct sr_if *es_igual = sr_local_addr_lookup(sr, arp_hdr->ar_tip);
 
         if(es_igual){
           /*La IP pertenece a este router
@@ -471,8 +1537,9 @@ void sr_handle_arp_packet(struct sr_instance *sr,
           arp_reply_hdr->ar_tip = arp_hdr->ar_sip;
 
           /*Se envía el paquete*/
-          print_hdrs(pkt_reply, tam_reply); //debbuging
-          sr_send_packet(sr, pkt_reply, tam_reply, interface);
+          if (sr_io_send_ctl(sr, pkt_reply, tam_reply, interface) < 0) {
+            printf("Cola de salida de %s llena, no sale el ARP reply.\n", interface);
+          }
 
           free(pkt_reply);
 
@@ -519,11 +1586,11 @@ void sr_handle_arp_packet(struct sr_instance *sr,
           sr_arp_reply_send_pending_packets(sr, pendientes, dhost, shost, if_salida);
           
           sr_arpreq_destroy(&(sr->cache), pendientes);
+        }
     } 
     else {
         printf("Código de operación ARP desconocido (OpCode: %hu). Paquete descartado.\n", op_code);
     }
-  }
 }
 
 /*
@@ -531,7 +1598,8 @@ Función auxiliar para realizar una búsqueda en la tabla de enrutamiento
 siguiendo la lógica LPM (Longest prefix match), devuelve un puntero
 a la entrada sr_rt con la coincidencia más larga, o NULL si no se encuentra
 */
-struct sr_rt *sr_lpm_lookup(struct sr_instance *sr, uint32_t dest_ip)
+/* Recorre toda la tabla; es la referencia contra la que se compara la FIB comprimida */
+struct sr_rt *sr_lpm_lookup_linear(struct sr_instance *sr, uint32_t dest_ip)
 {
     struct sr_rt *rt_walker = sr->routing_table;
     struct sr_rt *best_match = NULL;
@@ -555,6 +1623,20 @@ struct sr_rt *sr_lpm_lookup(struct sr_instance *sr, uint32_t dest_ip)
         rt_walker = rt_walker->next;
     }
 
+    return best_match;
+}
+
+struct sr_rt *sr_rip_fib_lookup(struct sr_instance *sr, uint32_t dest_ip, int *found); /* En sr_rip.c */
+
+struct sr_rt *sr_lpm_lookup(struct sr_instance *sr, uint32_t dest_ip)
+{
+    /* Primero la FIB comprimida que arma RIP; si todavía no hay, la lista */
+    int found = 0;
+    struct sr_rt *best_match = sr_rip_fib_lookup(sr, dest_ip, &found);
+    if (!found) {
+        best_match = sr_lpm_lookup_linear(sr, dest_ip);
+    }
+
     if (best_match) {
         printf("LPM: Ruta encontrada. Destino: 0x%x, Máscara: 0x%x, Interfaz: %s\n", 
                 ntohl(best_match->dest.s_addr), ntohl(best_match->mask.s_addr), best_match->interface);
@@ -578,22 +1660,85 @@ void sr_arp_reply_send_pending_packets(struct sr_instance *sr,
 
   struct sr_packet *currPacket = arpReq->packets;
   sr_ethernet_hdr_t *ethHdr;
-  uint8_t *copyPacket;
 
   while (currPacket != NULL) {
      ethHdr = (sr_ethernet_hdr_t *) currPacket->buf;
      memcpy(ethHdr->ether_shost, shost, sizeof(uint8_t) * ETHER_ADDR_LEN);
      memcpy(ethHdr->ether_dhost, dhost, sizeof(uint8_t) * ETHER_ADDR_LEN);
 
-     copyPacket = malloc(sizeof(uint8_t) * currPacket->len);
-     memcpy(copyPacket, ethHdr, sizeof(uint8_t) * currPacket->len);
-
-     print_hdrs(copyPacket, currPacket->len);
-     sr_send_packet(sr, copyPacket, currPacket->len, iface->name);
+     /* Se manda el buffer de la cola tal cual: el envío toma su referencia, no hace falta copiarlo */
+     if (sr_io_send_buf(sr, sr_arpcache_packet_buf(currPacket), iface->name) < 0) {
+       printf("Cola de salida de %s llena, se descarta un paquete que esperaba ARP.\n", iface->name);
+     }
      currPacket = currPacket->next;
   }
 }
 
+/* Manda un paquete ya validado a su handler */
+static void sr_dispatch(struct sr_instance *sr,
+        uint8_t *packet /* lent */,
+        unsigned int len,
+        struct sr_pkt_meta *meta,
+        char *interface /* lent */)
+{
+  sr_ethernet_hdr_t *eHdr = (sr_ethernet_hdr_t *) packet;
+
+  SR_TAP(SR_TAP_INGRESS, packet, len, interface);
+
+  if (meta->ethertype == ethertype_arp) {
+    printf("ARP:\n");
+    /* El handler de ARP no usa las copias de las MAC, las saca de eHdr */
+    sr_handle_arp_packet(sr, packet, len, NULL, NULL, interface, eHdr);
+  } else if (meta->ethertype == ethertype_ip) {
+    printf("IP:\n");
+    sr_ip_input(sr, packet, len, meta, interface, eHdr);
+  }
+}
+
+/* Validación completa: la de sr_utils y la de largos de sr_parse_frame */
+static int sr_parse_frame_checked(uint8_t *packet, unsigned int len, struct sr_pkt_meta *meta)
+{
+  return (is_packet_valid(packet, len) && sr_parse_frame(packet, len, meta) == 0) ? 0 : -1;
+}
+
+/*
+Procesa varios paquetes que llegaron por la misma interfaz: primero se validan y parsean
+todos (un loop cerrado sobre un arreglo de descriptores) y después se despachan en orden.
+La interfaz se resuelve una sola vez para todo el lote.
+*/
+void sr_handlepacket_batch(struct sr_instance* sr,
+        uint8_t **packets /* lent */,
+        unsigned int *lens,
+        unsigned int n,
+        char* interface /* lent */)
+{
+  struct sr_pkt_meta metas[SR_BATCH_MAX];
+  int valid[SR_BATCH_MAX];
+  struct sr_if *in_iface = sr_get_interface(sr, interface);
+
+  if (!in_iface) {
+    return;
+  }
+  for (unsigned int base = 0; base < n; base += SR_BATCH_MAX) {
+    unsigned int count = (n - base < SR_BATCH_MAX) ? n - base : SR_BATCH_MAX;
+
+    for (unsigned int i = 0; i < count; i++) {
+      metas[i].in_iface = in_iface;
+      valid[i] = sr_parse_frame_checked(packets[base + i], lens[base + i], &metas[i]) == 0;
+    }
+    /* Una sola entrada de época por lote: lo de adentro entra anidado, sin costo */
+    sr_epoch_enter();
+    for (unsigned int i = 0; i < count; i++) {
+      if (valid[i]) {
+        sr_dispatch(sr, packets[base + i], lens[base + i], &metas[i], interface);
+      } else {
+        printf("Paquete inválido.\n");
+      }
+    }
+    sr_epoch_exit();
+  }
+}
+
 /*---------------------------------------------------------------------
  * Method: sr_handlepacket(uint8_t* p,char* interface)
  * Scope:  Global
@@ -621,25 +1766,15 @@ void sr_handlepacket(struct sr_instance* sr,
 
   printf("*** -> Received packet of length %d \n",len);
 
-  /* Obtengo direcciones MAC origen y destino */
-  sr_ethernet_hdr_t *eHdr = (sr_ethernet_hdr_t *) packet;
-  uint8_t *destAddr = malloc(sizeof(uint8_t) * ETHER_ADDR_LEN);
-  uint8_t *srcAddr = malloc(sizeof(uint8_t) * ETHER_ADDR_LEN);
-  memcpy(destAddr, eHdr->ether_dhost, sizeof(uint8_t) * ETHER_ADDR_LEN);
-  memcpy(srcAddr, eHdr->ether_shost, sizeof(uint8_t) * ETHER_ADDR_LEN);
-  uint16_t pktType = ntohs(eHdr->ether_type);
-
-  if (is_packet_valid(packet, len)) {
-    if (pktType == ethertype_arp) {
-      printf("ARP:\n");
-      sr_handle_arp_packet(sr, packet, len, srcAddr, destAddr, interface, eHdr);
-    } else if (pktType == ethertype_ip) {
-      printf("IP:\n");
-      sr_handle_ip_packet(sr, packet, len, srcAddr, destAddr, interface, eHdr);
-    }
-  } else {
+  struct sr_pkt_meta meta;
+  meta.in_iface = sr_get_interface(sr, interface);
+  if (!meta.in_iface || sr_parse_frame_checked(packet, len, &meta) < 0) {
     printf("Paquete inválido.\n");
+    return;
   }
+  /* Lo que se lee sin lock (conntrack, ACLs, FIB) vale hasta salir de la época */
+  sr_epoch_enter();
+  sr_dispatch(sr, packet, len, &meta, interface);
+  sr_epoch_exit();
 
-
-}/* end sr_ForwardPacket */
\ No newline at end of file
+}/* end sr_ForwardPacket */
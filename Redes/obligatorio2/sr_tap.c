@@ -0,0 +1,436 @@
+/**********************************************************************
+ * file:  sr_tap.c
+ *
+ * Descripción:
+ *
+ * Captura de paquetes en los puntos del camino de reenvío, a pcap.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/filter.h>
+
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_epoch.h"
+#include "sr_tap.h"
+
+/*
+Captura de paquetes dentro del router, para no depender de print_hdrs en cada paquete.
+Se prende y se apaga mientras el router corre escribiendo o borrando SR_TAP_CONF_PATH:
+
+    <puntos> <interfaz|any> <archivo.pcap>
+    <filtro BPF clásico, opcional: la salida de "tcpdump -ddd ...">
+
+donde los puntos son ingress, lookup (después de elegir la ruta), egress y arpq (al quedar
+esperando ARP), separados por coma, o all. El filtro corre sobre la trama Ethernet y su
+resultado es cuántos bytes guardar (0 = no se captura), como en el kernel; sin filtro se
+guarda todo hasta SR_TAP_SNAPLEN.
+
+Lo que pasa el filtro se copia a un anillo sin locks (varios productores, un consumidor) y
+un hilo aparte lo escribe en formato pcap. Si el anillo está lleno la copia se pierde y se
+cuenta. Apagado, cada punto cuesta leer sr_tap_points y un salto que casi nunca se toma.
+
+La configuración se cambia con un solo intercambio del puntero. Capturan también los hilos de
+RIP, de ARP y el de las colas de salida, así que sr_tap_capture usa la configuración adentro de
+una época (sr_epoch_enter) y el escritor, antes de liberar la vieja y cerrar su archivo, espera
+a que salgan todos los que podían tenerla (sr_epoch_barrier). Cada lugar del anillo lleva la
+generación de la configuración con que se capturó, así lo de antes del cambio va al archivo
+viejo y lo de después al nuevo aunque queden mezclados en el anillo.
+*/
+#define SR_TAP_CONF_PATH "tap.conf"
+#define SR_TAP_SNAPLEN 256
+#define SR_TAP_RING_SIZE 1024         /* Potencia de 2 */
+#define SR_TAP_MAX_INSNS 256
+#define SR_TAP_IDLE_US 10000          /* Cuánto duerme el escritor si el anillo está vacío */
+#define SR_TAP_POLL_SEC 1             /* Cada cuánto se mira si cambió SR_TAP_CONF_PATH */
+
+struct sr_tap_conf {
+    unsigned int gen;                 /* Distinta en cada configuración que se publica */
+    unsigned int points;
+    char ifname[sr_IFACE_NAMELEN];    /* Vacío = cualquiera */
+    char path[256];
+    unsigned int n_insns;             /* 0 = sin filtro */
+    struct sock_filter insns[SR_TAP_MAX_INSNS];
+};
+
+struct sr_tap_slot {
+    unsigned int seq;
+    unsigned int gen;                 /* La de la configuración que la capturó */
+    unsigned int caplen;
+    unsigned int len;
+    struct timespec ts;
+    uint8_t data[SR_TAP_SNAPLEN];
+};
+
+unsigned int sr_tap_points = 0;       /* Puntos prendidos; los SR_TAP de los otros módulos lo leen */
+static struct sr_tap_conf *tap_conf = NULL;
+static unsigned int tap_gen = 0;      /* Última generación publicada (solo el escritor) */
+static struct sr_tap_slot tap_ring[SR_TAP_RING_SIZE];
+static unsigned int tap_head = 0;     /* Próximo lugar a tomar por un productor */
+static unsigned int tap_tail = 0;     /* Próximo lugar a leer por el escritor */
+static unsigned long tap_stat_captured = 0;
+static unsigned long tap_stat_dropped = 0;
+
+static uint32_t sr_tap_load(const uint8_t *pkt, unsigned int len, uint32_t off, unsigned int size, int *ok)
+{
+    if (off > len || size > len - off) {
+        *ok = 0;
+        return 0;
+    }
+    uint32_t v = 0;
+    for (unsigned int i = 0; i < size; i++) {
+        v = (v << 8) | pkt[off + i];
+    }
+    return v;
+}
+
+/* Corre el filtro (ya validado en sr_tap_check) sobre la trama; devuelve cuántos bytes guardar */
+static uint32_t sr_tap_filter(const struct sock_filter *insns, unsigned int n, const uint8_t *pkt, unsigned int len)
+{
+    uint32_t a = 0, x = 0, mem[BPF_MEMWORDS];
+    int ok = 1;
+
+    memset(mem, 0, sizeof(mem));
+    for (unsigned int pc = 0; pc < n; pc++) {
+        const struct sock_filter *f = &insns[pc];
+        uint32_t k = f->k;
+        uint32_t src = (BPF_SRC(f->code) == BPF_X) ? x : k;
+        unsigned int size = BPF_SIZE(f->code) == BPF_W ? 4 : BPF_SIZE(f->code) == BPF_H ? 2 : 1;
+
+        switch (BPF_CLASS(f->code)) {
+        case BPF_LD:
+            switch (BPF_MODE(f->code)) {
+            case BPF_ABS: a = sr_tap_load(pkt, len, k, size, &ok); break;
+            case BPF_IND: a = sr_tap_load(pkt, len, x + k, size, &ok); break;
+            case BPF_LEN: a = len; break;
+            case BPF_IMM: a = k; break;
+            case BPF_MEM: a = mem[k]; break;
+            default: return 0;
+            }
+            break;
+        case BPF_LDX:
+            switch (BPF_MODE(f->code)) {
+            case BPF_IMM: x = k; break;
+            case BPF_MEM: x = mem[k]; break;
+            case BPF_LEN: x = len; break;
+            case BPF_MSH: x = (sr_tap_load(pkt, len, k, 1, &ok) & 0xf) << 2; break;
+            default: return 0;
+            }
+            break;
+        case BPF_ST: mem[k] = a; break;
+        case BPF_STX: mem[k] = x; break;
+        case BPF_ALU:
+            switch (BPF_OP(f->code)) {
+            case BPF_ADD: a += src; break;
+            case BPF_SUB: a -= src; break;
+            case BPF_MUL: a *= src; break;
+            case BPF_DIV: if (src == 0) return 0; a /= src; break;
+            case BPF_MOD: if (src == 0) return 0; a %= src; break;
+            case BPF_AND: a &= src; break;
+            case BPF_OR: a |= src; break;
+            case BPF_XOR: a ^= src; break;
+            case BPF_LSH: a = src < 32 ? a << src : 0; break;
+            case BPF_RSH: a = src < 32 ? a >> src : 0; break;
+            case BPF_NEG: a = -a; break;
+            default: return 0;
+            }
+            break;
+        case BPF_JMP:
+            switch (BPF_OP(f->code)) {
+            case BPF_JA: pc += k; break;
+            case BPF_JEQ: pc += (a == src) ? f->jt : f->jf; break;
+            case BPF_JGT: pc += (a > src) ? f->jt : f->jf; break;
+            case BPF_JGE: pc += (a >= src) ? f->jt : f->jf; break;
+            case BPF_JSET: pc += (a & src) ? f->jt : f->jf; break;
+            default: return 0;
+            }
+            break;
+        case BPF_RET:
+            return BPF_RVAL(f->code) == BPF_A ? a : k;
+        case BPF_MISC:
+            if (BPF_MISCOP(f->code) == BPF_TAX) {
+                x = a;
+            } else {
+                a = x;
+            }
+            break;
+        }
+        if (!ok) {
+            return 0; /* Se leyó fuera de la trama */
+        }
+    }
+    return 0;
+}
+
+/* Que los saltos y la memoria queden adentro y que termine en RET; 0 si el filtro sirve */
+static int sr_tap_check(const struct sock_filter *insns, unsigned int n)
+{
+    if (n == 0 || BPF_CLASS(insns[n - 1].code) != BPF_RET) {
+        return -1;
+    }
+    for (unsigned int pc = 0; pc < n; pc++) {
+        const struct sock_filter *f = &insns[pc];
+        unsigned int cls = BPF_CLASS(f->code);
+        if (cls == BPF_JMP) {
+            if (BPF_OP(f->code) == BPF_JA ? f->k >= n - pc - 1
+                                          : (f->jt >= n - pc - 1 || f->jf >= n - pc - 1)) {
+                return -1;
+            }
+        }
+        if (((cls == BPF_LD || cls == BPF_LDX) && BPF_MODE(f->code) == BPF_MEM) || cls == BPF_ST || cls == BPF_STX) {
+            if (f->k >= BPF_MEMWORDS) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Copia la trama al anillo si el punto, la interfaz y el filtro la dejan pasar */
+void sr_tap_capture(unsigned int point, const uint8_t *buf, unsigned int len, const char *iface)
+{
+    /* Hasta que el lugar quede comprometido: el escritor espera a esto para cerrar el archivo */
+    sr_epoch_enter();
+    struct sr_tap_conf *conf = __atomic_load_n(&tap_conf, __ATOMIC_ACQUIRE);
+    if (!conf || !(conf->points & point)
+        || (conf->ifname[0] && strncmp(conf->ifname, iface, sr_IFACE_NAMELEN) != 0)) {
+        sr_epoch_exit();
+        return;
+    }
+    uint32_t caplen = conf->n_insns ? sr_tap_filter(conf->insns, conf->n_insns, buf, len) : len;
+    if (caplen == 0) {
+        sr_epoch_exit();
+        return;
+    }
+    if (caplen > len) {
+        caplen = len;
+    }
+    if (caplen > SR_TAP_SNAPLEN) {
+        caplen = SR_TAP_SNAPLEN;
+    }
+
+    /* Se toma un lugar: es nuestro cuando su seq coincide con la posición y ganamos el CAS */
+    unsigned int pos = __atomic_load_n(&tap_head, __ATOMIC_RELAXED);
+    struct sr_tap_slot *slot;
+    while (1) {
+        slot = &tap_ring[pos & (SR_TAP_RING_SIZE - 1)];
+        int dif = (int)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&tap_head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            __atomic_add_fetch(&tap_stat_dropped, 1, __ATOMIC_RELAXED);
+            sr_epoch_exit();
+            return; /* Lleno: el escritor no llegó a este lugar */
+        } else {
+            pos = __atomic_load_n(&tap_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &slot->ts);
+    slot->gen = conf->gen;
+    slot->len = len;
+    slot->caplen = caplen;
+    memcpy(slot->data, buf, caplen);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&tap_stat_captured, 1, __ATOMIC_RELAXED);
+    sr_epoch_exit();
+}
+
+/* Lee SR_TAP_CONF_PATH; NULL si no está o no se entiende */
+static struct sr_tap_conf *sr_tap_conf_read(void)
+{
+    FILE *f = fopen(SR_TAP_CONF_PATH, "r");
+    if (!f) {
+        return NULL;
+    }
+    struct sr_tap_conf *conf = (struct sr_tap_conf *)calloc(1, sizeof(*conf));
+    char line[512], points[64], ifname[64];
+    int have_header = 0;
+    unsigned int expected = 0;
+
+    while (conf && fgets(line, sizeof(line), f)) {
+        unsigned int code, jt, jf, k;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if (!have_header) {
+            if (sscanf(line, "%63s %63s %255s", points, ifname, conf->path) != 3) {
+                break;
+            }
+            have_header = 1;
+            char *save = NULL;
+            for (char *tok = strtok_r(points, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+                conf->points |= strcmp(tok, "ingress") == 0 ? SR_TAP_INGRESS
+                              : strcmp(tok, "lookup") == 0 ? SR_TAP_LOOKUP
+                              : strcmp(tok, "egress") == 0 ? SR_TAP_EGRESS
+                              : strcmp(tok, "arpq") == 0 ? SR_TAP_ARPQ
+                              : strcmp(tok, "all") == 0 ? 0xf : 0;
+            }
+            if (strcmp(ifname, "any") != 0) {
+                strncpy(conf->ifname, ifname, sr_IFACE_NAMELEN - 1);
+            }
+        } else if (expected == 0 && sscanf(line, "%u", &expected) == 1) {
+            /* Cantidad de instrucciones, la primera línea de tcpdump -ddd */
+        } else if (sscanf(line, "%u %u %u %u", &code, &jt, &jf, &k) == 4 && conf->n_insns < SR_TAP_MAX_INSNS) {
+            conf->insns[conf->n_insns].code = code;
+            conf->insns[conf->n_insns].jt = jt;
+            conf->insns[conf->n_insns].jf = jf;
+            conf->insns[conf->n_insns].k = k;
+            conf->n_insns++;
+        }
+    }
+    fclose(f);
+
+    if (conf && (!have_header || conf->points == 0 || conf->n_insns != expected
+                 || (conf->n_insns && sr_tap_check(conf->insns, conf->n_insns) < 0))) {
+        printf("Captura: %s no es válido, se ignora.\n", SR_TAP_CONF_PATH);
+        free(conf);
+        conf = NULL;
+    }
+    return conf;
+}
+
+/*
+Cambia la configuración activa (NULL apaga) con un solo intercambio y espera a que ningún
+productor siga con la anterior, que se libera acá. Al volver, todo lo capturado con la anterior
+está comprometido en el anillo antes de tap_head. Solo la llama el escritor.
+*/
+static void sr_tap_publish(struct sr_tap_conf *conf)
+{
+    __atomic_store_n(&sr_tap_points, conf ? conf->points : 0, __ATOMIC_RELEASE);
+    struct sr_tap_conf *old = __atomic_exchange_n(&tap_conf, conf, __ATOMIC_ACQ_REL);
+    sr_epoch_barrier();
+    free(old);
+}
+
+/*
+Pasa lo que haya en el anillo a su archivo: out si se capturó con la generación gen, prev si
+con prev_gen (el archivo anterior, mientras se cambia), y si no se descarta. Devuelve cuántas
+tramas sacó.
+*/
+static unsigned int sr_tap_drain(FILE *out, unsigned int gen, FILE *prev, unsigned int prev_gen)
+{
+    unsigned int n = 0;
+    while (1) {
+        struct sr_tap_slot *slot = &tap_ring[tap_tail & (SR_TAP_RING_SIZE - 1)];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tap_tail + 1) {
+            break;
+        }
+        FILE *f = slot->gen == gen ? out : slot->gen == prev_gen ? prev : NULL;
+        if (f) {
+            uint32_t rec[4] = {(uint32_t)slot->ts.tv_sec, (uint32_t)(slot->ts.tv_nsec / 1000), slot->caplen, slot->len};
+            fwrite(rec, sizeof(rec), 1, f);
+            fwrite(slot->data, 1, slot->caplen, f);
+        }
+        __atomic_store_n(&slot->seq, tap_tail + SR_TAP_RING_SIZE, __ATOMIC_RELEASE);
+        tap_tail++;
+        n++;
+    }
+    return n;
+}
+
+/* Para sr_arpcache.c, que no ve SR_TAP: el que llama ya miró sr_tap_points */
+void sr_tap_print_stats(void)
+{
+    printf("Captura: %lu tramas capturadas, %lu perdidas por anillo lleno\n",
+           tap_stat_captured, tap_stat_dropped);
+}
+
+/*
+Publica conf (NULL apaga) y pasa a new_out. Lo que quedó en el anillo de la configuración
+anterior termina en su archivo antes de cerrarlo: después de sr_tap_publish ya no la usa nadie,
+así que alcanza con vaciar hasta el tap_head de ese momento (esperando a los que tomaron un
+lugar y todavía no lo llenaron, que son de la nueva).
+*/
+static void sr_tap_switch(struct sr_tap_conf *conf, FILE **out, unsigned int *out_gen, FILE *new_out)
+{
+    unsigned int new_gen = 0;
+    if (conf) {
+        new_gen = conf->gen = ++tap_gen;
+    }
+    sr_tap_publish(conf);
+    unsigned int end = __atomic_load_n(&tap_head, __ATOMIC_ACQUIRE);
+    while ((int)(end - tap_tail) > 0) {
+        if (sr_tap_drain(new_out, new_gen, *out, *out_gen) == 0) {
+            sched_yield();
+        }
+    }
+    if (*out) {
+        fclose(*out);
+    }
+    *out = new_out;
+    *out_gen = new_gen;
+}
+
+static void *sr_tap_writer(void *arg)
+{
+    FILE *out = NULL;
+    unsigned int out_gen = 0;
+    struct timespec conf_mtime = {0, 0};
+    time_t next_poll = 0;
+    (void)arg;
+
+    while (1) {
+        time_t now = time(NULL);
+        if (now >= next_poll) {
+            next_poll = now + SR_TAP_POLL_SEC;
+            struct stat st;
+            int exists = (stat(SR_TAP_CONF_PATH, &st) == 0);
+            if (exists && (st.st_mtim.tv_sec != conf_mtime.tv_sec || st.st_mtim.tv_nsec != conf_mtime.tv_nsec)) {
+                conf_mtime = st.st_mtim;
+                struct sr_tap_conf *conf = sr_tap_conf_read();
+                FILE *new_out = conf ? fopen(conf->path, "wb") : NULL;
+                if (conf && !new_out) {
+                    perror("fopen (captura)");
+                    free(conf);
+                    conf = NULL;
+                }
+                if (new_out) {
+                    /* Cabezal pcap: versión 2.4, Ethernet */
+                    uint32_t hdr[6] = {0xa1b2c3d4, 2 | (4u << 16), 0, 0, SR_TAP_SNAPLEN, 1};
+                    fwrite(hdr, sizeof(hdr), 1, new_out);
+                    printf("Captura prendida en %s (%s), filtro de %u instrucciones.\n",
+                           conf->path, conf->ifname[0] ? conf->ifname : "todas", conf->n_insns);
+                }
+                if (conf || out) {
+                    sr_tap_switch(conf, &out, &out_gen, new_out);
+                }
+            } else if (!exists && out) {
+                conf_mtime.tv_sec = 0;
+                conf_mtime.tv_nsec = 0;
+                sr_tap_switch(NULL, &out, &out_gen, NULL);
+                printf("Captura apagada.\n");
+                sr_tap_print_stats();
+            }
+        }
+
+        if (sr_tap_drain(out, out_gen, NULL, 0) == 0) {
+            if (out) {
+                fflush(out);
+            }
+            usleep(SR_TAP_IDLE_US);
+        }
+    }
+    return NULL;
+}
+
+void sr_tap_start(struct sr_instance *sr)
+{
+    pthread_t thread;
+    for (unsigned int i = 0; i < SR_TAP_RING_SIZE; i++) {
+        tap_ring[i].seq = i;
+    }
+    if (pthread_create(&thread, &(sr->attr), sr_tap_writer, NULL) != 0) {
+        perror("pthread_create (captura)");
+    }
+}
+
@@ -0,0 +1,31 @@
+/*
+Captura de paquetes dentro del router (ver sr_tap.c). Cada punto de captura es un SR_TAP:
+apagado cuesta leer sr_tap_points y un salto que casi nunca se toma.
+*/
+#ifndef SR_TAP_H
+#define SR_TAP_H
+
+#include <stdint.h>
+
+#define SR_TAP_INGRESS 0x1
+#define SR_TAP_LOOKUP 0x2
+#define SR_TAP_EGRESS 0x4
+#define SR_TAP_ARPQ 0x8
+
+extern unsigned int sr_tap_points;    /* Puntos prendidos */
+
+void sr_tap_capture(unsigned int point, const uint8_t *buf, unsigned int len, const char *iface);
+
+#define SR_TAP(point, buf, len, iface) \
+    do { \
+        if (__builtin_expect((__atomic_load_n(&sr_tap_points, __ATOMIC_RELAXED) & (point)) != 0, 0)) { \
+            sr_tap_capture((point), (buf), (len), (iface)); \
+        } \
+    } while (0)
+
+struct sr_instance;
+
+void sr_tap_start(struct sr_instance *sr);
+void sr_tap_print_stats(void);
+
+#endif /* SR_TAP_H */
@@ -0,0 +1,529 @@
+/**********************************************************************
+ * file:  sr_txq.c
+ *
+ * Descripción:
+ *
+ * Colas de salida por interfaz, con clases y DRR, y el hilo que las vacía.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_tap.h"
+#include "sr_io.h"
+#include "sr_txq.h"
+
+/*
+Colas de salida por interfaz. sr_io_send no manda: deja la trama en la cola de la interfaz y
+vuelve, así un enlace lento no frena al hilo que recibe. Un hilo aparte las vacía de a
+SR_TXQ_FLUSH_BATCH por interfaz, por turnos, y como para él sr_io_batching está prendido, en
+el backend crudo todo lo que saca sale con un sendmmsg por puerto y en el de anillo con un
+solo kick.
+
+Cada cola tiene su lock (los que mandan por interfaces distintas no se pisan) y un pool de
+buffers reservado al crearla, con lugar para todas las tramas que pueden estar en la cola o
+saliendo: encolar es copiar a un buffer libre, sin malloc. Lo que no entra en un buffer (tramas
+jumbo) o ya viene en un sr_pktbuf (sr_io_send_buf) va por referencia, sin copiar.
+
+Cuando una cola está llena se descarta la trama nueva (SR_TXQ_TAIL_DROP, y sr_io_send
+devuelve -1 para que el que llama se entere) o la más vieja de la cola (SR_TXQ_HEAD_DROP).
+El hilo que recibe, si le rechazaron algo en el lote, espera a que el que vacía dé una vuelta
+(sr_txq_wait_room) antes de leer más: el resto lo descarta el kernel sin gastar CPU acá.
+Mientras no arranque el hilo (por ejemplo si no se llamó a sr_init) se manda directo.
+
+Cada interfaz tiene una cola por clase. Lo que genera el plano de control (ARP y RIP del
+router) lo manda con sr_io_send_ctl y va en la de control, que sale siempre primero (prioridad
+estricta) para que el tráfico reenviado no haga vencer rutas ni agotar reintentos de ARP. Se
+marca donde se manda y no mirando la trama: un UDP al puerto 520 que solo pasa por el router
+es tráfico de otro y no tiene por qué saltearse la cola. El resto se clasifica por DSCP y se
+reparte con deficit round robin, con SR_TXQ_QUANTUM bytes por turno multiplicados por el peso
+de la clase.
+*/
+#define SR_TXQ_ENABLED 1
+#define SR_TXQ_DEPTH 256
+#define SR_TXQ_FLUSH_BATCH 32
+#define SR_TXQ_BUF_SIZE 2048      /* Entra una trama de 1514; las más grandes van en un sr_pktbuf */
+#define SR_TXQ_POOL (SR_TXQ_NCLASSES * SR_TXQ_DEPTH + SR_TXQ_FLUSH_BATCH) /* Nunca se queda sin */
+#define SR_TXQ_BACKOFF_US 1000    /* Lo más que espera el que recibe cuando le rechazan tramas */
+
+#define SR_TXQ_TAIL_DROP 0
+#define SR_TXQ_HEAD_DROP 1
+#define SR_TXQ_POLICY SR_TXQ_TAIL_DROP
+
+#define SR_TXQ_CONTROL 0      /* ARP y RIP del router (sr_io_send_ctl) */
+#define SR_TXQ_EXPEDITED 1    /* DSCP 40 en adelante (CS5, EF, CS6, CS7) */
+#define SR_TXQ_ASSURED 2      /* DSCP 16 a 39 (AF2x a AF4x, CS2 a CS4) */
+#define SR_TXQ_BEST_EFFORT 3
+#define SR_TXQ_NCLASSES 4
+
+#define SR_TXQ_QUANTUM SR_IO_FRAME_MAX /* Tiene que entrar la trama más grande (se rechaza lo que no entra), así cada turno saca al menos una */
+
+static const unsigned int sr_txq_weight[SR_TXQ_NCLASSES] = {0, 4, 2, 1};
+static const char *sr_txq_class_name[SR_TXQ_NCLASSES] = {"control", "expedited", "assured", "best-effort"};
+
+/* Una trama en cola: en el buffer buf del pool, o en pb si no es NULL */
+struct sr_txq_ent {
+  struct sr_pktbuf *pb;
+  int buf;
+  unsigned int len;
+  uint64_t stamp;                  /* Cuándo se encoló, en ns */
+};
+
+struct sr_txq_class {
+  struct sr_txq_ent ents[SR_TXQ_DEPTH];
+  unsigned int head;
+  unsigned int count;
+  unsigned int deficit;
+  /* Contadores */
+  unsigned long enqueued;
+  unsigned long sent;              /* Las que salieron de verdad (el envío no falló) */
+  unsigned long bytes;
+  unsigned long tail_drops;
+  unsigned long head_drops;
+  unsigned long tx_errors;         /* Salieron de la cola pero el envío falló */
+  unsigned int max_depth;
+  uint64_t wait_ns;                /* Suma del tiempo en cola de lo que salió */
+  uint64_t max_wait_ns;
+};
+
+struct sr_txq {
+  pthread_mutex_t lock;
+  char name[sr_IFACE_NAMELEN];
+  struct sr_txq_class cls[SR_TXQ_NCLASSES];
+  unsigned int count;              /* En todas las clases */
+  int drr_cur;                     /* Clase de datos a la que le toca */
+  int drr_charged;                 /* Ya se le sumó el quantum en este turno */
+  uint8_t (*bufs)[SR_TXQ_BUF_SIZE];
+  int free_bufs[SR_TXQ_POOL];
+  int n_free;
+};
+
+static struct sr_txq sr_txqs[SR_IO_MAX_PORTS];
+static int sr_txq_n = 0;               /* Las colas no se borran: se leen sin lock hasta acá */
+static pthread_mutex_t txq_create_lock = PTHREAD_MUTEX_INITIALIZER;
+int sr_txq_running = 0;
+static unsigned int txq_pending = 0;   /* Paquetes en todas las colas (atómico) */
+static int txq_sleeping = 0;
+static unsigned long txq_rounds = 0;   /* Vueltas del hilo que vacía, para sr_txq_wait_room */
+static unsigned int txq_room_waiters = 0;
+static unsigned long txq_backoffs = 0;
+static pthread_mutex_t txq_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t txq_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t txq_room_cond = PTHREAD_COND_INITIALIZER;
+static __thread int sr_txq_refused = 0; /* A este hilo le rechazaron una trama desde la última espera */
+
+static uint64_t sr_txq_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Clase de datos de la trama, por DSCP (lo que no es IP va como best effort) */
+static int sr_txq_classify(const uint8_t *buf, unsigned int len)
+{
+  const unsigned int eth_hdr_len = sizeof(sr_ethernet_hdr_t);
+  if (len < eth_hdr_len + sizeof(sr_ip_hdr_t)
+      || ntohs(((const sr_ethernet_hdr_t *)buf)->ether_type) != ethertype_ip) {
+    return SR_TXQ_BEST_EFFORT;
+  }
+
+  const sr_ip_hdr_t *ip_hdr = (const sr_ip_hdr_t *)(buf + eth_hdr_len);
+  unsigned int dscp = ip_hdr->ip_tos >> 2;
+  if (dscp >= 40) {
+    return SR_TXQ_EXPEDITED;
+  }
+  return dscp >= 16 ? SR_TXQ_ASSURED : SR_TXQ_BEST_EFFORT;
+}
+
+/* La cola de la interfaz (la crea si no existe, con su pool). NULL si no hay lugar o memoria */
+static struct sr_txq *sr_txq_get(const char *name)
+{
+  int n = __atomic_load_n(&sr_txq_n, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < n; i++) {
+    if (strncmp(sr_txqs[i].name, name, sr_IFACE_NAMELEN) == 0) {
+      return &sr_txqs[i];
+    }
+  }
+
+  struct sr_txq *q = NULL;
+  pthread_mutex_lock(&txq_create_lock);
+  for (int i = 0; i < sr_txq_n; i++) {
+    if (strncmp(sr_txqs[i].name, name, sr_IFACE_NAMELEN) == 0) {
+      q = &sr_txqs[i];
+      break;
+    }
+  }
+  if (!q && sr_txq_n < SR_IO_MAX_PORTS) {
+    struct sr_txq *nq = &sr_txqs[sr_txq_n];
+    memset(nq, 0, sizeof(*nq));
+    nq->bufs = malloc((size_t)SR_TXQ_POOL * SR_TXQ_BUF_SIZE);
+    if (nq->bufs) {
+      pthread_mutex_init(&nq->lock, NULL);
+      strncpy(nq->name, name, sr_IFACE_NAMELEN - 1);
+      nq->drr_cur = SR_TXQ_CONTROL + 1;
+      for (int i = 0; i < SR_TXQ_POOL; i++) {
+        nq->free_bufs[i] = SR_TXQ_POOL - 1 - i;
+      }
+      nq->n_free = SR_TXQ_POOL;
+      q = nq;
+      __atomic_store_n(&sr_txq_n, sr_txq_n + 1, __ATOMIC_RELEASE);
+    }
+  }
+  pthread_mutex_unlock(&txq_create_lock);
+  return q;
+}
+
+/*
+Despierta al hilo que vacía las colas si está dormido. El que encola suma a txq_pending antes
+de mirar txq_sleeping y el hilo marca txq_sleeping antes de mirar txq_pending (con el lock):
+alguno de los dos ve al otro, así no se pierde un aviso.
+*/
+static void sr_txq_wake(void)
+{
+  if (__atomic_load_n(&txq_pending, __ATOMIC_SEQ_CST) && __atomic_load_n(&txq_sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&txq_wake_lock);
+    pthread_cond_signal(&txq_cond);
+    pthread_mutex_unlock(&txq_wake_lock);
+  }
+}
+
+/* Saca la primera de la clase. Con el lock de la cola tomado */
+static struct sr_txq_ent sr_txq_pop(struct sr_txq *q, struct sr_txq_class *c)
+{
+  struct sr_txq_ent e = c->ents[c->head];
+  c->head = (c->head + 1) % SR_TXQ_DEPTH;
+  c->count--;
+  q->count--;
+  __atomic_sub_fetch(&txq_pending, 1, __ATOMIC_RELAXED);
+  return e;
+}
+
+/* Devuelve el buffer de la trama al pool. Con el lock de la cola tomado */
+static void sr_txq_release(struct sr_txq *q, struct sr_txq_ent *e)
+{
+  if (!e->pb) {
+    q->free_bufs[q->n_free++] = e->buf;
+  }
+}
+
+/*
+Encola la trama: buf/len se copia a un buffer del pool, o si pb no es NULL la cola se queda
+con esa referencia (y buf no se usa). Con control va a la clase de control, si no a la que
+diga el DSCP. Devuelve -1 si se descartó.
+*/
+int sr_txq_enqueue(const char *iface, const uint8_t *buf, unsigned int len, struct sr_pktbuf *pb,
+                   int control)
+{
+  struct sr_pktbuf *dropped = NULL;
+  int ret = 0;
+
+  if ((pb ? pb->len : len) > SR_IO_FRAME_MAX) {
+    /* No sale por ningún backend, y más grande que el quantum trancaría su clase */
+    sr_pktbuf_put(pb);
+    sr_txq_refused = 1;
+    return -1;
+  }
+
+  if (!pb && len > SR_TXQ_BUF_SIZE) {
+    /* Jumbo: no entra en el pool */
+    pb = sr_pktbuf_copy(buf, len);
+    if (!pb) {
+      sr_txq_refused = 1;
+      return -1;
+    }
+  }
+  if (pb) {
+    buf = pb->data;
+    len = pb->len;
+  }
+  int cls = control ? SR_TXQ_CONTROL : sr_txq_classify(buf, len);
+  struct sr_txq *q = sr_txq_get(iface);
+  if (!q) {
+    sr_pktbuf_put(pb);
+    sr_txq_refused = 1;
+    return -1;
+  }
+  uint64_t now = sr_txq_now_ns();
+
+  pthread_mutex_lock(&q->lock);
+  struct sr_txq_class *c = &q->cls[cls];
+  if (c->count == SR_TXQ_DEPTH && SR_TXQ_POLICY == SR_TXQ_TAIL_DROP) {
+    c->tail_drops++;
+    dropped = pb;
+    ret = -1;
+  } else {
+    if (c->count == SR_TXQ_DEPTH) {
+      struct sr_txq_ent old = sr_txq_pop(q, c);
+      sr_txq_release(q, &old);
+      dropped = old.pb;
+      c->head_drops++;
+    }
+    struct sr_txq_ent *e = &c->ents[(c->head + c->count) % SR_TXQ_DEPTH];
+    e->pb = pb;
+    e->len = len;
+    e->stamp = now;
+    if (!pb) {
+      /* El pool tiene lugar para todo lo encolado más lo que está saliendo: no se acaba */
+      e->buf = q->free_bufs[--q->n_free];
+      memcpy(q->bufs[e->buf], buf, len);
+    }
+    c->count++;
+    c->enqueued++;
+    q->count++;
+    if (c->count > c->max_depth) {
+      c->max_depth = c->count;
+    }
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  if (ret < 0) {
+    sr_txq_refused = 1;
+  } else {
+    __atomic_add_fetch(&txq_pending, 1, __ATOMIC_SEQ_CST);
+    /* En medio de un lote se despierta una sola vez, al final (sr_io_process_batch).
+       Control se larga enseguida igual */
+    if (!sr_io_batching || cls == SR_TXQ_CONTROL) {
+      sr_txq_wake();
+    }
+  }
+  if (dropped) {
+    sr_pktbuf_put(dropped);
+  }
+  return ret;
+}
+
+/*
+Espera a que el hilo que vacía las colas termine una vuelta (o a que pasen max_us), para el
+que recibe cuando le rechazaron tramas. Devuelve enseguida si a este hilo no le rechazaron nada.
+*/
+void sr_txq_wait_room(unsigned int max_us)
+{
+  if (!sr_txq_refused) {
+    return;
+  }
+  sr_txq_refused = 0;
+  if (!__atomic_load_n(&sr_txq_running, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  __atomic_add_fetch(&txq_backoffs, 1, __ATOMIC_RELAXED);
+  sr_txq_wake();
+
+  struct timespec until;
+  clock_gettime(CLOCK_REALTIME, &until);
+  until.tv_nsec += (long)max_us * 1000;
+  until.tv_sec += until.tv_nsec / 1000000000;
+  until.tv_nsec %= 1000000000;
+  /* Como con txq_sleeping: se anota antes de mirar txq_rounds y el hilo suma antes de mirar
+     si hay alguien esperando */
+  pthread_mutex_lock(&txq_wake_lock);
+  __atomic_add_fetch(&txq_room_waiters, 1, __ATOMIC_SEQ_CST);
+  unsigned long round = __atomic_load_n(&txq_rounds, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&txq_rounds, __ATOMIC_SEQ_CST) == round) {
+    if (pthread_cond_timedwait(&txq_room_cond, &txq_wake_lock, &until) != 0) {
+      break;
+    }
+  }
+  __atomic_sub_fetch(&txq_room_waiters, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&txq_wake_lock);
+}
+
+/*
+La próxima trama que sale por la interfaz: control si hay, si no la que diga el deficit round
+robin entre las clases de datos. Devuelve su clase, o -1 si la cola está vacía. Con el lock
+de la cola tomado.
+*/
+static int sr_txq_dequeue(struct sr_txq *q, struct sr_txq_ent *out)
+{
+  int cls = SR_TXQ_CONTROL;
+  struct sr_txq_class *c = &q->cls[SR_TXQ_CONTROL];
+
+  /* Como el quantum alcanza para la trama más grande, en dos vueltas seguro sale algo */
+  for (int tries = 0; c->count == 0 && q->count && tries < 2 * SR_TXQ_NCLASSES; tries++) {
+    struct sr_txq_class *d = &q->cls[q->drr_cur];
+    if (d->count) {
+      if (!q->drr_charged) {
+        d->deficit += SR_TXQ_QUANTUM * sr_txq_weight[q->drr_cur];
+        q->drr_charged = 1;
+      }
+      if (d->ents[d->head].len <= d->deficit) {
+        d->deficit -= d->ents[d->head].len;
+        c = d;
+        cls = q->drr_cur;
+        if (d->count == 1) {
+          /* Se vacía: pierde lo que le sobró y pasa la siguiente */
+          d->deficit = 0;
+          q->drr_charged = 0;
+          q->drr_cur = q->drr_cur % (SR_TXQ_NCLASSES - 1) + 1;
+        }
+        break;
+      }
+    } else {
+      d->deficit = 0;
+    }
+    q->drr_charged = 0;
+    q->drr_cur = q->drr_cur % (SR_TXQ_NCLASSES - 1) + 1;
+  }
+  if (c->count == 0) {
+    return -1;
+  }
+  *out = sr_txq_pop(q, c);
+  return cls;
+}
+
+/*
+La llama el que recibe después de un lote: despierta al que vacía las colas y, si en el lote le
+rechazaron algo, le da una vuelta antes de leer más.
+*/
+void sr_txq_backoff(void)
+{
+  sr_txq_wake();
+  sr_txq_wait_room(SR_TXQ_BACKOFF_US);
+}
+
+void sr_txq_print_stats(void)
+{
+  int n = __atomic_load_n(&sr_txq_n, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < n; i++) {
+    struct sr_txq *q = &sr_txqs[i];
+    pthread_mutex_lock(&q->lock);
+    printf("Cola %s: %u en cola, %d de %d buffers libres\n", q->name, q->count, q->n_free, SR_TXQ_POOL);
+    for (int k = 0; k < SR_TXQ_NCLASSES; k++) {
+      struct sr_txq_class *c = &q->cls[k];
+      printf("  %-11s %u en cola (máx %u de %d), %lu encolados, %lu enviados (%lu bytes), %lu errores al enviar, "
+             "%lu descartes al final, %lu al principio, espera media %.1f us (máx %.1f us)\n",
+             sr_txq_class_name[k], c->count, c->max_depth, SR_TXQ_DEPTH, c->enqueued, c->sent, c->bytes,
+             c->tx_errors, c->tail_drops, c->head_drops, c->sent ? c->wait_ns / 1000.0 / c->sent : 0.0,
+             c->max_wait_ns / 1000.0);
+    }
+    pthread_mutex_unlock(&q->lock);
+  }
+  printf("Colas: %lu esperas del que recibe por colas llenas\n", __atomic_load_n(&txq_backoffs, __ATOMIC_RELAXED));
+}
+
+/* Manda una trama sacada de q. En el backend crudo va al lote del puerto apuntando al buffer del pool */
+static int sr_txq_xmit(struct sr_instance *sr, struct sr_txq *q, struct sr_txq_ent *e)
+{
+  if (e->pb) {
+    return sr_io_xmit_buf(sr, e->pb, q->name);
+  }
+  uint8_t *buf = q->bufs[e->buf];
+  if (sr_io_port_queue(q->name, buf, e->len) == 0) {
+    return 0;
+  }
+  return sr_io_xmit(sr, buf, e->len, q->name);
+}
+
+static void *sr_txq_flush_thread(void *arg)
+{
+  struct sr_instance *sr = (struct sr_instance *)arg;
+  struct sr_txq_ent batch[SR_TXQ_FLUSH_BATCH];
+  int batch_cls[SR_TXQ_FLUSH_BATCH];
+  int batch_ok[SR_TXQ_FLUSH_BATCH];
+  unsigned long next_stats = SR_IO_STATS_EVERY;
+  unsigned long total_sent = 0;
+
+  /* Lo que manda este hilo se junta por puerto y sale en sr_io_port_flush */
+  sr_io_batching = 1;
+
+  while (1) {
+    if (__atomic_load_n(&txq_pending, __ATOMIC_SEQ_CST) == 0) {
+      pthread_mutex_lock(&txq_wake_lock);
+      __atomic_store_n(&txq_sleeping, 1, __ATOMIC_SEQ_CST);
+      while (__atomic_load_n(&txq_pending, __ATOMIC_SEQ_CST) == 0) {
+        pthread_cond_wait(&txq_cond, &txq_wake_lock);
+      }
+      __atomic_store_n(&txq_sleeping, 0, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&txq_wake_lock);
+    }
+
+    int nq = __atomic_load_n(&sr_txq_n, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < nq; i++) {
+      struct sr_txq *q = &sr_txqs[i];
+      unsigned int n = 0;
+
+      pthread_mutex_lock(&q->lock);
+      uint64_t now = sr_txq_now_ns();
+      while (n < SR_TXQ_FLUSH_BATCH && (batch_cls[n] = sr_txq_dequeue(q, &batch[n])) >= 0) {
+        n++;
+      }
+      pthread_mutex_unlock(&q->lock);
+      if (n == 0) {
+        continue;
+      }
+
+      /* Los buffers del pool siguen siendo de la trama hasta que se la largó */
+      for (unsigned int k = 0; k < n; k++) {
+        batch_ok[k] = sr_txq_xmit(sr, q, &batch[k]) == 0;
+      }
+      /* En el crudo lo de arriba solo armó el lote: salen las primeras que acepte sendmmsg */
+      unsigned int sent_max = sr_io_port_flush(q->name, n);
+
+      pthread_mutex_lock(&q->lock);
+      unsigned int ranked = 0;
+      for (unsigned int k = 0; k < n; k++) {
+        struct sr_txq_class *c = &q->cls[batch_cls[k]];
+        if (batch_ok[k] && ranked++ < sent_max) {
+          uint64_t waited = now - batch[k].stamp;
+          c->sent++;
+          c->bytes += batch[k].len;
+          c->wait_ns += waited;
+          if (waited > c->max_wait_ns) {
+            c->max_wait_ns = waited;
+          }
+          total_sent++;
+        } else {
+          c->tx_errors++;
+        }
+        sr_txq_release(q, &batch[k]);
+      }
+      pthread_mutex_unlock(&q->lock);
+      for (unsigned int k = 0; k < n; k++) {
+        if (batch[k].pb) {
+          sr_pktbuf_put(batch[k].pb);
+        }
+      }
+    }
+
+    /* Una vuelta más: los que esperan lugar pueden seguir */
+    __atomic_add_fetch(&txq_rounds, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&txq_room_waiters, __ATOMIC_SEQ_CST)) {
+      pthread_mutex_lock(&txq_wake_lock);
+      pthread_cond_broadcast(&txq_room_cond);
+      pthread_mutex_unlock(&txq_wake_lock);
+    }
+
+    if (total_sent >= next_stats) {
+      sr_txq_print_stats();
+      next_stats += SR_IO_STATS_EVERY;
+    }
+  }
+  return NULL;
+}
+
+void sr_txq_start(struct sr_instance *sr)
+{
+  pthread_t thread;
+
+  if (!SR_TXQ_ENABLED || sr_txq_running) {
+    return;
+  }
+  /* Las colas (y sus pools) se arman de entrada; después solo aparecen si llega una interfaz nueva */
+  for (struct sr_if *iface = sr->if_list; iface; iface = iface->next) {
+    sr_txq_get(iface->name);
+  }
+  if (pthread_create(&thread, &(sr->attr), sr_txq_flush_thread, sr) != 0) {
+    perror("pthread_create (colas de salida)");
+    return;
+  }
+  __atomic_store_n(&sr_txq_running, 1, __ATOMIC_RELEASE);
+}
+
@@ -0,0 +1,21 @@
+/*
+Colas de salida por interfaz (ver sr_txq.c).
+*/
+#ifndef SR_TXQ_H
+#define SR_TXQ_H
+
+#include <stdint.h>
+
+struct sr_instance;
+struct sr_pktbuf;
+
+extern int sr_txq_running;  /* 1 cuando arrancó el hilo que vacía las colas */
+
+int sr_txq_enqueue(const char *iface, const uint8_t *buf, unsigned int len, struct sr_pktbuf *pb,
+                   int control);
+void sr_txq_backoff(void);
+void sr_txq_wait_room(unsigned int max_us);
+void sr_txq_start(struct sr_instance *sr);
+void sr_txq_print_stats(void);
+
+#endif /* SR_TXQ_H */
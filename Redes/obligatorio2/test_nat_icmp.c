@@ -0,0 +1,284 @@
+/*
+Prueba de los errores ICMP que genera el router para paquetes que pasan por NAT. Arma un
+router con eth0 adentro (10.0.1.1/24, host en 10.0.1.2) y eth1 afuera con NAT
+(10.0.2.1/24, ruta a 8.0.0.0/8 por el vecino 10.0.2.2), le pasa tramas armadas a mano y mira lo
+que manda sr_send_packet:
+
+  - De adentro con DF y más grande que el MTU de eth1: el Fragmentation Needed tiene que ir
+    a 10.0.1.2 citando su origen y su puerto, y no se tiene que reservar un puerto de NAT.
+  - La respuesta de afuera con TTL 1: el Time Exceeded va al host de afuera citando la IP
+    pública y el puerto traducido, no la dirección de adentro.
+  - La respuesta de afuera con DF y más grande que el MTU de eth0: lo mismo con el
+    Fragmentation Needed.
+  - Cambiarle la IP a eth0 (con sr_local_addr_rebuild) y la MAC (con sr_local_addr_poll): el
+    Time Exceeded siguiente tiene que salir con las nuevas, no con la plantilla vieja.
+
+Se compila con los fuentes del router, sin sr_main.c ni sr_vns_comm.c (este archivo pone
+su main y un sr_send_packet que guarda lo último que se mandó):
+  gcc -O1 -o test_nat_icmp test_nat_icmp.c sr_router.c sr_acl.c sr_ct.c sr_nat.c sr_flow.c sr_tap.c \
+      sr_io.c sr_txq.c sr_epoch.c sr_arpcache.c sr_rip.c sr_if.c sr_rt.c sr_utils.c -lpthread
+Uso: ./test_nat_icmp      (el resultado va a stderr; sale con 1 si algún caso falla)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_arpcache.h"
+#include "sr_protocol.h"
+#include "sr_fwd.h"
+#include "sr_nat.h"
+
+/* En sr_rip.c */
+void sr_rip_set_snapshot_path(struct sr_instance* sr, const char* path);
+void sr_rip_poll(struct sr_instance* sr);
+
+#define TEST_MAX_FRAME 2048
+#define TEST_INSIDE_HOST 0x0A000102u   /* 10.0.1.2 */
+#define TEST_PUBLIC_IP 0x0A000201u     /* 10.0.2.1, la de eth1 */
+#define TEST_OUTSIDE_HOST 0x08080808u  /* 8.8.8.8, por eth1 */
+#define TEST_INSIDE_PORT 5000
+#define TEST_OUTSIDE_PORT 53
+
+static struct sr_instance test_sr;
+static uint8_t test_last[TEST_MAX_FRAME];
+static unsigned int test_last_len = 0;
+static char test_last_iface[sr_IFACE_NAMELEN];
+static int test_failed = 0;
+
+int sr_send_packet(struct sr_instance *sr, uint8_t *buf, unsigned int len, const char *iface)
+{
+    (void)sr;
+    if (len <= sizeof(test_last)) {
+        memcpy(test_last, buf, len);
+        test_last_len = len;
+        snprintf(test_last_iface, sizeof(test_last_iface), "%s", iface);
+    }
+    return 0;
+}
+
+static void test_if_mac(int i, uint8_t *mac)
+{
+    uint8_t m[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x01, (uint8_t)i};
+    memcpy(mac, m, ETHER_ADDR_LEN);
+}
+
+static void test_peer_mac(int i, uint8_t *mac)
+{
+    uint8_t m[ETHER_ADDR_LEN] = {0x02, 0x00, 0x00, 0x00, 0x02, (uint8_t)i};
+    memcpy(mac, m, ETHER_ADDR_LEN);
+}
+
+static void test_setup(void)
+{
+    struct sr_instance *sr = &test_sr;
+
+    sr_arpcache_init(&sr->cache);
+    struct sr_if **tail = &sr->if_list;
+    for (int i = 0; i < 2; i++) {
+        struct sr_if *iface = calloc(1, sizeof(struct sr_if));
+        if (!iface) {
+            perror("calloc");
+            exit(1);
+        }
+        snprintf(iface->name, sizeof(iface->name), "eth%d", i);
+        test_if_mac(i, iface->addr);
+        iface->ip = htonl(0x0A000001u | (uint32_t)(i + 1) << 8);
+        iface->mask = htonl(0xFFFFFF00u);
+        iface->cost = 1;
+        *tail = iface;
+        tail = &iface->next;
+
+        uint8_t mac[ETHER_ADDR_LEN];
+        test_peer_mac(i, mac);
+        struct sr_arpreq *req = sr_arpcache_insert(&sr->cache, mac, htonl(0x0A000002u | (uint32_t)(i + 1) << 8));
+        if (req) {
+            sr_arpreq_destroy(&sr->cache, req);
+        }
+    }
+    /* Las rutas van antes del primer sr_rip_poll, que arma la FIB con lo que haya en la tabla */
+    struct in_addr any = { 0 };
+    struct in_addr mask = { htonl(0xFFFFFF00u) };
+    for (struct sr_if *iface = sr->if_list; iface; iface = iface->next) {
+        struct in_addr net = { iface->ip & iface->mask };
+        sr_add_rt_entry(sr, net, any, mask, iface->name, 1, 0, 0, time(NULL), 1, 0);
+    }
+    /* No una por defecto: sr_lpm_lookup nunca elige una máscara 0 */
+    struct in_addr outside = { htonl(0x08000000u) };
+    struct in_addr outside_mask = { htonl(0xFF000000u) };
+    struct in_addr gw = { htonl(0x0A000202u) };
+    sr_add_rt_entry(sr, outside, gw, outside_mask, "eth1", 2, 0, 0, time(NULL), 1, 0);
+    sr_rip_set_snapshot_path(sr, NULL);
+    sr_rip_poll(sr);
+    sr_nat_add_iface("eth1", 0);
+}
+
+static uint16_t test_cksum(const void *data, unsigned int len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t sum = 0;
+    for (; len > 1; len -= 2, p += 2) {
+        sum += (p[0] << 8) | p[1];
+    }
+    if (len) {
+        sum += p[0] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return htons(~sum & 0xFFFF);
+}
+
+/* Trama UDP recibida por eth<iface>; total_len es el largo IP. Devuelve el largo de la trama */
+static unsigned int test_udp_frame(uint8_t *frame, int iface, uint32_t src, uint32_t dst,
+                                   uint16_t sport, uint16_t dport, uint8_t ttl, int df,
+                                   unsigned int total_len)
+{
+    sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)frame;
+    sr_ip_hdr_t *ip = (sr_ip_hdr_t *)(frame + sizeof(sr_ethernet_hdr_t));
+    sr_udp_hdr_t *udp = (sr_udp_hdr_t *)((uint8_t *)ip + sizeof(sr_ip_hdr_t));
+
+    memset(frame, 0, sizeof(sr_ethernet_hdr_t) + total_len);
+    test_if_mac(iface, eth->ether_dhost);
+    test_peer_mac(iface, eth->ether_shost);
+    eth->ether_type = htons(ethertype_ip);
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(total_len);
+    ip->ip_off = htons(df ? IP_DF : 0);
+    ip->ip_ttl = ttl;
+    ip->ip_p = ip_protocol_udp;
+    ip->ip_src = htonl(src);
+    ip->ip_dst = htonl(dst);
+    ip->ip_sum = test_cksum(ip, sizeof(sr_ip_hdr_t));
+    udp->src_port = htons(sport);
+    udp->dst_port = htons(dport);
+    udp->length = htons(total_len - sizeof(sr_ip_hdr_t));
+    return sizeof(sr_ethernet_hdr_t) + total_len;
+}
+
+/* Pasa la trama y devuelve el cabezal IP de lo que salió, o NULL si no salió nada */
+static sr_ip_hdr_t *test_send(uint8_t *frame, unsigned int len, const char *iface)
+{
+    test_last_len = 0;
+    sr_handlepacket(&test_sr, frame, len, (char *)iface);
+    return test_last_len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)
+           ? (sr_ip_hdr_t *)(test_last + sizeof(sr_ethernet_hdr_t)) : NULL;
+}
+
+static void test_check(int ok, const char *what)
+{
+    fprintf(stderr, "  %-60s %s\n", what, ok ? "ok" : "FALLÓ");
+    if (!ok) {
+        test_failed = 1;
+    }
+}
+
+/*
+Mira que lo que salió por out_iface sea un error ICMP type/code hacia dst, citando un paquete
+UDP de quote_src:quote_sport a quote_dst:quote_dport
+*/
+static void test_check_error(sr_ip_hdr_t *ip, const char *out_iface, uint8_t type, uint8_t code,
+                             uint32_t dst, uint32_t quote_src, uint16_t quote_sport,
+                             uint32_t quote_dst, uint16_t quote_dport)
+{
+    char what[128];
+    if (!ip || ip->ip_p != ip_protocol_icmp) {
+        test_check(0, "salió un error ICMP");
+        return;
+    }
+    sr_icmp_t3_hdr_t *icmp = (sr_icmp_t3_hdr_t *)((uint8_t *)ip + sizeof(sr_ip_hdr_t));
+    sr_ip_hdr_t *q = (sr_ip_hdr_t *)icmp->data;
+    sr_udp_hdr_t *qu = (sr_udp_hdr_t *)(icmp->data + sizeof(sr_ip_hdr_t));
+
+    snprintf(what, sizeof(what), "tipo %u código %u por %s", type, code, out_iface);
+    test_check(icmp->icmp_type == type && icmp->icmp_code == code
+               && strcmp(test_last_iface, out_iface) == 0, what);
+    test_check(ip->ip_dst == htonl(dst), "destino del error");
+    test_check(q->ip_src == htonl(quote_src) && qu->src_port == htons(quote_sport), "origen citado");
+    test_check(q->ip_dst == htonl(quote_dst) && qu->dst_port == htons(quote_dport), "destino citado");
+}
+
+int main(void)
+{
+    static uint8_t frame[TEST_MAX_FRAME];
+    unsigned int len;
+    sr_ip_hdr_t *out;
+    int ok;
+
+    /* Los printf del router por paquete tapan el resultado, que va a stderr */
+    if (!freopen("/dev/null", "w", stdout)) {
+        perror("freopen");
+    }
+    test_setup();
+    sr_if_set_mtu("eth1", 1000);
+    sr_if_set_mtu("eth0", 576);
+
+    fprintf(stderr, "Salida con DF más grande que el MTU de eth1:\n");
+    len = test_udp_frame(frame, 0, TEST_INSIDE_HOST, TEST_OUTSIDE_HOST, TEST_INSIDE_PORT + 1,
+                         TEST_OUTSIDE_PORT, 64, 1, 1200);
+    out = test_send(frame, len, "eth0");
+    test_check_error(out, "eth0", 3, 4, TEST_INSIDE_HOST, TEST_INSIDE_HOST, TEST_INSIDE_PORT + 1,
+                     TEST_OUTSIDE_HOST, TEST_OUTSIDE_PORT);
+
+    /* Otro flujo sin DF abre la primera conexión: tiene que tomar el primer puerto libre */
+    len = test_udp_frame(frame, 0, TEST_INSIDE_HOST, TEST_OUTSIDE_HOST, TEST_INSIDE_PORT,
+                         TEST_OUTSIDE_PORT, 64, 0, 100);
+    out = test_send(frame, len, "eth0");
+    uint16_t public_port = 0;
+    ok = out && out->ip_src == htonl(TEST_PUBLIC_IP);
+    if (ok) {
+        memcpy(&public_port, (uint8_t *)out + sizeof(sr_ip_hdr_t), 2);
+        public_port = ntohs(public_port);
+    }
+    test_check(ok, "sin DF sale con la IP pública");
+    test_check(public_port == 1024, "el descartado no reservó puerto");
+
+    fprintf(stderr, "Respuesta de afuera con TTL 1:\n");
+    len = test_udp_frame(frame, 1, TEST_OUTSIDE_HOST, TEST_PUBLIC_IP, TEST_OUTSIDE_PORT,
+                         public_port, 1, 0, 100);
+    out = test_send(frame, len, "eth1");
+    test_check_error(out, "eth1", 11, 0, TEST_OUTSIDE_HOST, TEST_OUTSIDE_HOST, TEST_OUTSIDE_PORT,
+                     TEST_PUBLIC_IP, public_port);
+
+    fprintf(stderr, "Respuesta de afuera con DF más grande que el MTU de eth0:\n");
+    len = test_udp_frame(frame, 1, TEST_OUTSIDE_HOST, TEST_PUBLIC_IP, TEST_OUTSIDE_PORT,
+                         public_port, 64, 1, 800);
+    out = test_send(frame, len, "eth1");
+    test_check_error(out, "eth1", 3, 4, TEST_OUTSIDE_HOST, TEST_OUTSIDE_HOST, TEST_OUTSIDE_PORT,
+                     TEST_PUBLIC_IP, public_port);
+
+    fprintf(stderr, "Respuesta de afuera normal:\n");
+    len = test_udp_frame(frame, 1, TEST_OUTSIDE_HOST, TEST_PUBLIC_IP, TEST_OUTSIDE_PORT,
+                         public_port, 64, 0, 100);
+    out = test_send(frame, len, "eth1");
+    test_check(out && out->ip_dst == htonl(TEST_INSIDE_HOST) && strcmp(test_last_iface, "eth0") == 0,
+               "llega al host de adentro por eth0");
+
+    /* Las plantillas de los errores viven con el conjunto de direcciones locales: si cambia
+       la IP o la MAC de la interfaz el error tiene que salir con las nuevas */
+    fprintf(stderr, "Time Exceeded después de cambiar la IP de eth0:\n");
+    sr_ethernet_hdr_t *eth = (sr_ethernet_hdr_t *)test_last;
+    test_sr.if_list->ip = htonl(0x0A000105u);
+    sr_local_addr_rebuild(&test_sr);
+    len = test_udp_frame(frame, 0, TEST_INSIDE_HOST, TEST_OUTSIDE_HOST, TEST_INSIDE_PORT + 2,
+                         TEST_OUTSIDE_PORT, 1, 0, 100);
+    out = test_send(frame, len, "eth0");
+    test_check(out && out->ip_src == htonl(0x0A000105u), "sale desde 10.0.1.5");
+    test_check(out && test_cksum(out, sizeof(sr_ip_hdr_t)) == 0, "checksum IP");
+
+    fprintf(stderr, "Time Exceeded después de cambiar la MAC de eth0:\n");
+    test_sr.if_list->addr[5] ^= 0x77;
+    sr_local_addr_poll(&test_sr);
+    out = test_send(frame, len, "eth0");
+    test_check(out && memcmp(eth->ether_shost, test_sr.if_list->addr, ETHER_ADDR_LEN) == 0,
+               "sale con la MAC nueva");
+
+    fprintf(stderr, "%s\n", test_failed ? "FALLÓ" : "Todo bien.");
+    return test_failed;
+}